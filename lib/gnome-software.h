@@ -32,6 +32,8 @@
 #include <gs-plugin-job-refine.h>
 #include <gs-plugin-job-refresh-metadata.h>
 #include <gs-plugin-vfuncs.h>
+#include <gs-refine-cache.h>
 #include <gs-remote-icon.h>
 #include <gs-utils.h>
+#include <gs-worker-pool.h>
 #include <gs-worker-thread.h>
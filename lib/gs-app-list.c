@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <string.h>
 
 #include "gs-app-private.h"
 #include "gs-app-list-private.h"
@@ -36,8 +37,36 @@ struct _GsAppList
 	GsAppState		 state;
 	guint			 progress;  /* 0–100 inclusive, or %GS_APP_PROGRESS_UNKNOWN */
 	guint			 custom_progress; /* overrides the 'progress', if not %GS_APP_PROGRESS_UNKNOWN */
+
+	/* Running totals over the watched apps, so @state and @progress can be
+	 * updated in constant time when one of them changes. Each app in
+	 * @array is watched once, along with its addons and related apps
+	 * (depending on @flags); that set is kept in @watches so exactly the
+	 * same apps can be unwatched, and is updated when the addons or
+	 * related apps change. An app may be watched several times (e.g. an
+	 * addon of two apps), and each time counts towards the totals. */
+	GHashTable		*watches;  /* (owned) (element-type GsApp GPtrArray<GsApp>) */
+	GHashTable		*watched;  /* (owned) (element-type GsApp GsAppListWatched) */
+	guint			 n_watched;
+	guint			 n_watched_progress_unknown;
+	guint64			 watched_progress_sum;
+	guint			 n_watched_installing;
+	guint			 n_watched_removing;
+
+	/* Index of the apps in @array, built once the list is long enough for
+	 * linear scans to matter. Apps are bucketed by the component ID part
+	 * of their unique ID, which cannot be a wildcard; apps with no unique
+	 * ID or a wildcard component ID are kept in @index_unbucketed and are
+	 * always checked. Rebuilt if gs_app_get_unique_id_serial() changes. */
+	GHashTable		*index_apps;  /* (nullable) (owned) (element-type GsApp guint): count of each app in @array */
+	GHashTable		*index_buckets;  /* (nullable) (owned) (element-type utf8 GPtrArray<GsApp>) */
+	GPtrArray		*index_unbucketed;  /* (nullable) (owned) (element-type GsApp) */
+	guint			 index_serial;
 };
 
+/* below this length a linear scan is as fast as maintaining the index */
+#define GS_APP_LIST_INDEX_MIN_LENGTH	32
+
 G_DEFINE_TYPE (GsAppList, gs_app_list, G_TYPE_OBJECT)
 
 enum {
@@ -131,23 +160,29 @@ gs_app_list_override_progress (GsAppList *list,
 	}
 }
 
+typedef struct {
+	guint		 n_watches;
+	guint		 progress;  /* as last seen */
+	GsAppState	 state;  /* as last seen */
+} GsAppListWatched;
+
 static void
 gs_app_list_add_watched_for_app (GsAppList *list, GPtrArray *apps, GsApp *app)
 {
 	if (list->flags & GS_APP_LIST_FLAG_WATCH_APPS)
-		g_ptr_array_add (apps, app);
+		g_ptr_array_add (apps, g_object_ref (app));
 	if (list->flags & GS_APP_LIST_FLAG_WATCH_APPS_ADDONS) {
 		GsAppList *list2 = gs_app_get_addons (app);
 		for (guint i = 0; i < gs_app_list_length (list2); i++) {
 			GsApp *app2 = gs_app_list_index (list2, i);
-			g_ptr_array_add (apps, app2);
+			g_ptr_array_add (apps, g_object_ref (app2));
 		}
 	}
 	if (list->flags & GS_APP_LIST_FLAG_WATCH_APPS_RELATED) {
 		GsAppList *list2 = gs_app_get_related (app);
 		for (guint i = 0; i < gs_app_list_length (list2); i++) {
 			GsApp *app2 = gs_app_list_index (list2, i);
-			g_ptr_array_add (apps, app2);
+			g_ptr_array_add (apps, g_object_ref (app2));
 		}
 	}
 }
@@ -155,102 +190,244 @@ gs_app_list_add_watched_for_app (GsAppList *list, GPtrArray *apps, GsApp *app)
 static GPtrArray *
 gs_app_list_get_watched_for_app (GsAppList *list, GsApp *app)
 {
-	GPtrArray *apps = g_ptr_array_new ();
+	GPtrArray *apps = g_ptr_array_new_with_free_func (g_object_unref);
 	gs_app_list_add_watched_for_app (list, apps, app);
 	return apps;
 }
 
-static GPtrArray *
-gs_app_list_get_watched (GsAppList *list)
+/* add (@sign == 1) or remove (@sign == -1) the contribution of @watched
+ * to the running totals */
+static void
+gs_app_list_watched_account (GsAppList *self, const GsAppListWatched *watched, gint sign)
 {
-	GPtrArray *apps = g_ptr_array_new ();
-	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (list->array, i);
-		gs_app_list_add_watched_for_app (list, apps, app_tmp);
+	guint n = watched->n_watches;
+
+	if (sign < 0) {
+		self->n_watched -= n;
+		if (watched->progress == GS_APP_PROGRESS_UNKNOWN)
+			self->n_watched_progress_unknown -= n;
+		else
+			self->watched_progress_sum -= (guint64) n * watched->progress;
+		if (watched->state == GS_APP_STATE_INSTALLING)
+			self->n_watched_installing -= n;
+		else if (watched->state == GS_APP_STATE_REMOVING)
+			self->n_watched_removing -= n;
+	} else {
+		self->n_watched += n;
+		if (watched->progress == GS_APP_PROGRESS_UNKNOWN)
+			self->n_watched_progress_unknown += n;
+		else
+			self->watched_progress_sum += (guint64) n * watched->progress;
+		if (watched->state == GS_APP_STATE_INSTALLING)
+			self->n_watched_installing += n;
+		else if (watched->state == GS_APP_STATE_REMOVING)
+			self->n_watched_removing += n;
 	}
-	return apps;
 }
 
-static void
-gs_app_list_invalidate_progress (GsAppList *self)
+/* returns %TRUE if @progress changed */
+static gboolean
+gs_app_list_update_progress (GsAppList *self)
 {
-	guint progress = 0;
-	g_autoptr(GPtrArray) apps = gs_app_list_get_watched (self);
+	guint progress;
 
 	/* find the average percentage complete of the list */
-	if (apps->len > 0) {
-		guint64 pc_cnt = 0;
-		gboolean unknown_seen = FALSE;
+	if (self->n_watched > 0 && self->n_watched_progress_unknown == 0)
+		progress = self->watched_progress_sum / self->n_watched;
+	else
+		progress = GS_APP_PROGRESS_UNKNOWN;
 
-		for (guint i = 0; i < apps->len; i++) {
-			GsApp *app_tmp = g_ptr_array_index (apps, i);
-			guint app_progress = gs_app_get_progress (app_tmp);
+	if (self->progress == progress)
+		return FALSE;
+	self->progress = progress;
+	return TRUE;
+}
 
-			if (app_progress == GS_APP_PROGRESS_UNKNOWN) {
-				unknown_seen = TRUE;
-				break;
-			}
-			pc_cnt += gs_app_get_progress (app_tmp);
-		}
+static void
+gs_app_list_invalidate_progress (GsAppList *self)
+{
+	if (gs_app_list_update_progress (self))
+		g_object_notify (G_OBJECT (self), "progress");
+}
 
-		progress = (!unknown_seen) ? pc_cnt / apps->len : GS_APP_PROGRESS_UNKNOWN;
-	} else {
-		progress = GS_APP_PROGRESS_UNKNOWN;
-	}
+/* returns %TRUE if @state changed */
+static gboolean
+gs_app_list_update_state (GsAppList *self)
+{
+	GsAppState state = GS_APP_STATE_UNKNOWN;
 
-	if (self->progress != progress) {
-		self->progress = progress;
-		g_object_notify (G_OBJECT (self), "progress");
-	}
+	/* find any action state of the list; if apps are being both installed
+	 * and removed, installing wins, as only the totals are known here
+	 * (the state used to depend on which of the apps came first, which
+	 * is no more meaningful) */
+	if (self->n_watched_installing > 0)
+		state = GS_APP_STATE_INSTALLING;
+	else if (self->n_watched_removing > 0)
+		state = GS_APP_STATE_REMOVING;
+
+	if (self->state == state)
+		return FALSE;
+	self->state = state;
+	return TRUE;
 }
 
 static void
 gs_app_list_invalidate_state (GsAppList *self)
 {
-	GsAppState state = GS_APP_STATE_UNKNOWN;
-	g_autoptr(GPtrArray) apps = gs_app_list_get_watched (self);
-
-	/* find any action state of the list */
-	for (guint i = 0; i < apps->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (apps, i);
-		GsAppState state_tmp = gs_app_get_state (app_tmp);
-		if (state_tmp == GS_APP_STATE_INSTALLING ||
-		    state_tmp == GS_APP_STATE_REMOVING) {
-			state = state_tmp;
-			break;
-		}
-	}
-	if (self->state != state) {
-		self->state = state;
+	if (gs_app_list_update_state (self))
 		g_object_notify (G_OBJECT (self), "state");
-	}
 }
 
 static void
 gs_app_list_progress_notify_cb (GsApp *app, GParamSpec *pspec, GsAppList *self)
 {
-	gs_app_list_invalidate_progress (self);
+	GsAppListWatched *watched;
+	gboolean changed;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+	/* update the totals with the change in this app’s progress */
+	watched = g_hash_table_lookup (self->watched, app);
+	if (watched == NULL)
+		return;
+
+	gs_app_list_watched_account (self, watched, -1);
+	watched->progress = gs_app_get_progress (app);
+	gs_app_list_watched_account (self, watched, 1);
+	changed = gs_app_list_update_progress (self);
+
+	g_clear_pointer (&locker, g_mutex_locker_free);
+	if (changed)
+		g_object_notify (G_OBJECT (self), "progress");
 }
 
 static void
 gs_app_list_state_notify_cb (GsApp *app, GParamSpec *pspec, GsAppList *self)
 {
-	gs_app_list_invalidate_state (self);
+	GsAppListWatched *watched;
+	gboolean changed;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+	/* update the totals with the change in this app’s state */
+	watched = g_hash_table_lookup (self->watched, app);
+	if (watched != NULL) {
+		gs_app_list_watched_account (self, watched, -1);
+		watched->state = gs_app_get_state (app);
+		gs_app_list_watched_account (self, watched, 1);
+	}
+	changed = gs_app_list_update_state (self);
+
+	g_clear_pointer (&locker, g_mutex_locker_free);
+	if (changed)
+		g_object_notify (G_OBJECT (self), "state");
 
 	g_signal_emit (self, signals[SIGNAL_APP_STATE_CHANGED], 0, app);
 }
 
+static void
+gs_app_list_watch (GsAppList *list, GsApp *app)
+{
+	GsAppListWatched *watched = g_hash_table_lookup (list->watched, app);
+
+	if (watched != NULL) {
+		gs_app_list_watched_account (list, watched, -1);
+		watched->n_watches++;
+		gs_app_list_watched_account (list, watched, 1);
+		return;
+	}
+
+	watched = g_new0 (GsAppListWatched, 1);
+	watched->n_watches = 1;
+	watched->progress = gs_app_get_progress (app);
+	watched->state = gs_app_get_state (app);
+	g_hash_table_insert (list->watched, g_object_ref (app), watched);
+	gs_app_list_watched_account (list, watched, 1);
+
+	g_signal_connect_object (app, "notify::progress",
+				 G_CALLBACK (gs_app_list_progress_notify_cb),
+				 list, 0);
+	g_signal_connect_object (app, "notify::state",
+				 G_CALLBACK (gs_app_list_state_notify_cb),
+				 list, 0);
+}
+
+static void
+gs_app_list_unwatch (GsAppList *list, GsApp *app)
+{
+	GsAppListWatched *watched = g_hash_table_lookup (list->watched, app);
+
+	g_assert (watched != NULL && watched->n_watches > 0);
+
+	gs_app_list_watched_account (list, watched, -1);
+	watched->n_watches--;
+
+	if (watched->n_watches > 0) {
+		gs_app_list_watched_account (list, watched, 1);
+		return;
+	}
+
+	/* not by data, as @app may also be in @array and watched for its
+	 * addons and related apps changing */
+	g_signal_handlers_disconnect_by_func (app, gs_app_list_progress_notify_cb, list);
+	g_signal_handlers_disconnect_by_func (app, gs_app_list_state_notify_cb, list);
+	g_hash_table_remove (list->watched, app);
+}
+
+/* the addons or related apps of @app, which is in @array, changed */
+static void
+gs_app_list_rewatch_cb (GsApp *app, GParamSpec *pspec, GsAppList *self)
+{
+	GPtrArray *apps_old;
+	gboolean state_changed, progress_changed;
+	g_autoptr(GPtrArray) apps = NULL;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+	apps_old = g_hash_table_lookup (self->watches, app);
+	if (apps_old == NULL)
+		return;
+
+	/* watch the new set before unwatching the old one, so the apps in
+	 * both are never unwatched in between */
+	apps = gs_app_list_get_watched_for_app (self, app);
+	for (guint i = 0; i < apps->len; i++)
+		gs_app_list_watch (self, g_ptr_array_index (apps, i));
+	for (guint i = 0; i < apps_old->len; i++)
+		gs_app_list_unwatch (self, g_ptr_array_index (apps_old, i));
+	g_hash_table_insert (self->watches, g_object_ref (app), g_steal_pointer (&apps));
+
+	state_changed = gs_app_list_update_state (self);
+	progress_changed = gs_app_list_update_progress (self);
+
+	g_clear_pointer (&locker, g_mutex_locker_free);
+	if (state_changed)
+		g_object_notify (G_OBJECT (self), "state");
+	if (progress_changed)
+		g_object_notify (G_OBJECT (self), "progress");
+}
+
 static void
 gs_app_list_maybe_watch_app (GsAppList *list, GsApp *app)
 {
-	g_autoptr(GPtrArray) apps = gs_app_list_get_watched_for_app (list, app);
-	for (guint i = 0; i < apps->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (apps, i);
-		g_signal_connect_object (app_tmp, "notify::progress",
-					 G_CALLBACK (gs_app_list_progress_notify_cb),
+	g_autoptr(GPtrArray) apps = NULL;
+
+	/* already watched, e.g. a repeat of the same instance */
+	if (g_hash_table_contains (list->watches, app))
+		return;
+
+	apps = gs_app_list_get_watched_for_app (list, app);
+	for (guint i = 0; i < apps->len; i++)
+		gs_app_list_watch (list, g_ptr_array_index (apps, i));
+
+	g_hash_table_insert (list->watches, g_object_ref (app), g_steal_pointer (&apps));
+
+	/* addons and related apps may be added after @app is */
+	if (list->flags & GS_APP_LIST_FLAG_WATCH_APPS_ADDONS) {
+		g_signal_connect_object (app, "notify::addons",
+					 G_CALLBACK (gs_app_list_rewatch_cb),
 					 list, 0);
-		g_signal_connect_object (app_tmp, "notify::state",
-					 G_CALLBACK (gs_app_list_state_notify_cb),
+	}
+	if (list->flags & GS_APP_LIST_FLAG_WATCH_APPS_RELATED) {
+		g_signal_connect_object (app, "notify::related",
+					 G_CALLBACK (gs_app_list_rewatch_cb),
 					 list, 0);
 	}
 }
@@ -258,11 +435,25 @@ gs_app_list_maybe_watch_app (GsAppList *list, GsApp *app)
 static void
 gs_app_list_maybe_unwatch_app (GsAppList *list, GsApp *app)
 {
-	g_autoptr(GPtrArray) apps = gs_app_list_get_watched_for_app (list, app);
-	for (guint i = 0; i < apps->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (apps, i);
-		g_signal_handlers_disconnect_by_data (app_tmp, list);
-	}
+	GPtrArray *apps = g_hash_table_lookup (list->watches, app);
+
+	if (apps == NULL)
+		return;
+
+	for (guint i = 0; i < apps->len; i++)
+		gs_app_list_unwatch (list, g_ptr_array_index (apps, i));
+
+	g_signal_handlers_disconnect_by_func (app, gs_app_list_rewatch_cb, list);
+	g_hash_table_remove (list->watches, app);
+}
+
+/* whether @app is (still) present in @list */
+static gboolean
+gs_app_list_contains_instance (GsAppList *list, GsApp *app)
+{
+	if (list->index_apps != NULL)
+		return g_hash_table_contains (list->index_apps, app);
+	return g_ptr_array_find (list->array, app, NULL);
 }
 
 /**
@@ -281,9 +472,164 @@ gs_app_list_get_size_peak (GsAppList *list)
 	return list->size_peak;
 }
 
+/* returns the component ID of @unique_id if it is usable as a bucket key */
+static const gchar *
+gs_app_list_index_get_key (const gchar *unique_id, gsize *len_out)
+{
+	const gchar *cid = gs_app_unique_id_get_component_id (unique_id, len_out);
+	if (cid == NULL || *len_out == 0 || (*len_out == 1 && cid[0] == '*'))
+		return NULL;
+	return cid;
+}
+
+static GPtrArray *
+gs_app_list_index_get_bucket (GsAppList *list, const gchar *key, gsize key_len)
+{
+	gchar buf[128];
+	g_autofree gchar *key_owned = NULL;
+	const gchar *key_str = buf;
+
+	/* the key is not nul-terminated; avoid allocating for the common case */
+	if (key_len < sizeof (buf)) {
+		memcpy (buf, key, key_len);
+		buf[key_len] = '\0';
+	} else {
+		key_owned = g_strndup (key, key_len);
+		key_str = key_owned;
+	}
+	return g_hash_table_lookup (list->index_buckets, key_str);
+}
+
+static void
+gs_app_list_index_add (GsAppList *list, GsApp *app)
+{
+	const gchar *key;
+	gsize key_len = 0;
+	GPtrArray *bucket;
+	guint cnt;
+
+	cnt = GPOINTER_TO_UINT (g_hash_table_lookup (list->index_apps, app));
+	g_hash_table_insert (list->index_apps, app, GUINT_TO_POINTER (cnt + 1));
+
+	key = gs_app_list_index_get_key (gs_app_get_unique_id (app), &key_len);
+	if (key == NULL) {
+		g_ptr_array_add (list->index_unbucketed, app);
+		return;
+	}
+	bucket = gs_app_list_index_get_bucket (list, key, key_len);
+	if (bucket == NULL) {
+		bucket = g_ptr_array_new ();
+		g_hash_table_insert (list->index_buckets, g_strndup (key, key_len), bucket);
+	}
+	g_ptr_array_add (bucket, app);
+}
+
+static void
+gs_app_list_index_clear (GsAppList *list)
+{
+	g_clear_pointer (&list->index_apps, g_hash_table_unref);
+	g_clear_pointer (&list->index_buckets, g_hash_table_unref);
+	g_clear_pointer (&list->index_unbucketed, g_ptr_array_unref);
+}
+
+static void
+gs_app_list_index_rebuild (GsAppList *list)
+{
+	gs_app_list_index_clear (list);
+	if (list->array->len < GS_APP_LIST_INDEX_MIN_LENGTH)
+		return;
+
+	list->index_serial = gs_app_get_unique_id_serial ();
+	list->index_apps = g_hash_table_new (g_direct_hash, g_direct_equal);
+	list->index_buckets = g_hash_table_new_full (g_str_hash, g_str_equal,
+						     g_free, (GDestroyNotify) g_ptr_array_unref);
+	list->index_unbucketed = g_ptr_array_new ();
+	for (guint i = 0; i < list->array->len; i++)
+		gs_app_list_index_add (list, g_ptr_array_index (list->array, i));
+}
+
+static void
+gs_app_list_index_remove (GsAppList *list, GsApp *app)
+{
+	const gchar *key;
+	gsize key_len = 0;
+	GPtrArray *bucket;
+	guint cnt;
+
+	if (list->index_apps == NULL)
+		return;
+
+	cnt = GPOINTER_TO_UINT (g_hash_table_lookup (list->index_apps, app));
+	if (cnt <= 1)
+		g_hash_table_remove (list->index_apps, app);
+	else
+		g_hash_table_insert (list->index_apps, app, GUINT_TO_POINTER (cnt - 1));
+
+	/* the app may have gained a unique ID since it was added */
+	if (g_ptr_array_remove (list->index_unbucketed, app))
+		return;
+	key = gs_app_list_index_get_key (gs_app_get_unique_id (app), &key_len);
+	bucket = (key != NULL) ? gs_app_list_index_get_bucket (list, key, key_len) : NULL;
+	if (bucket == NULL || !g_ptr_array_remove (bucket, app)) {
+		/* the index is out of sync, so start again */
+		gs_app_list_index_rebuild (list);
+	}
+}
+
+/* returns %TRUE if the index is usable, rebuilding it if required */
+static gboolean
+gs_app_list_index_ensure (GsAppList *list)
+{
+	if (list->index_apps == NULL)
+		return FALSE;
+	if (list->index_serial != gs_app_get_unique_id_serial ())
+		gs_app_list_index_rebuild (list);
+	return list->index_apps != NULL;
+}
+
+/* call after appending @app to @array */
+static void
+gs_app_list_index_add_or_build (GsAppList *list, GsApp *app)
+{
+	if (list->index_apps != NULL)
+		gs_app_list_index_add (list, app);
+	else if (list->array->len >= GS_APP_LIST_INDEX_MIN_LENGTH)
+		gs_app_list_index_rebuild (list);
+}
+
 static GsApp *
 gs_app_list_lookup_safe (GsAppList *list, const gchar *unique_id)
 {
+	const gchar *key;
+	gsize key_len = 0;
+
+	/* only the apps in the same bucket, or with no bucket, can match */
+	key = gs_app_list_index_get_key (unique_id, &key_len);
+	if (key != NULL && gs_app_list_index_ensure (list)) {
+		GPtrArray *bucket = gs_app_list_index_get_bucket (list, key, key_len);
+		GsApp *found = NULL;
+		guint n_found = 0;
+
+		for (guint i = 0; bucket != NULL && i < bucket->len; i++) {
+			GsApp *app = g_ptr_array_index (bucket, i);
+			if (as_utils_data_id_equal (gs_app_get_unique_id (app), unique_id)) {
+				found = app;
+				n_found++;
+			}
+		}
+		for (guint i = 0; i < list->index_unbucketed->len; i++) {
+			GsApp *app = g_ptr_array_index (list->index_unbucketed, i);
+			if (as_utils_data_id_equal (gs_app_get_unique_id (app), unique_id)) {
+				found = app;
+				n_found++;
+			}
+		}
+
+		/* if there are several, the first in list order has to win */
+		if (n_found <= 1)
+			return found;
+	}
+
 	for (guint i = 0; i < list->array->len; i++) {
 		GsApp *app = g_ptr_array_index (list->array, i);
 		if (as_utils_data_id_equal (gs_app_get_unique_id (app), unique_id))
@@ -346,9 +692,11 @@ gs_app_list_add_flag (GsAppList *list, GsAppListFlags flag)
 		return;
 	list->flags |= flag;
 
-	/* turn this on for existing apps */
+	/* turn this on for existing apps, which may already be watched with
+	 * the previous flags */
 	for (guint i = 0; i < list->array->len; i++) {
 		GsApp *app = g_ptr_array_index (list->array, i);
+		gs_app_list_maybe_unwatch_app (list, app);
 		gs_app_list_maybe_watch_app (list, app);
 	}
 }
@@ -361,6 +709,30 @@ gs_app_list_check_for_duplicate (GsAppList *list, GsApp *app)
 
 	/* adding a wildcard */
 	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
+		const gchar *key;
+		gsize key_len = 0;
+
+		/* an identical unique ID must be in the same bucket */
+		key = gs_app_list_index_get_key (gs_app_get_unique_id (app), &key_len);
+		if (key != NULL && gs_app_list_index_ensure (list)) {
+			GPtrArray *bucket = gs_app_list_index_get_bucket (list, key, key_len);
+			for (guint i = 0; bucket != NULL && i < bucket->len; i++) {
+				GsApp *app_tmp = g_ptr_array_index (bucket, i);
+				if (gs_app_has_quirk (app_tmp, GS_APP_QUIRK_IS_WILDCARD) &&
+				    g_strcmp0 (gs_app_get_unique_id (app_tmp),
+					       gs_app_get_unique_id (app)) == 0)
+					return FALSE;
+			}
+			for (guint i = 0; i < list->index_unbucketed->len; i++) {
+				GsApp *app_tmp = g_ptr_array_index (list->index_unbucketed, i);
+				if (gs_app_has_quirk (app_tmp, GS_APP_QUIRK_IS_WILDCARD) &&
+				    g_strcmp0 (gs_app_get_unique_id (app_tmp),
+					       gs_app_get_unique_id (app)) == 0)
+					return FALSE;
+			}
+			return TRUE;
+		}
+
 		for (guint i = 0; i < list->array->len; i++) {
 			GsApp *app_tmp = g_ptr_array_index (list->array, i);
 			if (!gs_app_has_quirk (app_tmp, GS_APP_QUIRK_IS_WILDCARD))
@@ -373,10 +745,15 @@ gs_app_list_check_for_duplicate (GsAppList *list, GsApp *app)
 		return TRUE;
 	}
 
-	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (list->array, i);
-		if (app_tmp == app)
+	if (gs_app_list_index_ensure (list)) {
+		if (g_hash_table_contains (list->index_apps, app))
 			return FALSE;
+	} else {
+		for (guint i = 0; i < list->array->len; i++) {
+			GsApp *app_tmp = g_ptr_array_index (list->array, i);
+			if (app_tmp == app)
+				return FALSE;
+		}
 	}
 
 	/* does not exist */
@@ -418,12 +795,14 @@ gs_app_list_add_safe (GsAppList *list, GsApp *app, GsAppListAddFlag flag)
 	if (id == NULL) {
 		gs_app_list_maybe_watch_app (list, app);
 		g_ptr_array_add (list->array, g_object_ref (app));
+		gs_app_list_index_add_or_build (list, app);
 		return;
 	}
 
 	/* just use the ref */
 	gs_app_list_maybe_watch_app (list, app);
 	g_ptr_array_add (list->array, g_object_ref (app));
+	gs_app_list_index_add_or_build (list, app);
 
 	/* update the historical max */
 	if (list->array->len > list->size_peak)
@@ -478,8 +857,10 @@ gs_app_list_remove (GsAppList *list, GsApp *app)
 	g_return_if_fail (GS_IS_APP (app));
 
 	locker = g_mutex_locker_new (&list->mutex);
-	g_ptr_array_remove (list->array, app);
-	gs_app_list_maybe_unwatch_app (list, app);
+	if (g_ptr_array_remove (list->array, app))
+		gs_app_list_index_remove (list, app);
+	if (!gs_app_list_contains_instance (list, app))
+		gs_app_list_maybe_unwatch_app (list, app);
 
 	/* recalculate global state */
 	gs_app_list_invalidate_state (list);
@@ -560,6 +941,7 @@ gs_app_list_remove_all_safe (GsAppList *list)
 		gs_app_list_maybe_unwatch_app (list, app);
 	}
 	g_ptr_array_set_size (list->array, 0);
+	gs_app_list_index_clear (list);
 	gs_app_list_invalidate_state (list);
 	gs_app_list_invalidate_progress (list);
 }
@@ -666,6 +1048,7 @@ void
 gs_app_list_truncate (GsAppList *list, guint length)
 {
 	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GPtrArray) removed = NULL;
 
 	g_return_if_fail (GS_IS_APP_LIST (list));
 	g_return_if_fail (length <= list->array->len);
@@ -681,7 +1064,21 @@ gs_app_list_truncate (GsAppList *list, guint length)
 
 	/* remove the apps in the positions larger than the length */
 	locker = g_mutex_locker_new (&list->mutex);
+	removed = g_ptr_array_new_with_free_func (g_object_unref);
+	for (guint i = length; i < list->array->len; i++)
+		g_ptr_array_add (removed, g_object_ref (g_ptr_array_index (list->array, i)));
 	g_ptr_array_set_size (list->array, length);
+	if (list->index_apps != NULL)
+		gs_app_list_index_rebuild (list);
+
+	/* stop watching them */
+	for (guint i = 0; i < removed->len; i++) {
+		GsApp *app = g_ptr_array_index (removed, i);
+		if (!gs_app_list_contains_instance (list, app))
+			gs_app_list_maybe_unwatch_app (list, app);
+	}
+	gs_app_list_invalidate_state (list);
+	gs_app_list_invalidate_progress (list);
 }
 
 static gint
@@ -764,58 +1161,105 @@ gs_app_list_filter_app_is_better (GsApp *app, GsApp *found, GsAppListFilterFlags
 	return FALSE;
 }
 
-static GPtrArray *
-gs_app_list_filter_app_get_keys (GsApp *app, GsAppListFilterFlags flags)
+/* The key identifying an app when deduplicating. All the strings are borrowed
+ * from the app, which the list keeps alive, so nothing is copied. Unused parts
+ * are %NULL. */
+typedef struct {
+	const gchar	*id;
+	const gchar	*source;
+	const gchar	*version;
+} GsAppListFilterKey;
+
+static guint
+gs_app_list_filter_key_hash (gconstpointer data)
 {
-	GPtrArray *keys = g_ptr_array_new_with_free_func (g_free);
-	g_autoptr(GString) key = NULL;
+	const GsAppListFilterKey *key = data;
+	guint hash = 0;
+
+	if (key->id != NULL)
+		hash = g_str_hash (key->id);
+	if (key->source != NULL)
+		hash = (hash * 31) + g_str_hash (key->source);
+	if (key->version != NULL)
+		hash = (hash * 31) + g_str_hash (key->version);
+	return hash;
+}
+
+static gboolean
+gs_app_list_filter_key_equal (gconstpointer a, gconstpointer b)
+{
+	const GsAppListFilterKey *key1 = a;
+	const GsAppListFilterKey *key2 = b;
+
+	return g_strcmp0 (key1->id, key2->id) == 0 &&
+	       g_strcmp0 (key1->source, key2->source) == 0 &&
+	       g_strcmp0 (key1->version, key2->version) == 0;
+}
+
+/* Gets the @idx-th key of @app, returning %FALSE when there are no more.
+ * Only a filter using %GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES can give
+ * more than one key. */
+static gboolean
+gs_app_list_filter_app_get_key (GsApp *app,
+				GsAppListFilterFlags flags,
+				guint idx,
+				GsAppListFilterKey *key)
+{
+	key->id = NULL;
+	key->source = NULL;
+	key->version = NULL;
 
 	/* just use the unique ID */
 	if (flags == GS_APP_LIST_FILTER_FLAG_NONE) {
-		if (gs_app_get_unique_id (app) != NULL)
-			g_ptr_array_add (keys, g_strdup (gs_app_get_unique_id (app)));
-		return keys;
+		key->id = gs_app_get_unique_id (app);
+		return idx == 0 && key->id != NULL;
 	}
 
 	/* use the ID and any provided items */
 	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES) {
-		GPtrArray *provided = gs_app_get_provided (app);
-		g_ptr_array_add (keys, g_strdup (gs_app_get_id (app)));
+		GPtrArray *provided;
+
+		if (idx == 0) {
+			key->id = gs_app_get_id (app);
+			return key->id != NULL;
+		}
+		idx--;
+
+		provided = gs_app_get_provided (app);
 		for (guint i = 0; i < provided->len; i++) {
 			AsProvided *prov = g_ptr_array_index (provided, i);
 			GPtrArray *items;
 			if (as_provided_get_kind (prov) != AS_PROVIDED_KIND_ID)
 				continue;
 			items = as_provided_get_items (prov);
-			for (guint j = 0; j < items->len; j++)
-				g_ptr_array_add (keys, g_strdup (g_ptr_array_index (items, j)));
+			if (idx < items->len) {
+				key->id = g_ptr_array_index (items, idx);
+				return TRUE;
+			}
+			idx -= items->len;
 		}
-		return keys;
+		return FALSE;
 	}
 
 	/* specific compound type */
-	key = g_string_new (NULL);
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID) {
-		const gchar *tmp = gs_app_get_id (app);
-		if (tmp != NULL)
-			g_string_append (key, gs_app_get_id (app));
-	}
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_SOURCE) {
-		const gchar *tmp = gs_app_get_source_default (app);
-		if (tmp != NULL)
-			g_string_append_printf (key, ":%s", tmp);
-	}
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_VERSION) {
-		const gchar *tmp = gs_app_get_version (app);
-		if (tmp != NULL)
-			g_string_append_printf (key, ":%s", tmp);
-	}
-	if (key->len == 0)
-		return keys;
-	g_ptr_array_add (keys, g_string_free (g_steal_pointer (&key), FALSE));
-	return keys;
+	if (idx > 0)
+		return FALSE;
+	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID)
+		key->id = gs_app_get_id (app);
+	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_SOURCE)
+		key->source = gs_app_get_source_default (app);
+	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_VERSION)
+		key->version = gs_app_get_version (app);
+	return key->id != NULL || key->source != NULL || key->version != NULL;
 }
 
+typedef enum {
+	GS_APP_LIST_FILTER_STATE_DROP,
+	GS_APP_LIST_FILTER_STATE_KEEP,
+	/* dropped, but the same instance is kept elsewhere in the list */
+	GS_APP_LIST_FILTER_STATE_DROP_REPEAT,
+} GsAppListFilterState;
+
 /**
  * gs_app_list_filter_duplicates:
  * @list: A #GsAppList
@@ -828,72 +1272,103 @@ gs_app_list_filter_app_get_keys (GsApp *app, GsAppListFilterFlags flags)
 void
 gs_app_list_filter_duplicates (GsAppList *list, GsAppListFilterFlags flags)
 {
+	guint n_apps;
+	guint n_keys_total = 0;
+	guint n_kept = 0;
+	GsAppListFilterKey key_tmp;
+	g_autofree guint8 *states = NULL;
+	g_autofree GsAppListFilterKey *keys = NULL;
 	g_autoptr(GHashTable) hash = NULL;
-	g_autoptr(GHashTable) kept_apps = NULL;
-	g_autoptr(GsAppList) old = NULL;
+	g_autoptr(GHashTable) keyless_apps = NULL;
 	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_APP_LIST (list));
 
 	locker = g_mutex_locker_new (&list->mutex);
 
-	/* a hash table to hold apps with unique app ids */
-	hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-	/* a hash table containing apps we want to keep */
-	kept_apps = g_hash_table_new (g_direct_hash, g_direct_equal);
+	n_apps = list->array->len;
+	if (n_apps == 0)
+		return;
 
-	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app = gs_app_list_index (list, i);
-		GsApp *found = NULL;
-		g_autoptr(GPtrArray) keys = NULL;
-
-		/* get all the keys used to identify this app */
-		keys = gs_app_list_filter_app_get_keys (app, flags);
-		for (guint j = 0; j < keys->len; j++) {
-			const gchar *key = g_ptr_array_index (keys, j);
-			found = g_hash_table_lookup (hash, key);
-			if (found != NULL)
-				break;
+	/* all the keys go in one block so the hash table can point into it */
+	for (guint i = 0; i < n_apps; i++) {
+		GsApp *app = g_ptr_array_index (list->array, i);
+		for (guint j = 0; gs_app_list_filter_app_get_key (app, flags, j, &key_tmp); j++)
+			n_keys_total++;
+	}
+	keys = g_new (GsAppListFilterKey, MAX (n_keys_total, 1));
+	states = g_new0 (guint8, n_apps);
+
+	/* a hash table of each key to the position of the app using it, plus one */
+	hash = g_hash_table_new (gs_app_list_filter_key_hash, gs_app_list_filter_key_equal);
+
+	for (guint i = 0, k = 0; i < n_apps; i++) {
+		GsApp *app = g_ptr_array_index (list->array, i);
+		GsAppListFilterKey *app_keys = &keys[k];
+		guint found_pos = 0;
+		guint n_keys = 0;
+
+		/* find any existing app with one of the keys of this one */
+		while (k < n_keys_total &&
+		       gs_app_list_filter_app_get_key (app, flags, n_keys, &keys[k])) {
+			if (found_pos == 0)
+				found_pos = GPOINTER_TO_UINT (g_hash_table_lookup (hash, &keys[k]));
+			n_keys++;
+			k++;
 		}
 
-		/* new app */
-		if (found == NULL) {
-			for (guint j = 0; j < keys->len; j++) {
-				const gchar *key = g_ptr_array_index (keys, j);
-				g_hash_table_insert (hash, g_strdup (key), app);
-			}
-			g_hash_table_add (kept_apps, app);
+		/* no way to identify it, so only drop repeats of the same instance */
+		if (n_keys == 0) {
+			if (keyless_apps == NULL)
+				keyless_apps = g_hash_table_new (g_direct_hash, g_direct_equal);
+			if (g_hash_table_add (keyless_apps, app))
+				states[i] = GS_APP_LIST_FILTER_STATE_KEEP;
+			else
+				states[i] = GS_APP_LIST_FILTER_STATE_DROP_REPEAT;
 			continue;
 		}
 
-		/* better? */
-		if (flags != GS_APP_LIST_FILTER_FLAG_NONE) {
-			if (gs_app_list_filter_app_is_better (app, found, flags)) {
-				for (guint j = 0; j < keys->len; j++) {
-					const gchar *key = g_ptr_array_index (keys, j);
-					g_hash_table_insert (hash, g_strdup (key), app);
-				}
-				g_hash_table_remove (kept_apps, found);
-				g_hash_table_add (kept_apps, app);
-				continue;
-			}
+		/* new app, or better than the existing one */
+		if (found_pos == 0 ||
+		    (flags != GS_APP_LIST_FILTER_FLAG_NONE &&
+		     gs_app_list_filter_app_is_better (app,
+						       g_ptr_array_index (list->array, found_pos - 1),
+						       flags))) {
+			/* an existing key is kept and just points to this app now */
+			for (guint j = 0; j < n_keys; j++)
+				g_hash_table_insert (hash, &app_keys[j], GUINT_TO_POINTER (i + 1));
+			if (found_pos != 0)
+				states[found_pos - 1] = GS_APP_LIST_FILTER_STATE_DROP;
+			states[i] = GS_APP_LIST_FILTER_STATE_KEEP;
 			continue;
 		}
-		continue;
+
+		/* a repeat of the same instance */
+		if (g_ptr_array_index (list->array, found_pos - 1) == app)
+			states[i] = GS_APP_LIST_FILTER_STATE_DROP_REPEAT;
 	}
 
-	/* deep copy to a temp list and clear the current one */
-	old = gs_app_list_copy (list);
-	gs_app_list_remove_all_safe (list);
+	/* compact the list in place: the winners move to the front, keeping
+	 * their order, and the rest are unreffed when the array is shrunk */
+	for (guint i = 0; i < n_apps; i++) {
+		GsApp *app = g_ptr_array_index (list->array, i);
 
-	/* add back the apps we want to keep */
-	for (guint i = 0; i < old->array->len; i++) {
-		GsApp *app = gs_app_list_index (old, i);
-		if (g_hash_table_contains (kept_apps, app)) {
-			gs_app_list_add_safe (list, app, GS_APP_LIST_ADD_FLAG_NONE);
-			/* In case the same instance is in the 'list' multiple times */
-			g_hash_table_remove (kept_apps, app);
+		if (states[i] != GS_APP_LIST_FILTER_STATE_KEEP) {
+			if (states[i] == GS_APP_LIST_FILTER_STATE_DROP)
+				gs_app_list_maybe_unwatch_app (list, app);
+			continue;
 		}
+		list->array->pdata[i] = list->array->pdata[n_kept];
+		list->array->pdata[n_kept++] = app;
+	}
+	g_ptr_array_set_size (list->array, n_kept);
+
+	/* recalculate */
+	if (n_kept != n_apps) {
+		if (list->index_apps != NULL)
+			gs_app_list_index_rebuild (list);
+		gs_app_list_invalidate_state (list);
+		gs_app_list_invalidate_progress (list);
 	}
 }
 
@@ -954,6 +1429,9 @@ static void
 gs_app_list_finalize (GObject *object)
 {
 	GsAppList *list = GS_APP_LIST (object);
+	gs_app_list_index_clear (list);
+	g_hash_table_unref (list->watches);
+	g_hash_table_unref (list->watched);
 	g_ptr_array_unref (list->array);
 	g_mutex_clear (&list->mutex);
 	G_OBJECT_CLASS (gs_app_list_parent_class)->finalize (object);
@@ -1011,6 +1489,10 @@ gs_app_list_init (GsAppList *list)
 	g_mutex_init (&list->mutex);
 	list->array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	list->custom_progress = GS_APP_PROGRESS_UNKNOWN;
+	list->watches = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					       g_object_unref, (GDestroyNotify) g_ptr_array_unref);
+	list->watched = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					       g_object_unref, g_free);
 }
 
 /**
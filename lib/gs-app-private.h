@@ -26,5 +26,9 @@ void		 gs_app_set_pending_action	(GsApp		*app,
 						 GsPluginAction	 action);
 gint		 gs_app_compare_priority	(GsApp		*app1,
 						 GsApp		*app2);
+const gchar	*gs_app_unique_id_get_component_id
+						(const gchar	*unique_id,
+						 gsize		*len_out);
+guint		 gs_app_get_unique_id_serial	(void);
 
 G_END_DECLS
@@ -134,6 +134,7 @@ typedef struct
 	GPtrArray		*version_history; /* (element-type AsRelease) (nullable) (owned) */
 	GPtrArray		*relations;  /* (nullable) (element-type AsRelation) (owned) */
 	gboolean		 has_translations;
+	GPtrArray		*pending_notify_pspecs;  /* (nullable) (owned) (element-type GParamSpec); protected by pending_notify */
 } GsAppPrivate;
 
 typedef enum {
@@ -168,12 +169,18 @@ typedef enum {
 	PROP_RELATIONS,
 	PROP_ORIGIN_UI,
 	PROP_HAS_TRANSLATIONS,
+	PROP_ADDONS,
+	PROP_RELATED,
 } GsAppProperty;
 
-static GParamSpec *obj_props[PROP_HAS_TRANSLATIONS + 1] = { NULL, };
+static GParamSpec *obj_props[PROP_RELATED + 1] = { NULL, };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GsApp, gs_app, G_TYPE_OBJECT)
 
+/* incremented when the component ID part of an existing unique ID changes;
+ * see gs_app_get_unique_id_serial() */
+static guint unique_id_serial = 0;
+
 static gboolean
 _g_set_str (gchar **str_ptr, const gchar *new_str)
 {
@@ -335,6 +342,90 @@ _as_component_quirk_flag_to_string (GsAppQuirk quirk)
 	}
 }
 
+/**
+ * gs_app_unique_id_get_component_id:
+ * @unique_id: (nullable): a unique ID, e.g. `system/flatpak/flathub/org.gnome.Maps/stable`
+ * @len_out: (out): return location for the length of the component ID
+ *
+ * Finds the component ID part of @unique_id without copying it. The returned
+ * string is not nul-terminated at @len_out.
+ *
+ * Returns: (nullable): pointer into @unique_id, or %NULL if it is malformed
+ */
+const gchar *
+gs_app_unique_id_get_component_id (const gchar *unique_id,
+				   gsize       *len_out)
+{
+	const gchar *cid = unique_id;
+	const gchar *end;
+
+	if (unique_id == NULL)
+		return NULL;
+
+	/* skip scope, bundle kind and origin */
+	for (guint i = 0; i < 3; i++) {
+		cid = strchr (cid, '/');
+		if (cid == NULL)
+			return NULL;
+		cid++;
+	}
+	end = strchr (cid, '/');
+	*len_out = (end != NULL) ? (gsize) (end - cid) : strlen (cid);
+	return cid;
+}
+
+/**
+ * gs_app_get_unique_id_serial:
+ *
+ * Gets a counter which is incremented whenever the component ID part of the
+ * unique ID of any #GsApp changes after it has been computed. This lets
+ * #GsAppList detect when its unique ID index may be out of date.
+ *
+ * Returns: the current serial
+ */
+guint
+gs_app_get_unique_id_serial (void)
+{
+	return (guint) g_atomic_int_get (&unique_id_serial);
+}
+
+/* @cid_new is the new component ID itself, or a unique ID if @is_unique_id */
+static void
+gs_app_unique_id_changed (const gchar *unique_id_old,
+			  const gchar *cid_new,
+			  gboolean     is_unique_id)
+{
+	const gchar *cid_old;
+	gsize len_old = 0, len_new = 0;
+
+	/* nothing can have indexed it yet */
+	if (unique_id_old == NULL)
+		return;
+
+	cid_old = gs_app_unique_id_get_component_id (unique_id_old, &len_old);
+	if (is_unique_id)
+		cid_new = gs_app_unique_id_get_component_id (cid_new, &len_new);
+	else if (cid_new != NULL)
+		len_new = strlen (cid_new);
+	if (cid_old != NULL && cid_new != NULL &&
+	    len_old == len_new && memcmp (cid_old, cid_new, len_old) == 0)
+		return;
+
+	g_atomic_int_inc (&unique_id_serial);
+}
+
+/* mutex must be held */
+static void
+gs_app_invalidate_unique_id (GsApp *app)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+
+	/* the unique ID is rebuilt lazily, but its component ID part will be
+	 * @priv->id so anything indexing it must be told now */
+	gs_app_unique_id_changed (priv->unique_id, priv->id, FALSE);
+	priv->unique_id_valid = FALSE;
+}
+
 /* mutex must be held */
 static const gchar *
 gs_app_get_unique_id_unlocked (GsApp *app)
@@ -764,20 +855,37 @@ gs_app_to_string_append (GsApp *app, GString *str)
 	g_string_append_printf (str, "\n");
 }
 
-typedef struct {
-	GsApp *app;
-	GParamSpec *pspec;
-} AppNotifyData;
+/* Property notifications are queued from any thread and emitted in the main
+ * context. Rather than an idle source per notification, all the apps with
+ * pending notifications are collected (in the order they were first queued)
+ * and flushed by a single idle source. Each app’s pending properties are
+ * deduplicated, and emitted inside g_object_freeze_notify(). */
+G_LOCK_DEFINE_STATIC (pending_notify);
+static GPtrArray *pending_notify_apps = NULL;  /* (nullable) (owned) (element-type GsApp); protected by pending_notify */
 
 static gboolean
 notify_idle_cb (gpointer data)
 {
-	AppNotifyData *notify_data = data;
+	g_autoptr(GPtrArray) apps = NULL;
+
+	G_LOCK (pending_notify);
+	apps = g_steal_pointer (&pending_notify_apps);
+	G_UNLOCK (pending_notify);
 
-	g_object_notify_by_pspec (G_OBJECT (notify_data->app), notify_data->pspec);
+	for (guint i = 0; i < apps->len; i++) {
+		GsApp *app = g_ptr_array_index (apps, i);
+		GsAppPrivate *priv = gs_app_get_instance_private (app);
+		g_autoptr(GPtrArray) pspecs = NULL;
 
-	g_object_unref (notify_data->app);
-	g_free (notify_data);
+		G_LOCK (pending_notify);
+		pspecs = g_steal_pointer (&priv->pending_notify_pspecs);
+		G_UNLOCK (pending_notify);
+
+		g_object_freeze_notify (G_OBJECT (app));
+		for (guint j = 0; j < pspecs->len; j++)
+			g_object_notify_by_pspec (G_OBJECT (app), g_ptr_array_index (pspecs, j));
+		g_object_thaw_notify (G_OBJECT (app));
+	}
 
 	return G_SOURCE_REMOVE;
 }
@@ -785,13 +893,27 @@ notify_idle_cb (gpointer data)
 static void
 gs_app_queue_notify (GsApp *app, GParamSpec *pspec)
 {
-	AppNotifyData *notify_data;
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+
+	G_LOCK (pending_notify);
 
-	notify_data = g_new (AppNotifyData, 1);
-	notify_data->app = g_object_ref (app);
-	notify_data->pspec = pspec;
+	if (priv->pending_notify_pspecs == NULL) {
+		priv->pending_notify_pspecs = g_ptr_array_new ();
 
-	g_idle_add (notify_idle_cb, notify_data);
+		/* schedule a flush if this is the first pending app */
+		if (pending_notify_apps == NULL) {
+			pending_notify_apps = g_ptr_array_new_with_free_func (g_object_unref);
+			g_idle_add (notify_idle_cb, NULL);
+		}
+		g_ptr_array_add (pending_notify_apps, g_object_ref (app));
+	}
+
+	/* there are only a few pending properties per app, so a linear
+	 * search is fine */
+	if (!g_ptr_array_find (priv->pending_notify_pspecs, pspec, NULL))
+		g_ptr_array_add (priv->pending_notify_pspecs, pspec);
+
+	G_UNLOCK (pending_notify);
 }
 
 /**
@@ -827,7 +949,7 @@ gs_app_set_id (GsApp *app, const gchar *id)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	if (_g_set_str (&priv->id, id))
-		priv->unique_id_valid = FALSE;
+		gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -871,7 +993,7 @@ gs_app_set_scope (GsApp *app, AsComponentScope scope)
 	priv->scope = scope;
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -915,7 +1037,7 @@ gs_app_set_bundle_kind (GsApp *app, AsBundleKind bundle_kind)
 	priv->bundle_kind = bundle_kind;
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -1391,7 +1513,7 @@ gs_app_set_kind (GsApp *app, AsComponentKind kind)
 	gs_app_queue_notify (app, obj_props[PROP_KIND]);
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -1437,6 +1559,7 @@ gs_app_set_unique_id (GsApp *app, const gchar *unique_id)
 	if (!as_utils_data_id_valid (unique_id))
 		g_warning ("unique_id %s not valid", unique_id);
 
+	gs_app_unique_id_changed (priv->unique_id, unique_id, TRUE);
 	g_free (priv->unique_id);
 	priv->unique_id = g_strdup (unique_id);
 	priv->unique_id_valid = TRUE;
@@ -1560,7 +1683,7 @@ gs_app_set_branch (GsApp *app, const gchar *branch)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	if (_g_set_str (&priv->branch, branch))
-		priv->unique_id_valid = FALSE;
+		gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -2881,7 +3004,7 @@ gs_app_set_origin (GsApp *app, const gchar *origin)
 	priv->origin = g_strdup (origin);
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -3903,6 +4026,7 @@ gs_app_add_addon (GsApp *app, GsApp *addon)
 
 	locker = g_mutex_locker_new (&priv->mutex);
 	gs_app_list_add (priv->addons, addon);
+	gs_app_queue_notify (app, obj_props[PROP_ADDONS]);
 }
 
 /**
@@ -3923,6 +4047,7 @@ gs_app_remove_addon (GsApp *app, GsApp *addon)
 	g_return_if_fail (GS_IS_APP (addon));
 	locker = g_mutex_locker_new (&priv->mutex);
 	gs_app_list_remove (priv->addons, addon);
+	gs_app_queue_notify (app, obj_props[PROP_ADDONS]);
 }
 
 /**
@@ -3971,6 +4096,7 @@ gs_app_add_related (GsApp *app, GsApp *app2)
 		priv->state = priv2->state;
 
 	gs_app_list_add (priv->related, app2);
+	gs_app_queue_notify (app, obj_props[PROP_RELATED]);
 
 	/* The related apps add to the main app’s sizes. */
 	gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD_DEPENDENCIES]);
@@ -5016,6 +5142,12 @@ gs_app_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *
 	case PROP_HAS_TRANSLATIONS:
 		g_value_set_boolean (value, gs_app_get_has_translations (app));
 		break;
+	case PROP_ADDONS:
+		g_value_set_object (value, gs_app_get_addons (app));
+		break;
+	case PROP_RELATED:
+		g_value_set_object (value, gs_app_get_related (app));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -5130,6 +5262,11 @@ gs_app_set_property (GObject *object, guint prop_id, const GValue *value, GParam
 	case PROP_HAS_TRANSLATIONS:
 		gs_app_set_has_translations (app, g_value_get_boolean (value));
 		break;
+	case PROP_ADDONS:
+	case PROP_RELATED:
+		/* Read only */
+		g_assert_not_reached ();
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -5573,6 +5710,32 @@ gs_app_class_init (GsAppClass *klass)
 				      FALSE,
 				      G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
 
+	/**
+	 * GsApp:addons: (not nullable)
+	 *
+	 * The addons of the app, as returned by gs_app_get_addons(). This is
+	 * notified when an addon is added or removed.
+	 *
+	 * Since: 42
+	 */
+	obj_props[PROP_ADDONS] =
+		g_param_spec_object ("addons", NULL, NULL,
+				     GS_TYPE_APP_LIST,
+				     G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * GsApp:related: (not nullable)
+	 *
+	 * The related apps of the app, as returned by gs_app_get_related().
+	 * This is notified when a related app is added.
+	 *
+	 * Since: 42
+	 */
+	obj_props[PROP_RELATED] =
+		g_param_spec_object ("related", NULL, NULL,
+				     GS_TYPE_APP_LIST,
+				     G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties (object_class, G_N_ELEMENTS (obj_props), obj_props);
 }
 
@@ -281,35 +281,42 @@ gs_appstream_refine_icon (GsApp *app, XbNode *component)
 	}
 }
 
+/* the addons may come from a different silo than @app, such as a metainfo
+ * file extending an app from the distro catalog */
 static gboolean
 gs_appstream_refine_add_addons (GsPlugin *plugin,
 				GsApp *app,
-				XbSilo *silo,
+				XbSilo * const *silos,
+				guint n_silos,
 				GError **error)
 {
 	g_autofree gchar *xpath = NULL;
-	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GPtrArray) addons = NULL;
 
-	/* get all components */
-	xpath = g_strdup_printf ("components/component/extends[text()='%s']/..",
-				 gs_app_get_id (app));
-	addons = xb_silo_query (silo, xpath, 0, &error_local);
-	if (addons == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
-	}
-	for (guint i = 0; i < addons->len; i++) {
-		XbNode *addon = g_ptr_array_index (addons, i);
-		g_autoptr(GsApp) app2 = NULL;
-		app2 = gs_appstream_create_app (plugin, silo, addon, error);
-		if (app2 == NULL)
+	/* get all components, from catalogs and installed metainfo files */
+	xpath = g_strdup_printf ("components/component/extends[text()='%s']/..|"
+				 "component/extends[text()='%s']/..",
+				 gs_app_get_id (app), gs_app_get_id (app));
+	for (guint j = 0; j < n_silos; j++) {
+		g_autoptr(GError) error_local = NULL;
+		g_autoptr(GPtrArray) addons = NULL;
+
+		addons = xb_silo_query (silos[j], xpath, 0, &error_local);
+		if (addons == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				continue;
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
+				continue;
+			g_propagate_error (error, g_steal_pointer (&error_local));
 			return FALSE;
-		gs_app_add_addon (app, app2);
+		}
+		for (guint i = 0; i < addons->len; i++) {
+			XbNode *addon = g_ptr_array_index (addons, i);
+			g_autoptr(GsApp) app2 = NULL;
+			app2 = gs_appstream_create_app (plugin, silos[j], addon, error);
+			if (app2 == NULL)
+				return FALSE;
+			gs_app_add_addon (app, app2);
+		}
 	}
 	return TRUE;
 }
@@ -511,7 +518,8 @@ gs_appstream_copy_metadata (GsApp *app, XbNode *component, GError **error)
 
 static gboolean
 gs_appstream_refine_app_updates (GsApp *app,
-				 XbSilo *silo,
+				 XbSilo * const *silos,
+				 guint n_silos,
 				 XbNode *component,
 				 GError **error)
 {
@@ -519,7 +527,7 @@ gs_appstream_refine_app_updates (GsApp *app,
 	g_autofree gchar *xpath = NULL;
 	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GHashTable) installed = g_hash_table_new (g_str_hash, g_str_equal);
-	g_autoptr(GPtrArray) releases_inst = NULL;
+	g_autoptr(GPtrArray) releases_inst = g_ptr_array_new_with_free_func (g_object_unref);
 	g_autoptr(GPtrArray) releases = NULL;
 	g_autoptr(GPtrArray) updates_list = g_ptr_array_new ();
 
@@ -527,25 +535,32 @@ gs_appstream_refine_app_updates (GsApp *app,
 	if (!gs_app_is_updatable (app))
 		return TRUE;
 
-	/* find out which releases are already installed */
+	/* find out which releases are already installed; the installed
+	 * metainfo is usually in a different silo than @component */
 	xpath = g_strdup_printf ("component/id[text()='%s']/../releases/*[@version]",
 				 gs_app_get_id (app));
-	releases_inst = xb_silo_query (silo, xpath, 0, &error_local);
-	if (releases_inst == NULL) {
-		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
-		    !g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT)) {
-			g_propagate_error (error, g_steal_pointer (&error_local));
-			return FALSE;
-		}
-	} else {
-		for (guint i = 0; i < releases_inst->len; i++) {
-			XbNode *release = g_ptr_array_index (releases_inst, i);
-			g_hash_table_insert (installed,
-					     (gpointer) xb_node_get_attr (release, "version"),
-					     (gpointer) release);
+	for (guint j = 0; j < n_silos; j++) {
+		g_autoptr(GPtrArray) releases_tmp = NULL;
+
+		releases_tmp = xb_silo_query (silos[j], xpath, 0, &error_local);
+		if (releases_tmp == NULL) {
+			if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
+			    !g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT)) {
+				g_propagate_error (error, g_steal_pointer (&error_local));
+				return FALSE;
+			}
+			g_clear_error (&error_local);
+			continue;
 		}
+		for (guint i = 0; i < releases_tmp->len; i++)
+			g_ptr_array_add (releases_inst, g_object_ref (g_ptr_array_index (releases_tmp, i)));
+	}
+	for (guint i = 0; i < releases_inst->len; i++) {
+		XbNode *release = g_ptr_array_index (releases_inst, i);
+		g_hash_table_insert (installed,
+				     (gpointer) xb_node_get_attr (release, "version"),
+				     (gpointer) release);
 	}
-	g_clear_error (&error_local);
 
 	/* get all components */
 	releases = xb_node_query (component, "releases/*", 0, &error_local);
@@ -917,13 +932,14 @@ gs_appstream_refine_app_relations (GsApp     *app,
 	return TRUE;
 }
 
-gboolean
-gs_appstream_refine_app (GsPlugin *plugin,
-			 GsApp *app,
-			 XbSilo *silo,
-			 XbNode *component,
-			 GsPluginRefineFlags refine_flags,
-			 GError **error)
+static gboolean
+gs_appstream_refine_app_internal (GsPlugin *plugin,
+				  GsApp *app,
+				  XbSilo * const *silos,
+				  guint n_silos,
+				  XbNode *component,
+				  GsPluginRefineFlags refine_flags,
+				  GError **error)
 {
 	const gchar *tmp;
 	guint64 timestamp;
@@ -1215,8 +1231,8 @@ gs_appstream_refine_app (GsPlugin *plugin,
 
 	/* set addons */
 	if ((refine_flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS) != 0 &&
-	    plugin != NULL && silo != NULL) {
-		if (!gs_appstream_refine_add_addons (plugin, app, silo, error))
+	    plugin != NULL && n_silos > 0) {
+		if (!gs_appstream_refine_add_addons (plugin, app, silos, n_silos, error))
 			return FALSE;
 	}
 
@@ -1287,9 +1303,10 @@ gs_appstream_refine_app (GsPlugin *plugin,
 
 	/* is there any update information */
 	if ((refine_flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_DETAILS) != 0 &&
-	    silo != NULL) {
+	    n_silos > 0) {
 		if (!gs_appstream_refine_app_updates (app,
-						      silo,
+						      silos,
+						      n_silos,
 						      component,
 						      error))
 			return FALSE;
@@ -1298,97 +1315,378 @@ gs_appstream_refine_app (GsPlugin *plugin,
 	return TRUE;
 }
 
+gboolean
+gs_appstream_refine_app (GsPlugin *plugin,
+			 GsApp *app,
+			 XbSilo *silo,
+			 XbNode *component,
+			 GsPluginRefineFlags refine_flags,
+			 GError **error)
+{
+	return gs_appstream_refine_app_internal (plugin, app, &silo, (silo != NULL) ? 1 : 0,
+						 component, refine_flags, error);
+}
+
+/* Like gs_appstream_refine_app(), for AppStream data split across several
+ * silos; addons and installed releases of @app are looked up in all of
+ * @silos (element-type XbSilo), not just the one @component is from */
+gboolean
+gs_appstream_refine_app_with_silos (GsPlugin *plugin,
+				    GsApp *app,
+				    GPtrArray *silos,
+				    XbNode *component,
+				    GsPluginRefineFlags refine_flags,
+				    GError **error)
+{
+	return gs_appstream_refine_app_internal (plugin, app,
+						 (XbSilo * const *) silos->pdata, silos->len,
+						 component, refine_flags, error);
+}
+
+/* An inverted index over the searchable text of every component in a silo.
+ * Each folded token maps to a posting list of the components it appears in,
+ * along with the #AsSearchTokenMatch bits of the fields it appeared in. The
+ * index is built on the first search of a silo and attached to it, so it
+ * lives exactly as long as that silo generation and is rebuilt whenever the
+ * silo is invalidated and replaced. */
 typedef struct {
-	AsSearchTokenMatch	 match_value;
-	XbQuery			*query;
-} GsAppstreamSearchHelper;
+	guint32			 idx;		/* into the components/component results */
+	guint16			 match_value;	/* bitfield of AsSearchTokenMatch */
+} GsAppstreamSearchPosting;
+
+typedef struct {
+	gchar			*token;
+	GArray			*postings;	/* (element-type GsAppstreamSearchPosting), sorted by idx */
+} GsAppstreamSearchEntry;
+
+typedef struct {
+	gchar			*guid;
+	guint			 n_components;
+	GPtrArray		*entries;	/* (element-type GsAppstreamSearchEntry), sorted by token */
+} GsAppstreamSearchIndex;
 
 static void
-gs_appstream_search_helper_free (GsAppstreamSearchHelper *helper)
+gs_appstream_silo_mutex_free (GMutex *mutex)
 {
-	g_object_unref (helper->query);
-	g_free (helper);
+	g_mutex_clear (mutex);
+	g_free (mutex);
 }
 
-static guint16
-gs_appstream_silo_search_component2 (GPtrArray *array, XbNode *component, const gchar *search)
+/* Returns a mutex attached to @silo as @key, creating it if needed, so that
+ * data built from one silo is only built once without holding up work on
+ * the other silos. It is valid for as long as @silo is. */
+static GMutex *
+gs_appstream_silo_get_mutex (XbSilo *silo, const gchar *key)
 {
-	guint16 match_value = 0;
+	GMutex *mutex = g_object_get_data (G_OBJECT (silo), key);
 
-	/* do searches */
-	for (guint i = 0; i < array->len; i++) {
-		g_autoptr(GPtrArray) n = NULL;
-		GsAppstreamSearchHelper *helper = g_ptr_array_index (array, i);
-#if LIBXMLB_CHECK_VERSION(0, 3, 0)
-		g_auto(XbQueryContext) context = XB_QUERY_CONTEXT_INIT ();
-		xb_value_bindings_bind_str (xb_query_context_get_bindings (&context), 0, search, NULL);
-		n = xb_node_query_with_context (component, helper->query, &context, NULL);
-#else
-		xb_query_bind_str (helper->query, 0, search, NULL);
-		n = xb_node_query_full (component, helper->query, NULL);
-#endif
-		if (n != NULL)
-			match_value |= helper->match_value;
+	if (mutex != NULL)
+		return mutex;
+
+	/* another thread may be doing the same */
+	mutex = g_new0 (GMutex, 1);
+	g_mutex_init (mutex);
+	if (!g_object_replace_data (G_OBJECT (silo), key, NULL, mutex,
+				    (GDestroyNotify) gs_appstream_silo_mutex_free, NULL)) {
+		gs_appstream_silo_mutex_free (mutex);
+		mutex = g_object_get_data (G_OBJECT (silo), key);
 	}
-	return match_value;
+	return mutex;
 }
 
-static guint16
-gs_appstream_silo_search_component (GPtrArray *array, XbNode *component, const gchar * const *search)
+static void
+gs_appstream_search_entry_free (GsAppstreamSearchEntry *entry)
 {
-	guint16 matches_sum = 0;
+	g_free (entry->token);
+	g_array_unref (entry->postings);
+	g_free (entry);
+}
 
-	/* do *all* search keywords match */
-	for (guint i = 0; search[i] != NULL; i++) {
-		guint tmp = gs_appstream_silo_search_component2 (array, component, search[i]);
-		if (tmp == 0)
-			return 0;
-		matches_sum |= tmp;
+static void
+gs_appstream_search_index_clear (GsAppstreamSearchIndex *search_index)
+{
+	g_free (search_index->guid);
+	g_ptr_array_unref (search_index->entries);
+}
+
+static GsAppstreamSearchIndex *
+gs_appstream_search_index_ref (GsAppstreamSearchIndex *search_index)
+{
+	return g_atomic_rc_box_acquire (search_index);
+}
+
+static void
+gs_appstream_search_index_unref (GsAppstreamSearchIndex *search_index)
+{
+	g_atomic_rc_box_release_full (search_index, (GDestroyNotify) gs_appstream_search_index_clear);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsAppstreamSearchIndex, gs_appstream_search_index_unref)
+
+static gint
+gs_appstream_search_entry_sort_cb (gconstpointer a, gconstpointer b)
+{
+	GsAppstreamSearchEntry *entry1 = *((GsAppstreamSearchEntry **) a);
+	GsAppstreamSearchEntry *entry2 = *((GsAppstreamSearchEntry **) b);
+	return strcmp (entry1->token, entry2->token);
+}
+
+static gint
+gs_appstream_search_posting_sort_cb (gconstpointer a, gconstpointer b)
+{
+	const GsAppstreamSearchPosting *posting1 = a;
+	const GsAppstreamSearchPosting *posting2 = b;
+	if (posting1->idx < posting2->idx)
+		return -1;
+	if (posting1->idx > posting2->idx)
+		return 1;
+	return 0;
+}
+
+static void
+gs_appstream_search_index_add_token (GHashTable *component_tokens,
+				     const gchar *token,
+				     guint16 match_value)
+{
+	gpointer value;
+
+	if (token == NULL || token[0] == '\0')
+		return;
+	if (g_hash_table_lookup_extended (component_tokens, token, NULL, &value)) {
+		match_value |= GPOINTER_TO_UINT (value);
+		g_hash_table_replace (component_tokens, g_strdup (token), GUINT_TO_POINTER (match_value));
+	} else {
+		g_hash_table_insert (component_tokens, g_strdup (token), GUINT_TO_POINTER (match_value));
 	}
-	return matches_sum;
 }
 
-gboolean
-gs_appstream_search (GsPlugin *plugin,
-		     XbSilo *silo,
-		     const gchar * const *values,
-		     GsAppList *list,
-		     GCancellable *cancellable,
-		     GError **error)
+/* this mirrors xb_builder_node_tokenize_text(), which is what the ~= operator
+ * matches search terms against for the tokenized elements */
+static void
+gs_appstream_search_index_add_text (GHashTable *component_tokens,
+				    const gchar *text,
+				    guint16 match_value)
 {
-	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GPtrArray) array = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_appstream_search_helper_free);
-	g_autoptr(GPtrArray) components = NULL;
+	g_auto(GStrv) tokens = NULL;
+	g_auto(GStrv) ascii_tokens = NULL;
+
+	if (text == NULL || text[0] == '\0')
+		return;
+	tokens = g_str_tokenize_and_fold (text, NULL, &ascii_tokens);
+	for (guint i = 0; tokens[i] != NULL; i++)
+		gs_appstream_search_index_add_token (component_tokens, tokens[i], match_value);
+	for (guint i = 0; ascii_tokens[i] != NULL; i++)
+		gs_appstream_search_index_add_token (component_tokens, ascii_tokens[i], match_value);
+}
+
+static GsAppstreamSearchIndex *
+gs_appstream_search_index_new (XbSilo *silo, GPtrArray *components)
+{
+	GsAppstreamSearchIndex *search_index;
+	GHashTableIter iter;
+	gpointer key, value;
+	g_autoptr(GHashTable) postings = NULL;
+	g_autoptr(GHashTable) component_tokens = NULL;
+	g_autoptr(GPtrArray) queries = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(GArray) query_match_values = g_array_new (FALSE, FALSE, sizeof (guint16));
 	g_autoptr(GTimer) timer = g_timer_new ();
 	const struct {
 		AsSearchTokenMatch	match_value;
 		const gchar		*xpath;
-	} queries[] = {
-		{ AS_SEARCH_TOKEN_MATCH_MIMETYPE,	"mimetypes/mimetype[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"pkgname[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"summary[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NAME,	"name[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_KEYWORD,	"keywords/keyword[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ID,	"id[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ID,	"launchable[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ORIGIN,	"../components[@origin~=stem(?)]" },
+	} fields[] = {
+		{ AS_SEARCH_TOKEN_MATCH_MIMETYPE,	"mimetypes/mimetype" },
+		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"pkgname" },
+		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"summary" },
+		{ AS_SEARCH_TOKEN_MATCH_NAME,	"name" },
+		{ AS_SEARCH_TOKEN_MATCH_KEYWORD,	"keywords/keyword" },
+		{ AS_SEARCH_TOKEN_MATCH_ID,	"id" },
+		{ AS_SEARCH_TOKEN_MATCH_ID,	"launchable" },
 		{ AS_SEARCH_TOKEN_MATCH_NONE,	NULL }
 	};
 
-	/* add some weighted queries */
-	for (guint i = 0; queries[i].xpath != NULL; i++) {
+	/* elements which do not appear anywhere in the silo fail to compile */
+	for (guint i = 0; fields[i].xpath != NULL; i++) {
 		g_autoptr(GError) error_query = NULL;
-		g_autoptr(XbQuery) query = xb_query_new (silo, queries[i].xpath, &error_query);
+		g_autoptr(XbQuery) query = xb_query_new (silo, fields[i].xpath, &error_query);
 		if (query != NULL) {
-			GsAppstreamSearchHelper *helper = g_new0 (GsAppstreamSearchHelper, 1);
-			helper->match_value = queries[i].match_value;
-			helper->query = g_steal_pointer (&query);
-			g_ptr_array_add (array, helper);
+			guint16 match_value = fields[i].match_value;
+			g_ptr_array_add (queries, g_steal_pointer (&query));
+			g_array_append_val (query_match_values, match_value);
 		} else {
 			g_debug ("ignoring: %s", error_query->message);
 		}
 	}
 
+	/* token → (element-type GsAppstreamSearchPosting) */
+	postings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_array_unref);
+	component_tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (guint i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		g_autoptr(XbNode) parent = NULL;
+
+		/* collect every token of this component first, so that a token
+		 * appearing in several fields gets a single posting */
+		g_hash_table_remove_all (component_tokens);
+		for (guint j = 0; j < queries->len; j++) {
+			XbQuery *query = g_ptr_array_index (queries, j);
+			guint16 match_value = g_array_index (query_match_values, guint16, j);
+			g_autoptr(GPtrArray) nodes = NULL;
+#if LIBXMLB_CHECK_VERSION(0, 3, 0)
+			nodes = xb_node_query_with_context (component, query, NULL, NULL);
+#else
+			nodes = xb_node_query_full (component, query, NULL);
+#endif
+			for (guint k = 0; nodes != NULL && k < nodes->len; k++) {
+				XbNode *n = g_ptr_array_index (nodes, k);
+				gs_appstream_search_index_add_text (component_tokens,
+								    xb_node_get_text (n),
+								    match_value);
+			}
+		}
+		parent = xb_node_get_parent (component);
+		if (parent != NULL) {
+			gs_appstream_search_index_add_text (component_tokens,
+							    xb_node_get_attr (parent, "origin"),
+							    AS_SEARCH_TOKEN_MATCH_ORIGIN);
+		}
+
+		/* components are visited in order, so each posting list
+		 * stays sorted by idx */
+		g_hash_table_iter_init (&iter, component_tokens);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			GsAppstreamSearchPosting posting = { i, GPOINTER_TO_UINT (value) };
+			GArray *array = g_hash_table_lookup (postings, key);
+			if (array == NULL) {
+				array = g_array_new (FALSE, FALSE, sizeof (GsAppstreamSearchPosting));
+				g_hash_table_insert (postings, g_strdup (key), array);
+			}
+			g_array_append_val (array, posting);
+		}
+	}
+
+	/* sort the tokens so that prefix matches are a contiguous range */
+	search_index = g_atomic_rc_box_new0 (GsAppstreamSearchIndex);
+	search_index->guid = g_strdup (xb_silo_get_guid (silo));
+	search_index->n_components = components->len;
+	search_index->entries = g_ptr_array_new_full (g_hash_table_size (postings),
+					       (GDestroyNotify) gs_appstream_search_entry_free);
+	g_hash_table_iter_init (&iter, postings);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GsAppstreamSearchEntry *entry = g_new0 (GsAppstreamSearchEntry, 1);
+		entry->token = key;
+		entry->postings = value;
+		g_hash_table_iter_steal (&iter);
+		g_ptr_array_add (search_index->entries, entry);
+	}
+	g_ptr_array_sort (search_index->entries, gs_appstream_search_entry_sort_cb);
+
+	g_debug ("search index for silo %s with %u components and %u tokens took %fms",
+		 search_index->guid, search_index->n_components, search_index->entries->len,
+		 g_timer_elapsed (timer, NULL) * 1000);
+	return search_index;
+}
+
+static GsAppstreamSearchIndex *
+gs_appstream_search_index_ensure (XbSilo *silo, GPtrArray *components)
+{
+	GsAppstreamSearchIndex *search_index;
+	GMutex *mutex = gs_appstream_silo_get_mutex (silo, "GsAppstream::search-index-mutex");
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (mutex);
+
+	search_index = g_object_get_data (G_OBJECT (silo), "GsAppstream::search-index");
+	if (search_index != NULL &&
+	    g_strcmp0 (search_index->guid, xb_silo_get_guid (silo)) == 0 &&
+	    search_index->n_components == components->len)
+		return gs_appstream_search_index_ref (search_index);
+
+	search_index = gs_appstream_search_index_new (silo, components);
+	g_object_set_data_full (G_OBJECT (silo), "GsAppstream::search-index",
+				gs_appstream_search_index_ref (search_index),
+				(GDestroyNotify) gs_appstream_search_index_unref);
+	return search_index;
+}
+
+/* returns the union of the postings of every token starting with @search */
+static GArray *
+gs_appstream_search_index_lookup (GsAppstreamSearchIndex *search_index, const gchar *search)
+{
+	GArray *result = g_array_new (FALSE, FALSE, sizeof (GsAppstreamSearchPosting));
+	g_autofree gchar *folded = g_utf8_casefold (search, -1);
+	gsize folded_len = strlen (folded);
+	guint lower = 0;
+	guint upper = search_index->entries->len;
+	guint len = 0;
+
+	if (folded_len == 0)
+		return result;
+
+	/* find the first token not sorting before the search term */
+	while (lower < upper) {
+		guint mid = lower + (upper - lower) / 2;
+		GsAppstreamSearchEntry *entry = g_ptr_array_index (search_index->entries, mid);
+		if (strcmp (entry->token, folded) < 0)
+			lower = mid + 1;
+		else
+			upper = mid;
+	}
+	for (guint i = lower; i < search_index->entries->len; i++) {
+		GsAppstreamSearchEntry *entry = g_ptr_array_index (search_index->entries, i);
+		if (strncmp (entry->token, folded, folded_len) != 0)
+			break;
+		g_array_append_vals (result, entry->postings->data, entry->postings->len);
+	}
+
+	/* merge postings of the same component from different tokens */
+	g_array_sort (result, gs_appstream_search_posting_sort_cb);
+	for (guint i = 0; i < result->len; i++) {
+		GsAppstreamSearchPosting *posting = &g_array_index (result, GsAppstreamSearchPosting, i);
+		GsAppstreamSearchPosting *last = len > 0 ? &g_array_index (result, GsAppstreamSearchPosting, len - 1) : NULL;
+		if (last != NULL && last->idx == posting->idx)
+			last->match_value |= posting->match_value;
+		else
+			g_array_index (result, GsAppstreamSearchPosting, len++) = *posting;
+	}
+	g_array_set_size (result, len);
+	return result;
+}
+
+/* keeps the postings of @matches which are also in @postings */
+static void
+gs_appstream_search_postings_intersect (GArray *matches, GArray *postings)
+{
+	guint i = 0, j = 0, len = 0;
+
+	while (i < matches->len && j < postings->len) {
+		GsAppstreamSearchPosting *posting1 = &g_array_index (matches, GsAppstreamSearchPosting, i);
+		GsAppstreamSearchPosting *posting2 = &g_array_index (postings, GsAppstreamSearchPosting, j);
+		if (posting1->idx < posting2->idx) {
+			i++;
+		} else if (posting1->idx > posting2->idx) {
+			j++;
+		} else {
+			posting1->match_value |= posting2->match_value;
+			g_array_index (matches, GsAppstreamSearchPosting, len++) = *posting1;
+			i++;
+			j++;
+		}
+	}
+	g_array_set_size (matches, len);
+}
+
+gboolean
+gs_appstream_search (GsPlugin *plugin,
+		     XbSilo *silo,
+		     const gchar * const *values,
+		     GsAppList *list,
+		     GCancellable *cancellable,
+		     GError **error)
+{
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GsAppstreamSearchIndex) search_index = NULL;
+	g_autoptr(GArray) matches = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
 	/* get all components */
 	components = xb_silo_query (silo, "components/component", 0, &error_local);
 	if (components == NULL) {
@@ -1399,9 +1697,23 @@ gs_appstream_search (GsPlugin *plugin,
 		g_propagate_error (error, g_steal_pointer (&error_local));
 		return FALSE;
 	}
-	for (guint i = 0; i < components->len; i++) {
-		XbNode *component = g_ptr_array_index (components, i);
-		guint16 match_value = gs_appstream_silo_search_component (array, component, values);
+
+	/* do *all* search keywords match */
+	search_index = gs_appstream_search_index_ensure (silo, components);
+	for (guint i = 0; values[i] != NULL; i++) {
+		g_autoptr(GArray) postings = gs_appstream_search_index_lookup (search_index, values[i]);
+		if (matches == NULL)
+			matches = g_steal_pointer (&postings);
+		else
+			gs_appstream_search_postings_intersect (matches, postings);
+		if (matches->len == 0)
+			break;
+	}
+
+	for (guint i = 0; matches != NULL && i < matches->len; i++) {
+		GsAppstreamSearchPosting *posting = &g_array_index (matches, GsAppstreamSearchPosting, i);
+		XbNode *component = g_ptr_array_index (components, posting->idx);
+		guint16 match_value = posting->match_value;
 		if (match_value != 0) {
 			g_autoptr(GsApp) app = gs_appstream_create_app (plugin, silo, component, error);
 			if (app == NULL)
@@ -1443,6 +1755,145 @@ gs_appstream_search (GsPlugin *plugin,
 	return TRUE;
 }
 
+/* A map from each desktop group, such as `Audio` or `Audio::Player`, to the
+ * IDs of the components in it. This is built in a single pass over the silo
+ * the first time its categories are counted or listed, rather than running an
+ * XPath query over every component for each desktop group of each category,
+ * and is attached to the silo in the same way as #GsAppstreamSearchIndex. */
+typedef struct {
+	gchar			*guid;
+	GHashTable		*groups;	/* desktop group : GPtrArray (element-type utf8) of component IDs */
+} GsAppstreamCategoryIndex;
+
+static void
+gs_appstream_category_index_clear (GsAppstreamCategoryIndex *category_index)
+{
+	g_free (category_index->guid);
+	g_hash_table_unref (category_index->groups);
+}
+
+static GsAppstreamCategoryIndex *
+gs_appstream_category_index_ref (GsAppstreamCategoryIndex *category_index)
+{
+	return g_atomic_rc_box_acquire (category_index);
+}
+
+static void
+gs_appstream_category_index_unref (GsAppstreamCategoryIndex *category_index)
+{
+	g_atomic_rc_box_release_full (category_index, (GDestroyNotify) gs_appstream_category_index_clear);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsAppstreamCategoryIndex, gs_appstream_category_index_unref)
+
+static void
+gs_appstream_category_index_add (GHashTable *groups,
+				 const gchar *desktop_group,
+				 const gchar *id)
+{
+	GPtrArray *ids = g_hash_table_lookup (groups, desktop_group);
+	if (ids == NULL) {
+		ids = g_ptr_array_new_with_free_func (g_free);
+		g_hash_table_insert (groups, g_strdup (desktop_group), ids);
+	}
+	g_ptr_array_add (ids, g_strdup (id));
+}
+
+static GsAppstreamCategoryIndex *
+gs_appstream_category_index_new (XbSilo *silo)
+{
+	GsAppstreamCategoryIndex *category_index;
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GPtrArray) categories = g_ptr_array_new ();
+	g_autoptr(XbQuery) query = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
+	category_index = g_atomic_rc_box_new0 (GsAppstreamCategoryIndex);
+	category_index->guid = g_strdup (xb_silo_get_guid (silo));
+	category_index->groups = g_hash_table_new_full (g_str_hash, g_str_equal,
+							g_free, (GDestroyNotify) g_ptr_array_unref);
+
+	/* these fail if there are no components, or no categories at all */
+	components = xb_silo_query (silo, "components/component", 0, NULL);
+	query = xb_query_new (silo, "categories/category", NULL);
+	if (components == NULL || query == NULL)
+		return category_index;
+
+	for (guint i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		const gchar *id = xb_node_query_text (component, "id", NULL);
+		g_autoptr(GPtrArray) nodes = NULL;
+
+		if (id == NULL)
+			continue;
+#if LIBXMLB_CHECK_VERSION(0, 3, 0)
+		nodes = xb_node_query_with_context (component, query, NULL, NULL);
+#else
+		nodes = xb_node_query_full (component, query, NULL);
+#endif
+		if (nodes == NULL)
+			continue;
+
+		g_ptr_array_set_size (categories, 0);
+		for (guint j = 0; j < nodes->len; j++) {
+			const gchar *category = xb_node_get_text (g_ptr_array_index (nodes, j));
+			if (category != NULL &&
+			    !g_ptr_array_find_with_equal_func (categories, category, g_str_equal, NULL))
+				g_ptr_array_add (categories, (gpointer) category);
+		}
+
+		/* the component is in the group of each of its categories, and
+		 * in the `Main::Sub` group of each pair of them */
+		for (guint j = 0; j < categories->len; j++) {
+			const gchar *main_category = g_ptr_array_index (categories, j);
+
+			gs_appstream_category_index_add (category_index->groups, main_category, id);
+			for (guint k = 0; k < categories->len; k++) {
+				g_autofree gchar *desktop_group = NULL;
+
+				if (k == j)
+					continue;
+				desktop_group = g_strdup_printf ("%s::%s", main_category,
+								 (const gchar *) g_ptr_array_index (categories, k));
+				gs_appstream_category_index_add (category_index->groups, desktop_group, id);
+			}
+		}
+	}
+
+	g_debug ("category index for silo %s with %u components and %u groups took %fms",
+		 category_index->guid, components->len,
+		 g_hash_table_size (category_index->groups),
+		 g_timer_elapsed (timer, NULL) * 1000);
+	return category_index;
+}
+
+static GsAppstreamCategoryIndex *
+gs_appstream_category_index_ensure (XbSilo *silo)
+{
+	GsAppstreamCategoryIndex *category_index;
+	GMutex *mutex = gs_appstream_silo_get_mutex (silo, "GsAppstream::category-index-mutex");
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (mutex);
+
+	category_index = g_object_get_data (G_OBJECT (silo), "GsAppstream::category-index");
+	if (category_index != NULL &&
+	    g_strcmp0 (category_index->guid, xb_silo_get_guid (silo)) == 0)
+		return gs_appstream_category_index_ref (category_index);
+
+	category_index = gs_appstream_category_index_new (silo);
+	g_object_set_data_full (G_OBJECT (silo), "GsAppstream::category-index",
+				gs_appstream_category_index_ref (category_index),
+				(GDestroyNotify) gs_appstream_category_index_unref);
+	return category_index;
+}
+
+/* returns (transfer none) (nullable) (element-type utf8) */
+static GPtrArray *
+gs_appstream_category_index_lookup (GsAppstreamCategoryIndex *category_index,
+				    const gchar *desktop_group)
+{
+	return g_hash_table_lookup (category_index->groups, desktop_group);
+}
+
 gboolean
 gs_appstream_add_category_apps (GsPlugin *plugin,
 				XbSilo *silo,
@@ -1452,93 +1903,31 @@ gs_appstream_add_category_apps (GsPlugin *plugin,
 				GError **error)
 {
 	GPtrArray *desktop_groups;
-	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GsAppstreamCategoryIndex) category_index = NULL;
 
 	desktop_groups = gs_category_get_desktop_groups (category);
 	if (desktop_groups->len == 0) {
 		g_warning ("no desktop_groups for %s", gs_category_get_id (category));
 		return TRUE;
 	}
+
+	category_index = gs_appstream_category_index_ensure (silo);
 	for (guint j = 0; j < desktop_groups->len; j++) {
 		const gchar *desktop_group = g_ptr_array_index (desktop_groups, j);
-		g_autofree gchar *xpath = NULL;
-		g_auto(GStrv) split = g_strsplit (desktop_group, "::", -1);
-		g_autoptr(GPtrArray) components = NULL;
-
-		/* generate query */
-		if (g_strv_length (split) == 1) {
-			xpath = g_strdup_printf ("components/component/categories/"
-						 "category[text()='%s']/../..",
-						 split[0]);
-		} else if (g_strv_length (split) == 2) {
-			xpath = g_strdup_printf ("components/component/categories/"
-						 "category[text()='%s']/../"
-						 "category[text()='%s']/../..",
-						 split[0], split[1]);
-		}
-		components = xb_silo_query (silo, xpath, 0, &error_local);
-		if (components == NULL) {
-			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-				return TRUE;
-			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-				return TRUE;
-			g_propagate_error (error, g_steal_pointer (&error_local));
-			return FALSE;
-		}
+		GPtrArray *ids = gs_appstream_category_index_lookup (category_index, desktop_group);
 
 		/* create app */
-		for (guint i = 0; i < components->len; i++) {
-			XbNode *component = g_ptr_array_index (components, i);
-			g_autoptr(GsApp) app = NULL;
-			const gchar *id = xb_node_query_text (component, "id", NULL);
-			if (id == NULL)
-				continue;
-			app = gs_app_new (id);
+		for (guint i = 0; ids != NULL && i < ids->len; i++) {
+			g_autoptr(GsApp) app = gs_app_new (g_ptr_array_index (ids, i));
 			gs_app_set_metadata (app, "GnomeSoftware::Creator",
 					     gs_plugin_get_name (plugin));
 			gs_app_add_quirk (app, GS_APP_QUIRK_IS_WILDCARD);
 			gs_app_list_add (list, app);
 		}
-
 	}
 	return TRUE;
 }
 
-static guint
-gs_appstream_count_component_for_groups (XbSilo      *silo,
-                                         const gchar *desktop_group)
-{
-	guint limit = 10;
-	g_autofree gchar *xpath = NULL;
-	g_auto(GStrv) split = g_strsplit (desktop_group, "::", -1);
-	g_autoptr(GPtrArray) array = NULL;
-	g_autoptr(GError) error_local = NULL;
-
-	if (g_strv_length (split) == 1) { /* "all" group for a parent category */
-		xpath = g_strdup_printf ("components/component/categories/"
-					 "category[text()='%s']/../..",
-					 split[0]);
-	} else if (g_strv_length (split) == 2) {
-		xpath = g_strdup_printf ("components/component/categories/"
-					 "category[text()='%s']/../"
-					 "category[text()='%s']/../..",
-					 split[0], split[1]);
-	} else {
-		return 0;
-	}
-
-	array = xb_silo_query (silo, xpath, limit, &error_local);
-	if (array == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return 0;
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-			return 0;
-		g_warning ("%s", error_local->message);
-		return 0;
-	}
-	return array->len;
-}
-
 /* we're not actually adding categories here, we're just setting the number of
  * applications available in each category */
 gboolean
@@ -1547,16 +1936,24 @@ gs_appstream_add_categories (XbSilo *silo,
 			     GCancellable *cancellable,
 			     GError **error)
 {
+	g_autoptr(GsAppstreamCategoryIndex) category_index = gs_appstream_category_index_ensure (silo);
+
 	for (guint j = 0; j < list->len; j++) {
 		GsCategory *parent = GS_CATEGORY (g_ptr_array_index (list, j));
 		GPtrArray *children = gs_category_get_children (parent);
 
+		/* the counts are exact now, so avoid a notification for
+		 * every app */
+		g_object_freeze_notify (G_OBJECT (parent));
 		for (guint i = 0; i < children->len; i++) {
 			GsCategory *cat = g_ptr_array_index (children, i);
 			GPtrArray *groups = gs_category_get_desktop_groups (cat);
+
+			g_object_freeze_notify (G_OBJECT (cat));
 			for (guint k = 0; k < groups->len; k++) {
 				const gchar *group = g_ptr_array_index (groups, k);
-				guint cnt = gs_appstream_count_component_for_groups (silo, group);
+				GPtrArray *ids = gs_appstream_category_index_lookup (category_index, group);
+				guint cnt = (ids != NULL) ? ids->len : 0;
 				for (guint l = 0; l < cnt; l++) {
 					gs_category_increment_size (parent);
 					if (children->len > 1) {
@@ -1566,8 +1963,9 @@ gs_appstream_add_categories (XbSilo *silo,
 					}
 				}
 			}
+			g_object_thaw_notify (G_OBJECT (cat));
 		}
-		continue;
+		g_object_thaw_notify (G_OBJECT (parent));
 	}
 	return TRUE;
 }
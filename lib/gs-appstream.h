@@ -23,6 +23,12 @@ gboolean	 gs_appstream_refine_app		(GsPlugin	*plugin,
 							 XbNode		*component,
 							 GsPluginRefineFlags flags,
 							 GError		**error);
+gboolean	 gs_appstream_refine_app_with_silos	(GsPlugin	*plugin,
+							 GsApp		*app,
+							 GPtrArray	*silos,
+							 XbNode		*component,
+							 GsPluginRefineFlags flags,
+							 GError		**error);
 gboolean	 gs_appstream_search			(GsPlugin	*plugin,
 							 XbSilo		*silo,
 							 const gchar * const *values,
@@ -32,7 +32,7 @@ struct _GsCategory
 
 	GPtrArray	*desktop_groups;  /* potentially NULL if empty */
 	GsCategory	*parent;
-	guint		 size;
+	guint		 size;  /* (atomic) */
 	GPtrArray	*children;  /* potentially NULL if empty */
 };
 
@@ -119,7 +119,7 @@ gs_category_get_size (GsCategory *category)
 	if (category->parent != NULL && g_str_equal (gs_category_get_id (category), "all"))
 		return gs_category_get_size (category->parent);
 
-	return category->size;
+	return g_atomic_int_get (&category->size);
 }
 
 /**
@@ -137,10 +137,10 @@ gs_category_set_size (GsCategory *category, guint size)
 {
 	g_return_if_fail (GS_IS_CATEGORY (category));
 
-	if (size == category->size)
+	if (size == (guint) g_atomic_int_get (&category->size))
 		return;
 
-	category->size = size;
+	g_atomic_int_set (&category->size, size);
 	g_object_notify_by_pspec (G_OBJECT (category), obj_props[PROP_SIZE]);
 }
 
@@ -150,6 +150,8 @@ gs_category_set_size (GsCategory *category, guint size)
  *
  * Adds one to the size count if an application is available
  *
+ * This is safe to call from several threads at once.
+ *
  * Since: 3.22
  **/
 void
@@ -157,7 +159,7 @@ gs_category_increment_size (GsCategory *category)
 {
 	g_return_if_fail (GS_IS_CATEGORY (category));
 
-	category->size++;
+	g_atomic_int_inc (&category->size);
 	g_object_notify_by_pspec (G_OBJECT (category), obj_props[PROP_SIZE]);
 }
 
@@ -11,19 +11,29 @@
 
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
+#include <json-glib/json-glib.h>
 #include <locale.h>
+#include <math.h>
 
 #include "gnome-software-private.h"
 
 #include "gs-debug.h"
+#include "gs-profiler.h"
 
 typedef struct {
 	GsPluginLoader	*plugin_loader;
 	guint64		 refine_flags;
 	guint		 max_results;
 	gboolean	 interactive;
+	gchar		**plugin_allowlist;
+	gchar		**plugin_blocklist;
 } GsCmdSelf;
 
+typedef struct {
+	GMutex		 mutex;
+	GHashTable	*plugin_timings;	/* plugin name : GHashTable (stage : GArray of gdouble ms) */
+} GsCmdBenchmark;
+
 static void
 gs_cmd_show_results_apps (GsAppList *list)
 {
@@ -196,6 +206,362 @@ gs_cmd_prompt_for_number (guint maxnum)
 	return answer;
 }
 
+static GsCategory *
+gs_cmd_lookup_category (GsPluginLoader *plugin_loader, const gchar *id)
+{
+	GsCategoryManager *manager = gs_plugin_loader_get_category_manager (plugin_loader);
+	GsCategory *child;
+	g_autoptr(GsCategory) parent = NULL;
+	g_auto(GStrv) split = NULL;
+
+	split = g_strsplit (id, "/", 2);
+	parent = gs_category_manager_lookup (manager, split[0]);
+	if (parent == NULL || split[1] == NULL)
+		return g_steal_pointer (&parent);
+
+	child = gs_category_find_child (parent, split[1]);
+	return (child != NULL) ? g_object_ref (child) : NULL;
+}
+
+static GsPluginLoader *
+gs_cmd_plugin_loader_new (GsCmdSelf *self, GError **error)
+{
+	g_autoptr(GsPluginLoader) plugin_loader = gs_plugin_loader_new ();
+
+	if (g_file_test (LOCALPLUGINDIR, G_FILE_TEST_EXISTS))
+		gs_plugin_loader_add_location (plugin_loader, LOCALPLUGINDIR);
+	if (!gs_plugin_loader_setup (plugin_loader,
+				     (const gchar * const *) self->plugin_allowlist,
+				     (const gchar * const *) self->plugin_blocklist,
+				     NULL,
+				     error)) {
+		g_prefix_error (error, "Failed to setup plugins: ");
+		return NULL;
+	}
+	gs_plugin_loader_dump_state (plugin_loader);
+
+	/* ensure that at least some metadata of any age is present, and also
+	 * spin up the plugins enough as to prime caches */
+	if (g_getenv ("GS_CMD_NO_INITIAL_REFRESH") == NULL) {
+		g_autoptr(GsPluginJob) plugin_job = NULL;
+		GsPluginRefreshMetadataFlags refresh_metadata_flags = GS_PLUGIN_REFRESH_METADATA_FLAGS_NONE;
+
+		if (self->interactive)
+			refresh_metadata_flags |= GS_PLUGIN_REFRESH_METADATA_FLAGS_INTERACTIVE;
+
+		plugin_job = gs_plugin_job_refresh_metadata_new (G_MAXUINT64, refresh_metadata_flags);
+		if (!gs_plugin_loader_job_action (plugin_loader, plugin_job, NULL, error)) {
+			g_prefix_error (error, "Failed to refresh plugins: ");
+			return NULL;
+		}
+	}
+
+	return g_steal_pointer (&plugin_loader);
+}
+
+static GHashTable *
+gs_cmd_benchmark_timings_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal,
+				      g_free, (GDestroyNotify) g_array_unref);
+}
+
+static void
+gs_cmd_benchmark_add_timing (GHashTable *timings, const gchar *key, gdouble value_ms)
+{
+	GArray *values = g_hash_table_lookup (timings, key);
+	if (values == NULL) {
+		values = g_array_new (FALSE, FALSE, sizeof (gdouble));
+		g_hash_table_insert (timings, g_strdup (key), values);
+	}
+	g_array_append_val (values, value_ms);
+}
+
+/* called from any thread which runs a plugin */
+static void
+gs_cmd_benchmark_mark_cb (const gchar *name,
+			  const gchar *message,
+			  gint64       begin_time_nsec,
+			  gint64       duration_nsec,
+			  gpointer     user_data)
+{
+	GsCmdBenchmark *benchmark = user_data;
+	GHashTable *timings;
+	const gchar *plugin_name;
+	const gchar *stage;
+	g_auto(GStrv) split = NULL;
+
+	/* only the per-plugin marks are interesting, which are named
+	 * `vfunc:<action>:<plugin>`, `refine:<plugin>` or
+	 * `list-installed-apps:<plugin>` */
+	split = g_strsplit (name, ":", -1);
+	if (g_strv_length (split) == 3 && g_strcmp0 (split[0], "vfunc") == 0) {
+		stage = split[1];
+		plugin_name = split[2];
+	} else if (g_strv_length (split) == 2 &&
+		   (g_strcmp0 (split[0], "refine") == 0 ||
+		    g_strcmp0 (split[0], "list-installed-apps") == 0)) {
+		stage = split[0];
+		plugin_name = split[1];
+	} else {
+		return;
+	}
+
+	g_mutex_lock (&benchmark->mutex);
+	timings = g_hash_table_lookup (benchmark->plugin_timings, plugin_name);
+	if (timings == NULL) {
+		timings = gs_cmd_benchmark_timings_new ();
+		g_hash_table_insert (benchmark->plugin_timings, g_strdup (plugin_name), timings);
+	}
+	gs_cmd_benchmark_add_timing (timings, stage, duration_nsec / 1000000.0);
+	g_mutex_unlock (&benchmark->mutex);
+}
+
+static gint
+gs_cmd_benchmark_compare_double (gconstpointer a, gconstpointer b)
+{
+	gdouble value_a = *((const gdouble *) a);
+	gdouble value_b = *((const gdouble *) b);
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+/* nearest-rank percentile of an already sorted array */
+static gdouble
+gs_cmd_benchmark_percentile (GArray *values, guint percentile)
+{
+	guint rank = (guint) ceil (values->len * percentile / 100.0);
+	return g_array_index (values, gdouble, MAX (rank, 1) - 1);
+}
+
+static void
+gs_cmd_benchmark_add_stats (JsonBuilder *builder, GHashTable *timings)
+{
+	g_autoptr(GList) keys = g_hash_table_get_keys (timings);
+
+	keys = g_list_sort (keys, (GCompareFunc) g_strcmp0);
+	json_builder_begin_object (builder);
+	for (GList *l = keys; l != NULL; l = l->next) {
+		GArray *values = g_hash_table_lookup (timings, l->data);
+
+		g_array_sort (values, gs_cmd_benchmark_compare_double);
+		json_builder_set_member_name (builder, l->data);
+		json_builder_begin_object (builder);
+		json_builder_set_member_name (builder, "count");
+		json_builder_add_int_value (builder, values->len);
+		json_builder_set_member_name (builder, "min_ms");
+		json_builder_add_double_value (builder, g_array_index (values, gdouble, 0));
+		json_builder_set_member_name (builder, "p50_ms");
+		json_builder_add_double_value (builder, gs_cmd_benchmark_percentile (values, 50));
+		json_builder_set_member_name (builder, "p90_ms");
+		json_builder_add_double_value (builder, gs_cmd_benchmark_percentile (values, 90));
+		json_builder_set_member_name (builder, "p99_ms");
+		json_builder_add_double_value (builder, gs_cmd_benchmark_percentile (values, 99));
+		json_builder_set_member_name (builder, "max_ms");
+		json_builder_add_double_value (builder, g_array_index (values, gdouble, values->len - 1));
+		json_builder_end_object (builder);
+	}
+	json_builder_end_object (builder);
+}
+
+/* runs one line of a benchmark script, which is a command followed by its
+ * argument, e.g. `search gimp` or `refine org.gnome.Maps org.gnome.Todo` */
+static gboolean
+gs_cmd_benchmark_run_line (GsCmdSelf *self, const gchar *command, const gchar *arg, GError **error)
+{
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	g_autoptr(GsAppList) list = NULL;
+
+	if (g_strcmp0 (command, "search") == 0 && arg != NULL) {
+		plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_SEARCH,
+						 "search", arg,
+						 "refine-flags", self->refine_flags,
+						 "max-results", self->max_results,
+						 "interactive", self->interactive,
+						 NULL);
+	} else if (g_strcmp0 (command, "get-categories") == 0) {
+		g_autoptr(GPtrArray) categories = NULL;
+		plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_GET_CATEGORIES,
+						 "refine-flags", self->refine_flags,
+						 "max-results", self->max_results,
+						 "interactive", self->interactive,
+						 NULL);
+		categories = gs_plugin_loader_job_get_categories (self->plugin_loader,
+								 plugin_job,
+								 NULL, error);
+		return (categories != NULL);
+	} else if (g_strcmp0 (command, "get-category-apps") == 0 && arg != NULL) {
+		g_autoptr(GsCategory) category = gs_cmd_lookup_category (self->plugin_loader, arg);
+		if (category == NULL) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "Could not find category ‘%s’", arg);
+			return FALSE;
+		}
+		plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_GET_CATEGORY_APPS,
+						 "category", category,
+						 "refine-flags", self->refine_flags,
+						 "max-results", self->max_results,
+						 "interactive", self->interactive,
+						 NULL);
+	} else if (g_strcmp0 (command, "installed") == 0) {
+		GsPluginListInstalledAppsFlags installed_flags = GS_PLUGIN_LIST_INSTALLED_APPS_FLAGS_NONE;
+		if (self->interactive)
+			installed_flags |= GS_PLUGIN_LIST_INSTALLED_APPS_FLAGS_INTERACTIVE;
+		plugin_job = gs_plugin_job_list_installed_apps_new (self->refine_flags, self->max_results, GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT, installed_flags);
+	} else if (g_strcmp0 (command, "updates") == 0) {
+		plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_GET_UPDATES,
+						 "refine-flags", self->refine_flags,
+						 "max-results", self->max_results,
+						 "interactive", self->interactive,
+						 NULL);
+	} else if (g_strcmp0 (command, "refine") == 0 && arg != NULL) {
+		g_auto(GStrv) ids = g_strsplit_set (arg, " \t", -1);
+		g_autoptr(GsAppList) refine_list = gs_app_list_new ();
+
+		/* use new apps each time, so the results are not just
+		 * already set on the apps from the previous iteration */
+		for (guint i = 0; ids[i] != NULL; i++) {
+			g_autoptr(GsApp) app = NULL;
+			if (ids[i][0] == '\0')
+				continue;
+			app = gs_app_new (ids[i]);
+			gs_app_list_add (refine_list, app);
+		}
+		plugin_job = gs_plugin_job_refine_new (refine_list, self->refine_flags);
+		return gs_plugin_loader_job_action (self->plugin_loader, plugin_job,
+						    NULL, error);
+	} else {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "Did not recognise benchmark command ‘%s’, use "
+			     "'search TERM', 'get-categories', "
+			     "'get-category-apps ID', 'installed', 'updates' or "
+			     "'refine ID…'", command);
+		return FALSE;
+	}
+
+	list = gs_plugin_loader_job_process (self->plugin_loader, plugin_job, NULL, error);
+	return (list != NULL);
+}
+
+static gboolean
+gs_cmd_benchmark_run_script (GsCmdSelf *self, gchar **lines, GHashTable *action_timings, GError **error)
+{
+	for (guint i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) split = NULL;
+		gint64 begin_time_usec;
+
+		/* skip blank lines and comments */
+		if (lines[i][0] == '\0' || lines[i][0] == '#')
+			continue;
+
+		split = g_strsplit (lines[i], " ", 2);
+		if (split[1] != NULL)
+			g_strstrip (split[1]);
+
+		begin_time_usec = g_get_monotonic_time ();
+		if (!gs_cmd_benchmark_run_line (self, split[0], split[1], error)) {
+			g_prefix_error (error, "Failed to run ‘%s’: ", lines[i]);
+			return FALSE;
+		}
+		if (action_timings != NULL) {
+			gs_cmd_benchmark_add_timing (action_timings, split[0],
+						     (g_get_monotonic_time () - begin_time_usec) / 1000.0);
+		}
+	}
+
+	return TRUE;
+}
+
+/* Runs the commands in @filename @n_iterations times, and prints latency
+ * percentiles for each command and for each plugin vfunc as JSON. With @cold
+ * a new plugin loader is set up for each iteration; otherwise the script is
+ * run once beforehand to warm up the plugins’ caches. */
+static gboolean
+gs_cmd_benchmark (GsCmdSelf *self, const gchar *filename, guint n_iterations, gboolean cold, GError **error)
+{
+	GsCmdBenchmark benchmark = { 0, };
+	gboolean ret = TRUE;
+	g_autofree gchar *script = NULL;
+	g_autofree gchar *json = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(GHashTable) action_timings = gs_cmd_benchmark_timings_new ();
+	g_autoptr(GHashTable) plugin_timings = NULL;
+	g_autoptr(GList) plugin_names = NULL;
+	g_autoptr(JsonBuilder) builder = NULL;
+	g_autoptr(JsonGenerator) json_generator = NULL;
+	g_autoptr(JsonNode) json_root = NULL;
+
+	if (!g_file_get_contents (filename, &script, NULL, error))
+		return FALSE;
+	lines = g_strsplit (script, "\n", -1);
+	for (guint i = 0; lines[i] != NULL; i++)
+		g_strstrip (lines[i]);
+
+	if (!cold && !gs_cmd_benchmark_run_script (self, lines, NULL, error))
+		return FALSE;
+
+	plugin_timings = g_hash_table_new_full (g_str_hash, g_str_equal,
+						g_free, (GDestroyNotify) g_hash_table_unref);
+	g_mutex_init (&benchmark.mutex);
+	benchmark.plugin_timings = plugin_timings;
+	gs_profiler_set_mark_func (gs_cmd_benchmark_mark_cb, &benchmark);
+
+	for (guint i = 0; i < n_iterations && ret; i++) {
+		/* set up the new loader before dropping the old one, so the
+		 * profiler stays open */
+		if (cold && i > 0) {
+			g_autoptr(GsPluginLoader) plugin_loader = NULL;
+
+			gs_profiler_set_mark_func (NULL, NULL);
+			plugin_loader = gs_cmd_plugin_loader_new (self, error);
+			gs_profiler_set_mark_func (gs_cmd_benchmark_mark_cb, &benchmark);
+			if (plugin_loader == NULL) {
+				ret = FALSE;
+				break;
+			}
+			g_set_object (&self->plugin_loader, plugin_loader);
+		}
+		ret = gs_cmd_benchmark_run_script (self, lines, action_timings, error);
+	}
+
+	gs_profiler_set_mark_func (NULL, NULL);
+	g_mutex_clear (&benchmark.mutex);
+	if (!ret)
+		return FALSE;
+
+	builder = json_builder_new ();
+	json_builder_begin_object (builder);
+	json_builder_set_member_name (builder, "iterations");
+	json_builder_add_int_value (builder, n_iterations);
+	json_builder_set_member_name (builder, "cold");
+	json_builder_add_boolean_value (builder, cold);
+	json_builder_set_member_name (builder, "actions");
+	gs_cmd_benchmark_add_stats (builder, action_timings);
+	json_builder_set_member_name (builder, "plugins");
+	json_builder_begin_object (builder);
+	plugin_names = g_hash_table_get_keys (plugin_timings);
+	plugin_names = g_list_sort (plugin_names, (GCompareFunc) g_strcmp0);
+	for (GList *l = plugin_names; l != NULL; l = l->next) {
+		json_builder_set_member_name (builder, l->data);
+		gs_cmd_benchmark_add_stats (builder, g_hash_table_lookup (plugin_timings, l->data));
+	}
+	json_builder_end_object (builder);
+	json_builder_end_object (builder);
+
+	/* export as a string */
+	json_root = json_builder_get_root (builder);
+	json_generator = json_generator_new ();
+	json_generator_set_pretty (json_generator, TRUE);
+	json_generator_set_root (json_generator, json_root);
+	json = json_generator_to_data (json_generator, NULL);
+	g_print ("%s\n", json);
+
+	return TRUE;
+}
+
 static gboolean
 gs_cmd_action_exec (GsCmdSelf *self, GsPluginAction action, const gchar *name, GError **error)
 {
@@ -280,6 +646,8 @@ gs_cmd_self_free (GsCmdSelf *self)
 {
 	if (self->plugin_loader != NULL)
 		g_object_unref (self->plugin_loader);
+	g_strfreev (self->plugin_allowlist);
+	g_strfreev (self->plugin_blocklist);
 	g_free (self);
 }
 
@@ -289,6 +657,7 @@ int
 main (int argc, char **argv)
 {
 	g_autoptr(GOptionContext) context = NULL;
+	gboolean cold = FALSE;
 	gboolean prefer_local = FALSE;
 	gboolean ret;
 	gboolean show_results = FALSE;
@@ -296,8 +665,6 @@ main (int argc, char **argv)
 	gint i;
 	guint64 cache_age_secs = 0;
 	gint repeat = 1;
-	g_auto(GStrv) plugin_blocklist = NULL;
-	g_auto(GStrv) plugin_allowlist = NULL;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GsAppList) list = NULL;
 	g_autoptr(GPtrArray) categories = NULL;
@@ -329,6 +696,8 @@ main (int argc, char **argv)
 		  "Show verbose debugging information", NULL },
 		{ "interactive", 'i', 0, G_OPTION_ARG_NONE, &self->interactive,
 		  "Allow interactive authentication", NULL },
+		{ "cold", '\0', 0, G_OPTION_ARG_NONE, &cold,
+		  "Benchmark with a new plugin loader for each repeat", NULL },
 		{ NULL}
 	};
 
@@ -362,41 +731,15 @@ main (int argc, char **argv)
 	}
 
 	/* load plugins */
-	self->plugin_loader = gs_plugin_loader_new ();
-	if (g_file_test (LOCALPLUGINDIR, G_FILE_TEST_EXISTS))
-		gs_plugin_loader_add_location (self->plugin_loader, LOCALPLUGINDIR);
 	if (plugin_allowlist_str != NULL)
-		plugin_allowlist = g_strsplit (plugin_allowlist_str, ",", -1);
+		self->plugin_allowlist = g_strsplit (plugin_allowlist_str, ",", -1);
 	if (plugin_blocklist_str != NULL)
-		plugin_blocklist = g_strsplit (plugin_blocklist_str, ",", -1);
-	ret = gs_plugin_loader_setup (self->plugin_loader,
-				      (const gchar * const *) plugin_allowlist,
-				      (const gchar * const *) plugin_blocklist,
-				      NULL,
-				      &error);
-	if (!ret) {
-		g_print ("Failed to setup plugins: %s\n", error->message);
+		self->plugin_blocklist = g_strsplit (plugin_blocklist_str, ",", -1);
+	self->plugin_loader = gs_cmd_plugin_loader_new (self, &error);
+	if (self->plugin_loader == NULL) {
+		g_print ("%s\n", error->message);
 		return EXIT_FAILURE;
 	}
-	gs_plugin_loader_dump_state (self->plugin_loader);
-
-	/* ensure that at least some metadata of any age is present, and also
-	 * spin up the plugins enough as to prime caches */
-	if (g_getenv ("GS_CMD_NO_INITIAL_REFRESH") == NULL) {
-		g_autoptr(GsPluginJob) plugin_job = NULL;
-		GsPluginRefreshMetadataFlags refresh_metadata_flags = GS_PLUGIN_REFRESH_METADATA_FLAGS_NONE;
-
-		if (self->interactive)
-			refresh_metadata_flags |= GS_PLUGIN_REFRESH_METADATA_FLAGS_INTERACTIVE;
-
-		plugin_job = gs_plugin_job_refresh_metadata_new (G_MAXUINT64, refresh_metadata_flags);
-		ret = gs_plugin_loader_job_action (self->plugin_loader, plugin_job,
-						    NULL, &error);
-		if (!ret) {
-			g_print ("Failed to refresh plugins: %s\n", error->message);
-			return EXIT_FAILURE;
-		}
-	}
 
 	/* do action */
 	if (argc == 2 && g_strcmp0 (argv[1], "installed") == 0) {
@@ -656,20 +999,7 @@ main (int argc, char **argv)
 			}
 		}
 	} else if (argc == 3 && g_strcmp0 (argv[1], "get-category-apps") == 0) {
-		g_autoptr(GsCategory) category_owned = NULL;
-		GsCategory *category = NULL;
-		g_auto(GStrv) split = NULL;
-		GsCategoryManager *manager = gs_plugin_loader_get_category_manager (self->plugin_loader);
-
-		split = g_strsplit (argv[2], "/", 2);
-		if (g_strv_length (split) == 1) {
-			category_owned = gs_category_manager_lookup (manager, split[0]);
-			category = category_owned;
-		} else {
-			g_autoptr(GsCategory) parent = gs_category_manager_lookup (manager, split[0]);
-			if (parent != NULL)
-				category = gs_category_find_child (parent, split[1]);
-		}
+		g_autoptr(GsCategory) category = gs_cmd_lookup_category (self->plugin_loader, argv[2]);
 
 		if (category == NULL) {
 			g_printerr ("Error: Could not find category ‘%s’\n", argv[2]);
@@ -702,6 +1032,8 @@ main (int argc, char **argv)
 		plugin_job = gs_plugin_job_refresh_metadata_new (cache_age_secs, refresh_metadata_flags);
 		ret = gs_plugin_loader_job_action (self->plugin_loader, plugin_job,
 						    NULL, &error);
+	} else if (argc == 3 && g_strcmp0 (argv[1], "benchmark") == 0) {
+		ret = gs_cmd_benchmark (self, argv[2], MAX (repeat, 1), cold, &error);
 	} else if (argc >= 1 && g_strcmp0 (argv[1], "user-hash") == 0) {
 		g_autofree gchar *user_hash = gs_utils_get_user_hash (&error);
 		if (user_hash == NULL) {
@@ -719,7 +1051,7 @@ main (int argc, char **argv)
 				     "'updates', 'popular', 'get-categories', "
 				     "'get-category-apps', 'get-alternates', 'filename-to-app', "
 				     "'action install', 'action remove', "
-				     "'sources', 'refresh', 'launch' or 'search'");
+				     "'sources', 'refresh', 'launch', 'benchmark' or 'search'");
 	}
 	if (!ret) {
 		g_print ("Failed: %s\n", error->message);
@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2021 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "gs-key-colors.h"
+
+G_BEGIN_DECLS
+
+/**
+ * GsKeyColorsImpl:
+ * @GS_KEY_COLORS_IMPL_AUTO:	Fastest implementation supported by the CPU
+ * @GS_KEY_COLORS_IMPL_SCALAR:	Portable scalar implementation
+ * @GS_KEY_COLORS_IMPL_SSE2:	SSE2 implementation, x86 only
+ * @GS_KEY_COLORS_IMPL_AVX2:	AVX2 implementation, x86 only
+ *
+ * Implementations of the k-means kernels used by gs_calculate_key_colors().
+ **/
+typedef enum {
+	GS_KEY_COLORS_IMPL_AUTO,
+	GS_KEY_COLORS_IMPL_SCALAR,
+	GS_KEY_COLORS_IMPL_SSE2,
+	GS_KEY_COLORS_IMPL_AVX2,
+	GS_KEY_COLORS_IMPL_LAST  /*< skip >*/
+} GsKeyColorsImpl;
+
+gboolean	 gs_key_colors_set_impl		(GsKeyColorsImpl impl);
+
+G_END_DECLS
@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2021 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* Vectorised k-means kernels for gs-key-colors.c, which includes this once
+ * for each vector width after defining K_MEANS_LANES, K_MEANS_SUFFIX and
+ * K_MEANS_TARGET. It is not a standalone header.
+ *
+ * Each lane holds one #ClusterPixel8, with red in the low byte and the
+ * cluster in the high byte. Pixels which don’t fill a whole vector are
+ * handed to the scalar kernels. */
+
+#define K_MEANS_CONCAT_(a, b) a ## _ ## b
+#define K_MEANS_CONCAT(a, b) K_MEANS_CONCAT_ (a, b)
+#define K_MEANS_FN(name) K_MEANS_CONCAT (name, K_MEANS_SUFFIX)
+#define K_MEANS_ATTRIBUTES __attribute__ ((target (K_MEANS_TARGET)))
+
+#define VecI32 K_MEANS_FN (VecI32)
+#define VecF32 K_MEANS_FN (VecF32)
+
+typedef gint32 VecI32 __attribute__ ((vector_size (K_MEANS_LANES * sizeof (gint32))));
+typedef gfloat VecF32 __attribute__ ((vector_size (K_MEANS_LANES * sizeof (gfloat))));
+
+/* vectors are only passed by pointer, as passing them by value changes the
+ * ABI depending on whether AVX is enabled */
+K_MEANS_ATTRIBUTES static inline gint32
+K_MEANS_FN (vec_sum) (const VecI32 *v)
+{
+	gint32 sum = 0;
+	for (guint i = 0; i < K_MEANS_LANES; i++)
+		sum += (*v)[i];
+	return sum;
+}
+
+K_MEANS_ATTRIBUTES static void
+K_MEANS_FN (accumulate) (const ClusterPixel8 *pixels,
+                         gsize                n_pixels,
+                         CentroidAccumulator *accumulators,
+                         gsize                n_accumulators)
+{
+	gsize n_vec = n_pixels - n_pixels % K_MEANS_LANES;
+
+	for (gsize k = 0; k < n_accumulators; k++) {
+		VecI32 red = { 0, }, green = { 0, }, blue = { 0, }, n_members = { 0, };
+
+		for (gsize i = 0; i < n_vec; i += K_MEANS_LANES) {
+			VecI32 v, member;
+
+			memcpy (&v, &pixels[i], sizeof (v));
+			member = ((v >> 24) & 0xff) == (gint32) k;
+			red += v & 0xff & member;
+			green += (v >> 8) & 0xff & member;
+			blue += (v >> 16) & 0xff & member;
+			n_members -= member;
+		}
+
+		accumulators[k].red += K_MEANS_FN (vec_sum) (&red);
+		accumulators[k].green += K_MEANS_FN (vec_sum) (&green);
+		accumulators[k].blue += K_MEANS_FN (vec_sum) (&blue);
+		accumulators[k].n_members += K_MEANS_FN (vec_sum) (&n_members);
+	}
+
+	accumulate_scalar (pixels + n_vec, n_pixels - n_vec, accumulators, n_accumulators);
+}
+
+/* Returns the number of pixels whose cluster changed. */
+K_MEANS_ATTRIBUTES static guint
+K_MEANS_FN (assign) (ClusterPixel8 *pixels,
+                     gsize          n_pixels,
+                     const Pixel8  *cluster_centres,
+                     gsize          n_cluster_centres)
+{
+	gsize n_vec = n_pixels - n_pixels % K_MEANS_LANES;
+	VecI32 n_changed = { 0, };
+
+	for (gsize i = 0; i < n_vec; i += K_MEANS_LANES) {
+		VecI32 v, red, green, blue, cluster, valid;
+		VecI32 nearest = { 0, };
+		VecF32 nearest_distance = { 0, };
+
+		memcpy (&v, &pixels[i], sizeof (v));
+		red = v & 0xff;
+		green = (v >> 8) & 0xff;
+		blue = (v >> 16) & 0xff;
+		cluster = (v >> 24) & 0xff;
+
+		/* Same tie-breaking as nearest_cluster(): the first of several
+		 * equidistant clusters wins.
+		 *
+		 * SSE2 can’t multiply 32-bit integers lane-wise, so square the
+		 * differences as floats. The results are exact, as they are
+		 * well below 2^24. */
+		for (gsize k = 0; k < n_cluster_centres; k++) {
+			VecF32 dr = __builtin_convertvector (red - cluster_centres[k].red, VecF32);
+			VecF32 dg = __builtin_convertvector (green - cluster_centres[k].green, VecF32);
+			VecF32 db = __builtin_convertvector (blue - cluster_centres[k].blue, VecF32);
+			VecF32 distance = dr * dr + dg * dg + db * db;
+
+			if (k == 0) {
+				nearest_distance = distance;
+			} else {
+				VecI32 closer = distance < nearest_distance;
+				VecI32 index = { 0, };
+
+				index += (gint32) k;
+				nearest = vec_select (closer, index, nearest);
+				nearest_distance = (VecF32) vec_select (closer, (VecI32) distance, (VecI32) nearest_distance);
+			}
+		}
+
+		/* transparent pixels keep their out-of-range cluster */
+		valid = cluster < (gint32) n_cluster_centres;
+		nearest = vec_select (valid, nearest, cluster);
+		n_changed -= valid & (nearest != cluster);
+
+		v = (v & 0x00ffffff) | (nearest << 24);
+		memcpy (&pixels[i], &v, sizeof (v));
+	}
+
+	return K_MEANS_FN (vec_sum) (&n_changed) +
+	       assign_scalar (pixels + n_vec, n_pixels - n_vec,
+			      cluster_centres, n_cluster_centres);
+}
+
+#undef VecF32
+#undef VecI32
+#undef K_MEANS_ATTRIBUTES
+#undef K_MEANS_FN
+#undef K_MEANS_CONCAT
+#undef K_MEANS_CONCAT_
+#undef K_MEANS_TARGET
+#undef K_MEANS_SUFFIX
+#undef K_MEANS_LANES
@@ -31,8 +31,18 @@
 #include <glib.h>
 #include <gdk/gdk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <string.h>
 
 #include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
+
+/* The assignment and accumulation steps of k_means() are vectorised using
+ * GCC vector extensions on x86, where SSE2 is the baseline and AVX2 is
+ * selected at runtime if the CPU supports it. Everything else uses the
+ * scalar implementation. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define HAVE_K_MEANS_SIMD 1
+#endif
 
 /* Hard-code the number of clusters to split the icon color space into. This
  * gives the maximum number of key colors returned for an icon. This number has
@@ -119,6 +129,147 @@ nearest_cluster (const Pixel8 *pixel,
 	return nearest_cluster;
 }
 
+static void
+accumulate_scalar (const ClusterPixel8 *pixels,
+                   gsize                n_pixels,
+                   CentroidAccumulator *accumulators,
+                   gsize                n_accumulators)
+{
+	for (const ClusterPixel8 *p = pixels; p < pixels + n_pixels; p++) {
+		if (p->cluster >= n_accumulators)
+			continue;
+
+		accumulators[p->cluster].red += p->color.red;
+		accumulators[p->cluster].green += p->color.green;
+		accumulators[p->cluster].blue += p->color.blue;
+		accumulators[p->cluster].n_members++;
+	}
+}
+
+/* Returns the number of pixels whose cluster changed. */
+static guint
+assign_scalar (ClusterPixel8 *pixels,
+               gsize          n_pixels,
+               const Pixel8  *cluster_centres,
+               gsize          n_cluster_centres)
+{
+	guint n_assignments_changed = 0;
+
+	for (ClusterPixel8 *p = pixels; p < pixels + n_pixels; p++) {
+		gsize new_cluster;
+
+		if (p->cluster >= n_cluster_centres)
+			continue;
+
+		new_cluster = nearest_cluster (&p->color, cluster_centres, n_cluster_centres);
+		if (new_cluster != p->cluster)
+			n_assignments_changed++;
+		p->cluster = new_cluster;
+	}
+
+	return n_assignments_changed;
+}
+
+#ifdef HAVE_K_MEANS_SIMD
+G_STATIC_ASSERT (sizeof (ClusterPixel8) == sizeof (gint32));
+
+#define vec_select(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+
+/* Instantiate the kernels once per vector width. GCC lowers 8-lane vectors
+ * to SSE2 very poorly, so the SSE2 kernels use 4 lanes. */
+#define K_MEANS_LANES 4
+#define K_MEANS_SUFFIX sse2
+#define K_MEANS_TARGET "sse2"
+#include "gs-key-colors-simd.h"
+
+#define K_MEANS_LANES 8
+#define K_MEANS_SUFFIX avx2
+#define K_MEANS_TARGET "avx2"
+#include "gs-key-colors-simd.h"
+#endif  /* HAVE_K_MEANS_SIMD */
+
+typedef struct {
+	void	(*accumulate)	(const ClusterPixel8 *pixels,
+				 gsize                n_pixels,
+				 CentroidAccumulator *accumulators,
+				 gsize                n_accumulators);
+	guint	(*assign)	(ClusterPixel8 *pixels,
+				 gsize          n_pixels,
+				 const Pixel8  *cluster_centres,
+				 gsize          n_cluster_centres);
+} KMeansImpl;
+
+static const KMeansImpl k_means_impls[] = {
+	[GS_KEY_COLORS_IMPL_SCALAR] = { accumulate_scalar, assign_scalar },
+#ifdef HAVE_K_MEANS_SIMD
+	[GS_KEY_COLORS_IMPL_SSE2] = { accumulate_sse2, assign_sse2 },
+	[GS_KEY_COLORS_IMPL_AVX2] = { accumulate_avx2, assign_avx2 },
+#endif
+};
+
+static const KMeansImpl *k_means_impl = NULL;  /* (atomic) */
+
+static gboolean
+k_means_impl_supported (GsKeyColorsImpl impl)
+{
+	switch (impl) {
+	case GS_KEY_COLORS_IMPL_SCALAR:
+		return TRUE;
+#ifdef HAVE_K_MEANS_SIMD
+	case GS_KEY_COLORS_IMPL_SSE2:
+		return TRUE;
+	case GS_KEY_COLORS_IMPL_AVX2:
+		__builtin_cpu_init ();
+		return __builtin_cpu_supports ("avx2");
+#endif
+	default:
+		return FALSE;
+	}
+}
+
+static const KMeansImpl *
+k_means_get_impl (void)
+{
+	const KMeansImpl *impl = g_atomic_pointer_get (&k_means_impl);
+
+	if (G_UNLIKELY (impl == NULL)) {
+		gs_key_colors_set_impl (GS_KEY_COLORS_IMPL_AUTO);
+		impl = g_atomic_pointer_get (&k_means_impl);
+	}
+
+	return impl;
+}
+
+/**
+ * gs_key_colors_set_impl:
+ * @impl: the implementation to use
+ *
+ * Choose which implementation of the k-means kernels to use. This is only
+ * intended for testing and profiling; by default the fastest one supported
+ * by the CPU is used.
+ *
+ * Returns: %TRUE if @impl is supported on this machine and is now in use
+ * Since: 43
+ */
+gboolean
+gs_key_colors_set_impl (GsKeyColorsImpl impl)
+{
+	if (impl == GS_KEY_COLORS_IMPL_AUTO) {
+		if (k_means_impl_supported (GS_KEY_COLORS_IMPL_AVX2))
+			impl = GS_KEY_COLORS_IMPL_AVX2;
+		else if (k_means_impl_supported (GS_KEY_COLORS_IMPL_SSE2))
+			impl = GS_KEY_COLORS_IMPL_SSE2;
+		else
+			impl = GS_KEY_COLORS_IMPL_SCALAR;
+	}
+
+	if (!k_means_impl_supported (impl))
+		return FALSE;
+
+	g_atomic_pointer_set (&k_means_impl, &k_means_impls[impl]);
+	return TRUE;
+}
+
 /* A variant of g_random_int_range() which chooses without replacement,
  * tracking the used integers in @used_ints and @n_used_ints.
  * Once all integers in 0..max_ints have been used once, it will choose
@@ -188,6 +339,8 @@ k_means (GArray    *colors,
 	guint n_assignments_changed;
 	guint n_iterations = 0;
 	guint assignments_termination_limit;
+	gsize n_pixels;
+	const KMeansImpl *impl = k_means_get_impl ();
 
 	n_channels = gdk_pixbuf_get_n_channels (pb);
 	rowstride = gdk_pixbuf_get_rowstride (pb);
@@ -202,7 +355,8 @@ k_means (GArray    *colors,
 	g_assert (n_channels == 4);
 
 	pixels = (ClusterPixel8 *) raw_pixels;
-	pixels_end = &pixels[height * width];
+	n_pixels = (gsize) height * width;
+	pixels_end = &pixels[n_pixels];
 
 	memset (cluster_centres, 0, sizeof (cluster_centres));
 	memset (used_clusters, 0, sizeof (used_clusters));
@@ -241,16 +395,7 @@ k_means (GArray    *colors,
 		/* Update step. Re-calculate the centroid of each cluster from
 		 * the colors which are in it. */
 		memset (cluster_accumulators, 0, sizeof (cluster_accumulators));
-
-		for (const ClusterPixel8 *p = pixels; p < pixels_end; p++) {
-			if (p->cluster >= G_N_ELEMENTS (cluster_centres))
-				continue;
-
-			cluster_accumulators[p->cluster].red += p->color.red;
-			cluster_accumulators[p->cluster].green += p->color.green;
-			cluster_accumulators[p->cluster].blue += p->color.blue;
-			cluster_accumulators[p->cluster].n_members++;
-		}
+		impl->accumulate (pixels, n_pixels, cluster_accumulators, G_N_ELEMENTS (cluster_accumulators));
 
 		for (gsize i = 0; i < G_N_ELEMENTS (cluster_centres); i++) {
 			if (cluster_accumulators[i].n_members == 0)
@@ -262,18 +407,7 @@ k_means (GArray    *colors,
 		}
 
 		/* Update assignments of colors to clusters. */
-		n_assignments_changed = 0;
-		for (ClusterPixel8 *p = pixels; p < pixels_end; p++) {
-			gsize new_cluster;
-
-			if (p->cluster >= G_N_ELEMENTS (cluster_centres))
-				continue;
-
-			new_cluster = nearest_cluster (&p->color, cluster_centres, G_N_ELEMENTS (cluster_centres));
-			if (new_cluster != p->cluster)
-				n_assignments_changed++;
-			p->cluster = new_cluster;
-		}
+		n_assignments_changed = impl->assign (pixels, n_pixels, cluster_centres, G_N_ELEMENTS (cluster_centres));
 
 		n_iterations++;
 	} while (n_assignments_changed > assignments_termination_limit && n_iterations < 50);
@@ -332,3 +466,70 @@ gs_calculate_key_colors (GdkPixbuf *pixbuf)
 
 	return g_steal_pointer (&colors);
 }
+
+typedef struct {
+	GPtrArray *pixbufs;  /* (element-type GdkPixbuf) (unowned) */
+	GPtrArray *results;  /* (element-type GArray) (unowned) */
+} KeyColorsBatch;
+
+static void
+calculate_key_colors_batch_cb (gpointer data,
+                               gpointer user_data)
+{
+	KeyColorsBatch *batch = user_data;
+	guint idx = GPOINTER_TO_UINT (data) - 1;
+
+	/* each worker writes a distinct slot, so no locking is needed */
+	batch->results->pdata[idx] = gs_calculate_key_colors (g_ptr_array_index (batch->pixbufs, idx));
+}
+
+/**
+ * gs_calculate_key_colors_batch:
+ * @pixbufs: (element-type GdkPixbuf): app icons to calculate key colors from
+ *
+ * Calculate the key colors for each of @pixbufs, as with
+ * gs_calculate_key_colors(), spreading the work across a thread per CPU.
+ *
+ * This blocks until all the icons have been processed. It is faster than
+ * calling gs_calculate_key_colors() on each icon in turn when there are
+ * more than a handful of them, such as when loading a whole category.
+ *
+ * Returns: (transfer full) (element-type GArray): key colors for each of
+ *     @pixbufs, in the same order
+ * Since: 43
+ */
+GPtrArray *
+gs_calculate_key_colors_batch (GPtrArray *pixbufs)
+{
+	g_autoptr(GPtrArray) results = NULL;
+	KeyColorsBatch batch;
+	GThreadPool *pool;
+	guint n_threads;
+
+	g_return_val_if_fail (pixbufs != NULL, NULL);
+
+	results = g_ptr_array_new_full (pixbufs->len, (GDestroyNotify) g_array_unref);
+	g_ptr_array_set_size (results, pixbufs->len);
+
+	/* not worth spinning up threads for */
+	n_threads = MIN (g_get_num_processors (), pixbufs->len);
+	if (n_threads <= 1) {
+		for (guint i = 0; i < pixbufs->len; i++)
+			results->pdata[i] = gs_calculate_key_colors (g_ptr_array_index (pixbufs, i));
+		return g_steal_pointer (&results);
+	}
+
+	batch.pixbufs = pixbufs;
+	batch.results = results;
+	pool = g_thread_pool_new (calculate_key_colors_batch_cb, &batch,
+				  (gint) n_threads, TRUE, NULL);
+
+	/* offset the indices by one, as pushing NULL is not allowed */
+	for (guint i = 0; i < pixbufs->len; i++)
+		g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+
+	/* wait for all queued work to finish */
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	return g_steal_pointer (&results);
+}
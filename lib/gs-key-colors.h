@@ -22,6 +22,7 @@
 
 G_BEGIN_DECLS
 
-GArray	*gs_calculate_key_colors	(GdkPixbuf	*pixbuf);
+GArray		*gs_calculate_key_colors	(GdkPixbuf	*pixbuf);
+GPtrArray	*gs_calculate_key_colors_batch	(GPtrArray	*pixbufs);
 
 G_END_DECLS
@@ -43,10 +43,10 @@
 
 G_DEFINE_QUARK (gs-odrs-provider-error-quark, gs_odrs_provider_error)
 
-/* Element in self->ratings, all allocated in one big block and sorted
- * alphabetically to reduce the number of allocations and fragmentation. */
+/* Ratings parsed from ratings.json, before they are serialised. The app ID
+ * is owned by the #JsonParser. */
 typedef struct {
-	gchar *app_id;  /* (owned) */
+	const gchar *app_id;  /* (unowned) */
 	guint32 n_star_ratings[6];
 } GsOdrsRating;
 
@@ -56,11 +56,13 @@ rating_compare (const GsOdrsRating *a, const GsOdrsRating *b)
 	return g_strcmp0 (a->app_id, b->app_id);
 }
 
-static void
-rating_clear (GsOdrsRating *rating)
-{
-	g_free (rating->app_id);
-}
+/* The parsed ratings are cached next to ratings.json in this format, sorted
+ * by app ID, so that they can be binary searched straight from the mapped
+ * file on the next start. The magic number also catches a cache written
+ * with a different byte order. */
+#define GS_ODRS_PROVIDER_RATINGS_CACHE		"ratings.gvariant"
+#define GS_ODRS_PROVIDER_RATINGS_MAGIC		0x5352444f  /* ODRS */
+#define GS_ODRS_PROVIDER_RATINGS_TYPE		"a(s(uuuuuu))"
 
 struct _GsOdrsProvider
 {
@@ -69,7 +71,7 @@ struct _GsOdrsProvider
 	gchar		*distro;  /* (not nullable) (owned) */
 	gchar		*user_hash;  /* (not nullable) (owned) */
 	gchar		*review_server;  /* (not nullable) (owned) */
-	GArray		*ratings;  /* (element-type GsOdrsRating) (mutex ratings_mutex) (owned) (nullable) */
+	GVariant	*ratings;  /* (type a(s(uuuuuu))) (mutex ratings_mutex) (owned) (nullable) */
 	GMutex		 ratings_mutex;
 	guint64		 max_cache_age_secs;
 	guint		 n_results_max;
@@ -104,15 +106,16 @@ gs_odrs_provider_load_ratings_for_app (JsonObject   *json_app,
 		rating_out->n_star_ratings[i] = (guint64) json_object_get_int_member (json_app, names[i]);
 	}
 
-	rating_out->app_id = g_strdup (app_id);
+	rating_out->app_id = app_id;
 
 	return TRUE;
 }
 
-static gboolean
-gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
-                               const gchar     *filename,
-                               GError         **error)
+/* returns the sorted ratings from @filename, serialised as a
+ * GS_ODRS_PROVIDER_RATINGS_TYPE variant */
+static GVariant *
+gs_odrs_provider_parse_ratings (const gchar  *filename,
+                                GError      **error)
 {
 	JsonNode *json_root;
 	JsonObject *json_item;
@@ -120,8 +123,8 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 	const gchar *app_id;
 	JsonNode *json_app_node;
 	JsonObjectIter iter;
+	GVariantBuilder builder;
 	g_autoptr(GArray) new_ratings = NULL;
-	g_autoptr(GMutexLocker) locker = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	/* parse the data and find the success */
@@ -131,7 +134,7 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 			     GS_ODRS_PROVIDER_ERROR,
 			     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 			     "Error parsing ODRS data: %s", local_error->message);
-		return FALSE;
+		return NULL;
 	}
 	json_root = json_parser_get_root (json_parser);
 	if (json_root == NULL) {
@@ -139,14 +142,14 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 				     GS_ODRS_PROVIDER_ERROR,
 				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 				     "no ratings root");
-		return FALSE;
+		return NULL;
 	}
 	if (json_node_get_node_type (json_root) != JSON_NODE_OBJECT) {
 		g_set_error_literal (error,
 				     GS_ODRS_PROVIDER_ERROR,
 				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 				     "no ratings array");
-		return FALSE;
+		return NULL;
 	}
 
 	json_item = json_node_get_object (json_root);
@@ -155,7 +158,6 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 					 FALSE,  /* don’t clear */
 					 sizeof (GsOdrsRating),
 					 json_object_get_size (json_item));
-	g_array_set_clear_func (new_ratings, (GDestroyNotify) rating_clear);
 
 	/* parse each app */
 	json_object_iter_init (&iter, json_item);
@@ -174,14 +176,155 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 	/* Allow for binary searches later. */
 	g_array_sort (new_ratings, (GCompareFunc) rating_compare);
 
+	g_variant_builder_init (&builder, G_VARIANT_TYPE (GS_ODRS_PROVIDER_RATINGS_TYPE));
+	for (guint i = 0; i < new_ratings->len; i++) {
+		const GsOdrsRating *rating = &g_array_index (new_ratings, GsOdrsRating, i);
+		g_variant_builder_add (&builder, "(s(uuuuuu))",
+				       rating->app_id,
+				       rating->n_star_ratings[0],
+				       rating->n_star_ratings[1],
+				       rating->n_star_ratings[2],
+				       rating->n_star_ratings[3],
+				       rating->n_star_ratings[4],
+				       rating->n_star_ratings[5]);
+	}
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gint64
+gs_odrs_provider_get_mtime (const gchar *filename)
+{
+	g_autoptr(GFile) file = g_file_new_for_path (filename);
+	g_autoptr(GFileInfo) info = NULL;
+	g_autoptr(GDateTime) mtime = NULL;
+
+	info = g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+				  G_FILE_QUERY_INFO_NONE,
+				  NULL, NULL);
+	if (info == NULL)
+		return -1;
+	mtime = g_file_info_get_modification_date_time (info);
+	if (mtime == NULL)
+		return -1;
+	return g_date_time_to_unix (mtime) * G_USEC_PER_SEC + g_date_time_get_microsecond (mtime);
+}
+
+/* maps the ratings written by gs_odrs_provider_save_ratings_cache() */
+static GVariant *
+gs_odrs_provider_load_ratings_cache (const gchar  *filename,
+                                     GError      **error)
+{
+	guint32 magic = 0;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) ratings = NULL;
+
+	mapped_file = g_mapped_file_new (filename, FALSE, error);
+	if (mapped_file == NULL)
+		return NULL;
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(u" GS_ODRS_PROVIDER_RATINGS_TYPE ")"),
+							     bytes, FALSE));
+	g_variant_get (data, "(u@" GS_ODRS_PROVIDER_RATINGS_TYPE ")", &magic, &ratings);
+	if (magic != GS_ODRS_PROVIDER_RATINGS_MAGIC) {
+		g_set_error (error,
+			     GS_ODRS_PROVIDER_ERROR,
+			     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+			     "Invalid ODRS ratings cache %s", filename);
+		return NULL;
+	}
+	return g_steal_pointer (&ratings);
+}
+
+static gboolean
+gs_odrs_provider_save_ratings_cache (const gchar  *filename,
+                                     GVariant     *ratings,
+                                     GError      **error)
+{
+	g_autoptr(GVariant) data = NULL;
+
+	data = g_variant_ref_sink (g_variant_new ("(u@" GS_ODRS_PROVIDER_RATINGS_TYPE ")",
+						  GS_ODRS_PROVIDER_RATINGS_MAGIC, ratings));
+	return g_file_set_contents (filename,
+				    g_variant_get_data (data),
+				    g_variant_get_size (data),
+				    error);
+}
+
+static gboolean
+gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
+                               const gchar     *filename,
+                               GError         **error)
+{
+	g_autofree gchar *dirname = g_path_get_dirname (filename);
+	g_autofree gchar *cache_filename = g_build_filename (dirname, GS_ODRS_PROVIDER_RATINGS_CACHE, NULL);
+	gint64 cache_mtime = gs_odrs_provider_get_mtime (cache_filename);
+	g_autoptr(GVariant) new_ratings = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	/* use the cache unless ratings.json has been downloaded since */
+	if (cache_mtime >= 0 && cache_mtime >= gs_odrs_provider_get_mtime (filename)) {
+		g_autoptr(GError) error_local = NULL;
+		new_ratings = gs_odrs_provider_load_ratings_cache (cache_filename, &error_local);
+		if (new_ratings == NULL)
+			g_debug ("Failed to load %s: %s", cache_filename, error_local->message);
+	}
+	if (new_ratings == NULL) {
+		g_autoptr(GError) error_local = NULL;
+
+		new_ratings = gs_odrs_provider_parse_ratings (filename, error);
+		if (new_ratings == NULL)
+			return FALSE;
+		if (!gs_odrs_provider_save_ratings_cache (cache_filename, new_ratings, &error_local))
+			g_debug ("Failed to save %s: %s", cache_filename, error_local->message);
+	}
+
 	/* Update the shared state */
 	locker = g_mutex_locker_new (&self->ratings_mutex);
-	g_clear_pointer (&self->ratings, g_array_unref);
+	g_clear_pointer (&self->ratings, g_variant_unref);
 	self->ratings = g_steal_pointer (&new_ratings);
 
 	return TRUE;
 }
 
+/* binary search of the sorted self->ratings */
+static gboolean
+gs_odrs_provider_lookup_rating (GVariant    *ratings,
+                                const gchar *app_id,
+                                guint32      n_star_ratings_out[6])
+{
+	gsize lower = 0;
+	gsize upper = g_variant_n_children (ratings);
+
+	while (lower < upper) {
+		gsize mid = lower + (upper - lower) / 2;
+		g_autoptr(GVariant) rating = g_variant_get_child_value (ratings, mid);
+		const gchar *id = NULL;
+		gint rc;
+
+		g_variant_get_child (rating, 0, "&s", &id);
+		rc = strcmp (app_id, id);
+		if (rc < 0) {
+			upper = mid;
+		} else if (rc > 0) {
+			lower = mid + 1;
+		} else {
+			g_variant_get_child (rating, 1, "(uuuuuu)",
+					     &n_star_ratings_out[0],
+					     &n_star_ratings_out[1],
+					     &n_star_ratings_out[2],
+					     &n_star_ratings_out[3],
+					     &n_star_ratings_out[4],
+					     &n_star_ratings_out[5]);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 static AsReview *
 gs_odrs_provider_parse_review_object (JsonObject *item)
 {
@@ -598,19 +741,14 @@ gs_odrs_provider_refine_ratings (GsOdrsProvider  *self,
 
 	for (guint i = 0; i < reviewable_ids->len; i++) {
 		const gchar *id = g_ptr_array_index (reviewable_ids, i);
-		const GsOdrsRating search_rating = { (gchar *) id, { 0, }};
-		guint found_index;
-		const GsOdrsRating *found_rating;
+		guint32 n_star_ratings[6];
 
-		if (!g_array_binary_search (self->ratings, &search_rating,
-					    (GCompareFunc) rating_compare, &found_index))
+		if (!gs_odrs_provider_lookup_rating (self->ratings, id, n_star_ratings))
 			continue;
 
-		found_rating = &g_array_index (self->ratings, GsOdrsRating, found_index);
-
 		/* copy into accumulator array */
 		for (guint j = 0; j < 6; j++)
-			ratings_raw[j] += found_rating->n_star_ratings[j];
+			ratings_raw[j] += n_star_ratings[j];
 		cnt++;
 	}
 	if (cnt == 0)
@@ -1194,7 +1332,7 @@ gs_odrs_provider_finalize (GObject *object)
 	g_free (self->user_hash);
 	g_free (self->distro);
 	g_free (self->review_server);
-	g_clear_pointer (&self->ratings, g_array_unref);
+	g_clear_pointer (&self->ratings, g_variant_unref);
 	g_mutex_clear (&self->ratings_mutex);
 
 	G_OBJECT_CLASS (gs_odrs_provider_parent_class)->finalize (object);
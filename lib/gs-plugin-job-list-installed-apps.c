@@ -47,6 +47,7 @@
 #include "gs-plugin-job-list-installed-apps.h"
 #include "gs-plugin-job-refine.h"
 #include "gs-plugin-private.h"
+#include "gs-profiler.h"
 #include "gs-utils.h"
 
 struct _GsPluginJobListInstalledApps
@@ -63,6 +64,7 @@ struct _GsPluginJobListInstalledApps
 	GsAppList *merged_list;  /* (owned) (nullable) */
 	GError *saved_error;  /* (owned) (nullable) */
 	guint n_pending_ops;
+	gint64 begin_time_nsec;
 
 	/* Results. */
 	GsAppList *result_list;  /* (owned) (nullable) */
@@ -282,6 +284,7 @@ gs_plugin_job_list_installed_apps_run_async (GsPluginJob         *job,
 	 * initialised to 1 until all the operations are started */
 	self->n_pending_ops = 1;
 	self->merged_list = gs_app_list_new ();
+	self->begin_time_nsec = gs_profiler_get_current_time ();
 	plugins = gs_plugin_loader_get_plugins (plugin_loader);
 
 	for (guint i = 0; i < plugins->len; i++) {
@@ -332,6 +335,13 @@ plugin_list_installed_apps_cb (GObject      *source_object,
 	plugin_apps = plugin_class->list_installed_apps_finish (plugin, result, &local_error);
 	gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
 
+	/* all the plugins are started together, so this is the plugin’s own
+	 * duration */
+	if (gs_profiler_is_enabled ()) {
+		g_autofree gchar *sysprof_name = g_strconcat ("list-installed-apps:", gs_plugin_get_name (plugin), NULL);
+		gs_profiler_add_mark (self->begin_time_nsec, sysprof_name, NULL);
+	}
+
 	if (plugin_apps != NULL)
 		gs_app_list_add_list (self->merged_list, plugin_apps);
 
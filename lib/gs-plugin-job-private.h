@@ -25,6 +25,9 @@ void			 gs_plugin_job_remove_refine_flags	(GsPluginJob	*self,
 								 GsPluginRefineFlags refine_flags);
 gboolean		 gs_plugin_job_get_interactive		(GsPluginJob	*self);
 gboolean		 gs_plugin_job_get_propagate_error	(GsPluginJob	*self);
+gboolean		 gs_plugin_job_get_partial_results	(GsPluginJob	*self);
+void			 gs_plugin_job_emit_partial_results	(GsPluginJob	*self,
+								 GsAppList	*list);
 guint			 gs_plugin_job_get_max_results		(GsPluginJob	*self);
 guint			 gs_plugin_job_get_timeout		(GsPluginJob	*self);
 guint64			 gs_plugin_job_get_age			(GsPluginJob	*self);
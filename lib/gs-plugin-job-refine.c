@@ -33,32 +33,50 @@
  * into the job will not be modified.
  *
  * Internally, the #GsPluginClass.refine_async() functions are called on all
- * the plugins in series, and in series with a call to
- * gs_odrs_provider_refine_async(). Once all of those calls are finished,
- * zero or more recursive calls to run_refine_internal_async() are made in
- * parallel to do a similar refine process on the addons, runtime and related
- * components for all the components in the input #GsAppList. The refine job is
- * complete once all these recursive calls complete.
+ * the plugins in parallel, except where one plugin has to run after another
+ * according to their %GS_PLUGIN_RULE_RUN_AFTER and %GS_PLUGIN_RULE_RUN_BEFORE
+ * rules (see gs_plugin_loader_plugin_runs_after()). In that case the later
+ * plugin’s refine_async() is only started once all the plugins it depends on
+ * have finished. Once all of those calls are finished,
+ * gs_odrs_provider_refine_async() is called. Then zero or more recursive calls
+ * to run_refine_internal_async() are made in parallel to do a similar refine
+ * process on the addons, runtime and related components for all the
+ * components in the input #GsAppList. The refine job is complete once all
+ * these recursive calls complete.
  *
- * FIXME: Ideally, the #GsPluginClass.refine_async() calls would happen in
- * parallel, but this cannot be the case until the results of the refine_async()
- * call in one plugin don’t depend on the results of refine_async() in another.
- * This still happens with several pairs of plugins.
+ * Plugins whose refine_async() depends on the results of refine_async() in
+ * another plugin must declare that with a rule, or they may see the apps
+ * before the other plugin has refined them.
+ *
+ * Before any of that, the apps are looked up in the loader’s #GsRefineCache.
+ * Apps found there have their cacheable fields set from it, and are refined
+ * separately without %GS_REFINE_CACHE_FLAGS (or not at all, if no other flags
+ * were requested). The other apps are stored in the cache once refined.
+ *
+ * The remaining apps are then checked against the loader’s
+ * #GsRefineCoordinator, so that apps which another refine job is already
+ * refining are not refined twice at the same time. Those apps are only refined
+ * for the flags the other jobs aren’t covering, and this job waits for the
+ * other jobs before completing. If one of them fails, the apps it was refining
+ * are refined again here with all the flags.
  *
  * ```
  *                                    run_async()
  *                                         |
  *                                         v
- *           /-----------------------+-------------+----------------\
- *           |                       |             |                |
- * plugin->refine_async()            |             |                |
- *           v             plugin->refine_async()  |                |
- *           |                       v             …                |
- *           |                       |             v  gs_odrs_provider_refine_async()
- *           |                       |             |                v
- *           |                       |             |                |
- *           \-----------------------+-------------+----------------/
- *                                         |
+ *           /-----------------------+-------------\
+ *           |                       |             |
+ * plugin->refine_async()  plugin->refine_async()  …
+ *           v                       v             |
+ *           |                       |             v
+ * plugin->refine_async()            |             |
+ *   (runs after the first)          |             |
+ *           v                       |             |
+ *           \-----------------------+-------------/
+ *                                   |
+ *                  gs_odrs_provider_refine_async()
+ *                                   v
+ *                                   |
  *                            finish_refine_internal_op()
  *                                         |
  *                                         v
@@ -89,6 +107,9 @@
 #include "gs-enums.h"
 #include "gs-plugin-job-private.h"
 #include "gs-plugin-job-refine.h"
+#include "gs-profiler.h"
+#include "gs-refine-cache.h"
+#include "gs-refine-coordinator.h"
 #include "gs-utils.h"
 
 struct _GsPluginJobRefine
@@ -212,6 +233,8 @@ app_is_non_wildcard (GsApp *app, gpointer user_data)
 	return !gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD);
 }
 
+static void start_plugin_refine (GTask *task,
+                                 guint  plugin_index);
 static void plugin_refine_cb (GObject      *source_object,
                               GAsyncResult *result,
                               gpointer      user_data);
@@ -236,9 +259,13 @@ typedef struct {
 	GsPluginRefineFlags flags;
 
 	/* In-progress data. */
+	GPtrArray *plugins;  /* (element-type GsPlugin) (owned) */
+	guint *n_pending_deps;  /* (array length=plugins->len) (owned) */
+	gint64 *plugin_begin_time_nsec;  /* (array length=plugins->len) (owned) */
 	guint n_pending_ops;
 	guint n_pending_recursions;
-	guint next_plugin_index;
+	gboolean odrs_refine_started;
+	gint64 odrs_begin_time_nsec;
 
 	/* Output data. */
 	GError *error;  /* (nullable) (owned) */
@@ -249,6 +276,9 @@ refine_internal_data_free (RefineInternalData *data)
 {
 	g_clear_object (&data->plugin_loader);
 	g_clear_object (&data->list);
+	g_clear_pointer (&data->plugins, g_ptr_array_unref);
+	g_free (data->n_pending_deps);
+	g_free (data->plugin_begin_time_nsec);
 
 	g_assert (data->n_pending_ops == 0);
 	g_assert (data->n_pending_recursions == 0);
@@ -275,6 +305,7 @@ run_refine_internal_async (GsPluginJobRefine   *self,
 	g_autoptr(GTask) task = NULL;
 	RefineInternalData *data;
 	g_autoptr(RefineInternalData) data_owned = NULL;
+	gint64 adopt_begin_time_nsec;
 
 	task = g_task_new (self, cancellable, callback, user_data);
 	g_task_set_source_tag (task, run_refine_internal_async);
@@ -286,21 +317,14 @@ run_refine_internal_async (GsPluginJobRefine   *self,
 	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) refine_internal_data_free);
 
 	/* try to adopt each application with a plugin */
+	adopt_begin_time_nsec = gs_profiler_get_current_time ();
 	gs_plugin_loader_run_adopt (plugin_loader, list);
+	gs_profiler_add_mark (adopt_begin_time_nsec, "adopt", NULL);
 
-	data->n_pending_ops = 0;
-
-	/* run each plugin
-	 *
-	 * FIXME: For now, we have to run these vfuncs sequentially rather than
-	 * all in parallel. This is because there are still dependencies between
-	 * some of the plugins, where the code to refine an app in one plugin
-	 * depends on the results of refining it in another plugin first.
-	 *
-	 * Eventually, the plugins should all be changed/removed so that they
-	 * can operate independently. At that point, this code can be reverted
-	 * so that the refine_async() vfuncs are called in parallel. */
+	/* work out which plugins have to wait for which others; the loader
+	 * has already sorted the plugins so that dependencies come first */
 	plugins = gs_plugin_loader_get_plugins (plugin_loader);
+	data->plugins = g_ptr_array_new_with_free_func (g_object_unref);
 
 	for (guint i = 0; i < plugins->len; i++) {
 		GsPlugin *plugin = g_ptr_array_index (plugins, i);
@@ -311,24 +335,49 @@ run_refine_internal_async (GsPluginJobRefine   *self,
 		if (plugin_class->refine_async == NULL)
 			continue;
 
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		data->next_plugin_index = i + 1;
+		g_ptr_array_add (data->plugins, g_object_ref (plugin));
+	}
 
-		/* run the batched plugin symbol */
-		data->n_pending_ops++;
-		plugin_class->refine_async (plugin, list, flags,
-					    cancellable, plugin_refine_cb, g_object_ref (task));
+	data->n_pending_deps = g_new0 (guint, data->plugins->len);
+	data->plugin_begin_time_nsec = g_new0 (gint64, data->plugins->len);
+	for (guint i = 0; i < data->plugins->len; i++) {
+		GsPlugin *plugin = g_ptr_array_index (data->plugins, i);
 
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		return;
+		for (guint j = 0; j < i; j++) {
+			GsPlugin *dep = g_ptr_array_index (data->plugins, j);
+			if (gs_plugin_loader_plugin_runs_after (plugin_loader, plugin, dep))
+				data->n_pending_deps[i]++;
+		}
+	}
+
+	/* run each plugin which doesn’t depend on another; the rest are
+	 * started from plugin_refine_cb() as their dependencies finish */
+	data->n_pending_ops = 1;
+
+	for (guint i = 0; i < data->plugins->len; i++) {
+		if (data->n_pending_deps[i] == 0)
+			start_plugin_refine (task, i);
 	}
 
-	data->n_pending_ops++;
 	finish_refine_internal_op (task, NULL);
 }
 
+static void
+start_plugin_refine (GTask *task,
+                     guint  plugin_index)
+{
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	RefineInternalData *data = g_task_get_task_data (task);
+	GsPlugin *plugin = g_ptr_array_index (data->plugins, plugin_index);
+	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
+
+	/* run the batched plugin symbol */
+	data->n_pending_ops++;
+	data->plugin_begin_time_nsec[plugin_index] = gs_profiler_get_current_time ();
+	plugin_class->refine_async (plugin, data->list, data->flags,
+				    cancellable, plugin_refine_cb, g_object_ref (task));
+}
+
 static void
 plugin_refine_cb (GObject      *source_object,
                   GAsyncResult *result,
@@ -336,17 +385,39 @@ plugin_refine_cb (GObject      *source_object,
 {
 	GsPlugin *plugin = GS_PLUGIN (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	RefineInternalData *data = g_task_get_task_data (task);
 	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
 	g_autoptr(GError) local_error = NULL;
+	guint plugin_index;
+
+	if (plugin_class->refine_finish (plugin, result, &local_error))
+		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+
+	/* start any plugins which were only waiting for this one; this is done
+	 * even if it failed, as the plugins used to be run in series
+	 * regardless of errors */
+	if (g_ptr_array_find (data->plugins, plugin, &plugin_index)) {
+		if (gs_profiler_is_enabled ()) {
+			g_autofree gchar *sysprof_name = g_strconcat ("refine:", gs_plugin_get_name (plugin), NULL);
+			gs_profiler_add_mark_printf (data->plugin_begin_time_nsec[plugin_index],
+						     sysprof_name, "%u apps",
+						     gs_app_list_length (data->list));
+		}
 
-	if (!plugin_class->refine_finish (plugin, result, &local_error)) {
-		finish_refine_internal_op (task, g_steal_pointer (&local_error));
-		return;
-	}
+		for (guint i = plugin_index + 1; i < data->plugins->len; i++) {
+			GsPlugin *plugin2 = g_ptr_array_index (data->plugins, i);
 
-	gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+			if (!gs_plugin_loader_plugin_runs_after (data->plugin_loader, plugin2, plugin))
+				continue;
 
-	finish_refine_internal_op (task, NULL);
+			g_assert (data->n_pending_deps[i] > 0);
+			data->n_pending_deps[i]--;
+			if (data->n_pending_deps[i] == 0)
+				start_plugin_refine (task, i);
+		}
+	}
+
+	finish_refine_internal_op (task, g_steal_pointer (&local_error));
 }
 
 static void
@@ -356,9 +427,12 @@ odrs_provider_refine_cb (GObject      *source_object,
 {
 	GsOdrsProvider *odrs_provider = GS_ODRS_PROVIDER (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	RefineInternalData *data = g_task_get_task_data (task);
 	g_autoptr(GError) local_error = NULL;
 
 	gs_odrs_provider_refine_finish (odrs_provider, result, &local_error);
+	gs_profiler_add_mark_printf (data->odrs_begin_time_nsec, "odrs", "%u apps",
+				     gs_app_list_length (data->list));
 	finish_refine_internal_op (task, g_steal_pointer (&local_error));
 }
 
@@ -376,7 +450,6 @@ finish_refine_internal_op (GTask  *task,
 	GsPluginRefineFlags flags = data->flags;
 	GsOdrsProvider *odrs_provider;
 	GsOdrsProviderRefineFlags odrs_refine_flags = 0;
-	GPtrArray *plugins;  /* (element-type GsPlugin) */
 
 	if (data->error == NULL && error_owned != NULL) {
 		data->error = g_steal_pointer (&error_owned);
@@ -387,34 +460,12 @@ finish_refine_internal_op (GTask  *task,
 	g_assert (data->n_pending_ops > 0);
 	data->n_pending_ops--;
 
-	plugins = gs_plugin_loader_get_plugins (plugin_loader);
-
-	for (guint i = data->next_plugin_index; i < plugins->len; i++) {
-		GsPlugin *plugin = g_ptr_array_index (plugins, i);
-		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
-
-		if (!gs_plugin_get_enabled (plugin))
-			continue;
-		if (plugin_class->refine_async == NULL)
-			continue;
-
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		data->next_plugin_index = i + 1;
-
-		/* run the batched plugin symbol */
-		data->n_pending_ops++;
-		plugin_class->refine_async (plugin, list, flags,
-					    cancellable, plugin_refine_cb, g_object_ref (task));
-
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
+	if (data->n_pending_ops > 0)
 		return;
-	}
 
-	if (data->next_plugin_index == plugins->len) {
+	if (!data->odrs_refine_started) {
 		/* Avoid the ODRS refine being run multiple times. */
-		data->next_plugin_index++;
+		data->odrs_refine_started = TRUE;
 
 		/* Add ODRS data if needed */
 		odrs_provider = gs_plugin_loader_get_odrs_provider (plugin_loader);
@@ -427,14 +478,13 @@ finish_refine_internal_op (GTask  *task,
 
 		if (odrs_provider != NULL && odrs_refine_flags != 0) {
 			data->n_pending_ops++;
+			data->odrs_begin_time_nsec = gs_profiler_get_current_time ();
 			gs_odrs_provider_refine_async (odrs_provider, list, odrs_refine_flags,
 						       cancellable, odrs_provider_refine_cb, g_object_ref (task));
+			return;
 		}
 	}
 
-	if (data->n_pending_ops > 0)
-		return;
-
 	/* At this point, all the plugin->refine() calls are complete and the
 	 * gs_odrs_provider_refine_async() call is also complete. If an error
 	 * occurred during those calls, return with it now rather than
@@ -607,9 +657,52 @@ app_thaw_notify_idle (gpointer data)
 static void run_cb (GObject      *source_object,
                     GAsyncResult *result,
                     gpointer      user_data);
+static void wait_cb (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data);
 static void finish_run (GTask     *task,
                         GsAppList *result_list);
 
+typedef struct {
+	GsPluginLoader *plugin_loader;  /* (owned) */
+	GsAppList *result_list;  /* (owned) (not nullable) */
+	GsAppList *cached_list;  /* (owned) (nullable) */
+	GsRefineCache *refine_cache;  /* (owned) (nullable) */
+	gchar *cache_stamp;  /* (owned) (nullable) */
+
+	/* apps which another job is already refining, for some or all of the
+	 * flags, and the ticket for the apps this job is refining */
+	GsAppList *partial_list;  /* (owned) (nullable) */
+	GsAppList *covered_list;  /* (owned) (nullable) */
+	GsRefineTicket *ticket;  /* (owned) (nullable) */
+	gboolean fallback_started;
+
+	guint n_pending_ops;
+	GError *error;  /* (owned) (nullable) */
+} RunData;
+
+static void
+run_data_free (RunData *data)
+{
+	g_clear_object (&data->plugin_loader);
+	g_clear_object (&data->result_list);
+	g_clear_object (&data->cached_list);
+	g_clear_object (&data->refine_cache);
+	g_free (data->cache_stamp);
+	g_clear_object (&data->partial_list);
+	g_clear_object (&data->covered_list);
+
+	/* the ticket must have been finished in run_cb() */
+	g_assert (data->ticket == NULL);
+
+	g_assert (data->n_pending_ops == 0);
+	g_assert (data->error == NULL);
+
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (RunData, run_data_free)
+
 static void
 gs_plugin_job_refine_run_async (GsPluginJob         *job,
                                 GsPluginLoader      *plugin_loader,
@@ -619,7 +712,12 @@ gs_plugin_job_refine_run_async (GsPluginJob         *job,
 {
 	GsPluginJobRefine *self = GS_PLUGIN_JOB_REFINE (job);
 	g_autoptr(GTask) task = NULL;
-	g_autoptr(GsAppList) result_list = NULL;
+	RunData *data;
+	g_autoptr(RunData) data_owned = NULL;
+	GsRefineCache *refine_cache;
+	GsPluginRefineFlags cached_flags = self->flags & ~GS_REFINE_CACHE_FLAGS;
+	GsPluginRefineFlags partial_flags = 0;
+	g_autoptr(GPtrArray) wait_tickets = NULL;
 
 	/* check required args */
 	task = g_task_new (job, cancellable, callback, user_data);
@@ -627,14 +725,16 @@ gs_plugin_job_refine_run_async (GsPluginJob         *job,
 
 	/* Operate on a copy of the input list so we don’t modify it when
 	 * resolving wildcards. */
-	result_list = gs_app_list_copy (self->app_list);
-	g_task_set_task_data (task, g_object_ref (result_list), (GDestroyNotify) g_object_unref);
+	data = data_owned = g_new0 (RunData, 1);
+	data->plugin_loader = g_object_ref (plugin_loader);
+	data->result_list = gs_app_list_copy (self->app_list);
+	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) run_data_free);
 
 	/* nothing to do */
 	if (self->flags == 0 ||
-	    gs_app_list_length (result_list) == 0) {
+	    gs_app_list_length (data->result_list) == 0) {
 		g_debug ("no refine flags set for transaction or app list is empty");
-		finish_run (task, result_list);
+		finish_run (task, data->result_list);
 		return;
 	}
 
@@ -644,12 +744,126 @@ gs_plugin_job_refine_run_async (GsPluginJob         *job,
 		g_object_freeze_notify (G_OBJECT (app));
 	}
 
+	/* Set the cacheable fields of any apps which are in the refine cache,
+	 * and move them to a separate list which is only refined for the
+	 * remaining flags. The cache needs the management plugin, so adopt
+	 * the apps first. */
+	refine_cache = gs_plugin_loader_get_refine_cache (plugin_loader);
+	if (refine_cache != NULL && (self->flags & GS_REFINE_CACHE_FLAGS) != 0)
+		data->cache_stamp = gs_refine_cache_compute_stamp (gs_plugin_loader_get_plugins (plugin_loader));
+
+	if (data->cache_stamp != NULL) {
+		data->refine_cache = g_object_ref (refine_cache);
+		gs_plugin_loader_run_adopt (plugin_loader, data->result_list);
+
+		for (guint i = 0; i < gs_app_list_length (data->result_list); i++) {
+			GsApp *app = gs_app_list_index (data->result_list, i);
+
+			if (!gs_refine_cache_lookup (data->refine_cache, app, data->cache_stamp, self->flags))
+				continue;
+			if (data->cached_list == NULL)
+				data->cached_list = gs_app_list_new ();
+			gs_app_list_add (data->cached_list, app);
+		}
+
+		if (data->cached_list != NULL) {
+			g_debug ("%u of %u apps found in refine cache",
+				 gs_app_list_length (data->cached_list),
+				 gs_app_list_length (data->result_list));
+			for (guint i = 0; i < gs_app_list_length (data->cached_list); i++)
+				gs_app_list_remove (data->result_list, gs_app_list_index (data->cached_list, i));
+		}
+	}
+
+	/* Don’t refine apps which another job is already refining; only
+	 * refine them for the flags it isn’t covering, then wait for it. This
+	 * waits for all the apps in the other job, not just the shared ones;
+	 * see gs-refine-coordinator.c. */
+	if (gs_app_list_length (data->result_list) > 0) {
+		data->partial_list = gs_app_list_new ();
+		data->covered_list = gs_app_list_new ();
+		wait_tickets = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_refine_ticket_unref);
+		data->ticket = gs_refine_coordinator_begin (gs_plugin_loader_get_refine_coordinator (plugin_loader),
+							    data->result_list, self->flags,
+							    data->partial_list, &partial_flags,
+							    data->covered_list, wait_tickets);
+
+		if (wait_tickets->len > 0)
+			g_debug ("%u apps being refined by %u other jobs; refining %u for remaining flags",
+				 gs_app_list_length (data->partial_list) + gs_app_list_length (data->covered_list),
+				 wait_tickets->len,
+				 gs_app_list_length (data->partial_list));
+	}
+
 	/* Start refining the apps. */
-	run_refine_internal_async (self, plugin_loader, result_list,
-				   self->flags, cancellable,
-				   run_cb, g_steal_pointer (&task));
+	data->n_pending_ops = 1;
+
+	if (gs_app_list_length (data->result_list) > 0) {
+		data->n_pending_ops++;
+		run_refine_internal_async (self, plugin_loader, data->result_list,
+					   self->flags, cancellable,
+					   run_cb, g_object_ref (task));
+	}
+
+	if (data->partial_list != NULL && gs_app_list_length (data->partial_list) > 0) {
+		data->n_pending_ops++;
+		run_refine_internal_async (self, plugin_loader, data->partial_list,
+					   partial_flags, cancellable,
+					   run_cb, g_object_ref (task));
+	}
+
+	for (guint i = 0; wait_tickets != NULL && i < wait_tickets->len; i++) {
+		data->n_pending_ops++;
+		gs_refine_ticket_wait_async (g_ptr_array_index (wait_tickets, i), cancellable,
+					     wait_cb, g_object_ref (task));
+	}
+
+	if (data->cached_list != NULL && cached_flags != 0) {
+		data->n_pending_ops++;
+		run_refine_internal_async (self, plugin_loader, data->cached_list,
+					   cached_flags, cancellable,
+					   run_cb, g_object_ref (task));
+	}
+
+	run_cb (G_OBJECT (self), NULL, g_steal_pointer (&task));
 }
 
+/* The apps in @input_list are refined in several subsets, so put them back in
+ * the order they were passed in. Any apps which wildcards resolved to go
+ * after them, in the order they were resolved. Apps which the refine removed,
+ * such as the wildcards themselves, stay removed. */
+static GsAppList *
+restore_input_order (GsAppList  *input_list,
+                     GsAppList **refined_lists,
+                     gsize       n_refined_lists)
+{
+	g_autoptr(GsAppList) ordered_list = gs_app_list_new ();
+	g_autoptr(GHashTable) refined = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	for (gsize i = 0; i < n_refined_lists; i++) {
+		for (guint j = 0; refined_lists[i] != NULL && j < gs_app_list_length (refined_lists[i]); j++)
+			g_hash_table_add (refined, gs_app_list_index (refined_lists[i], j));
+	}
+
+	for (guint i = 0; i < gs_app_list_length (input_list); i++) {
+		GsApp *app = gs_app_list_index (input_list, i);
+		if (g_hash_table_remove (refined, app))
+			gs_app_list_add (ordered_list, app);
+	}
+
+	for (gsize i = 0; i < n_refined_lists; i++) {
+		for (guint j = 0; refined_lists[i] != NULL && j < gs_app_list_length (refined_lists[i]); j++) {
+			GsApp *app = gs_app_list_index (refined_lists[i], j);
+			if (g_hash_table_remove (refined, app))
+				gs_app_list_add (ordered_list, app);
+		}
+	}
+
+	return g_steal_pointer (&ordered_list);
+}
+
+/* @result is %NULL for the initial call from gs_plugin_job_refine_run_async(),
+ * and for calls from wait_cb() */
 static void
 run_cb (GObject      *source_object,
         GAsyncResult *result,
@@ -657,10 +871,52 @@ run_cb (GObject      *source_object,
 {
 	GsPluginJobRefine *self = GS_PLUGIN_JOB_REFINE (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
-	GsAppList *result_list = g_task_get_task_data (task);
+	RunData *data = g_task_get_task_data (task);
+	GsAppList *result_list = data->result_list;
 	g_autoptr(GError) local_error = NULL;
 
-	if (run_refine_internal_finish (self, result, &local_error)) {
+	if (result != NULL &&
+	    !run_refine_internal_finish (self, result, &local_error)) {
+		if (data->error == NULL)
+			data->error = g_steal_pointer (&local_error);
+		else
+			g_debug ("Additional error while refining: %s", local_error->message);
+		g_clear_error (&local_error);
+	}
+
+	g_assert (data->n_pending_ops > 0);
+	data->n_pending_ops--;
+
+	if (data->n_pending_ops > 0)
+		return;
+
+	local_error = g_steal_pointer (&data->error);
+
+	if (data->ticket != NULL) {
+		gs_refine_ticket_finish (data->ticket, local_error == NULL);
+		g_clear_pointer (&data->ticket, gs_refine_ticket_unref);
+	}
+
+	if (local_error == NULL) {
+		GsAppList *refined_lists[] = {
+			data->result_list, data->cached_list,
+			data->partial_list, data->covered_list,
+		};
+		g_autoptr(GsAppList) ordered_list = NULL;
+
+		/* store the freshly refined apps before adding back the ones
+		 * which came from the cache */
+		if (data->refine_cache != NULL) {
+			for (guint i = 0; i < gs_app_list_length (result_list); i++) {
+				GsApp *app = gs_app_list_index (result_list, i);
+				gs_refine_cache_store (data->refine_cache, app, data->cache_stamp, self->flags);
+			}
+		}
+
+		ordered_list = restore_input_order (self->app_list, refined_lists, G_N_ELEMENTS (refined_lists));
+		gs_app_list_remove_all (result_list);
+		gs_app_list_add_list (result_list, ordered_list);
+
 		/* remove any addons that have the same source as the parent app */
 		for (guint i = 0; i < gs_app_list_length (result_list); i++) {
 			g_autoptr(GPtrArray) to_remove = g_ptr_array_new ();
@@ -707,6 +963,45 @@ run_cb (GObject      *source_object,
 	finish_run (task, result_list);
 }
 
+/* Called once another job which was refining some of the apps has finished, or
+ * this job was cancelled. If the other job failed, refine all the shared apps
+ * here instead, as it’s not known which of them it had refined. */
+static void
+wait_cb (GObject      *source_object,
+         GAsyncResult *result,
+         gpointer      user_data)
+{
+	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	GsPluginJobRefine *self = g_task_get_source_object (task);
+	RunData *data = g_task_get_task_data (task);
+	gboolean other_succeeded;
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_refine_ticket_wait_finish (result, &other_succeeded, &local_error)) {
+		if (data->error == NULL)
+			data->error = g_steal_pointer (&local_error);
+		else
+			g_debug ("Additional error while refining: %s", local_error->message);
+	} else if (!other_succeeded && !data->fallback_started) {
+		g_autoptr(GsAppList) fallback_list = gs_app_list_new ();
+
+		g_debug ("Other refine job failed; refining %u shared apps",
+			 gs_app_list_length (data->partial_list) + gs_app_list_length (data->covered_list));
+
+		data->fallback_started = TRUE;
+		gs_app_list_add_list (fallback_list, data->partial_list);
+		gs_app_list_add_list (fallback_list, data->covered_list);
+
+		data->n_pending_ops++;
+		run_refine_internal_async (self, data->plugin_loader, fallback_list,
+					   self->flags, g_task_get_cancellable (task),
+					   run_cb, g_object_ref (task));
+	}
+
+	/* Drop the pending op for the wait. */
+	run_cb (G_OBJECT (self), NULL, g_steal_pointer (&task));
+}
+
 static void
 finish_run (GTask     *task,
             GsAppList *result_list)
@@ -21,6 +21,7 @@ typedef struct
 	GsAppListFilterFlags	 dedupe_flags;
 	gboolean		 interactive;
 	gboolean		 propagate_error;
+	gboolean		 partial_results;
 	guint			 max_results;
 	guint			 timeout;
 	guint64			 age;
@@ -53,9 +54,17 @@ enum {
 	PROP_MAX_RESULTS,
 	PROP_TIMEOUT,
 	PROP_PROPAGATE_ERROR,
+	PROP_PARTIAL_RESULTS,
 	PROP_LAST
 };
 
+enum {
+	SIGNAL_PARTIAL_RESULTS,
+	SIGNAL_LAST
+};
+
+static guint signals [SIGNAL_LAST] = { 0 };
+
 G_DEFINE_TYPE_WITH_PRIVATE (GsPluginJob, gs_plugin_job, G_TYPE_OBJECT)
 
 gchar *
@@ -80,6 +89,8 @@ gs_plugin_job_to_string (GsPluginJob *self)
 		g_string_append_printf (str, " with interactive=True");
 	if (priv->propagate_error)
 		g_string_append_printf (str, " with propagate-error=True");
+	if (priv->partial_results)
+		g_string_append_printf (str, " with partial-results=True");
 	if (priv->timeout > 0)
 		g_string_append_printf (str, " with timeout=%u", priv->timeout);
 	if (priv->max_results > 0)
@@ -221,6 +232,31 @@ gs_plugin_job_get_propagate_error (GsPluginJob *self)
 	return priv->propagate_error;
 }
 
+void
+gs_plugin_job_set_partial_results (GsPluginJob *self, gboolean partial_results)
+{
+	GsPluginJobPrivate *priv = gs_plugin_job_get_instance_private (self);
+	g_return_if_fail (GS_IS_PLUGIN_JOB (self));
+	priv->partial_results = partial_results;
+}
+
+gboolean
+gs_plugin_job_get_partial_results (GsPluginJob *self)
+{
+	GsPluginJobPrivate *priv = gs_plugin_job_get_instance_private (self);
+	g_return_val_if_fail (GS_IS_PLUGIN_JOB (self), FALSE);
+	return priv->partial_results;
+}
+
+/* must be called from the #GMainContext the job was started from */
+void
+gs_plugin_job_emit_partial_results (GsPluginJob *self, GsAppList *list)
+{
+	g_return_if_fail (GS_IS_PLUGIN_JOB (self));
+	g_return_if_fail (GS_IS_APP_LIST (list));
+	g_signal_emit (self, signals[SIGNAL_PARTIAL_RESULTS], 0, list);
+}
+
 void
 gs_plugin_job_set_max_results (GsPluginJob *self, guint max_results)
 {
@@ -472,6 +508,9 @@ gs_plugin_job_get_property (GObject *obj, guint prop_id, GValue *value, GParamSp
 	case PROP_PROPAGATE_ERROR:
 		g_value_set_boolean (value, priv->propagate_error);
 		break;
+	case PROP_PARTIAL_RESULTS:
+		g_value_set_boolean (value, priv->partial_results);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
 		break;
@@ -526,6 +565,9 @@ gs_plugin_job_set_property (GObject *obj, guint prop_id, const GValue *value, GP
 	case PROP_PROPAGATE_ERROR:
 		gs_plugin_job_set_propagate_error (self, g_value_get_boolean (value));
 		break;
+	case PROP_PARTIAL_RESULTS:
+		gs_plugin_job_set_partial_results (self, g_value_get_boolean (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
 		break;
@@ -628,6 +670,20 @@ gs_plugin_job_class_init (GsPluginJobClass *klass)
 				      FALSE,
 				      G_PARAM_READWRITE);
 	g_object_class_install_property (object_class, PROP_PROPAGATE_ERROR, pspec);
+
+	pspec = g_param_spec_boolean ("partial-results", NULL, NULL,
+				      FALSE,
+				      G_PARAM_READWRITE);
+	g_object_class_install_property (object_class, PROP_PARTIAL_RESULTS, pspec);
+
+	/* emitted with all the refined results found so far each time a
+	 * search plugin finishes, if the partial-results property is set;
+	 * the list returned when the job completes supersedes these */
+	signals [SIGNAL_PARTIAL_RESULTS] =
+		g_signal_new ("partial-results",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_VOID__OBJECT,
+			      G_TYPE_NONE, 1, GS_TYPE_APP_LIST);
 }
 
 static void
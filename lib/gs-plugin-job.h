@@ -44,6 +44,8 @@ void		 gs_plugin_job_set_interactive		(GsPluginJob	*self,
 							 gboolean	 interactive);
 void		 gs_plugin_job_set_propagate_error	(GsPluginJob	*self,
 							 gboolean	 propagate_error);
+void		 gs_plugin_job_set_partial_results	(GsPluginJob	*self,
+							 gboolean	 partial_results);
 void		 gs_plugin_job_set_max_results		(GsPluginJob	*self,
 							 guint		 max_results);
 void		 gs_plugin_job_set_timeout		(GsPluginJob	*self,
@@ -14,10 +14,6 @@
 #include <appstream.h>
 #include <math.h>
 
-#ifdef HAVE_SYSPROF
-#include <sysprof-capture.h>
-#endif
-
 #include "gs-app-collation.h"
 #include "gs-app-private.h"
 #include "gs-app-list-private.h"
@@ -31,6 +27,8 @@
 #include "gs-plugin-event.h"
 #include "gs-plugin-job-private.h"
 #include "gs-plugin-private.h"
+#include "gs-profiler.h"
+#include "gs-refine-coordinator.h"
 #include "gs-utils.h"
 
 #define GS_PLUGIN_LOADER_UPDATES_CHANGED_DELAY	3	/* s */
@@ -44,6 +42,7 @@ struct _GsPluginLoader
 	GCancellable		*setup_complete_cancellable;  /* (nullable) (owned) */
 
 	GPtrArray		*plugins;
+	GHashTable		*plugin_deps;		/* GsPlugin : GHashTable (set of GsPlugin) */
 	GPtrArray		*locations;
 	gchar			*language;
 	gboolean		 plugin_dir_dirty;
@@ -55,6 +54,7 @@ struct _GsPluginLoader
 	GPtrArray		*pending_apps;
 
 	GThreadPool		*queued_ops_pool;
+	guint			 queued_ops_counter;  /* sysprof counter ID, or 0 */
 
 	GSettings		*settings;
 
@@ -76,10 +76,8 @@ struct _GsPluginLoader
 
 	GsCategoryManager	*category_manager;
 	GsOdrsProvider		*odrs_provider;  /* (owned) (nullable) */
-
-#ifdef HAVE_SYSPROF
-	SysprofCaptureWriter	*sysprof_writer;  /* (owned) (nullable) */
-#endif
+	GsRefineCache		*refine_cache;  /* (owned) (nullable) */
+	GsRefineCoordinator	*refine_coordinator;  /* (owned) */
 };
 
 static void gs_plugin_loader_monitor_network (GsPluginLoader *plugin_loader);
@@ -190,6 +188,9 @@ typedef struct {
 	guint				 timeout_id;
 	gboolean			 timeout_triggered;
 	gchar				**tokens;
+	GMainContext			*caller_context;
+	GsAppList			*partial_list;
+	guint				 partial_offset;
 } GsPluginLoaderHelper;
 
 static GsPluginLoaderHelper *
@@ -261,6 +262,9 @@ gs_plugin_loader_helper_free (GsPluginLoaderHelper *helper)
 	if (helper->catlist != NULL)
 		g_ptr_array_unref (helper->catlist);
 	g_strfreev (helper->tokens);
+	if (helper->caller_context != NULL)
+		g_main_context_unref (helper->caller_context);
+	g_clear_object (&helper->partial_list);
 	g_slice_free (GsPluginLoaderHelper, helper);
 }
 
@@ -575,9 +579,7 @@ gs_plugin_loader_call_vfunc (GsPluginLoaderHelper *helper,
 	gpointer func = NULL;
 	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GTimer) timer = g_timer_new ();
-#ifdef HAVE_SYSPROF
-	gint64 begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
-#endif
+	gint64 begin_time_nsec = gs_profiler_get_current_time ();
 
 	/* load the possible symbol */
 	func = gs_plugin_get_symbol (plugin, helper->function_name);
@@ -767,23 +769,15 @@ gs_plugin_loader_call_vfunc (GsPluginLoaderHelper *helper,
 	        add_app_to_install_queue (plugin_loader, app);
 	}
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
+	if (gs_profiler_is_enabled ()) {
 		g_autofree gchar *sysprof_name = NULL;
 		g_autofree gchar *sysprof_message = NULL;
 
-		sysprof_name = g_strconcat ("vfunc:", gs_plugin_action_to_string (action), NULL);
+		sysprof_name = g_strconcat ("vfunc:", gs_plugin_action_to_string (action),
+					    ":", gs_plugin_get_name (plugin), NULL);
 		sysprof_message = gs_plugin_job_to_string (helper->plugin_job);
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - begin_time_nsec,
-						 "gnome-software",
-						 sysprof_name,
-						 sysprof_message);
+		gs_profiler_add_mark (begin_time_nsec, sysprof_name, sysprof_message);
 	}
-#endif  /* HAVE_SYSPROF */
 
 	/* check the plugin didn't take too long */
 	if (g_timer_elapsed (timer, NULL) > 1.0f) {
@@ -853,15 +847,16 @@ gs_plugin_loader_job_sorted_truncation (GsPluginJob *plugin_job,
 	gs_app_list_truncate (list, max_results);
 }
 
+static void gs_plugin_loader_run_results_partial (GsPluginLoaderHelper *helper,
+						  GCancellable *cancellable);
+
 static gboolean
 gs_plugin_loader_run_results (GsPluginLoaderHelper *helper,
 			      GCancellable *cancellable,
 			      GError **error)
 {
 	GsPluginLoader *plugin_loader = helper->plugin_loader;
-#ifdef HAVE_SYSPROF
-	gint64 begin_time_nsec G_GNUC_UNUSED = SYSPROF_CAPTURE_CURRENT_TIME;
-#endif
+	gint64 begin_time_nsec = gs_profiler_get_current_time ();
 
 	/* Refining is done separately as it’s a special action */
 	g_assert (!GS_IS_PLUGIN_JOB_REFINE (helper->plugin_job));
@@ -879,10 +874,13 @@ gs_plugin_loader_run_results (GsPluginLoaderHelper *helper,
 			return FALSE;
 		}
 		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+
+		/* the final results follow soon after the last plugin */
+		if (helper->partial_list != NULL && i + 1 < plugin_loader->plugins->len)
+			gs_plugin_loader_run_results_partial (helper, cancellable);
 	}
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
+	if (gs_profiler_is_enabled ()) {
 		g_autofree gchar *sysprof_name = NULL;
 		g_autofree gchar *sysprof_message = NULL;
 
@@ -890,16 +888,8 @@ gs_plugin_loader_run_results (GsPluginLoaderHelper *helper,
 					    gs_plugin_action_to_string (gs_plugin_job_get_action (helper->plugin_job)),
 					    NULL);
 		sysprof_message = gs_plugin_job_to_string (helper->plugin_job);
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - begin_time_nsec,
-						 "gnome-software",
-						 sysprof_name,
-						 sysprof_message);
+		gs_profiler_add_mark (begin_time_nsec, sysprof_name, sysprof_message);
 	}
-#endif  /* HAVE_SYSPROF */
 
 	return TRUE;
 }
@@ -1247,9 +1237,7 @@ gs_plugin_loader_job_get_categories_thread_cb (GTask *task,
 	GsCategory * const *categories = NULL;
 	gsize n_categories;
 	g_autofree gchar *job_debug = NULL;
-#ifdef HAVE_SYSPROF
-	gint64 begin_time_nsec G_GNUC_UNUSED = SYSPROF_CAPTURE_CURRENT_TIME;
-#endif
+	gint64 begin_time_nsec = gs_profiler_get_current_time ();
 
 	/* get the categories */
 	categories = gs_category_manager_get_categories (plugin_loader->category_manager, &n_categories);
@@ -1270,19 +1258,10 @@ gs_plugin_loader_job_get_categories_thread_cb (GTask *task,
 		gs_category_sort_children (cat);
 	}
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
+	if (gs_profiler_is_enabled ()) {
 		g_autofree gchar *sysprof_message = gs_plugin_job_to_string (helper->plugin_job);
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - begin_time_nsec,
-						 "gnome-software",
-						 "get-categories",
-						 sysprof_message);
+		gs_profiler_add_mark (begin_time_nsec, "get-categories", sysprof_message);
 	}
-#endif  /* HAVE_SYSPROF */
 
 	/* show elapsed time */
 	job_debug = gs_plugin_job_to_string (helper->plugin_job);
@@ -1427,6 +1406,106 @@ async_result_cb (GObject      *source_object,
 	g_main_context_wakeup (g_main_context_get_thread_default ());
 }
 
+typedef struct {
+	GsPluginJob	*plugin_job;
+	GsAppList	*list;
+	GCancellable	*cancellable;
+} GsPluginLoaderPartialResults;
+
+static void
+gs_plugin_loader_partial_results_free (GsPluginLoaderPartialResults *data)
+{
+	g_object_unref (data->plugin_job);
+	g_object_unref (data->list);
+	g_clear_object (&data->cancellable);
+	g_free (data);
+}
+
+static gboolean
+gs_plugin_loader_partial_results_cb (gpointer user_data)
+{
+	GsPluginLoaderPartialResults *data = user_data;
+
+	/* the caller has already moved on */
+	if (data->cancellable != NULL && g_cancellable_is_cancelled (data->cancellable))
+		return G_SOURCE_REMOVE;
+
+	gs_plugin_job_emit_partial_results (data->plugin_job, data->list);
+	return G_SOURCE_REMOVE;
+}
+
+/* Refine and filter the results added since the last call, exactly as
+ * gs_plugin_loader_process_thread_cb() does for the whole list, and send
+ * everything found so far to the caller. This is best-effort: errors are
+ * ignored as the final results will report them. */
+static void
+gs_plugin_loader_run_results_partial (GsPluginLoaderHelper *helper,
+				      GCancellable *cancellable)
+{
+	GsPluginLoader *plugin_loader = helper->plugin_loader;
+	GsAppList *list = gs_plugin_job_get_list (helper->plugin_job);
+	GsPluginRefineFlags refine_flags = gs_plugin_job_get_refine_flags (helper->plugin_job);
+	GsAppListFilterFlags dedupe_flags = gs_plugin_job_get_dedupe_flags (helper->plugin_job);
+	GsPluginLoaderPartialResults *data;
+	g_autoptr(GsAppList) batch = gs_app_list_new ();
+	g_autoptr(GsAppList) results = NULL;
+
+	/* nothing new */
+	if (gs_app_list_length (list) <= helper->partial_offset)
+		return;
+	for (guint i = helper->partial_offset; i < gs_app_list_length (list); i++)
+		gs_app_list_add (batch, gs_app_list_index (list, i));
+	helper->partial_offset = gs_app_list_length (list);
+
+	/* refine only the new apps */
+	if (refine_flags != 0) {
+		g_autoptr(GsPluginJob) refine_job = NULL;
+		g_autoptr(GAsyncResult) refine_result = NULL;
+		g_autoptr(GsAppList) new_list = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		refine_job = gs_plugin_job_refine_new (batch, refine_flags | GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
+		gs_plugin_loader_job_process_async (plugin_loader, refine_job,
+						    cancellable,
+						    async_result_cb,
+						    &refine_result);
+		while (refine_result == NULL)
+			g_main_context_iteration (g_main_context_get_thread_default (), TRUE);
+
+		new_list = gs_plugin_loader_job_process_finish (plugin_loader, refine_result, &error_local);
+		if (new_list == NULL) {
+			g_debug ("failed to refine partial results: %s", error_local->message);
+			return;
+		}
+		g_set_object (&batch, new_list);
+	}
+
+	gs_app_list_filter (batch, gs_plugin_loader_app_is_valid_filter, helper);
+	gs_app_list_filter (batch, gs_plugin_loader_filter_qt_for_gtk, NULL);
+	gs_app_list_filter (batch, gs_plugin_loader_get_app_is_compatible, plugin_loader);
+	if (gs_app_list_length (batch) == 0)
+		return;
+	gs_app_list_add_list (helper->partial_list, batch);
+
+	/* dedupe, sort and truncate a snapshot of everything so far */
+	results = gs_app_list_copy (helper->partial_list);
+	if (dedupe_flags != GS_APP_LIST_FILTER_FLAG_NONE)
+		gs_app_list_filter_duplicates (results, dedupe_flags);
+	gs_plugin_loader_job_sorted_truncation (helper->plugin_job, results);
+	gs_plugin_loader_job_sorted_truncation_again (helper->plugin_job, results);
+
+	g_debug ("emitting %u partial results for %s",
+		 gs_app_list_length (results),
+		 gs_plugin_action_to_string (gs_plugin_job_get_action (helper->plugin_job)));
+	data = g_new0 (GsPluginLoaderPartialResults, 1);
+	data->plugin_job = g_object_ref (helper->plugin_job);
+	data->list = g_steal_pointer (&results);
+	data->cancellable = (cancellable != NULL) ? g_object_ref (cancellable) : NULL;
+	g_main_context_invoke_full (helper->caller_context, G_PRIORITY_DEFAULT,
+				    gs_plugin_loader_partial_results_cb, data,
+				    (GDestroyNotify) gs_plugin_loader_partial_results_free);
+}
+
 /* This will load the install queue and add it to #GsPluginLoader.pending_apps,
  * but it won’t refine the loaded apps. */
 static GsAppList *
@@ -2142,10 +2221,8 @@ gs_plugin_loader_find_plugins (const gchar *path, GError **error)
 
 typedef struct {
 	guint n_pending;
-#ifdef HAVE_SYSPROF
 	gint64 setup_begin_time_nsec;
 	gint64 plugins_begin_time_nsec;
-#endif
 } SetupData;
 
 static void
@@ -2175,6 +2252,104 @@ notify_setup_complete (GsPluginLoader *plugin_loader)
 	g_clear_object (&plugin_loader->setup_complete_cancellable);
 }
 
+/* Records, for every plugin, the set of plugins which have to run before it
+ * according to the %GS_PLUGIN_RULE_RUN_AFTER and %GS_PLUGIN_RULE_RUN_BEFORE
+ * rules, following the rules transitively. Disabled plugins are included so
+ * that a chain of rules going through one is not broken. */
+static void
+gs_plugin_loader_calculate_plugin_deps (GsPluginLoader *plugin_loader)
+{
+	gboolean changes;
+
+	g_hash_table_remove_all (plugin_loader->plugin_deps);
+	for (guint i = 0; i < plugin_loader->plugins->len; i++) {
+		GsPlugin *plugin = g_ptr_array_index (plugin_loader->plugins, i);
+		g_hash_table_insert (plugin_loader->plugin_deps, plugin,
+				     g_hash_table_new (g_direct_hash, g_direct_equal));
+	}
+
+	/* direct edges */
+	for (guint i = 0; i < plugin_loader->plugins->len; i++) {
+		GsPlugin *plugin = g_ptr_array_index (plugin_loader->plugins, i);
+		GPtrArray *deps;
+
+		deps = gs_plugin_get_rules (plugin, GS_PLUGIN_RULE_RUN_AFTER);
+		for (guint j = 0; j < deps->len; j++) {
+			GsPlugin *dep = gs_plugin_loader_find_plugin (plugin_loader,
+								      g_ptr_array_index (deps, j));
+			if (dep != NULL && dep != plugin)
+				g_hash_table_add (g_hash_table_lookup (plugin_loader->plugin_deps, plugin), dep);
+		}
+		deps = gs_plugin_get_rules (plugin, GS_PLUGIN_RULE_RUN_BEFORE);
+		for (guint j = 0; j < deps->len; j++) {
+			GsPlugin *dep = gs_plugin_loader_find_plugin (plugin_loader,
+								      g_ptr_array_index (deps, j));
+			if (dep != NULL && dep != plugin)
+				g_hash_table_add (g_hash_table_lookup (plugin_loader->plugin_deps, dep), plugin);
+		}
+	}
+
+	/* transitive closure; the ordering above has already failed if there
+	 * is a loop, so this terminates */
+	do {
+		changes = FALSE;
+		for (guint i = 0; i < plugin_loader->plugins->len; i++) {
+			GsPlugin *plugin = g_ptr_array_index (plugin_loader->plugins, i);
+			GHashTable *deps = g_hash_table_lookup (plugin_loader->plugin_deps, plugin);
+			g_autoptr(GPtrArray) indirect = g_ptr_array_new ();
+			GHashTableIter iter;
+			gpointer dep;
+
+			g_hash_table_iter_init (&iter, deps);
+			while (g_hash_table_iter_next (&iter, &dep, NULL)) {
+				GHashTable *dep_deps = g_hash_table_lookup (plugin_loader->plugin_deps, dep);
+				GHashTableIter iter2;
+				gpointer dep2;
+
+				g_hash_table_iter_init (&iter2, dep_deps);
+				while (g_hash_table_iter_next (&iter2, &dep2, NULL)) {
+					if (dep2 != plugin && !g_hash_table_contains (deps, dep2))
+						g_ptr_array_add (indirect, dep2);
+				}
+			}
+			for (guint j = 0; j < indirect->len; j++) {
+				if (g_hash_table_add (deps, g_ptr_array_index (indirect, j)))
+					changes = TRUE;
+			}
+		}
+	} while (changes);
+}
+
+/**
+ * gs_plugin_loader_plugin_runs_after:
+ * @plugin_loader: a #GsPluginLoader
+ * @plugin: a #GsPlugin
+ * @dep: another #GsPlugin
+ *
+ * Checks whether @plugin has to be run after @dep, either directly or through
+ * a chain of other plugins, because of %GS_PLUGIN_RULE_RUN_AFTER or
+ * %GS_PLUGIN_RULE_RUN_BEFORE rules.
+ *
+ * Plugins where this is not true in either direction may be run in parallel.
+ *
+ * Returns: %TRUE if @plugin depends on the results of @dep
+ * Since: 43
+ */
+gboolean
+gs_plugin_loader_plugin_runs_after (GsPluginLoader *plugin_loader,
+				    GsPlugin       *plugin,
+				    GsPlugin       *dep)
+{
+	GHashTable *deps;
+
+	g_return_val_if_fail (GS_IS_PLUGIN_LOADER (plugin_loader), FALSE);
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
+	g_return_val_if_fail (GS_IS_PLUGIN (dep), FALSE);
+
+	deps = g_hash_table_lookup (plugin_loader->plugin_deps, plugin);
+	return deps != NULL && g_hash_table_contains (deps, dep);
+}
+
 /**
  * gs_plugin_loader_setup_async:
  * @plugin_loader: a #GsPluginLoader
@@ -2211,9 +2386,7 @@ gs_plugin_loader_setup_async (GsPluginLoader      *plugin_loader,
 	g_autoptr(GPtrArray) locations = NULL;
 	g_autoptr(GTask) task = NULL;
 	g_autoptr(GError) local_error = NULL;
-#ifdef HAVE_SYSPROF
-	gint64 begin_time_nsec G_GNUC_UNUSED = SYSPROF_CAPTURE_CURRENT_TIME;
-#endif
+	gint64 begin_time_nsec = gs_profiler_get_current_time ();
 
 	task = g_task_new (plugin_loader, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_loader_setup_async);
@@ -2364,6 +2537,9 @@ gs_plugin_loader_setup_async (GsPluginLoader      *plugin_loader,
 		}
 	} while (changes);
 
+	/* save the ordering for working out what can be run in parallel */
+	gs_plugin_loader_calculate_plugin_deps (plugin_loader);
+
 	/* check for conflicts */
 	for (i = 0; i < plugin_loader->plugins->len; i++) {
 		plugin = g_ptr_array_index (plugin_loader->plugins, i);
@@ -2429,10 +2605,8 @@ gs_plugin_loader_setup_async (GsPluginLoader      *plugin_loader,
 	/* run setup */
 	setup_data = setup_data_owned = g_new0 (SetupData, 1);
 	setup_data->n_pending = 1;  /* incremented until all operations have been started */
-#ifdef HAVE_SYSPROF
 	setup_data->setup_begin_time_nsec = begin_time_nsec;
-	setup_data->plugins_begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
-#endif
+	setup_data->plugins_begin_time_nsec = gs_profiler_get_current_time ();
 
 	g_task_set_task_data (task, g_steal_pointer (&setup_data_owned), (GDestroyNotify) setup_data_free);
 
@@ -2472,18 +2646,7 @@ plugin_setup_cb (GObject      *source_object,
 		gs_plugin_set_enabled (plugin, FALSE);
 	}
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 data->plugins_begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - data->plugins_begin_time_nsec,
-						 "gnome-software",
-						 "setup-plugin",
-						 NULL);
-	}
-#endif  /* HAVE_SYSPROF */
+	gs_profiler_add_mark (data->plugins_begin_time_nsec, "setup-plugin", gs_plugin_get_name (plugin));
 
 	/* Indicate this plugin has finished setting up. */
 	finish_setup_op (task);
@@ -2517,18 +2680,7 @@ finish_setup_op (GTask *task)
 	 * queue apps, which requires @setup_complete to be %TRUE. */
 	notify_setup_complete (plugin_loader);
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 data->setup_begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - data->setup_begin_time_nsec,
-						 "gnome-software",
-						 "setup",
-						 NULL);
-	}
-#endif  /* HAVE_SYSPROF */
+	gs_profiler_add_mark (data->setup_begin_time_nsec, "setup", NULL);
 
 	/* Refine the install queue. */
 	if (gs_app_list_length (install_queue) > 0) {
@@ -2686,11 +2838,9 @@ gs_plugin_loader_dispose (GObject *object)
 	g_clear_pointer (&plugin_loader->pending_apps, g_ptr_array_unref);
 	g_clear_object (&plugin_loader->category_manager);
 	g_clear_object (&plugin_loader->odrs_provider);
+	g_clear_object (&plugin_loader->refine_cache);
 	g_clear_object (&plugin_loader->setup_complete_cancellable);
 
-#ifdef HAVE_SYSPROF
-	g_clear_pointer (&plugin_loader->sysprof_writer, sysprof_capture_writer_unref);
-#endif
 
 	G_OBJECT_CLASS (gs_plugin_loader_parent_class)->dispose (object);
 }
@@ -2706,11 +2856,16 @@ gs_plugin_loader_finalize (GObject *object)
 	g_ptr_array_unref (plugin_loader->file_monitors);
 	g_hash_table_unref (plugin_loader->events_by_id);
 	g_hash_table_unref (plugin_loader->disallow_updates);
+	g_hash_table_unref (plugin_loader->plugin_deps);
 	g_clear_object (&plugin_loader->as_pool);
 
 	g_mutex_clear (&plugin_loader->pending_apps_mutex);
 	g_mutex_clear (&plugin_loader->events_by_id_mutex);
 
+	gs_refine_coordinator_free (plugin_loader->refine_coordinator);
+
+	gs_profiler_release ();
+
 	G_OBJECT_CLASS (gs_plugin_loader_parent_class)->finalize (object);
 }
 
@@ -2817,14 +2972,16 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 	guint i;
 	g_autofree gchar *review_server = NULL;
 	g_autofree gchar *user_hash = NULL;
+	g_autofree gchar *refine_cache_filename = NULL;
 	g_autoptr(GError) local_error = NULL;
 	const guint64 odrs_review_max_cache_age_secs = 237000;  /* 1 week */
 	const guint odrs_review_n_results_max = 20;
 	const gchar *locale;
 
-#ifdef HAVE_SYSPROF
-	plugin_loader->sysprof_writer = sysprof_capture_writer_new_from_env (0);
-#endif  /* HAVE_SYSPROF */
+	gs_profiler_acquire ();
+	plugin_loader->queued_ops_counter = gs_profiler_define_counter ("gnome-software",
+									 "Queued jobs",
+									 "Jobs waiting for a thread in the plugin loader");
 
 	plugin_loader->setup_complete_cancellable = g_cancellable_new ();
 	plugin_loader->scale = 1;
@@ -2835,6 +2992,8 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 						   get_max_parallel_ops (),
 						   FALSE,
 						   NULL);
+	plugin_loader->plugin_deps = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+							    NULL, (GDestroyNotify) g_hash_table_unref);
 	plugin_loader->file_monitors = g_ptr_array_new_with_free_func (g_object_unref);
 	plugin_loader->locations = g_ptr_array_new_with_free_func (g_free);
 	plugin_loader->settings = g_settings_new ("org.gnome.software");
@@ -2887,6 +3046,22 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 		}
 	}
 
+	/* set up the refine cache */
+	g_clear_error (&local_error);
+	refine_cache_filename = gs_utils_get_cache_filename ("refine",
+							     "cache.gvariant",
+							     GS_UTILS_CACHE_FLAG_WRITEABLE |
+							     GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+							     &local_error);
+	if (refine_cache_filename == NULL) {
+		g_warning ("Failed to get refine cache filename: %s", local_error->message);
+		g_clear_error (&local_error);
+	} else {
+		plugin_loader->refine_cache = gs_refine_cache_new (refine_cache_filename);
+	}
+
+	plugin_loader->refine_coordinator = gs_refine_coordinator_new ();
+
 	/* the settings key sets the initial override */
 	plugin_loader->disallow_updates = g_hash_table_new (g_direct_hash, g_direct_equal);
 	gs_plugin_loader_allow_updates_recheck (plugin_loader);
@@ -3153,9 +3328,8 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 	g_autoptr(GMainContext) context = g_main_context_new ();
 	g_autoptr(GMainContextPusher) pusher = g_main_context_pusher_new (context);
 	g_autofree gchar *job_debug = NULL;
-#ifdef HAVE_SYSPROF
-	gint64 begin_time_nsec G_GNUC_UNUSED = SYSPROF_CAPTURE_CURRENT_TIME;
-#endif
+	gint64 begin_time_nsec = gs_profiler_get_current_time ();
+	gint64 stage_begin_time_nsec;
 
 	/* these change the pending count on the installed panel */
 	switch (action) {
@@ -3285,7 +3459,9 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 	}
 
 	/* filter to reduce to a sane set */
+	stage_begin_time_nsec = gs_profiler_get_current_time ();
 	gs_plugin_loader_job_sorted_truncation (helper->plugin_job, list);
+	gs_profiler_add_mark (stage_begin_time_nsec, "sort-truncate", gs_plugin_action_to_string (action));
 
 	/* set the local file on any of the returned results */
 	switch (action) {
@@ -3321,6 +3497,7 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 		g_autoptr(GAsyncResult) refine_result = NULL;
 		g_autoptr(GsAppList) new_list = NULL;
 
+		stage_begin_time_nsec = gs_profiler_get_current_time ();
 		refine_job = gs_plugin_job_refine_new (list, gs_plugin_job_get_refine_flags (helper->plugin_job) | GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
 		gs_plugin_loader_job_process_async (plugin_loader, refine_job,
 						    cancellable,
@@ -3341,6 +3518,8 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 
 		/* Update the app list in case the refine resolved any wildcards. */
 		g_set_object (&list, new_list);
+
+		gs_profiler_add_mark (stage_begin_time_nsec, "refine", gs_plugin_action_to_string (action));
 	} else {
 		g_debug ("no refine flags set for transaction");
 	}
@@ -3395,6 +3574,7 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 	}
 
 	/* filter package list */
+	stage_begin_time_nsec = gs_profiler_get_current_time ();
 	switch (action) {
 	case GS_PLUGIN_ACTION_URL_TO_APP:
 		gs_app_list_filter (list, gs_plugin_loader_app_is_valid_filter, helper);
@@ -3438,6 +3618,7 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 	default:
 		break;
 	}
+	gs_profiler_add_mark (stage_begin_time_nsec, "filter", gs_plugin_action_to_string (action));
 
 	/* only allow one result */
 	if (action == GS_PLUGIN_ACTION_URL_TO_APP ||
@@ -3463,29 +3644,25 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 	/* filter duplicates with priority, taking into account the source name
 	 * & version, so we combine available updates with the installed app */
 	dedupe_flags = gs_plugin_job_get_dedupe_flags (helper->plugin_job);
-	if (dedupe_flags != GS_APP_LIST_FILTER_FLAG_NONE)
+	if (dedupe_flags != GS_APP_LIST_FILTER_FLAG_NONE) {
+		stage_begin_time_nsec = gs_profiler_get_current_time ();
 		gs_app_list_filter_duplicates (list, dedupe_flags);
+		gs_profiler_add_mark (stage_begin_time_nsec, "dedupe", gs_plugin_action_to_string (action));
+	}
 
 	/* sort these again as the refine may have added useful metadata */
+	stage_begin_time_nsec = gs_profiler_get_current_time ();
 	gs_plugin_loader_job_sorted_truncation_again (helper->plugin_job, list);
+	gs_profiler_add_mark (stage_begin_time_nsec, "sort", gs_plugin_action_to_string (action));
 
 	/* Hint that the job has finished. */
 	gs_plugin_loader_hint_job_finished (plugin_loader);
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
+	if (gs_profiler_is_enabled ()) {
 		g_autofree gchar *sysprof_name = g_strconcat ("process-thread:", gs_plugin_action_to_string (action), NULL);
 		g_autofree gchar *sysprof_message = gs_plugin_job_to_string (helper->plugin_job);
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - begin_time_nsec,
-						 "gnome-software",
-						 sysprof_name,
-						 sysprof_message);
+		gs_profiler_add_mark (begin_time_nsec, sysprof_name, sysprof_message);
 	}
-#endif  /* HAVE_SYSPROF */
 
 	/* show elapsed time */
 	job_debug = gs_plugin_job_to_string (helper->plugin_job);
@@ -3506,6 +3683,10 @@ gs_plugin_loader_process_in_thread_pool_cb (gpointer data,
 	GsPluginLoaderHelper *helper = g_task_get_task_data (task);
 	GsApp *app = gs_plugin_job_get_app (helper->plugin_job);
 	GsPluginAction action = gs_plugin_job_get_action (helper->plugin_job);
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (source_object);
+
+	gs_profiler_set_counter (plugin_loader->queued_ops_counter,
+				 g_thread_pool_unprocessed (plugin_loader->queued_ops_pool));
 
 	gs_ioprio_set (G_PRIORITY_LOW);
 
@@ -3611,6 +3792,8 @@ gs_plugin_loader_schedule_task (GsPluginLoader *plugin_loader,
 		gs_app_set_pending_action (app, action);
 	}
 	g_thread_pool_push (plugin_loader->queued_ops_pool, g_object_ref (task), NULL);
+	gs_profiler_set_counter (plugin_loader->queued_ops_counter,
+				 g_thread_pool_unprocessed (plugin_loader->queued_ops_pool));
 }
 
 static void
@@ -3622,25 +3805,14 @@ run_job_cb (GObject      *source_object,
 	GsPluginJobClass *job_class;
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
 	GsPluginLoader *plugin_loader = g_task_get_source_object (task);
-#ifdef HAVE_SYSPROF
 	gint64 begin_time_nsec = GPOINTER_TO_SIZE (g_task_get_task_data (task));
-#endif  /* HAVE_SYSPROF */
 	g_autoptr(GError) local_error = NULL;
 
-#ifdef HAVE_SYSPROF
-	if (plugin_loader->sysprof_writer != NULL) {
+	if (gs_profiler_is_enabled ()) {
 		g_autofree gchar *sysprof_name = g_strconcat ("process-thread:", G_OBJECT_TYPE_NAME (plugin_job), NULL);
 		g_autofree gchar *sysprof_message = gs_plugin_job_to_string (plugin_job);
-		sysprof_capture_writer_add_mark (plugin_loader->sysprof_writer,
-						 begin_time_nsec,
-						 sched_getcpu (),
-						 getpid (),
-						 SYSPROF_CAPTURE_CURRENT_TIME - begin_time_nsec,
-						 "gnome-software",
-						 sysprof_name,
-						 sysprof_message);
+		gs_profiler_add_mark (begin_time_nsec, sysprof_name, sysprof_message);
 	}
-#endif  /* HAVE_SYSPROF */
 
 	/* Hint that the job has finished. */
 	gs_plugin_loader_hint_job_finished (plugin_loader);
@@ -3813,11 +3985,9 @@ job_process_cb (GTask *task)
 	 * gs_plugin_loader_job_process_async() is removed. */
 
 	if (job_class->run_async != NULL) {
-#ifdef HAVE_SYSPROF
-		gint64 begin_time_nsec G_GNUC_UNUSED = SYSPROF_CAPTURE_CURRENT_TIME;
+		gint64 begin_time_nsec = gs_profiler_get_current_time ();
 
 		g_task_set_task_data (task, GSIZE_TO_POINTER (begin_time_nsec), NULL);
-#endif
 
 		job_class->run_async (plugin_job, plugin_loader, cancellable,
 				      run_job_cb, g_object_ref (task));
@@ -3953,6 +4123,20 @@ job_process_cb (GTask *task)
 	helper = gs_plugin_loader_helper_new (plugin_loader, plugin_job);
 	g_task_set_task_data (task, helper, (GDestroyNotify) gs_plugin_loader_helper_free);
 
+	/* send results to the caller as each plugin finishes */
+	if (gs_plugin_job_get_partial_results (plugin_job)) {
+		switch (action) {
+		case GS_PLUGIN_ACTION_SEARCH:
+		case GS_PLUGIN_ACTION_SEARCH_FILES:
+		case GS_PLUGIN_ACTION_SEARCH_PROVIDES:
+			helper->caller_context = g_main_context_ref (g_task_get_context (task));
+			helper->partial_list = gs_app_list_new ();
+			break;
+		default:
+			break;
+		}
+	}
+
 	/* let the task cancel itself */
 	g_task_set_check_cancellable (task, FALSE);
 	g_task_set_return_on_cancel (task, FALSE);
@@ -3964,7 +4148,9 @@ job_process_cb (GTask *task)
 	/* pre-tokenize search */
 	if (action == GS_PLUGIN_ACTION_SEARCH) {
 		const gchar *search = gs_plugin_job_get_search (plugin_job);
+		gint64 tokenize_begin_time_nsec = gs_profiler_get_current_time ();
 		helper->tokens = as_pool_build_search_tokens (plugin_loader->as_pool, search);
+		gs_profiler_add_mark (tokenize_begin_time_nsec, "tokenize", search);
 		if (helper->tokens == NULL) {
 			g_task_return_new_error (task,
 						 GS_PLUGIN_ERROR,
@@ -4262,6 +4448,34 @@ gs_plugin_loader_get_odrs_provider (GsPluginLoader *plugin_loader)
 	return plugin_loader->odrs_provider;
 }
 
+/**
+ * gs_plugin_loader_get_refine_cache:
+ * @plugin_loader: a #GsPluginLoader
+ *
+ * Get the singleton #GsRefineCache which stores refine results between runs.
+ *
+ * Returns: (transfer none) (nullable): a #GsRefineCache, or %NULL if the
+ *   cache directory is not available
+ * Since: 43
+ */
+GsRefineCache *
+gs_plugin_loader_get_refine_cache (GsPluginLoader *plugin_loader)
+{
+	g_return_val_if_fail (GS_IS_PLUGIN_LOADER (plugin_loader), NULL);
+
+	return plugin_loader->refine_cache;
+}
+
+/* Private, declared in gs-refine-coordinator.h. Returns the coordinator which
+ * deduplicates refines between concurrent #GsPluginJobRefine jobs. */
+GsRefineCoordinator *
+gs_plugin_loader_get_refine_coordinator (GsPluginLoader *plugin_loader)
+{
+	g_return_val_if_fail (GS_IS_PLUGIN_LOADER (plugin_loader), NULL);
+
+	return plugin_loader->refine_coordinator;
+}
+
 /**
  * gs_plugin_loader_set_max_parallel_ops:
  * @plugin_loader: a #GsPluginLoader
@@ -17,6 +17,7 @@
 #include "gs-odrs-provider.h"
 #include "gs-plugin-event.h"
 #include "gs-plugin.h"
+#include "gs-refine-cache.h"
 
 G_BEGIN_DECLS
 
@@ -74,6 +75,9 @@ gboolean	 gs_plugin_loader_get_plugin_supported	(GsPluginLoader	*plugin_loader,
 							 const gchar	*function_name);
 
 GPtrArray	*gs_plugin_loader_get_plugins		(GsPluginLoader	*plugin_loader);
+gboolean	 gs_plugin_loader_plugin_runs_after	(GsPluginLoader	*plugin_loader,
+							 GsPlugin	*plugin,
+							 GsPlugin	*dep);
 
 void		 gs_plugin_loader_add_event		(GsPluginLoader *plugin_loader,
 							 GsPluginEvent	*event);
@@ -97,6 +101,7 @@ GsApp		*gs_plugin_loader_get_system_app_finish	(GsPluginLoader	*plugin_loader,
 							 GAsyncResult	*res,
 							 GError		**error);
 GsOdrsProvider	*gs_plugin_loader_get_odrs_provider	(GsPluginLoader	*plugin_loader);
+GsRefineCache	*gs_plugin_loader_get_refine_cache	(GsPluginLoader	*plugin_loader);
 
 /* only useful from the self tests */
 void		 gs_plugin_loader_clear_caches		(GsPluginLoader	*plugin_loader);
@@ -69,6 +69,8 @@ typedef struct
 	guint			 timer_id;
 	GMutex			 timer_mutex;
 	GNetworkMonitor		*network_monitor;
+	gchar			*refine_cache_stamp;	/* (nullable) (owned) */
+	GMutex			 refine_cache_stamp_mutex;
 } GsPluginPrivate;
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (GsPlugin, gs_plugin, G_TYPE_OBJECT)
@@ -221,6 +223,7 @@ gs_plugin_finalize (GObject *object)
 	g_free (priv->name);
 	g_free (priv->appstream_id);
 	g_free (priv->language);
+	g_free (priv->refine_cache_stamp);
 	if (priv->network_monitor != NULL)
 		g_object_unref (priv->network_monitor);
 	g_hash_table_unref (priv->cache);
@@ -229,6 +232,7 @@ gs_plugin_finalize (GObject *object)
 	g_mutex_clear (&priv->interactive_mutex);
 	g_mutex_clear (&priv->timer_mutex);
 	g_mutex_clear (&priv->vfuncs_mutex);
+	g_mutex_clear (&priv->refine_cache_stamp_mutex);
 #ifndef RUNNING_ON_VALGRIND
 	if (priv->module != NULL)
 		g_module_close (priv->module);
@@ -378,6 +382,62 @@ gs_plugin_set_appstream_id (GsPlugin *plugin, const gchar *appstream_id)
 	priv->appstream_id = g_strdup (appstream_id);
 }
 
+/**
+ * gs_plugin_dup_refine_cache_stamp:
+ * @plugin: a #GsPlugin
+ *
+ * Gets the stamp set with gs_plugin_set_refine_cache_stamp().
+ *
+ * Returns: (transfer full) (nullable): the stamp, or %NULL if not set
+ *
+ * Since: 43
+ **/
+gchar *
+gs_plugin_dup_refine_cache_stamp (GsPlugin *plugin)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), NULL);
+
+	locker = g_mutex_locker_new (&priv->refine_cache_stamp_mutex);
+	return g_strdup (priv->refine_cache_stamp);
+}
+
+/**
+ * gs_plugin_set_refine_cache_stamp:
+ * @plugin: a #GsPlugin
+ * @stamp: (nullable): an opaque string identifying the state of the data the
+ *   plugin refines apps from, or %NULL to unset it
+ *
+ * Sets a stamp which identifies the on-disk state that the plugin’s refine
+ * results are derived from, such as the GUID of an appstream silo or the
+ * modification time of a package database. It must change whenever that
+ * state changes, including across restarts.
+ *
+ * Refine results are cached on disk between runs, and are only reused while
+ * the stamps of all the plugins are the same as when they were cached.
+ * Plugins which refine apps from state which can change, and which don’t set
+ * a stamp, risk stale data being shown after a restart.
+ *
+ * This can be called from any thread.
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_set_refine_cache_stamp (GsPlugin    *plugin,
+                                  const gchar *stamp)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+
+	locker = g_mutex_locker_new (&priv->refine_cache_stamp_mutex);
+	g_free (priv->refine_cache_stamp);
+	priv->refine_cache_stamp = g_strdup (stamp);
+}
+
 /**
  * gs_plugin_get_scale:
  * @plugin: a #GsPlugin
@@ -616,6 +676,10 @@ gs_plugin_remove_flags (GsPlugin *plugin, GsPluginFlags flags)
  * for example the plugin specified by @name will be ordered after this plugin
  * when %GS_PLUGIN_RULE_RUN_AFTER is used.
  *
+ * The %GS_PLUGIN_RULE_RUN_AFTER and %GS_PLUGIN_RULE_RUN_BEFORE rules are also
+ * the only thing which stops the #GsPluginClass.refine_async vfuncs of two
+ * plugins being run in parallel.
+ *
  * NOTE: The depsolver is iterative and may not solve overly-complicated rules;
  * If depsolving fails then gnome-software will not start.
  *
@@ -1807,6 +1871,7 @@ gs_plugin_init (GsPlugin *plugin)
 	g_mutex_init (&priv->interactive_mutex);
 	g_mutex_init (&priv->timer_mutex);
 	g_mutex_init (&priv->vfuncs_mutex);
+	g_mutex_init (&priv->refine_cache_stamp_mutex);
 }
 
 /**
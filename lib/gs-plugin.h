@@ -161,6 +161,9 @@ const gchar	*gs_plugin_get_name			(GsPlugin	*plugin);
 const gchar	*gs_plugin_get_appstream_id		(GsPlugin	*plugin);
 void		 gs_plugin_set_appstream_id		(GsPlugin	*plugin,
 							 const gchar	*appstream_id);
+gchar		*gs_plugin_dup_refine_cache_stamp	(GsPlugin	*plugin);
+void		 gs_plugin_set_refine_cache_stamp	(GsPlugin	*plugin,
+							 const gchar	*stamp);
 gboolean	 gs_plugin_get_enabled			(GsPlugin	*plugin);
 void		 gs_plugin_set_enabled			(GsPlugin	*plugin,
 							 gboolean	 enabled);
@@ -0,0 +1,229 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* A process-wide wrapper around the sysprof capture writer, so that code
+ * which has no #GsPluginLoader to hand (such as the refine job and the worker
+ * threads) can add marks and counters to the same capture.
+ *
+ * The writer is opened from `SYSPROF_TRACE_FD` when the first
+ * #GsPluginLoader calls gs_profiler_acquire(), and flushed and closed when
+ * the last one calls gs_profiler_release(). Marks can also be passed to a
+ * #GsProfilerMarkFunc, which is how `gnome-software-cmd benchmark` collects
+ * per-plugin timings without needing sysprof. Everything here is a no-op if
+ * neither is in use. The writer itself is not thread-safe, so all access to
+ * it is serialised. */
+
+#include "config.h"
+
+#include <glib.h>
+
+#ifdef HAVE_SYSPROF
+#include <sched.h>
+#include <sysprof-capture.h>
+#include <unistd.h>
+#endif
+
+#include "gs-profiler.h"
+
+G_LOCK_DEFINE_STATIC (profiler);
+#ifdef HAVE_SYSPROF
+static guint profiler_ref_count = 0;  /* (lock profiler) */
+static SysprofCaptureWriter *profiler_writer = NULL;  /* (lock profiler) (owned) (nullable) */
+#endif
+static GsProfilerMarkFunc profiler_mark_func = NULL;  /* (lock profiler) (nullable) */
+static gpointer profiler_mark_func_data = NULL;  /* (lock profiler) */
+static gboolean profiler_enabled = FALSE;  /* (atomic) */
+
+/* Must be called with the profiler lock held. */
+static void
+update_enabled_locked (void)
+{
+	gboolean enabled = (profiler_mark_func != NULL);
+#ifdef HAVE_SYSPROF
+	enabled = enabled || (profiler_writer != NULL);
+#endif
+	g_atomic_int_set (&profiler_enabled, enabled);
+}
+
+void
+gs_profiler_acquire (void)
+{
+#ifdef HAVE_SYSPROF
+	G_LOCK (profiler);
+	if (profiler_ref_count++ == 0) {
+		profiler_writer = sysprof_capture_writer_new_from_env (0);
+		update_enabled_locked ();
+	}
+	G_UNLOCK (profiler);
+#endif
+}
+
+void
+gs_profiler_release (void)
+{
+#ifdef HAVE_SYSPROF
+	G_LOCK (profiler);
+	g_assert (profiler_ref_count > 0);
+	if (--profiler_ref_count == 0) {
+		g_clear_pointer (&profiler_writer, sysprof_capture_writer_unref);
+		update_enabled_locked ();
+	}
+	G_UNLOCK (profiler);
+#endif
+}
+
+/* Sets a function to be called for every mark, from whichever thread added
+ * it. @func is called with the profiler lock held, so must not call back into
+ * the profiler. Pass %NULL to unset it. */
+void
+gs_profiler_set_mark_func (GsProfilerMarkFunc func,
+                           gpointer           user_data)
+{
+	G_LOCK (profiler);
+	profiler_mark_func = func;
+	profiler_mark_func_data = user_data;
+	update_enabled_locked ();
+	G_UNLOCK (profiler);
+}
+
+/* Callers should check this before formatting a message for a mark. */
+gboolean
+gs_profiler_is_enabled (void)
+{
+	return g_atomic_int_get (&profiler_enabled);
+}
+
+/* Returns a monotonic time in nanoseconds to pass to gs_profiler_add_mark()
+ * later, or 0 when not profiling. */
+gint64
+gs_profiler_get_current_time (void)
+{
+	if (!gs_profiler_is_enabled ())
+		return 0;
+#ifdef HAVE_SYSPROF
+	return SYSPROF_CAPTURE_CURRENT_TIME;
+#else
+	return g_get_monotonic_time () * 1000;
+#endif
+}
+
+/* Adds a span from @begin_time_nsec until now. */
+void
+gs_profiler_add_mark (gint64       begin_time_nsec,
+                      const gchar *name,
+                      const gchar *message)
+{
+	gint64 end_time_nsec;
+
+	if (!gs_profiler_is_enabled () || begin_time_nsec == 0)
+		return;
+
+	end_time_nsec = gs_profiler_get_current_time ();
+
+	G_LOCK (profiler);
+#ifdef HAVE_SYSPROF
+	if (profiler_writer != NULL)
+		sysprof_capture_writer_add_mark (profiler_writer,
+						 begin_time_nsec,
+						 sched_getcpu (),
+						 getpid (),
+						 end_time_nsec - begin_time_nsec,
+						 "gnome-software",
+						 name,
+						 (message != NULL) ? message : "");
+#endif
+	if (profiler_mark_func != NULL)
+		profiler_mark_func (name, message, begin_time_nsec,
+				    end_time_nsec - begin_time_nsec,
+				    profiler_mark_func_data);
+	G_UNLOCK (profiler);
+}
+
+void
+gs_profiler_add_mark_printf (gint64       begin_time_nsec,
+                             const gchar *name,
+                             const gchar *format,
+                             ...)
+{
+	va_list args;
+	g_autofree gchar *message = NULL;
+
+	if (!gs_profiler_is_enabled () || begin_time_nsec == 0)
+		return;
+
+	va_start (args, format);
+	message = g_strdup_vprintf (format, args);
+	va_end (args);
+
+	gs_profiler_add_mark (begin_time_nsec, name, message);
+}
+
+/* Returns an ID for gs_profiler_set_counter(), or 0 when not profiling. The
+ * strings are truncated to the lengths sysprof allows. */
+guint
+gs_profiler_define_counter (const gchar *category,
+                            const gchar *name,
+                            const gchar *description)
+{
+#ifdef HAVE_SYSPROF
+	SysprofCaptureCounter counter = { 0, };
+	guint counter_id = 0;
+
+	if (!gs_profiler_is_enabled ())
+		return 0;
+
+	G_LOCK (profiler);
+	if (profiler_writer != NULL) {
+		counter_id = sysprof_capture_writer_request_counter (profiler_writer, 1);
+
+		g_strlcpy (counter.category, category, sizeof (counter.category));
+		g_strlcpy (counter.name, name, sizeof (counter.name));
+		g_strlcpy (counter.description, description, sizeof (counter.description));
+		counter.id = counter_id;
+		counter.type = SYSPROF_CAPTURE_COUNTER_INT64;
+		counter.value.v64 = 0;
+
+		sysprof_capture_writer_define_counters (profiler_writer,
+							SYSPROF_CAPTURE_CURRENT_TIME,
+							-1,
+							getpid (),
+							&counter,
+							1);
+	}
+	G_UNLOCK (profiler);
+
+	return counter_id;
+#else
+	return 0;
+#endif
+}
+
+void
+gs_profiler_set_counter (guint  counter_id,
+                         gint64 value)
+{
+#ifdef HAVE_SYSPROF
+	SysprofCaptureCounterValue counter_value;
+
+	if (!gs_profiler_is_enabled () || counter_id == 0)
+		return;
+
+	counter_value.v64 = value;
+
+	G_LOCK (profiler);
+	if (profiler_writer != NULL)
+		sysprof_capture_writer_set_counters (profiler_writer,
+						     SYSPROF_CAPTURE_CURRENT_TIME,
+						     -1,
+						     getpid (),
+						     &counter_id,
+						     &counter_value,
+						     1);
+	G_UNLOCK (profiler);
+#endif
+}
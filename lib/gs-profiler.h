@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef void (*GsProfilerMarkFunc) (const gchar *name,
+                                    const gchar *message,
+                                    gint64       begin_time_nsec,
+                                    gint64       duration_nsec,
+                                    gpointer     user_data);
+
+void		 gs_profiler_acquire		(void);
+void		 gs_profiler_release		(void);
+void		 gs_profiler_set_mark_func	(GsProfilerMarkFunc	 func,
+						 gpointer		 user_data);
+
+gboolean	 gs_profiler_is_enabled		(void);
+gint64		 gs_profiler_get_current_time	(void);
+
+void		 gs_profiler_add_mark		(gint64		 begin_time_nsec,
+						 const gchar	*name,
+						 const gchar	*message);
+void		 gs_profiler_add_mark_printf	(gint64		 begin_time_nsec,
+						 const gchar	*name,
+						 const gchar	*format,
+						 ...) G_GNUC_PRINTF (3, 4);
+
+guint		 gs_profiler_define_counter	(const gchar	*category,
+						 const gchar	*name,
+						 const gchar	*description);
+void		 gs_profiler_set_counter	(guint		 counter_id,
+						 gint64		 value);
+
+G_END_DECLS
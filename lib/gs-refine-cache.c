@@ -0,0 +1,524 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/**
+ * SECTION:gs-refine-cache
+ * @short_description: A persistent cache of refined #GsApp fields
+ *
+ * #GsRefineCache stores the values of some #GsApp fields after they have been
+ * refined, so that the next time gnome-software is started they can be set
+ * on the apps without asking the plugins to look them up again. Only the
+ * fields for the refine flags in %GS_REFINE_CACHE_FLAGS are stored.
+ *
+ * Each entry is keyed by the app’s unique ID, and records the stamp which
+ * was current when it was stored. The stamp is computed by
+ * gs_refine_cache_compute_stamp() from the stamps set by each plugin with
+ * gs_plugin_set_refine_cache_stamp(), and it changes whenever any of the data
+ * the plugins refine apps from changes. Entries with a different stamp are
+ * ignored, and are dropped the next time the cache is saved.
+ *
+ * Apps are only cached if their management plugin has set a stamp, as
+ * otherwise there is no way to tell when their entries become stale.
+ *
+ * The cache is saved to disk a few seconds after it is last changed, and when
+ * it is disposed. It is safe to use from multiple threads.
+ *
+ * Since: 43
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "gs-plugin.h"
+#include "gs-refine-cache.h"
+
+/* Bump GS_REFINE_CACHE_FORMAT whenever the meaning of the stored fields
+ * changes; it’s also mixed into the stamp. The magic number catches a cache
+ * written with a different byte order. */
+#define GS_REFINE_CACHE_MAGIC		0x4e464552  /* REFN */
+#define GS_REFINE_CACHE_FORMAT		2
+#define GS_REFINE_CACHE_ENTRY_TYPE	"(sta{sv})"
+#define GS_REFINE_CACHE_TYPE		"(uua{s" GS_REFINE_CACHE_ENTRY_TYPE "})"
+
+/* seconds to wait after the last change before saving */
+#define GS_REFINE_CACHE_SAVE_DELAY	5
+
+struct _GsRefineCache
+{
+	GObject		 parent_instance;
+
+	gchar		*filename;  /* (owned) (not nullable) */
+	GMainContext	*context;  /* (owned) (not nullable) */
+
+	GMutex		 mutex;
+	GHashTable	*entries;  /* (mutex mutex) (owned) (element-type utf8 GVariant) */
+	gchar		*current_stamp;  /* (mutex mutex) (owned) (nullable) */
+	gboolean	 dirty;  /* (mutex mutex) */
+	GSource		*save_source;  /* (mutex mutex) (owned) (nullable) */
+};
+
+G_DEFINE_TYPE (GsRefineCache, gs_refine_cache, G_TYPE_OBJECT)
+
+static void
+gs_refine_cache_load (GsRefineCache *self)
+{
+	guint32 magic = 0;
+	guint32 format = 0;
+	GVariantIter iter;
+	const gchar *unique_id;
+	GVariant *entry;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) entries = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	mapped_file = g_mapped_file_new (self->filename, FALSE, &error_local);
+	if (mapped_file == NULL) {
+		if (!g_error_matches (error_local, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("failed to load refine cache: %s", error_local->message);
+		return;
+	}
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (GS_REFINE_CACHE_TYPE),
+							     bytes, FALSE));
+	g_variant_get (data, "(uu@a{s" GS_REFINE_CACHE_ENTRY_TYPE "})", &magic, &format, &entries);
+	if (magic != GS_REFINE_CACHE_MAGIC || format != GS_REFINE_CACHE_FORMAT) {
+		g_debug ("ignoring refine cache %s with an unknown format", self->filename);
+		return;
+	}
+
+	g_variant_iter_init (&iter, entries);
+	while (g_variant_iter_next (&iter, "{&s@" GS_REFINE_CACHE_ENTRY_TYPE "}", &unique_id, &entry))
+		g_hash_table_insert (self->entries, g_strdup (unique_id), entry);
+
+	g_debug ("loaded %u entries from refine cache", g_hash_table_size (self->entries));
+}
+
+/**
+ * gs_refine_cache_save:
+ * @self: a #GsRefineCache
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the cache to disk now, if it has changed. Entries which don’t have the
+ * most recently used stamp are not saved.
+ *
+ * This is done automatically shortly after the cache changes.
+ *
+ * Returns: %TRUE on success
+ * Since: 43
+ */
+gboolean
+gs_refine_cache_save (GsRefineCache  *self,
+                      GError        **error)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{s" GS_REFINE_CACHE_ENTRY_TYPE "}"));
+	g_autoptr(GVariant) data = NULL;
+
+	g_return_val_if_fail (GS_IS_REFINE_CACHE (self), FALSE);
+
+	{
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+		if (!self->dirty)
+			return TRUE;
+		self->dirty = FALSE;
+
+		g_hash_table_iter_init (&iter, self->entries);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			const gchar *entry_stamp;
+
+			g_variant_get_child (value, 0, "&s", &entry_stamp);
+			if (g_strcmp0 (entry_stamp, self->current_stamp) != 0) {
+				g_hash_table_iter_remove (&iter);
+				continue;
+			}
+			g_variant_builder_add (&builder, "{s@" GS_REFINE_CACHE_ENTRY_TYPE "}",
+					       (const gchar *) key, (GVariant *) value);
+		}
+	}
+
+	data = g_variant_ref_sink (g_variant_new ("(uu@a{s" GS_REFINE_CACHE_ENTRY_TYPE "})",
+						  GS_REFINE_CACHE_MAGIC,
+						  GS_REFINE_CACHE_FORMAT,
+						  g_variant_builder_end (&builder)));
+	return g_file_set_contents (self->filename,
+				    g_variant_get_data (data),
+				    g_variant_get_size (data),
+				    error);
+}
+
+static gboolean
+save_timeout_cb (gpointer user_data)
+{
+	GsRefineCache *self = GS_REFINE_CACHE (user_data);
+	g_autoptr(GError) error_local = NULL;
+
+	g_mutex_lock (&self->mutex);
+	g_clear_pointer (&self->save_source, g_source_unref);
+	g_mutex_unlock (&self->mutex);
+
+	if (!gs_refine_cache_save (self, &error_local))
+		g_warning ("failed to save refine cache: %s", error_local->message);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* must be called with the mutex held */
+static void
+schedule_save_locked (GsRefineCache *self)
+{
+	self->dirty = TRUE;
+	if (self->save_source != NULL)
+		return;
+
+	self->save_source = g_timeout_source_new_seconds (GS_REFINE_CACHE_SAVE_DELAY);
+	g_source_set_name (self->save_source, "[gnome-software] refine cache save");
+	g_source_set_callback (self->save_source, save_timeout_cb, self, NULL);
+	g_source_attach (self->save_source, self->context);
+}
+
+/* The app’s own stamp must be set for its entry to be trusted, even though
+ * the combined stamp is compared. */
+static gboolean
+app_is_cacheable (GsApp *app)
+{
+	g_autoptr(GsPlugin) plugin = NULL;
+	g_autofree gchar *plugin_stamp = NULL;
+
+	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+		return FALSE;
+	if (gs_app_get_unique_id (app) == NULL)
+		return FALSE;
+
+	plugin = gs_app_dup_management_plugin (app);
+	if (plugin == NULL)
+		return FALSE;
+	plugin_stamp = gs_plugin_dup_refine_cache_stamp (plugin);
+	return (plugin_stamp != NULL);
+}
+
+/**
+ * gs_refine_cache_compute_stamp:
+ * @plugins: (element-type GsPlugin): the loaded plugins
+ *
+ * Combine the stamps set by the enabled plugins in @plugins using
+ * gs_plugin_set_refine_cache_stamp() into one stamp, to be passed to
+ * gs_refine_cache_lookup() and gs_refine_cache_store().
+ *
+ * Returns: (transfer full) (nullable): the combined stamp, or %NULL if no
+ *   plugin has set one
+ * Since: 43
+ */
+gchar *
+gs_refine_cache_compute_stamp (GPtrArray *plugins)
+{
+	g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA1);
+	g_autofree gchar *header = NULL;
+	gboolean any_stamp = FALSE;
+
+	header = g_strdup_printf ("%s:%u\n", PACKAGE_VERSION, (guint) GS_REFINE_CACHE_FORMAT);
+	g_checksum_update (checksum, (const guchar *) header, -1);
+
+	for (guint i = 0; i < plugins->len; i++) {
+		GsPlugin *plugin = g_ptr_array_index (plugins, i);
+		g_autofree gchar *stamp = NULL;
+		g_autofree gchar *line = NULL;
+
+		if (!gs_plugin_get_enabled (plugin))
+			continue;
+		stamp = gs_plugin_dup_refine_cache_stamp (plugin);
+		if (stamp == NULL)
+			continue;
+
+		line = g_strdup_printf ("%s=%s\n", gs_plugin_get_name (plugin), stamp);
+		g_checksum_update (checksum, (const guchar *) line, -1);
+		any_stamp = TRUE;
+	}
+
+	if (!any_stamp)
+		return NULL;
+
+	return g_strdup (g_checksum_get_string (checksum));
+}
+
+static const gchar *
+lookup_string (GVariantDict *fields,
+               const gchar  *key)
+{
+	const gchar *value = NULL;
+
+	if (!g_variant_dict_lookup (fields, key, "&s", &value))
+		return NULL;
+	return value;
+}
+
+/* all the URL kinds are stored, as they are all set by the same refine flag */
+static gchar *
+url_kind_to_key (AsUrlKind kind)
+{
+	return g_strconcat ("url-", as_url_kind_to_string (kind), NULL);
+}
+
+/**
+ * gs_refine_cache_lookup:
+ * @self: a #GsRefineCache
+ * @app: a #GsApp
+ * @stamp: (nullable): the current stamp from gs_refine_cache_compute_stamp()
+ * @flags: the refine flags being requested for @app
+ *
+ * Look up @app in the cache, and if it has an entry for @stamp which covers
+ * all of the cacheable fields in @flags, set those fields on @app. Fields
+ * which already have a value on @app are not overwritten.
+ *
+ * Returns: %TRUE if @app was found and its fields set, so that it only needs
+ *   to be refined with `flags & ~GS_REFINE_CACHE_FLAGS`
+ * Since: 43
+ */
+gboolean
+gs_refine_cache_lookup (GsRefineCache       *self,
+                        GsApp               *app,
+                        const gchar         *stamp,
+                        GsPluginRefineFlags  flags)
+{
+	GsPluginRefineFlags wanted = flags & GS_REFINE_CACHE_FLAGS;
+	guint64 entry_flags;
+	const gchar *entry_stamp;
+	const gchar *value;
+	g_autoptr(GVariant) entry = NULL;
+	g_autoptr(GVariant) fields_variant = NULL;
+	g_autoptr(GVariantDict) fields = NULL;
+
+	g_return_val_if_fail (GS_IS_REFINE_CACHE (self), FALSE);
+	g_return_val_if_fail (GS_IS_APP (app), FALSE);
+
+	if (stamp == NULL || wanted == 0 || !app_is_cacheable (app))
+		return FALSE;
+
+	{
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+		entry = g_hash_table_lookup (self->entries, gs_app_get_unique_id (app));
+		if (entry == NULL)
+			return FALSE;
+		g_variant_ref (entry);
+	}
+
+	g_variant_get (entry, "(&st@a{sv})", &entry_stamp, &entry_flags, &fields_variant);
+	if (g_strcmp0 (entry_stamp, stamp) != 0)
+		return FALSE;
+	if ((entry_flags & wanted) != wanted)
+		return FALSE;
+
+	fields = g_variant_dict_new (fields_variant);
+
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE) {
+		value = lookup_string (fields, "license");
+		if (value != NULL)
+			gs_app_set_license (app, GS_APP_QUALITY_NORMAL, value);
+	}
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL) {
+		for (guint kind = AS_URL_KIND_UNKNOWN + 1; kind < AS_URL_KIND_LAST; kind++) {
+			g_autofree gchar *key = url_kind_to_key (kind);
+			value = lookup_string (fields, key);
+			if (value != NULL && gs_app_get_url (app, kind) == NULL)
+				gs_app_set_url (app, kind, value);
+		}
+	}
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION) {
+		value = lookup_string (fields, "description");
+		if (value != NULL)
+			gs_app_set_description (app, GS_APP_QUALITY_NORMAL, value);
+	}
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION) {
+		value = lookup_string (fields, "version");
+		if (value != NULL && gs_app_get_version (app) == NULL)
+			gs_app_set_version (app, value);
+	}
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_DEVELOPER_NAME) {
+		value = lookup_string (fields, "developer-name");
+		if (value != NULL && gs_app_get_developer_name (app) == NULL)
+			gs_app_set_developer_name (app, value);
+	}
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME) {
+		value = lookup_string (fields, "origin-hostname");
+		if (value != NULL && gs_app_get_origin_hostname (app) == NULL)
+			gs_app_set_origin_hostname (app, value);
+	}
+
+	return TRUE;
+}
+
+static void
+insert_string (GVariantDict *fields,
+               const gchar  *key,
+               const gchar  *value)
+{
+	if (value != NULL)
+		g_variant_dict_insert (fields, key, "s", value);
+	else
+		g_variant_dict_remove (fields, key);
+}
+
+/**
+ * gs_refine_cache_store:
+ * @self: a #GsRefineCache
+ * @app: a #GsApp which has been refined with @flags
+ * @stamp: (nullable): the current stamp from gs_refine_cache_compute_stamp()
+ * @flags: the refine flags @app was refined with
+ *
+ * Store the cacheable fields in @flags from @app in the cache. They are
+ * merged with any fields already stored for @app with the same @stamp.
+ *
+ * Since: 43
+ */
+void
+gs_refine_cache_store (GsRefineCache       *self,
+                       GsApp               *app,
+                       const gchar         *stamp,
+                       GsPluginRefineFlags  flags)
+{
+	GsPluginRefineFlags wanted = flags & GS_REFINE_CACHE_FLAGS;
+	guint64 entry_flags = wanted;
+	const gchar *unique_id;
+	GVariant *old_entry;
+	g_autoptr(GVariant) old_fields = NULL;
+	g_autoptr(GVariantDict) fields = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_REFINE_CACHE (self));
+	g_return_if_fail (GS_IS_APP (app));
+
+	if (stamp == NULL || wanted == 0 || !app_is_cacheable (app))
+		return;
+
+	unique_id = gs_app_get_unique_id (app);
+
+	locker = g_mutex_locker_new (&self->mutex);
+
+	if (g_strcmp0 (self->current_stamp, stamp) != 0) {
+		g_free (self->current_stamp);
+		self->current_stamp = g_strdup (stamp);
+	}
+
+	old_entry = g_hash_table_lookup (self->entries, unique_id);
+	if (old_entry != NULL) {
+		const gchar *old_stamp;
+		guint64 old_flags;
+
+		g_variant_get (old_entry, "(&st@a{sv})", &old_stamp, &old_flags, &old_fields);
+		if (g_strcmp0 (old_stamp, stamp) == 0)
+			entry_flags |= old_flags;
+		else
+			g_clear_pointer (&old_fields, g_variant_unref);
+	}
+
+	fields = g_variant_dict_new (old_fields);
+
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE)
+		insert_string (fields, "license", gs_app_get_license (app));
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL) {
+		for (guint kind = AS_URL_KIND_UNKNOWN + 1; kind < AS_URL_KIND_LAST; kind++) {
+			g_autofree gchar *key = url_kind_to_key (kind);
+			insert_string (fields, key, gs_app_get_url (app, kind));
+		}
+	}
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION)
+		insert_string (fields, "description", gs_app_get_description (app));
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION)
+		insert_string (fields, "version", gs_app_get_version (app));
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_DEVELOPER_NAME)
+		insert_string (fields, "developer-name", gs_app_get_developer_name (app));
+	if (wanted & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME)
+		insert_string (fields, "origin-hostname", gs_app_get_origin_hostname (app));
+
+	g_hash_table_insert (self->entries, g_strdup (unique_id),
+			     g_variant_ref_sink (g_variant_new ("(st@a{sv})", stamp, entry_flags,
+								g_variant_dict_end (fields))));
+	schedule_save_locked (self);
+}
+
+static void
+gs_refine_cache_dispose (GObject *object)
+{
+	GsRefineCache *self = GS_REFINE_CACHE (object);
+	g_autoptr(GError) error_local = NULL;
+
+	if (self->save_source != NULL) {
+		g_source_destroy (self->save_source);
+		g_clear_pointer (&self->save_source, g_source_unref);
+	}
+
+	if (!gs_refine_cache_save (self, &error_local))
+		g_warning ("failed to save refine cache: %s", error_local->message);
+
+	G_OBJECT_CLASS (gs_refine_cache_parent_class)->dispose (object);
+}
+
+static void
+gs_refine_cache_finalize (GObject *object)
+{
+	GsRefineCache *self = GS_REFINE_CACHE (object);
+
+	g_hash_table_unref (self->entries);
+	g_free (self->current_stamp);
+	g_free (self->filename);
+	g_main_context_unref (self->context);
+	g_mutex_clear (&self->mutex);
+
+	G_OBJECT_CLASS (gs_refine_cache_parent_class)->finalize (object);
+}
+
+static void
+gs_refine_cache_class_init (GsRefineCacheClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->dispose = gs_refine_cache_dispose;
+	object_class->finalize = gs_refine_cache_finalize;
+}
+
+static void
+gs_refine_cache_init (GsRefineCache *self)
+{
+	g_mutex_init (&self->mutex);
+	self->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) g_variant_unref);
+	self->context = g_main_context_ref_thread_default ();
+}
+
+/**
+ * gs_refine_cache_new:
+ * @filename: (type filename): path to the cache file
+ *
+ * Create a new #GsRefineCache, loading any entries previously saved to
+ * @filename. A missing or invalid file is treated as an empty cache.
+ *
+ * The cache is saved from the thread-default #GMainContext at the time of
+ * construction.
+ *
+ * Returns: (transfer full): a new #GsRefineCache
+ * Since: 43
+ */
+GsRefineCache *
+gs_refine_cache_new (const gchar *filename)
+{
+	GsRefineCache *self;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	self = g_object_new (GS_TYPE_REFINE_CACHE, NULL);
+	self->filename = g_strdup (filename);
+	gs_refine_cache_load (self);
+
+	return self;
+}
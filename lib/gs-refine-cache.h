@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "gs-app.h"
+#include "gs-plugin-types.h"
+
+G_BEGIN_DECLS
+
+/**
+ * GS_REFINE_CACHE_FLAGS:
+ *
+ * The #GsPluginRefineFlags whose results can be stored in a #GsRefineCache.
+ *
+ * Since: 43
+ */
+#define GS_REFINE_CACHE_FLAGS	(GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE | \
+				 GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL | \
+				 GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION | \
+				 GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION | \
+				 GS_PLUGIN_REFINE_FLAGS_REQUIRE_DEVELOPER_NAME | \
+				 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME)
+
+#define GS_TYPE_REFINE_CACHE (gs_refine_cache_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsRefineCache, gs_refine_cache, GS, REFINE_CACHE, GObject)
+
+GsRefineCache	*gs_refine_cache_new		(const gchar		*filename);
+
+gchar		*gs_refine_cache_compute_stamp	(GPtrArray		*plugins);
+
+gboolean	 gs_refine_cache_lookup		(GsRefineCache		*self,
+						 GsApp			*app,
+						 const gchar		*stamp,
+						 GsPluginRefineFlags	 flags);
+void		 gs_refine_cache_store		(GsRefineCache		*self,
+						 GsApp			*app,
+						 const gchar		*stamp,
+						 GsPluginRefineFlags	 flags);
+
+gboolean	 gs_refine_cache_save		(GsRefineCache		*self,
+						 GError			**error);
+
+G_END_DECLS
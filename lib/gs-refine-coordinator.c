@@ -0,0 +1,426 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* Tracks which apps are currently being refined, and for which flags, so that
+ * concurrent #GsPluginJobRefine jobs don’t refine the same #GsApp for the
+ * same flags at the same time. This happens a lot at startup, when several
+ * pages load at once and refine many of the same apps.
+ *
+ * A refine job calls gs_refine_coordinator_begin() with the apps it wants to
+ * refine. Each app is then either:
+ *  - not being refined elsewhere, so the job refines it as normal;
+ *  - being refined elsewhere for some of the flags, so the job only refines
+ *    it for the rest and waits for the other jobs to finish; or
+ *  - being refined elsewhere for all of the flags, so the job only waits.
+ *
+ * The apps the job refines are registered against its #GsRefineTicket until
+ * it calls gs_refine_ticket_finish(), which also wakes up the jobs waiting
+ * for it. A job only ever waits for tickets which began before its own, so
+ * there can be no cycles.
+ *
+ * A refine completes all of its apps at once, so a job which shares even one
+ * app with another job waits for all of the other job’s apps to be refined.
+ * To stop a fast refine waiting for a slow one, a job only shares apps with
+ * jobs which refine them for a subset of its own flags; otherwise it refines
+ * them itself, as if they weren’t being refined elsewhere. Waits can be
+ * cancelled.
+ *
+ * Wildcards are never shared, as the apps they resolve to are only added to
+ * the list of the job which refined them.
+ *
+ * It is safe to use from multiple threads. */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "gs-app.h"
+#include "gs-refine-coordinator.h"
+
+/* Flags which change how a refine behaves rather than what it looks up, so
+ * they don’t count towards whether another refine covers an app. */
+#define GS_REFINE_COORDINATOR_MODIFIER_FLAGS	(GS_PLUGIN_REFINE_FLAGS_ALLOW_PACKAGES | \
+						 GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING)
+
+struct _GsRefineCoordinator {
+	GMutex		 mutex;
+	GHashTable	*in_flight;  /* (mutex mutex) (owned) (element-type GsApp GPtrArray<GsRefineTicket>); tickets are unowned */
+};
+
+typedef struct {
+	GsRefineTicket	*ticket;  /* (owned) */
+	GCancellable	*cancellable;  /* (owned) (nullable) */
+	gulong		 cancelled_id;
+} WaitData;
+
+struct _GsRefineTicket {
+	gint		 ref_count;  /* (atomic) */
+	GsRefineCoordinator *coordinator;  /* (unowned) */
+
+	/* these are only changed with the coordinator’s mutex held */
+	GHashTable	*apps;  /* (owned) (element-type GsApp GsPluginRefineFlags) */
+	gboolean	 done;
+	gboolean	 success;
+	GPtrArray	*waiters;  /* (owned) (element-type GTask<WaitData>) */
+};
+
+GsRefineCoordinator *
+gs_refine_coordinator_new (void)
+{
+	GsRefineCoordinator *self = g_new0 (GsRefineCoordinator, 1);
+
+	g_mutex_init (&self->mutex);
+	self->in_flight = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						 g_object_unref, (GDestroyNotify) g_ptr_array_unref);
+
+	return self;
+}
+
+/* All tickets must have been finished. */
+void
+gs_refine_coordinator_free (GsRefineCoordinator *self)
+{
+	g_assert (g_hash_table_size (self->in_flight) == 0);
+
+	g_hash_table_unref (self->in_flight);
+	g_mutex_clear (&self->mutex);
+	g_free (self);
+}
+
+static GsRefineTicket *
+gs_refine_ticket_new (GsRefineCoordinator *coordinator)
+{
+	GsRefineTicket *ticket = g_new0 (GsRefineTicket, 1);
+
+	ticket->ref_count = 1;
+	ticket->coordinator = coordinator;
+	ticket->apps = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, NULL);
+	ticket->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+
+	return ticket;
+}
+
+GsRefineTicket *
+gs_refine_ticket_ref (GsRefineTicket *ticket)
+{
+	g_atomic_int_inc (&ticket->ref_count);
+	return ticket;
+}
+
+void
+gs_refine_ticket_unref (GsRefineTicket *ticket)
+{
+	if (!g_atomic_int_dec_and_test (&ticket->ref_count))
+		return;
+
+	g_assert (ticket->done);
+	g_assert (ticket->waiters->len == 0);
+
+	g_hash_table_unref (ticket->apps);
+	g_ptr_array_unref (ticket->waiters);
+	g_free (ticket);
+}
+
+/* Must be called with the coordinator’s mutex held. */
+static void
+register_app_locked (GsRefineCoordinator *self,
+                     GsRefineTicket      *ticket,
+                     GsApp               *app,
+                     GsPluginRefineFlags  flags)
+{
+	GPtrArray *tickets = g_hash_table_lookup (self->in_flight, app);
+
+	if (tickets == NULL) {
+		tickets = g_ptr_array_new ();
+		g_hash_table_insert (self->in_flight, g_object_ref (app), tickets);
+	}
+	g_ptr_array_add (tickets, ticket);
+	g_hash_table_insert (ticket->apps, g_object_ref (app), GUINT_TO_POINTER (flags));
+}
+
+/*
+ * gs_refine_coordinator_begin:
+ * @self: a #GsRefineCoordinator
+ * @list: apps to refine; on return, only the apps to refine for all of @flags
+ * @flags: flags to refine the apps for
+ * @partial_list: return location for the apps to refine for only some flags
+ * @partial_flags_out: (out): return location for the flags to refine
+ *   @partial_list for
+ * @covered_list: return location for the apps which don’t need refining,
+ *   as they are already being refined for all of @flags
+ * @wait_tickets: (element-type GsRefineTicket): return location for the
+ *   tickets to wait for before the apps in @partial_list and @covered_list
+ *   are completely refined
+ *
+ * Work out which of the apps in @list are already being refined, and
+ * register the rest as being refined by the returned ticket. The caller
+ * must call gs_refine_ticket_finish() on the ticket once it has finished
+ * refining @list and @partial_list.
+ *
+ * Returns: (transfer full): a new ticket
+ */
+GsRefineTicket *
+gs_refine_coordinator_begin (GsRefineCoordinator *self,
+                             GsAppList           *list,
+                             GsPluginRefineFlags  flags,
+                             GsAppList           *partial_list,
+                             GsPluginRefineFlags *partial_flags_out,
+                             GsAppList           *covered_list,
+                             GPtrArray           *wait_tickets)
+{
+	GsRefineTicket *ticket = gs_refine_ticket_new (self);
+	GsPluginRefineFlags required = flags & ~GS_REFINE_COORDINATOR_MODIFIER_FLAGS;
+	GsPluginRefineFlags partial_flags = 0;
+	g_autoptr(GHashTable) waits = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		GPtrArray *tickets;
+		GsPluginRefineFlags covered = 0;
+		GsPluginRefineFlags missing;
+
+		if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+			continue;
+
+		tickets = g_hash_table_lookup (self->in_flight, app);
+		for (guint j = 0; tickets != NULL && j < tickets->len; j++) {
+			GsRefineTicket *other = g_ptr_array_index (tickets, j);
+			GsPluginRefineFlags other_flags = GPOINTER_TO_UINT (g_hash_table_lookup (other->apps, app));
+
+			/* don’t wait for refines of flags this job doesn’t need */
+			if ((other_flags & required) == 0 ||
+			    (other_flags & ~required & ~GS_REFINE_COORDINATOR_MODIFIER_FLAGS) != 0)
+				continue;
+
+			covered |= other_flags;
+			g_hash_table_add (waits, other);
+		}
+
+		missing = required & ~covered;
+		if (missing == required)
+			continue;
+
+		if (missing == 0) {
+			gs_app_list_add (covered_list, app);
+		} else {
+			gs_app_list_add (partial_list, app);
+			partial_flags |= missing;
+		}
+	}
+
+	/* take the shared apps out of @list */
+	for (guint i = 0; i < gs_app_list_length (partial_list); i++)
+		gs_app_list_remove (list, gs_app_list_index (partial_list, i));
+	for (guint i = 0; i < gs_app_list_length (covered_list); i++)
+		gs_app_list_remove (list, gs_app_list_index (covered_list, i));
+
+	if (partial_flags != 0)
+		partial_flags |= flags & GS_REFINE_COORDINATOR_MODIFIER_FLAGS;
+
+	/* register what this ticket is going to refine */
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		if (!gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+			register_app_locked (self, ticket, app, flags);
+	}
+	for (guint i = 0; i < gs_app_list_length (partial_list); i++)
+		register_app_locked (self, ticket, gs_app_list_index (partial_list, i), partial_flags);
+
+	if (wait_tickets != NULL) {
+		GHashTableIter iter;
+		gpointer key;
+
+		g_hash_table_iter_init (&iter, waits);
+		while (g_hash_table_iter_next (&iter, &key, NULL))
+			g_ptr_array_add (wait_tickets, gs_refine_ticket_ref (key));
+	}
+
+	*partial_flags_out = partial_flags;
+
+	return ticket;
+}
+
+/*
+ * gs_refine_ticket_finish:
+ * @ticket: a #GsRefineTicket
+ * @success: whether refining the apps succeeded
+ *
+ * Unregister the apps being refined by @ticket, and wake up anything waiting
+ * for it.
+ */
+void
+gs_refine_ticket_finish (GsRefineTicket *ticket,
+                         gboolean        success)
+{
+	GsRefineCoordinator *self = ticket->coordinator;
+	g_autoptr(GPtrArray) waiters = NULL;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_mutex_lock (&self->mutex);
+
+	g_assert (!ticket->done);
+	ticket->done = TRUE;
+	ticket->success = success;
+
+	g_hash_table_iter_init (&iter, ticket->apps);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		GPtrArray *tickets = g_hash_table_lookup (self->in_flight, key);
+
+		g_ptr_array_remove_fast (tickets, ticket);
+		if (tickets->len == 0)
+			g_hash_table_remove (self->in_flight, key);
+	}
+	g_hash_table_remove_all (ticket->apps);
+
+	waiters = g_steal_pointer (&ticket->waiters);
+	ticket->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+
+	g_mutex_unlock (&self->mutex);
+
+	/* the tasks dispatch to their own main contexts */
+	for (guint i = 0; i < waiters->len; i++) {
+		GTask *task = g_ptr_array_index (waiters, i);
+		WaitData *wait_data = g_task_get_task_data (task);
+
+		if (wait_data->cancellable != NULL)
+			g_cancellable_disconnect (wait_data->cancellable, wait_data->cancelled_id);
+		g_task_return_boolean (task, success);
+	}
+}
+
+static void
+wait_data_free (WaitData *wait_data)
+{
+	gs_refine_ticket_unref (wait_data->ticket);
+	g_clear_object (&wait_data->cancellable);
+	g_free (wait_data);
+}
+
+/* Runs in the waiter’s main context, outside the ::cancelled emission, so the
+ * handler can be disconnected. */
+static gboolean
+wait_cancelled_idle_cb (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	WaitData *wait_data = g_task_get_task_data (task);
+	GsRefineTicket *ticket = wait_data->ticket;
+	g_autoptr(GTask) waiter = NULL;
+	guint idx;
+
+	g_mutex_lock (&ticket->coordinator->mutex);
+	if (g_ptr_array_find (ticket->waiters, task, &idx))
+		waiter = g_ptr_array_steal_index_fast (ticket->waiters, idx);
+	g_mutex_unlock (&ticket->coordinator->mutex);
+
+	/* gs_refine_ticket_finish() has already returned it */
+	if (waiter == NULL)
+		return G_SOURCE_REMOVE;
+
+	g_cancellable_disconnect (wait_data->cancellable, wait_data->cancelled_id);
+	g_task_return_error_if_cancelled (waiter);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+wait_cancelled_cb (GCancellable *cancellable,
+                   gpointer      user_data)
+{
+	GTask *task = G_TASK (user_data);
+	g_autoptr(GSource) source = g_idle_source_new ();
+
+	g_source_set_callback (source, wait_cancelled_idle_cb, g_object_ref (task), g_object_unref);
+	g_source_attach (source, g_task_get_context (task));
+}
+
+/*
+ * gs_refine_ticket_wait_async:
+ * @ticket: a #GsRefineTicket
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to call once @ticket has finished
+ * @user_data: data to pass to @callback
+ *
+ * Wait for gs_refine_ticket_finish() to be called on @ticket. The callback is
+ * called in the thread-default main context of the caller.
+ *
+ * Cancelling the wait doesn’t affect the refine being waited for.
+ */
+void
+gs_refine_ticket_wait_async (GsRefineTicket      *ticket,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+	GsRefineCoordinator *self = ticket->coordinator;
+	g_autoptr(GTask) task = NULL;
+	WaitData *wait_data;
+	gboolean done, success;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_refine_ticket_wait_async);
+
+	wait_data = g_new0 (WaitData, 1);
+	wait_data->ticket = gs_refine_ticket_ref (ticket);
+	wait_data->cancellable = (cancellable != NULL) ? g_object_ref (cancellable) : NULL;
+	g_task_set_task_data (task, wait_data, (GDestroyNotify) wait_data_free);
+
+	/* connect before @task can be returned by gs_refine_ticket_finish(),
+	 * which disconnects it */
+	if (cancellable != NULL)
+		wait_data->cancelled_id = g_cancellable_connect (cancellable,
+								 G_CALLBACK (wait_cancelled_cb),
+								 task, NULL);
+
+	g_mutex_lock (&self->mutex);
+	done = ticket->done;
+	success = ticket->success;
+	if (!done)
+		g_ptr_array_add (ticket->waiters, g_object_ref (task));
+	g_mutex_unlock (&self->mutex);
+
+	if (done) {
+		if (cancellable != NULL)
+			g_cancellable_disconnect (cancellable, wait_data->cancelled_id);
+		g_task_return_boolean (task, success);
+	}
+}
+
+/*
+ * gs_refine_ticket_wait_finish:
+ * @result: result of the operation
+ * @success_out: (out): return location for whether the refine for @ticket
+ *   succeeded
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with gs_refine_ticket_wait_async().
+ *
+ * Returns: %TRUE if @ticket finished, %FALSE if the wait was cancelled
+ */
+gboolean
+gs_refine_ticket_wait_finish (GAsyncResult  *result,
+                              gboolean      *success_out,
+                              GError       **error)
+{
+	g_autoptr(GError) local_error = NULL;
+	gboolean success;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+	g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == gs_refine_ticket_wait_async, FALSE);
+
+	success = g_task_propagate_boolean (G_TASK (result), &local_error);
+	if (local_error != NULL) {
+		g_propagate_error (error, g_steal_pointer (&local_error));
+		return FALSE;
+	}
+
+	*success_out = success;
+	return TRUE;
+}
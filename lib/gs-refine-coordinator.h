@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "gs-app-list.h"
+#include "gs-plugin-loader.h"
+#include "gs-plugin-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsRefineCoordinator GsRefineCoordinator;
+typedef struct _GsRefineTicket GsRefineTicket;
+
+GsRefineCoordinator	*gs_refine_coordinator_new	(void);
+void			 gs_refine_coordinator_free	(GsRefineCoordinator	*self);
+
+GsRefineTicket		*gs_refine_coordinator_begin	(GsRefineCoordinator	*self,
+							 GsAppList		*list,
+							 GsPluginRefineFlags	 flags,
+							 GsAppList		*partial_list,
+							 GsPluginRefineFlags	*partial_flags_out,
+							 GsAppList		*covered_list,
+							 GPtrArray		*wait_tickets);
+
+GsRefineTicket		*gs_refine_ticket_ref		(GsRefineTicket		*ticket);
+void			 gs_refine_ticket_unref		(GsRefineTicket		*ticket);
+void			 gs_refine_ticket_finish	(GsRefineTicket		*ticket,
+							 gboolean		 success);
+void			 gs_refine_ticket_wait_async	(GsRefineTicket		*ticket,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean		 gs_refine_ticket_wait_finish	(GAsyncResult		*result,
+							 gboolean		*success_out,
+							 GError			**error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsRefineTicket, gs_refine_ticket_unref)
+
+/* implemented in gs-plugin-loader.c */
+GsRefineCoordinator	*gs_plugin_loader_get_refine_coordinator	(GsPluginLoader	*plugin_loader);
+
+G_END_DECLS
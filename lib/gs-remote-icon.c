@@ -14,8 +14,9 @@
  *
  * #GsRemoteIcon is a #GIcon implementation which represents remote icons —
  * icons which have an HTTP or HTTPS URI. It provides a well-known local filename
- * for a cached copy of the icon, accessible as #GFileIcon:file, and a method
- * to download the icon to the cache, gs_remote_icon_ensure_cached().
+ * for a cached copy of the icon, accessible as #GFileIcon:file, and methods
+ * to download the icon to the cache, gs_remote_icon_ensure_cached() and
+ * gs_remote_icon_ensure_cached_async().
  *
  * Constructing a #GsRemoteIcon does not guarantee that the icon is cached. Call
  * gs_remote_icon_ensure_cached() for that.
@@ -35,6 +36,7 @@
 #include <glib-object.h>
 #include <libsoup/soup.h>
 
+#include "gs-download-utils.h"
 #include "gs-remote-icon.h"
 #include "gs-utils.h"
 
@@ -232,6 +234,46 @@ gs_remote_icon_get_uri (GsRemoteIcon *self)
 	return self->uri;
 }
 
+/* Decode an icon from @stream, scale it down to at most @max_size square if
+ * needed, and save it to @destination_path. */
+static GdkPixbuf *
+gs_icon_save_from_stream (GInputStream  *stream,
+                          const gchar   *destination_path,
+                          guint          max_size,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GdkPixbuf) scaled_pixbuf = NULL;
+	g_autofree gchar *buffer = NULL;
+	gsize buffer_len = 0;
+
+	/* Typically these icons are 64x64px PNG files. If not, resize down
+	 * so it’s at most @max_size square, to minimise the size of the on-disk
+	 * cache.*/
+	pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, error);
+	if (pixbuf == NULL)
+		return NULL;
+
+	if ((guint) gdk_pixbuf_get_height (pixbuf) <= max_size &&
+	    (guint) gdk_pixbuf_get_width (pixbuf) <= max_size) {
+		scaled_pixbuf = g_object_ref (pixbuf);
+	} else {
+		scaled_pixbuf = gdk_pixbuf_scale_simple (pixbuf, max_size, max_size,
+							 GDK_INTERP_BILINEAR);
+	}
+
+	/* write file; g_file_set_contents() writes to a temporary file and
+	 * renames it into place, so nothing ever sees a partial icon, even if
+	 * two downloads of it race */
+	if (!gdk_pixbuf_save_to_buffer (scaled_pixbuf, &buffer, &buffer_len, "png", error, NULL))
+		return NULL;
+	if (!g_file_set_contents (destination_path, buffer, buffer_len, error))
+		return NULL;
+
+	return g_steal_pointer (&scaled_pixbuf);
+}
+
 static GdkPixbuf *
 gs_icon_download (SoupSession   *session,
                   const gchar   *uri,
@@ -243,8 +285,6 @@ gs_icon_download (SoupSession   *session,
 	guint status_code;
 	g_autoptr(SoupMessage) msg = NULL;
 	g_autoptr(GInputStream) stream = NULL;
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
-	g_autoptr(GdkPixbuf) scaled_pixbuf = NULL;
 
 	/* Create the request */
 	msg = soup_message_new (SOUP_METHOD_GET, uri);
@@ -275,26 +315,36 @@ gs_icon_download (SoupSession   *session,
 		return NULL;
 	}
 
-	/* Typically these icons are 64x64px PNG files. If not, resize down
-	 * so it’s at most @max_size square, to minimise the size of the on-disk
-	 * cache.*/
-	pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, error);
-	if (pixbuf == NULL)
-		return NULL;
+	return gs_icon_save_from_stream (stream, destination_path, max_size, cancellable, error);
+}
 
-	if ((guint) gdk_pixbuf_get_height (pixbuf) <= max_size &&
-	    (guint) gdk_pixbuf_get_width (pixbuf) <= max_size) {
-		scaled_pixbuf = g_object_ref (pixbuf);
-	} else {
-		scaled_pixbuf = gdk_pixbuf_scale_simple (pixbuf, max_size, max_size,
-							 GDK_INTERP_BILINEAR);
+/* Check whether the icon is already in the cache at @cache_filename, and
+ * ensure its dimensions are stored on it if so. */
+static gboolean
+gs_remote_icon_check_cached (GsRemoteIcon *self,
+                             const gchar  *cache_filename)
+{
+	gint width = 0, height = 0;
+
+	if (!g_file_test (cache_filename, G_FILE_TEST_IS_REGULAR))
+		return FALSE;
+
+	/* Ensure the downloaded image dimensions are stored on the icon */
+	if (!g_object_get_data (G_OBJECT (self), "width") &&
+	    gdk_pixbuf_get_file_info (cache_filename, &width, &height)) {
+		g_object_set_data (G_OBJECT (self), "width", GINT_TO_POINTER (width));
+		g_object_set_data (G_OBJECT (self), "height", GINT_TO_POINTER (height));
 	}
 
-	/* write file */
-	if (!gdk_pixbuf_save (scaled_pixbuf, destination_path, "png", error, NULL))
-		return NULL;
+	return TRUE;
+}
 
-	return g_steal_pointer (&scaled_pixbuf);
+static void
+gs_remote_icon_set_size_from_pixbuf (GsRemoteIcon *self,
+                                     GdkPixbuf    *pixbuf)
+{
+	g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (gdk_pixbuf_get_width (pixbuf)));
+	g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (gdk_pixbuf_get_height (pixbuf)));
 }
 
 /**
@@ -345,24 +395,167 @@ gs_remote_icon_ensure_cached (GsRemoteIcon  *self,
 		return FALSE;
 
 	/* Already in cache? */
-	if (g_file_test (cache_filename, G_FILE_TEST_IS_REGULAR)) {
-		gint width = 0, height = 0;
-		/* Ensure the downloaded image dimensions are stored on the icon */
-		if (!g_object_get_data (G_OBJECT (self), "width") &&
-		    gdk_pixbuf_get_file_info (cache_filename, &width, &height)) {
-			g_object_set_data (G_OBJECT (self), "width", GINT_TO_POINTER (width));
-			g_object_set_data (G_OBJECT (self), "height", GINT_TO_POINTER (height));
-		}
+	if (gs_remote_icon_check_cached (self, cache_filename))
 		return TRUE;
-	}
 
 	cached_pixbuf = gs_icon_download (soup_session, uri, cache_filename, maximum_icon_size, cancellable, error);
 	if (cached_pixbuf == NULL)
 		return FALSE;
 
 	/* Ensure the dimensions are set correctly on the icon. */
-	g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (gdk_pixbuf_get_width (cached_pixbuf)));
-	g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (gdk_pixbuf_get_height (cached_pixbuf)));
+	gs_remote_icon_set_size_from_pixbuf (self, cached_pixbuf);
 
 	return TRUE;
 }
+
+typedef struct {
+	gchar *cache_filename;  /* (owned) */
+	guint maximum_icon_size;
+	GOutputStream *output_stream;  /* (owned) */
+} EnsureCachedData;
+
+static void
+ensure_cached_data_free (EnsureCachedData *data)
+{
+	g_free (data->cache_filename);
+	g_clear_object (&data->output_stream);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EnsureCachedData, ensure_cached_data_free)
+
+static void ensure_cached_download_cb (GObject      *source_object,
+                                       GAsyncResult *result,
+                                       gpointer      user_data);
+
+/**
+ * gs_remote_icon_ensure_cached_async:
+ * @self: a #GsRemoteIcon
+ * @soup_session: a #SoupSession to use to download the icon
+ * @maximum_icon_size: maximum size (in device pixels) of the icon to save
+ * @io_priority: I/O priority to download the icon at, typically
+ *   %G_PRIORITY_DEFAULT
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to call once the operation is complete
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronous version of gs_remote_icon_ensure_cached().
+ *
+ * Only the network request is asynchronous. Checking the cache, decoding the
+ * downloaded icon and saving it to the cache are done synchronously in the
+ * thread-default main context of the caller, so this should be called from a
+ * worker thread.
+ *
+ * This allows many icons to be downloaded in parallel over the same
+ * @soup_session, reusing its connections, without needing a thread for each.
+ *
+ * Since: 43
+ */
+void
+gs_remote_icon_ensure_cached_async (GsRemoteIcon        *self,
+                                    SoupSession         *soup_session,
+                                    guint                maximum_icon_size,
+                                    int                  io_priority,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	EnsureCachedData *data;
+	g_autoptr(EnsureCachedData) data_owned = NULL;
+	g_autofree gchar *cache_filename = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	g_return_if_fail (GS_IS_REMOTE_ICON (self));
+	g_return_if_fail (SOUP_IS_SESSION (soup_session));
+	g_return_if_fail (maximum_icon_size > 0);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_remote_icon_ensure_cached_async);
+
+	/* Work out cache filename. */
+	cache_filename = gs_remote_icon_get_cache_filename (self->uri, TRUE, &local_error);
+	if (cache_filename == NULL) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	/* Already in cache? */
+	if (gs_remote_icon_check_cached (self, cache_filename)) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* Icons are small, so download into memory and decode from there. */
+	data = data_owned = g_new0 (EnsureCachedData, 1);
+	data->cache_filename = g_steal_pointer (&cache_filename);
+	data->maximum_icon_size = maximum_icon_size;
+	data->output_stream = g_memory_output_stream_new_resizable ();
+	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) ensure_cached_data_free);
+
+	gs_download_stream_async (soup_session, self->uri, data->output_stream, NULL, NULL, io_priority, NULL, NULL, cancellable,
+				  ensure_cached_download_cb, g_steal_pointer (&task));
+}
+
+static void
+ensure_cached_download_cb (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+	SoupSession *soup_session = SOUP_SESSION (source_object);
+	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	GsRemoteIcon *self = g_task_get_source_object (task);
+	EnsureCachedData *data = g_task_get_task_data (task);
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GdkPixbuf) cached_pixbuf = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_download_stream_finish (soup_session, result, NULL, NULL, &local_error)) {
+		g_prefix_error (&local_error, "Failed to download icon %s: ", self->uri);
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (data->output_stream));
+	stream = g_memory_input_stream_new_from_bytes (bytes);
+
+	cached_pixbuf = gs_icon_save_from_stream (stream, data->cache_filename,
+						  data->maximum_icon_size,
+						  cancellable, &local_error);
+	if (cached_pixbuf == NULL) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	/* Ensure the dimensions are set correctly on the icon. */
+	gs_remote_icon_set_size_from_pixbuf (self, cached_pixbuf);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * gs_remote_icon_ensure_cached_finish:
+ * @self: a #GsRemoteIcon
+ * @result: result of the asynchronous operation
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous operation started with
+ * gs_remote_icon_ensure_cached_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 43
+ */
+gboolean
+gs_remote_icon_ensure_cached_finish (GsRemoteIcon  *self,
+                                     GAsyncResult  *result,
+                                     GError       **error)
+{
+	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_remote_icon_ensure_cached_async), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -33,5 +33,17 @@ gboolean	 gs_remote_icon_ensure_cached	(GsRemoteIcon		 *self,
 						 guint			  maximum_icon_size,
 						 GCancellable		 *cancellable,
 						 GError			**error);
+void		 gs_remote_icon_ensure_cached_async
+						(GsRemoteIcon		 *self,
+						 SoupSession		 *soup_session,
+						 guint			  maximum_icon_size,
+						 int			  io_priority,
+						 GCancellable		 *cancellable,
+						 GAsyncReadyCallback	  callback,
+						 gpointer		  user_data);
+gboolean	 gs_remote_icon_ensure_cached_finish
+						(GsRemoteIcon		 *self,
+						 GAsyncResult		 *result,
+						 GError			**error);
 
 G_END_DECLS
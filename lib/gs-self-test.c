@@ -9,9 +9,14 @@
 
 #include "config.h"
 
+#include <glib/gstdio.h>
+
 #include "gnome-software-private.h"
 
+#include "gs-appstream.h"
 #include "gs-debug.h"
+#include "gs-key-colors-private.h"
+#include "gs-refine-coordinator.h"
 #include "gs-test.h"
 
 static gboolean
@@ -639,6 +644,62 @@ gs_app_func (void)
 	gs_app_set_state_recover (app);
 }
 
+static void
+gs_app_notify_count_cb (GObject    *object,
+                        GParamSpec *pspec,
+                        gpointer    user_data)
+{
+	GHashTable *counts = user_data;
+	guint count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, pspec->name));
+
+	g_hash_table_insert (counts, (gpointer) pspec->name, GUINT_TO_POINTER (count + 1));
+}
+
+static void
+gs_app_notify_coalesce_func (void)
+{
+	g_autoptr(GsApp) app1 = gs_app_new ("app1.desktop");
+	g_autoptr(GsApp) app2 = gs_app_new ("app2.desktop");
+	g_autoptr(GHashTable) counts1 = g_hash_table_new (g_str_hash, g_str_equal);
+	g_autoptr(GHashTable) counts2 = g_hash_table_new (g_str_hash, g_str_equal);
+
+	gs_test_flush_main_context ();
+
+	g_signal_connect (app1, "notify", G_CALLBACK (gs_app_notify_count_cb), counts1);
+	g_signal_connect (app2, "notify", G_CALLBACK (gs_app_notify_count_cb), counts2);
+
+	/* change some properties several times each */
+	for (guint i = 0; i < 10; i++) {
+		g_autofree gchar *name = g_strdup_printf ("name %u", i);
+		g_autofree gchar *summary = g_strdup_printf ("summary %u", i);
+
+		gs_app_set_name (app1, GS_APP_QUALITY_NORMAL, name);
+		gs_app_set_summary (app1, GS_APP_QUALITY_NORMAL, summary);
+		gs_app_set_name (app2, GS_APP_QUALITY_NORMAL, name);
+	}
+
+	/* nothing is emitted until the main context is iterated */
+	g_assert_cmpuint (g_hash_table_size (counts1), ==, 0);
+	g_assert_cmpuint (g_hash_table_size (counts2), ==, 0);
+
+	gs_test_flush_main_context ();
+
+	/* then each changed property is notified exactly once */
+	g_assert_cmpuint (g_hash_table_size (counts1), ==, 2);
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts1, "name")), ==, 1);
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts1, "summary")), ==, 1);
+	g_assert_cmpuint (g_hash_table_size (counts2), ==, 1);
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts2, "name")), ==, 1);
+
+	/* and later changes are notified again */
+	gs_app_set_name (app1, GS_APP_QUALITY_NORMAL, "another name");
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts1, "name")), ==, 2);
+
+	g_signal_handlers_disconnect_by_data (app1, counts1);
+	g_signal_handlers_disconnect_by_data (app2, counts2);
+}
+
 static void
 gs_app_progress_clamping_func (void)
 {
@@ -700,6 +761,66 @@ gs_app_list_func (void)
 	g_assert_cmpint (gs_app_list_get_state (list), ==, GS_APP_STATE_UNKNOWN);
 }
 
+static void
+gs_app_list_watch_func (void)
+{
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsApp) app1 = gs_app_new ("app1");
+	g_autoptr(GsApp) app2 = gs_app_new ("app2");
+	g_autoptr(GsApp) addon = gs_app_new ("addon");
+	g_autoptr(GsApp) addon2 = gs_app_new ("addon2");
+
+	gs_app_list_add_flag (list,
+			      GS_APP_LIST_FLAG_WATCH_APPS |
+			      GS_APP_LIST_FLAG_WATCH_APPS_ADDONS);
+
+	/* the addon is shared, so it counts twice */
+	gs_app_add_addon (app1, addon);
+	gs_app_add_addon (app2, addon);
+	gs_app_set_progress (app1, 10);
+	gs_app_set_progress (app2, 20);
+	gs_app_set_progress (addon, 60);
+	gs_test_flush_main_context ();
+
+	gs_app_list_add (list, app1);
+	gs_app_list_add (list, app2);
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, (10 + 60 + 20 + 60) / 4);
+	g_assert_cmpint (gs_app_list_get_state (list), ==, GS_APP_STATE_UNKNOWN);
+
+	gs_app_set_progress (addon, 100);
+	gs_app_set_state (addon, GS_APP_STATE_AVAILABLE);
+	gs_app_set_state (addon, GS_APP_STATE_INSTALLING);
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, (10 + 100 + 20 + 100) / 4);
+	g_assert_cmpint (gs_app_list_get_state (list), ==, GS_APP_STATE_INSTALLING);
+
+	/* truncating stops watching the removed app, but not the addon */
+	gs_app_list_truncate (list, 1);
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, (10 + 100) / 2);
+	g_assert_cmpint (gs_app_list_get_state (list), ==, GS_APP_STATE_INSTALLING);
+
+	/* nothing is watched any more */
+	gs_app_list_remove (list, app1);
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, GS_APP_PROGRESS_UNKNOWN);
+	g_assert_cmpint (gs_app_list_get_state (list), ==, GS_APP_STATE_UNKNOWN);
+
+	gs_app_set_progress (addon, 0);
+	gs_app_set_progress (app2, 0);
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, GS_APP_PROGRESS_UNKNOWN);
+
+	/* addons added or removed after the app are followed */
+	gs_app_list_add (list, app1);
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, (10 + 0) / 2);
+	gs_app_set_progress (addon2, 30);
+	gs_app_add_addon (app1, addon2);
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, (10 + 0 + 30) / 3);
+	gs_app_remove_addon (app1, addon2);
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (gs_app_list_get_progress (list), ==, (10 + 0) / 2);
+}
+
 static void
 gs_app_list_performance_func (void)
 {
@@ -722,6 +843,127 @@ gs_app_list_performance_func (void)
 	g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
 }
 
+static void
+gs_app_list_index_performance_func (void)
+{
+	g_autoptr(GPtrArray) apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GTimer) timer = NULL;
+
+	/* create enough apps that a linear dedupe would be noticeable */
+	for (guint i = 0; i < 5000; i++) {
+		g_autofree gchar *id = g_strdup_printf ("%04u.desktop", i);
+		g_ptr_array_add (apps, gs_app_new (id));
+	}
+
+	/* add them to the list, twice */
+	timer = g_timer_new ();
+	for (guint i = 0; i < apps->len * 2; i++) {
+		GsApp *app = g_ptr_array_index (apps, i % apps->len);
+		gs_app_list_add (list, app);
+	}
+	g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
+	g_assert_cmpint (gs_app_list_length (list), ==, apps->len);
+	g_assert (gs_app_list_lookup (list, "*/*/*/4999.desktop/*") == g_ptr_array_index (apps, 4999));
+}
+
+static void
+gs_app_list_filter_duplicates_performance_func (void)
+{
+	g_autoptr(GPtrArray) apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	g_autoptr(GTimer) timer = g_timer_new ();
+	const GsAppListFilterFlags filters[] = {
+		GS_APP_LIST_FILTER_FLAG_NONE,
+		GS_APP_LIST_FILTER_FLAG_KEY_ID,
+		GS_APP_LIST_FILTER_FLAG_KEY_ID | GS_APP_LIST_FILTER_FLAG_KEY_SOURCE | GS_APP_LIST_FILTER_FLAG_KEY_VERSION,
+		GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES,
+	};
+	const guint expected_lengths[] = { 10000, 5000, 5000, 5000 };
+
+	/* 10k apps, with each ID packaged by two different origins */
+	for (guint i = 0; i < 10000; i++) {
+		g_autofree gchar *id = g_strdup_printf ("%04u.desktop", i / 2);
+		GsApp *app = gs_app_new (id);
+		gs_app_set_origin (app, (i % 2 == 0) ? "fedora" : "flathub");
+		gs_app_add_source (app, id);
+		gs_app_set_version (app, "1.2.3");
+		gs_app_set_priority (app, i % 2);
+		g_ptr_array_add (apps, app);
+	}
+
+	for (gsize f = 0; f < G_N_ELEMENTS (filters); f++) {
+		g_autoptr(GsAppList) list = gs_app_list_new ();
+
+		for (guint i = 0; i < apps->len; i++)
+			gs_app_list_add (list, g_ptr_array_index (apps, i));
+		g_assert_cmpint (gs_app_list_length (list), ==, 10000);
+
+		g_timer_reset (timer);
+		gs_app_list_filter_duplicates (list, filters[f]);
+		g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
+
+		g_assert_cmpint (gs_app_list_length (list), ==, expected_lengths[f]);
+		if (filters[f] != GS_APP_LIST_FILTER_FLAG_NONE) {
+			/* the higher priority app wins, and order is kept */
+			g_assert_cmpstr (gs_app_get_origin (gs_app_list_index (list, 0)), ==, "flathub");
+			g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list, 0)), ==, "0000.desktop");
+			g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list, 4999)), ==, "4999.desktop");
+		}
+	}
+}
+
+static void
+gs_app_list_index_func (void)
+{
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsApp) app_moved = NULL;
+	g_autoptr(GsApp) app_dupe = NULL;
+
+	/* enough apps for the list to index them */
+	for (guint i = 0; i < 100; i++) {
+		g_autofree gchar *id = g_strdup_printf ("%03u.desktop", i);
+		g_autoptr(GsApp) app = gs_app_new (id);
+		gs_app_set_scope (app, AS_COMPONENT_SCOPE_SYSTEM);
+		gs_app_set_bundle_kind (app, AS_BUNDLE_KIND_PACKAGE);
+		gs_app_list_add (list, app);
+	}
+	g_assert_cmpint (gs_app_list_length (list), ==, 100);
+	g_assert_nonnull (gs_app_list_lookup (list, "system/package/*/042.desktop/*"));
+	g_assert_nonnull (gs_app_list_lookup (list, "*/*/*/099.desktop/*"));
+	g_assert_null (gs_app_list_lookup (list, "system/flatpak/*/042.desktop/*"));
+	g_assert_null (gs_app_list_lookup (list, "system/package/*/100.desktop/*"));
+
+	/* the same app, and an app with a matching unique ID, are not added */
+	app_dupe = gs_app_new ("042.desktop");
+	gs_app_set_scope (app_dupe, AS_COMPONENT_SCOPE_SYSTEM);
+	gs_app_list_add (list, app_dupe);
+	gs_app_list_add (list, gs_app_list_index (list, 7));
+	g_assert_cmpint (gs_app_list_length (list), ==, 100);
+
+	/* wildcard component IDs match any bucket */
+	gs_app_set_unique_id (app_dupe, "system/snap/*/*/*");
+	gs_app_list_add (list, app_dupe);
+	g_assert_cmpint (gs_app_list_length (list), ==, 101);
+	g_assert (gs_app_list_lookup (list, "system/snap/*/123.desktop/*") == app_dupe);
+
+	/* changing the ID of an app in the list is noticed */
+	app_moved = g_object_ref (gs_app_list_index (list, 3));
+	gs_app_set_id (app_moved, "moved.desktop");
+	g_assert (gs_app_list_lookup (list, "system/package/*/moved.desktop/*") == app_moved);
+	g_assert_null (gs_app_list_lookup (list, "system/package/*/003.desktop/*"));
+
+	/* removing and truncating keep it coherent */
+	gs_app_list_remove (list, app_moved);
+	g_assert_null (gs_app_list_lookup (list, "system/package/*/moved.desktop/*"));
+	gs_app_list_add (list, app_moved);
+	g_assert (gs_app_list_lookup (list, "system/package/*/moved.desktop/*") == app_moved);
+	gs_app_list_truncate (list, 50);
+	g_assert_null (gs_app_list_lookup (list, "system/package/*/moved.desktop/*"));
+	g_assert_nonnull (gs_app_list_lookup (list, "system/package/*/049.desktop/*"));
+	gs_app_list_add (list, app_moved);
+	g_assert_cmpint (gs_app_list_length (list), ==, 51);
+}
+
 static void
 gs_app_list_related_func (void)
 {
@@ -742,6 +984,623 @@ gs_app_list_related_func (void)
 	g_assert_cmpint (gs_app_list_get_progress (list), ==, 50);
 }
 
+typedef struct {
+	GMutex mutex;
+	GCond cond;
+	gboolean release_background;
+	guint n_background_started;
+} WorkerPoolData;
+
+static void
+worker_pool_background_cb (GTask        *task,
+                           gpointer      source_object,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
+{
+	WorkerPoolData *data = task_data;
+
+	g_mutex_lock (&data->mutex);
+	data->n_background_started++;
+	g_cond_broadcast (&data->cond);
+	while (!data->release_background)
+		g_cond_wait (&data->cond, &data->mutex);
+	g_mutex_unlock (&data->mutex);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+worker_pool_interactive_cb (GTask        *task,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+	WorkerPoolData *data = task_data;
+
+	/* the second background task must not have taken the last thread */
+	g_mutex_lock (&data->mutex);
+	g_assert_cmpuint (data->n_background_started, ==, 1);
+	g_assert_false (data->release_background);
+	g_mutex_unlock (&data->mutex);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+worker_pool_done_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	guint *n_completed = user_data;
+
+	g_assert_true (g_task_propagate_boolean (G_TASK (result), NULL));
+	(*n_completed)++;
+}
+
+static void
+worker_pool_shutdown_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	GAsyncResult **result_out = user_data;
+	*result_out = g_object_ref (result);
+}
+
+static void
+gs_worker_pool_func (void)
+{
+	g_autoptr(GsWorkerPool) pool = gs_worker_pool_new ("gs-self-test", 2);
+	g_autoptr(GAsyncResult) shutdown_result = NULL;
+	g_autoptr(GError) error = NULL;
+	WorkerPoolData data = { 0, };
+	guint n_completed = 0;
+
+	g_mutex_init (&data.mutex);
+	g_cond_init (&data.cond);
+	g_assert_cmpuint (gs_worker_pool_get_n_threads (pool), ==, 2);
+	g_assert_false (gs_worker_pool_is_in_worker_context (pool));
+
+	/* two background tasks, only one of which may run at once */
+	for (guint i = 0; i < 2; i++) {
+		GTask *task = g_task_new (NULL, NULL, worker_pool_done_cb, &n_completed);
+		g_task_set_task_data (task, &data, NULL);
+		gs_worker_pool_queue (pool, G_PRIORITY_LOW, worker_pool_background_cb, task);
+	}
+	g_mutex_lock (&data.mutex);
+	while (data.n_background_started == 0)
+		g_cond_wait (&data.cond, &data.mutex);
+	g_mutex_unlock (&data.mutex);
+
+	/* an interactive task still gets a thread straight away */
+	{
+		GTask *task = g_task_new (NULL, NULL, worker_pool_done_cb, &n_completed);
+		g_task_set_task_data (task, &data, NULL);
+		gs_worker_pool_queue (pool, G_PRIORITY_DEFAULT, worker_pool_interactive_cb, task);
+	}
+	while (n_completed < 1)
+		g_main_context_iteration (NULL, TRUE);
+
+	/* let the background tasks finish */
+	g_mutex_lock (&data.mutex);
+	data.release_background = TRUE;
+	g_cond_broadcast (&data.cond);
+	g_mutex_unlock (&data.mutex);
+	while (n_completed < 3)
+		g_main_context_iteration (NULL, TRUE);
+	g_assert_cmpuint (data.n_background_started, ==, 2);
+
+	gs_worker_pool_shutdown_async (pool, NULL, worker_pool_shutdown_cb, &shutdown_result);
+	while (shutdown_result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	g_assert_true (gs_worker_pool_shutdown_finish (pool, shutdown_result, &error));
+	g_assert_no_error (error);
+
+	g_cond_clear (&data.cond);
+	g_mutex_clear (&data.mutex);
+}
+
+/* GsPlugin is abstract, so this is the smallest subclass which can manage an
+ * app in the refine cache tests */
+typedef GsPlugin GsSelfTestPlugin;
+typedef GsPluginClass GsSelfTestPluginClass;
+
+G_DEFINE_TYPE (GsSelfTestPlugin, gs_self_test_plugin, GS_TYPE_PLUGIN)
+
+static void
+gs_self_test_plugin_class_init (GsSelfTestPluginClass *klass)
+{
+}
+
+static void
+gs_self_test_plugin_init (GsSelfTestPlugin *self)
+{
+}
+
+static GsApp *
+refine_cache_app_new (GsPlugin *plugin)
+{
+	GsApp *app = gs_app_new ("org.example.App");
+	gs_app_set_origin (app, "example");
+	gs_app_set_management_plugin (app, plugin);
+	return app;
+}
+
+static void
+gs_refine_cache_func (void)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsPlugin) plugin = NULL;
+	g_autoptr(GsPlugin) plugin_unstamped = NULL;
+	g_autoptr(GPtrArray) plugins = g_ptr_array_new ();
+	g_autoptr(GsRefineCache) cache = NULL;
+	g_autoptr(GsApp) app = NULL;
+	g_autoptr(GsApp) app2 = NULL;
+	g_autoptr(GsApp) app3 = NULL;
+	g_autoptr(GsApp) app_unstamped = NULL;
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *stamp = NULL;
+	g_autofree gchar *stamp2 = NULL;
+
+	tmp_dir = g_dir_make_tmp ("gs-refine-cache-XXXXXX", &error);
+	g_assert_no_error (error);
+	filename = g_build_filename (tmp_dir, "cache.gvariant", NULL);
+
+	plugin = g_object_new (gs_self_test_plugin_get_type (), NULL);
+	gs_plugin_set_name (plugin, "self-test");
+	plugin_unstamped = g_object_new (gs_self_test_plugin_get_type (), NULL);
+	gs_plugin_set_name (plugin_unstamped, "self-test-unstamped");
+	g_ptr_array_add (plugins, plugin);
+	g_ptr_array_add (plugins, plugin_unstamped);
+
+	/* no stamps at all disables the cache */
+	g_assert_null (gs_refine_cache_compute_stamp (plugins));
+	gs_plugin_set_refine_cache_stamp (plugin, "1");
+	stamp = gs_refine_cache_compute_stamp (plugins);
+	g_assert_nonnull (stamp);
+
+	/* store a refined app */
+	cache = gs_refine_cache_new (filename);
+	app = refine_cache_app_new (plugin);
+	gs_app_set_license (app, GS_APP_QUALITY_NORMAL, "GPL-2.0+");
+	gs_app_set_version (app, "1.2.3");
+	gs_app_set_url (app, AS_URL_KIND_HOMEPAGE, "https://example.org/");
+	gs_app_set_url (app, AS_URL_KIND_BUGTRACKER, "https://example.org/issues");
+	gs_refine_cache_store (cache, app, stamp,
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+
+	/* apps from plugins without a stamp are never cached */
+	app_unstamped = refine_cache_app_new (plugin_unstamped);
+	gs_app_set_id (app_unstamped, "org.example.Unstamped");
+	gs_app_set_license (app_unstamped, GS_APP_QUALITY_NORMAL, "MIT");
+	gs_refine_cache_store (cache, app_unstamped, stamp, GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE);
+	g_assert_false (gs_refine_cache_lookup (cache, app_unstamped, stamp, GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE));
+
+	/* it survives being saved and reloaded */
+	g_assert_true (gs_refine_cache_save (cache, &error));
+	g_assert_no_error (error);
+	g_clear_object (&cache);
+	cache = gs_refine_cache_new (filename);
+
+	app2 = refine_cache_app_new (plugin);
+	g_assert_true (gs_refine_cache_lookup (cache, app2, stamp, GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE));
+	g_assert_cmpstr (gs_app_get_license (app2), ==, "GPL-2.0+");
+	g_assert_null (gs_app_get_version (app2));
+	g_assert_true (gs_refine_cache_lookup (cache, app2, stamp,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON));
+	g_assert_cmpstr (gs_app_get_version (app2), ==, "1.2.3");
+
+	/* every kind of URL is restored, not just the homepage */
+	g_assert_true (gs_refine_cache_lookup (cache, app2, stamp, GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL));
+	g_assert_cmpstr (gs_app_get_url (app2, AS_URL_KIND_HOMEPAGE), ==, "https://example.org/");
+	g_assert_cmpstr (gs_app_get_url (app2, AS_URL_KIND_BUGTRACKER), ==, "https://example.org/issues");
+	g_assert_null (gs_app_get_url (app2, AS_URL_KIND_HELP));
+
+	/* a field which wasn’t refined is a miss */
+	g_assert_false (gs_refine_cache_lookup (cache, app2, stamp,
+						GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE |
+						GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION));
+
+	/* changing a plugin’s stamp invalidates everything */
+	gs_plugin_set_refine_cache_stamp (plugin, "2");
+	stamp2 = gs_refine_cache_compute_stamp (plugins);
+	g_assert_cmpstr (stamp, !=, stamp2);
+	app3 = refine_cache_app_new (plugin);
+	g_assert_false (gs_refine_cache_lookup (cache, app3, stamp2, GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE));
+	g_assert_null (gs_app_get_license (app3));
+
+	g_clear_object (&cache);
+	g_assert_cmpint (g_unlink (filename), ==, 0);
+	g_assert_cmpint (g_rmdir (tmp_dir), ==, 0);
+}
+
+static void
+refine_ticket_wait_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	GAsyncResult **result_out = user_data;
+	*result_out = g_object_ref (result);
+}
+
+static void
+gs_refine_coordinator_func (void)
+{
+	GsRefineCoordinator *coordinator = gs_refine_coordinator_new ();
+	g_autoptr(GsApp) app_a = gs_app_new ("org.example.A");
+	g_autoptr(GsApp) app_b = gs_app_new ("org.example.B");
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsAppList) partial_list = gs_app_list_new ();
+	g_autoptr(GsAppList) covered_list = gs_app_list_new ();
+	g_autoptr(GPtrArray) wait_tickets = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_refine_ticket_unref);
+	g_autoptr(GsRefineTicket) ticket1 = NULL;
+	g_autoptr(GsRefineTicket) ticket2 = NULL;
+	g_autoptr(GsRefineTicket) ticket3 = NULL;
+	g_autoptr(GsRefineTicket) ticket4 = NULL;
+	g_autoptr(GsRefineTicket) ticket5 = NULL;
+	g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+	g_autoptr(GAsyncResult) wait_result = NULL;
+	g_autoptr(GError) error = NULL;
+	GsPluginRefineFlags partial_flags;
+	gboolean other_succeeded;
+
+	/* nothing else is being refined, so there’s no coverage */
+	gs_app_list_add (list, app_a);
+	gs_app_list_add (list, app_b);
+	ticket1 = gs_refine_coordinator_begin (coordinator, list,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION,
+					       partial_list, &partial_flags,
+					       covered_list, wait_tickets);
+	g_assert_cmpuint (gs_app_list_length (list), ==, 2);
+	g_assert_cmpuint (gs_app_list_length (partial_list), ==, 0);
+	g_assert_cmpuint (gs_app_list_length (covered_list), ==, 0);
+	g_assert_cmpuint (partial_flags, ==, 0);
+	g_assert_cmpuint (wait_tickets->len, ==, 0);
+
+	/* full coverage; modifier flags don’t count */
+	gs_app_list_remove_all (list);
+	gs_app_list_add (list, app_a);
+	ticket2 = gs_refine_coordinator_begin (coordinator, list,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+					       GS_PLUGIN_REFINE_FLAGS_ALLOW_PACKAGES,
+					       partial_list, &partial_flags,
+					       covered_list, wait_tickets);
+	g_assert_cmpuint (gs_app_list_length (list), ==, 0);
+	g_assert_cmpuint (gs_app_list_length (partial_list), ==, 0);
+	g_assert_cmpuint (gs_app_list_length (covered_list), ==, 1);
+	g_assert_true (gs_app_list_index (covered_list, 0) == app_a);
+	g_assert_cmpuint (wait_tickets->len, ==, 1);
+	g_assert_true (g_ptr_array_index (wait_tickets, 0) == ticket1);
+
+	/* partial coverage, so only the missing flags are refined */
+	gs_app_list_remove_all (covered_list);
+	g_ptr_array_set_size (wait_tickets, 0);
+	gs_app_list_add (list, app_b);
+	ticket3 = gs_refine_coordinator_begin (coordinator, list,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE,
+					       partial_list, &partial_flags,
+					       covered_list, wait_tickets);
+	g_assert_cmpuint (gs_app_list_length (list), ==, 0);
+	g_assert_cmpuint (gs_app_list_length (partial_list), ==, 1);
+	g_assert_true (gs_app_list_index (partial_list, 0) == app_b);
+	g_assert_cmpuint (gs_app_list_length (covered_list), ==, 0);
+	g_assert_cmpuint (partial_flags, ==, GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE);
+	g_assert_cmpuint (wait_tickets->len, ==, 1);
+	g_assert_true (g_ptr_array_index (wait_tickets, 0) == ticket1);
+
+	/* a refine for more flags than needed isn’t waited for */
+	gs_app_list_remove_all (partial_list);
+	g_ptr_array_set_size (wait_tickets, 0);
+	gs_app_list_add (list, app_a);
+	ticket4 = gs_refine_coordinator_begin (coordinator, list,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+					       partial_list, &partial_flags,
+					       covered_list, wait_tickets);
+	g_assert_cmpuint (gs_app_list_length (list), ==, 1);
+	g_assert_cmpuint (gs_app_list_length (partial_list), ==, 0);
+	g_assert_cmpuint (gs_app_list_length (covered_list), ==, 0);
+	g_assert_cmpuint (wait_tickets->len, ==, 0);
+
+	/* waiters find out when the other refine fails, so they can fall back
+	 * to refining the shared apps themselves */
+	gs_refine_ticket_wait_async (ticket1, NULL, refine_ticket_wait_cb, &wait_result);
+	g_main_context_iteration (NULL, FALSE);
+	g_assert_null (wait_result);
+	gs_refine_ticket_finish (ticket1, FALSE);
+	while (wait_result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	g_assert_true (gs_refine_ticket_wait_finish (wait_result, &other_succeeded, &error));
+	g_assert_no_error (error);
+	g_assert_false (other_succeeded);
+	g_clear_object (&wait_result);
+
+	/* waits can be cancelled without affecting the refine being waited for */
+	gs_app_list_remove_all (list);
+	gs_app_list_add (list, app_b);
+	ticket5 = gs_refine_coordinator_begin (coordinator, list,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE,
+					       partial_list, &partial_flags,
+					       covered_list, wait_tickets);
+	g_assert_cmpuint (gs_app_list_length (covered_list), ==, 1);
+	g_assert_cmpuint (wait_tickets->len, ==, 1);
+	g_assert_true (g_ptr_array_index (wait_tickets, 0) == ticket3);
+	gs_refine_ticket_wait_async (ticket3, cancellable, refine_ticket_wait_cb, &wait_result);
+	g_cancellable_cancel (cancellable);
+	while (wait_result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	g_assert_false (gs_refine_ticket_wait_finish (wait_result, &other_succeeded, &error));
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_clear_object (&wait_result);
+	g_clear_error (&error);
+
+	/* once finished, the apps aren’t covered any more */
+	gs_refine_ticket_finish (ticket2, TRUE);
+	gs_refine_ticket_finish (ticket3, TRUE);
+	gs_refine_ticket_finish (ticket4, TRUE);
+	gs_refine_ticket_finish (ticket5, TRUE);
+
+	gs_app_list_remove_all (list);
+	gs_app_list_remove_all (covered_list);
+	g_ptr_array_set_size (wait_tickets, 0);
+	gs_app_list_add (list, app_a);
+	gs_app_list_add (list, app_b);
+	g_clear_pointer (&ticket1, gs_refine_ticket_unref);
+	ticket1 = gs_refine_coordinator_begin (coordinator, list,
+					       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+					       partial_list, &partial_flags,
+					       covered_list, wait_tickets);
+	g_assert_cmpuint (gs_app_list_length (list), ==, 2);
+	g_assert_cmpuint (wait_tickets->len, ==, 0);
+	gs_refine_ticket_finish (ticket1, TRUE);
+
+	g_clear_pointer (&ticket1, gs_refine_ticket_unref);
+	g_clear_pointer (&ticket2, gs_refine_ticket_unref);
+	g_clear_pointer (&ticket3, gs_refine_ticket_unref);
+	g_clear_pointer (&ticket4, gs_refine_ticket_unref);
+	g_clear_pointer (&ticket5, gs_refine_ticket_unref);
+	gs_refine_coordinator_free (coordinator);
+}
+
+static void
+gs_appstream_categories_func (void)
+{
+	static const GsDesktopMap map_test[] = {
+		{ "all",		"All",
+					{ "Graphics",
+					  NULL } },
+		{ "viewers",		"Viewers",
+					{ "Graphics::Viewer",
+					  NULL } },
+		{ "photography",	"Photography",
+					{ "Graphics::Photography",
+					  NULL } },
+		{ NULL }
+	};
+	static const GsDesktopData data_test = {
+		"create", map_test, "Create", "org.gnome.Software.Create", 100
+	};
+	const gchar *xml =
+		"<components origin=\"test\">\n"
+		"  <component type=\"desktop-application\">\n"
+		"    <id>a.desktop</id>\n"
+		"    <categories><category>Graphics</category><category>Viewer</category></categories>\n"
+		"  </component>\n"
+		"  <component type=\"desktop-application\">\n"
+		"    <id>b.desktop</id>\n"
+		"    <categories><category>Graphics</category><category>Photography</category>"
+		"<category>Viewer</category><category>Viewer</category></categories>\n"
+		"  </component>\n"
+		"  <component type=\"desktop-application\">\n"
+		"    <id>c.desktop</id>\n"
+		"    <categories><category>Office</category></categories>\n"
+		"  </component>\n"
+		"  <component type=\"desktop-application\">\n"
+		"    <id>d.desktop</id>\n"
+		"    <categories><category>Viewer</category></categories>\n"
+		"  </component>\n"
+		"</components>\n";
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsCategory) category = NULL;
+	g_autoptr(GsPlugin) plugin = NULL;
+	g_autoptr(GPtrArray) categories = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(XbBuilder) builder = xb_builder_new ();
+	g_autoptr(XbBuilderSource) source = xb_builder_source_new ();
+	g_autoptr(XbSilo) silo = NULL;
+	GsCategory *viewers;
+
+	g_assert_true (xb_builder_source_load_xml (source, xml, XB_BUILDER_SOURCE_FLAG_NONE, &error));
+	g_assert_no_error (error);
+	xb_builder_import_source (builder, source);
+	silo = xb_builder_compile (builder, XB_BUILDER_COMPILE_FLAG_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (silo);
+
+	category = gs_category_new_for_desktop_data (&data_test);
+	g_ptr_array_add (categories, g_object_ref (category));
+
+	/* ‘all’ covers all three groups, so a and b are counted once for
+	 * Graphics, once for Graphics::Viewer, and b once for
+	 * Graphics::Photography; d is not in Graphics at all. The parent
+	 * counts those 5 again for the other two subcategories. */
+	g_assert_true (gs_appstream_add_categories (silo, categories, NULL, &error));
+	g_assert_no_error (error);
+	viewers = gs_category_find_child (category, "viewers");
+	g_assert_nonnull (viewers);
+	g_assert_cmpint (gs_category_get_size (viewers), ==, 2);
+	g_assert_cmpint (gs_category_get_size (gs_category_find_child (category, "photography")), ==, 1);
+	g_assert_cmpint (gs_category_get_size (category), ==, 8);
+
+	/* the ‘all’ subcategory reports the size of its parent */
+	g_assert_cmpint (gs_category_get_size (gs_category_find_child (category, "all")), ==, 8);
+
+	/* the same index lists the apps */
+	plugin = g_object_new (gs_self_test_plugin_get_type (), NULL);
+	gs_plugin_set_name (plugin, "self-test");
+	g_assert_true (gs_appstream_add_category_apps (plugin, silo, viewers, list, NULL, &error));
+	g_assert_no_error (error);
+	g_assert_cmpint (gs_app_list_length (list), ==, 2);
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list, 0)), ==, "a.desktop");
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list, 1)), ==, "b.desktop");
+	g_assert_true (gs_app_has_quirk (gs_app_list_index (list, 0), GS_APP_QUIRK_IS_WILDCARD));
+}
+
+static XbSilo *
+gs_appstream_compile_test_silo (const gchar *xml)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(XbBuilder) builder = xb_builder_new ();
+	g_autoptr(XbBuilderSource) source = xb_builder_source_new ();
+	g_autoptr(XbSilo) silo = NULL;
+
+	g_assert_true (xb_builder_source_load_xml (source, xml, XB_BUILDER_SOURCE_FLAG_NONE, &error));
+	g_assert_no_error (error);
+	xb_builder_import_source (builder, source);
+	silo = xb_builder_compile (builder, XB_BUILDER_COMPILE_FLAG_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (silo);
+
+	return g_steal_pointer (&silo);
+}
+
+static void
+gs_appstream_refine_silos_func (void)
+{
+	const gchar *catalog_xml =
+		"<components origin=\"test\">\n"
+		"  <component type=\"desktop-application\">\n"
+		"    <id>parent.desktop</id>\n"
+		"    <releases>\n"
+		"      <release version=\"2.0\"><description><p>New</p></description></release>\n"
+		"      <release version=\"1.0\"><description><p>Old</p></description></release>\n"
+		"    </releases>\n"
+		"  </component>\n"
+		"</components>\n";
+	const gchar *addon_xml =
+		"<component type=\"addon\">\n"
+		"  <id>parent.addon</id>\n"
+		"  <extends>parent.desktop</extends>\n"
+		"</component>\n";
+	const gchar *installed_xml =
+		"<component type=\"desktop-application\">\n"
+		"  <id>parent.desktop</id>\n"
+		"  <releases><release version=\"1.0\"/></releases>\n"
+		"</component>\n";
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsApp) app = gs_app_new ("parent.desktop");
+	g_autoptr(GsPlugin) plugin = NULL;
+	g_autoptr(GPtrArray) silos = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(XbNode) component = NULL;
+	GsAppList *addons;
+
+	/* the parent, its addon and its installed releases are each in
+	 * different silos, as they are from different sources */
+	g_ptr_array_add (silos, gs_appstream_compile_test_silo (catalog_xml));
+	g_ptr_array_add (silos, gs_appstream_compile_test_silo (addon_xml));
+	g_ptr_array_add (silos, gs_appstream_compile_test_silo (installed_xml));
+	component = xb_silo_query_first (g_ptr_array_index (silos, 0),
+					 "components/component/id[text()='parent.desktop']/..", &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (component);
+
+	plugin = g_object_new (gs_self_test_plugin_get_type (), NULL);
+	gs_plugin_set_name (plugin, "self-test");
+	gs_app_set_state (app, GS_APP_STATE_UPDATABLE);
+	g_assert_true (gs_appstream_refine_app_with_silos (plugin, app, silos, component,
+							   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS |
+							   GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_DETAILS,
+							   &error));
+	g_assert_no_error (error);
+
+	addons = gs_app_get_addons (app);
+	g_assert_nonnull (addons);
+	g_assert_cmpint (gs_app_list_length (addons), ==, 1);
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (addons, 0)), ==, "parent.addon");
+
+	/* 1.0 is installed, so only 2.0 is an update */
+	g_assert_cmpstr (gs_app_get_update_details_markup (app), ==, "New");
+}
+
+/* An icon-like image with a few blocks of colour, a gradient and a
+ * transparent border, so the clustering has to do some work */
+static GdkPixbuf *
+key_colors_test_pixbuf_new (guint variant)
+{
+	GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 32, 32);
+	gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+	guint8 *pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+	for (guint y = 0; y < 32; y++) {
+		for (guint x = 0; x < 32; x++) {
+			guint8 *p = pixels + y * rowstride + x * 4;
+
+			if (x < 2 || y < 2 || x >= 30 || y >= 30) {
+				p[0] = p[1] = p[2] = 0xff;
+				p[3] = 0;
+			} else if (x < 12) {
+				p[0] = 0xe0 - variant * 16;
+				p[1] = 0x20 + y;
+				p[2] = 0x30;
+				p[3] = 0xff;
+			} else if (y < 16) {
+				p[0] = 0x10;
+				p[1] = 0x80 + variant * 8;
+				p[2] = 0x40 + x * 4;
+				p[3] = 0xff;
+			} else {
+				p[0] = (x * 7 + y * 3 + variant * 11) & 0xff;
+				p[1] = (x * 5 + variant * 29) & 0xff;
+				p[2] = (y * 9) & 0xff;
+				p[3] = 0xff;
+			}
+		}
+	}
+
+	return pixbuf;
+}
+
+static GArray *
+key_colors_calculate_seeded (GdkPixbuf *pixbuf)
+{
+	/* the clusters are initialised randomly */
+	g_random_set_seed (42);
+	return gs_calculate_key_colors (pixbuf);
+}
+
+static void
+gs_key_colors_impls_func (void)
+{
+	for (guint variant = 0; variant < 4; variant++) {
+		g_autoptr(GdkPixbuf) pixbuf = key_colors_test_pixbuf_new (variant);
+		g_autoptr(GArray) colors_scalar = NULL;
+
+		g_assert_true (gs_key_colors_set_impl (GS_KEY_COLORS_IMPL_SCALAR));
+		colors_scalar = key_colors_calculate_seeded (pixbuf);
+		g_assert_cmpuint (colors_scalar->len, >, 0);
+
+		for (guint impl = GS_KEY_COLORS_IMPL_SCALAR + 1; impl < GS_KEY_COLORS_IMPL_LAST; impl++) {
+			g_autoptr(GArray) colors = NULL;
+
+			if (!gs_key_colors_set_impl ((GsKeyColorsImpl) impl)) {
+				g_debug ("key colors implementation %u not supported", impl);
+				continue;
+			}
+			colors = key_colors_calculate_seeded (pixbuf);
+
+			g_assert_cmpuint (colors->len, ==, colors_scalar->len);
+			for (guint i = 0; i < colors->len; i++) {
+				const GdkRGBA *a = &g_array_index (colors, GdkRGBA, i);
+				const GdkRGBA *b = &g_array_index (colors_scalar, GdkRGBA, i);
+				g_assert_true (gdk_rgba_equal (a, b));
+			}
+		}
+	}
+
+	g_assert_true (gs_key_colors_set_impl (GS_KEY_COLORS_IMPL_AUTO));
+}
+
 int
 main (int argc, char **argv)
 {
@@ -758,15 +1617,26 @@ main (int argc, char **argv)
 	g_test_add_func ("/gnome-software/lib/os-release", gs_os_release_func);
 	g_test_add_func ("/gnome-software/lib/app", gs_app_func);
 	g_test_add_func ("/gnome-software/lib/app/progress-clamping", gs_app_progress_clamping_func);
+	g_test_add_func ("/gnome-software/lib/app{notify-coalesce}", gs_app_notify_coalesce_func);
 	g_test_add_func ("/gnome-software/lib/app{addons}", gs_app_addons_func);
 	g_test_add_func ("/gnome-software/lib/app{unique-id}", gs_app_unique_id_func);
 	g_test_add_data_func ("/gnome-software/lib/app{thread}", debug, gs_app_thread_func);
 	g_test_add_func ("/gnome-software/lib/app{list}", gs_app_list_func);
+	g_test_add_func ("/gnome-software/lib/app{list-watch}", gs_app_list_watch_func);
 	g_test_add_func ("/gnome-software/lib/app{list-wildcard-dedupe}", gs_app_list_wildcard_dedupe_func);
 	g_test_add_func ("/gnome-software/lib/app{list-performance}", gs_app_list_performance_func);
+	g_test_add_func ("/gnome-software/lib/app{list-index}", gs_app_list_index_func);
+	g_test_add_func ("/gnome-software/lib/app{list-index-performance}", gs_app_list_index_performance_func);
+	g_test_add_func ("/gnome-software/lib/app{list-filter-duplicates-performance}", gs_app_list_filter_duplicates_performance_func);
 	g_test_add_func ("/gnome-software/lib/app{list-related}", gs_app_list_related_func);
 	g_test_add_func ("/gnome-software/lib/plugin", gs_plugin_func);
 	g_test_add_func ("/gnome-software/lib/plugin{download-rewrite}", gs_plugin_download_rewrite_func);
+	g_test_add_func ("/gnome-software/lib/worker-pool", gs_worker_pool_func);
+	g_test_add_func ("/gnome-software/lib/refine-cache", gs_refine_cache_func);
+	g_test_add_func ("/gnome-software/lib/refine-coordinator", gs_refine_coordinator_func);
+	g_test_add_func ("/gnome-software/lib/appstream{categories}", gs_appstream_categories_func);
+	g_test_add_func ("/gnome-software/lib/appstream{refine-silos}", gs_appstream_refine_silos_func);
+	g_test_add_func ("/gnome-software/lib/key-colors{impls}", gs_key_colors_impls_func);
 
 	return g_test_run ();
 }
@@ -0,0 +1,650 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2021 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/**
+ * SECTION:gs-worker-pool
+ * @short_description: A pool of worker threads which execute queued #GTasks by priority
+ *
+ * #GsWorkerPool is a multi-threaded variant of #GsWorkerThread. It has the
+ * same API, so a plugin can switch from one to the other as long as its
+ * worker functions are safe to run in parallel with each other.
+ *
+ * Tasks can be added to the queue using gs_worker_pool_queue(). There is one
+ * FIFO queue per priority, and whenever a thread in the pool becomes free it
+ * takes the oldest task from the highest priority queue which has one, so
+ * tasks are started in strict (priority, queue order) order across all the
+ * threads. Each #GTaskThreadFunc is responsible for calling
+ * `g_task_return_*()` on its #GTask to complete that task.
+ *
+ * Tasks queued at a priority lower than %G_PRIORITY_DEFAULT (such as
+ * %G_PRIORITY_LOW, used for background operations) are never allowed to
+ * occupy all the threads in the pool at once: one thread is always kept
+ * free for tasks at %G_PRIORITY_DEFAULT or higher, so interactive operations
+ * never wait behind a long-running background one.
+ *
+ * As with #GsWorkerThread, the priority passed to gs_worker_pool_queue() is
+ * used to adjust the executing thread’s I/O priority (using `ioprio_set()`).
+ *
+ * Each thread in the pool has its own thread-default #GMainContext, which is
+ * iterated while the thread is waiting for work, so that sources attached
+ * to it by a task (such as file monitors) are dispatched.
+ *
+ * The threads will continue executing tasks until
+ * gs_worker_pool_shutdown_async() is called. This must be called before the
+ * final reference to the #GsWorkerPool is dropped.
+ *
+ * Since: 43
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "gs-ioprio.h"
+#include "gs-profiler.h"
+#include "gs-worker-pool.h"
+
+/* Default upper limit on the number of threads in a pool. The work done by
+ * plugins is mostly I/O bound or serialised on locks, so more threads than
+ * this rarely help. */
+#define GS_WORKER_POOL_MAX_DEFAULT_THREADS	4
+
+typedef enum {
+	GS_WORKER_POOL_STATE_RUNNING = 0,
+	GS_WORKER_POOL_STATE_SHUTTING_DOWN = 1,
+	GS_WORKER_POOL_STATE_SHUT_DOWN = 2,
+} GsWorkerPoolState;
+
+/* Essentially a wrapper around these elements to avoid the caller having to
+ * return `G_SOURCE_REMOVE` from their `work_func` every time. */
+typedef struct {
+	GTaskThreadFunc work_func;
+	GTask *task;  /* (owned) */
+	gint priority;
+} WorkData;
+
+typedef struct {
+	gint priority;
+	GQueue queue;  /* (element-type WorkData) (owned) */
+} PriorityQueue;
+
+typedef struct {
+	GsWorkerPool *pool;  /* (unowned) */
+	GMainContext *context;  /* (owned) */
+	GThread *thread;  /* (owned) (nullable) */
+} WorkerData;
+
+struct _GsWorkerPool
+{
+	GObject			 parent;
+
+	gchar			*name;  /* (not nullable) (owned) after construction */
+	guint			 n_threads;
+	guint			 backlog_counter;  /* sysprof counter ID, or 0 */
+
+	GsWorkerPoolState	 state;  /* (atomic) */
+	GPtrArray		*workers;  /* (element-type WorkerData) (owned) */
+
+	GMutex			 mutex;
+	/* The following are protected by @mutex: */
+	GArray			*queues;  /* (element-type PriorityQueue) (owned), sorted by priority */
+	guint			 n_queued;
+	guint			 n_running_background;
+	guint			 n_workers_running;
+	GTask			*shutdown_task;  /* (owned) (nullable) */
+};
+
+typedef enum {
+	PROP_NAME = 1,
+	PROP_N_THREADS,
+} GsWorkerPoolProperty;
+
+static GParamSpec *props[PROP_N_THREADS + 1] = { NULL, };
+
+G_DEFINE_TYPE (GsWorkerPool, gs_worker_pool, G_TYPE_OBJECT)
+
+/* The pool which owns the calling thread, if any. */
+static GPrivate current_pool;
+
+static void
+work_data_free (WorkData *data)
+{
+	g_clear_object (&data->task);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (WorkData, work_data_free)
+
+static void
+worker_data_free (WorkerData *worker)
+{
+	/* Should have been joined by now. */
+	g_assert (worker->thread == NULL);
+
+	g_main_context_unref (worker->context);
+	g_free (worker);
+}
+
+static gboolean
+priority_is_background (gint priority)
+{
+	return priority > G_PRIORITY_DEFAULT;
+}
+
+static void
+gs_worker_pool_get_property (GObject    *object,
+                             guint       prop_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+	GsWorkerPool *self = GS_WORKER_POOL (object);
+
+	switch ((GsWorkerPoolProperty) prop_id) {
+	case PROP_NAME:
+		g_value_set_string (value, self->name);
+		break;
+	case PROP_N_THREADS:
+		g_value_set_uint (value, self->n_threads);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gs_worker_pool_set_property (GObject      *object,
+                             guint         prop_id,
+                             const GValue *value,
+                             GParamSpec   *pspec)
+{
+	GsWorkerPool *self = GS_WORKER_POOL (object);
+
+	switch ((GsWorkerPoolProperty) prop_id) {
+	case PROP_NAME:
+		/* Construct only */
+		g_assert (self->name == NULL);
+		self->name = g_value_dup_string (value);
+		break;
+	case PROP_N_THREADS:
+		/* Construct only */
+		g_assert (self->n_threads == 0);
+		self->n_threads = g_value_get_uint (value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gs_worker_pool_dispose (GObject *object)
+{
+	GsWorkerPool *self = GS_WORKER_POOL (object);
+
+	/* Should have stopped by now. */
+	g_assert (g_atomic_int_get (&self->state) != GS_WORKER_POOL_STATE_RUNNING);
+
+	g_clear_pointer (&self->workers, g_ptr_array_unref);
+
+	G_OBJECT_CLASS (gs_worker_pool_parent_class)->dispose (object);
+}
+
+static void
+gs_worker_pool_finalize (GObject *object)
+{
+	GsWorkerPool *self = GS_WORKER_POOL (object);
+
+	g_assert (self->n_queued == 0);
+	g_assert (self->shutdown_task == NULL);
+
+	g_free (self->name);
+	g_array_unref (self->queues);
+	g_mutex_clear (&self->mutex);
+
+	G_OBJECT_CLASS (gs_worker_pool_parent_class)->finalize (object);
+}
+
+static gpointer thread_cb (gpointer data);
+
+static void
+gs_worker_pool_constructed (GObject *object)
+{
+	GsWorkerPool *self = GS_WORKER_POOL (object);
+
+	G_OBJECT_CLASS (gs_worker_pool_parent_class)->constructed (object);
+
+	/* Default to one thread per CPU, within limits. At least two are
+	 * needed so that one can be kept free for interactive tasks. */
+	if (self->n_threads == 0)
+		self->n_threads = MIN (g_get_num_processors (), GS_WORKER_POOL_MAX_DEFAULT_THREADS);
+	self->n_threads = MAX (self->n_threads, 2);
+
+	/* The name is used for the sysprof counter and the thread names, so
+	 * make sure there is one even if the pool was created using
+	 * g_object_new() without setting #GsWorkerPool:name. */
+	if (self->name == NULL)
+		self->name = g_strdup ("gs-worker-pool");
+
+	self->backlog_counter = gs_profiler_define_counter ("gnome-software",
+							    self->name,
+							    "Tasks waiting for a thread in the worker pool");
+
+	/* Start up the worker threads. They will run until @state changes
+	 * from %GS_WORKER_POOL_STATE_RUNNING and the queues are empty. */
+	self->state = GS_WORKER_POOL_STATE_RUNNING;
+	self->workers = g_ptr_array_new_full (self->n_threads, (GDestroyNotify) worker_data_free);
+
+	g_mutex_lock (&self->mutex);
+	for (guint i = 0; i < self->n_threads; i++) {
+		WorkerData *worker = g_new0 (WorkerData, 1);
+		worker->pool = self;
+		worker->context = g_main_context_new ();
+		g_ptr_array_add (self->workers, worker);
+	}
+	for (guint i = 0; i < self->n_threads; i++) {
+		WorkerData *worker = g_ptr_array_index (self->workers, i);
+		worker->thread = g_thread_new (self->name, thread_cb, worker);
+		self->n_workers_running++;
+	}
+	g_mutex_unlock (&self->mutex);
+}
+
+static void
+gs_worker_pool_class_init (GsWorkerPoolClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->constructed = gs_worker_pool_constructed;
+	object_class->get_property = gs_worker_pool_get_property;
+	object_class->set_property = gs_worker_pool_set_property;
+	object_class->dispose = gs_worker_pool_dispose;
+	object_class->finalize = gs_worker_pool_finalize;
+
+	/**
+	 * GsWorkerPool:name: (not nullable):
+	 *
+	 * Name for the worker threads to use in debug output. This must be set.
+	 *
+	 * Since: 43
+	 */
+	props[PROP_NAME] =
+		g_param_spec_string ("name",
+				     "Name",
+				     "Name for the worker threads to use in debug output.",
+				     NULL,
+				     G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+	/**
+	 * GsWorkerPool:n-threads:
+	 *
+	 * Number of threads in the pool, or zero to pick a default based on
+	 * the number of CPUs.
+	 *
+	 * There are always at least two threads.
+	 *
+	 * Since: 43
+	 */
+	props[PROP_N_THREADS] =
+		g_param_spec_uint ("n-threads",
+				   "Number of Threads",
+				   "Number of threads in the pool, or zero to pick a default.",
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+	g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
+}
+
+static void
+gs_worker_pool_init (GsWorkerPool *self)
+{
+	g_mutex_init (&self->mutex);
+	self->queues = g_array_new (FALSE, FALSE, sizeof (PriorityQueue));
+}
+
+/* Must be called with @mutex held. */
+static void
+wake_workers_locked (GsWorkerPool *self)
+{
+	for (guint i = 0; i < self->workers->len; i++) {
+		WorkerData *worker = g_ptr_array_index (self->workers, i);
+		g_main_context_wakeup (worker->context);
+	}
+}
+
+/* Takes the next task to run, if one may be run now. If there’s nothing left
+ * to run and the pool is shutting down, @out_shutdown_task is set when this is
+ * the last worker thread to stop, and @out_exit is set to %TRUE.
+ *
+ * Must be called with @mutex held. */
+static WorkData *
+pop_work_locked (GsWorkerPool  *self,
+                 gboolean      *out_exit,
+                 GTask        **out_shutdown_task)
+{
+	*out_exit = FALSE;
+
+	for (guint i = 0; i < self->queues->len; i++) {
+		PriorityQueue *pq = &g_array_index (self->queues, PriorityQueue, i);
+		WorkData *data;
+
+		if (g_queue_is_empty (&pq->queue))
+			continue;
+
+		/* Only lower priority queues follow, so if this one can’t be
+		 * run now, none of them can. */
+		if (priority_is_background (pq->priority) &&
+		    self->n_running_background + 1 >= self->n_threads)
+			return NULL;
+
+		data = g_queue_pop_head (&pq->queue);
+		self->n_queued--;
+		gs_profiler_set_counter (self->backlog_counter, self->n_queued);
+		if (priority_is_background (data->priority))
+			self->n_running_background++;
+		return data;
+	}
+
+	/* Nothing queued. */
+	if (g_atomic_int_get (&self->state) == GS_WORKER_POOL_STATE_RUNNING)
+		return NULL;
+
+	*out_exit = TRUE;
+	g_assert (self->n_workers_running > 0);
+	self->n_workers_running--;
+	if (self->n_workers_running == 0) {
+		g_atomic_int_set (&self->state, GS_WORKER_POOL_STATE_SHUT_DOWN);
+		*out_shutdown_task = g_steal_pointer (&self->shutdown_task);
+	}
+
+	return NULL;
+}
+
+static gpointer
+thread_cb (gpointer data)
+{
+	WorkerData *worker = data;
+	GsWorkerPool *self = worker->pool;
+	g_autoptr(GMainContextPusher) pusher = g_main_context_pusher_new (worker->context);
+	g_autoptr(GTask) shutdown_task = NULL;
+
+	g_private_set (&current_pool, self);
+
+	while (TRUE) {
+		g_autoptr(WorkData) work = NULL;
+		gboolean should_exit = FALSE;
+
+		g_mutex_lock (&self->mutex);
+		work = pop_work_locked (self, &should_exit, &shutdown_task);
+		g_mutex_unlock (&self->mutex);
+
+		if (should_exit)
+			break;
+
+		if (work != NULL) {
+			GTask *task = work->task;
+
+			/* Set the I/O priority of the thread to match the
+			 * priority of the task. */
+			gs_ioprio_set (work->priority);
+
+			work->work_func (task,
+					 g_task_get_source_object (task),
+					 g_task_get_task_data (task),
+					 g_task_get_cancellable (task));
+
+			/* A background slot has been freed up, so a thread
+			 * which skipped a background task may now take it. */
+			if (priority_is_background (work->priority)) {
+				g_mutex_lock (&self->mutex);
+				self->n_running_background--;
+				wake_workers_locked (self);
+				g_mutex_unlock (&self->mutex);
+			}
+
+			continue;
+		}
+
+		/* Dispatch anything attached to this thread’s context until
+		 * woken up by gs_worker_pool_queue() or another worker. */
+		g_main_context_iteration (worker->context, TRUE);
+	}
+
+	g_private_set (&current_pool, NULL);
+
+	if (shutdown_task != NULL)
+		g_task_return_boolean (shutdown_task, TRUE);
+
+	return NULL;
+}
+
+/**
+ * gs_worker_pool_new:
+ * @name: (not nullable): name for the worker threads
+ * @n_threads: number of threads in the pool, or zero to use the default
+ *
+ * Create and start a new #GsWorkerPool.
+ *
+ * @name will be used to set the thread names and in debug output.
+ *
+ * If @n_threads is zero, the number of threads is chosen from the number of
+ * online CPUs, capped to a small limit. At least two threads are always
+ * started.
+ *
+ * Returns: (transfer full): a new #GsWorkerPool
+ * Since: 43
+ */
+GsWorkerPool *
+gs_worker_pool_new (const gchar *name,
+                    guint        n_threads)
+{
+	g_return_val_if_fail (name != NULL, NULL);
+
+	return g_object_new (GS_TYPE_WORKER_POOL,
+			     "name", name,
+			     "n-threads", n_threads,
+			     NULL);
+}
+
+/**
+ * gs_worker_pool_get_n_threads:
+ * @self: a #GsWorkerPool
+ *
+ * Get the number of threads in the pool.
+ *
+ * Returns: number of threads
+ * Since: 43
+ */
+guint
+gs_worker_pool_get_n_threads (GsWorkerPool *self)
+{
+	g_return_val_if_fail (GS_IS_WORKER_POOL (self), 0);
+
+	return self->n_threads;
+}
+
+/**
+ * gs_worker_pool_queue:
+ * @self: a #GsWorkerPool
+ * @priority: (default G_PRIORITY_DEFAULT): priority to queue the task at,
+ *   typically #G_PRIORITY_DEFAULT
+ * @work_func: (not nullable): function to run the task
+ * @task: (transfer full) (not nullable): the #GTask containing context data to
+ *   pass to @work_func
+ *
+ * Queue @task to be run in one of the worker threads at the given @priority.
+ *
+ * This function takes ownership of @task.
+ *
+ * @priority sets the order of the task in the queue, and also affects the I/O
+ * priority of the worker thread when the task is executed, as with
+ * gs_worker_thread_queue(). Tasks with a priority lower than
+ * %G_PRIORITY_DEFAULT are limited so they can’t occupy every thread.
+ *
+ * When the task is run, @work_func will be executed and passed @task and the
+ * source object, task data and cancellable set on @task. It may be run in
+ * parallel with other tasks from the same pool.
+ *
+ * @work_func is responsible for calling `g_task_return_*()` on @task once the
+ * task is complete.
+ *
+ * If a task is cancelled using its #GCancellable after it’s queued to the
+ * #GsWorkerPool, @work_func will still be executed. @work_func is responsible
+ * for checking whether the #GCancellable has been cancelled.
+ *
+ * It is an error to call this function after gs_worker_pool_shutdown_async()
+ * has called.
+ *
+ * Since: 43
+ */
+void
+gs_worker_pool_queue (GsWorkerPool    *self,
+                      gint             priority,
+                      GTaskThreadFunc  work_func,
+                      GTask           *task)
+{
+	g_autoptr(WorkData) data = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	PriorityQueue *pq = NULL;
+	guint i;
+
+	g_return_if_fail (GS_IS_WORKER_POOL (self));
+	g_return_if_fail (work_func != NULL);
+	g_return_if_fail (G_IS_TASK (task));
+
+	g_assert (g_atomic_int_get (&self->state) == GS_WORKER_POOL_STATE_RUNNING);
+
+	data = g_new0 (WorkData, 1);
+	data->work_func = work_func;
+	data->task = g_steal_pointer (&task);
+	data->priority = priority;
+
+	locker = g_mutex_locker_new (&self->mutex);
+
+	/* Find or insert the queue for this priority. There are only ever a
+	 * handful of different priorities in use, so a linear scan is fine. */
+	for (i = 0; i < self->queues->len; i++) {
+		PriorityQueue *candidate = &g_array_index (self->queues, PriorityQueue, i);
+		if (candidate->priority == priority)
+			pq = candidate;
+		if (candidate->priority >= priority)
+			break;
+	}
+	if (pq == NULL) {
+		PriorityQueue new_pq = { priority, G_QUEUE_INIT };
+		g_array_insert_val (self->queues, i, new_pq);
+		pq = &g_array_index (self->queues, PriorityQueue, i);
+	}
+
+	g_queue_push_tail (&pq->queue, g_steal_pointer (&data));
+	self->n_queued++;
+	gs_profiler_set_counter (self->backlog_counter, self->n_queued);
+
+	wake_workers_locked (self);
+}
+
+/**
+ * gs_worker_pool_is_in_worker_context:
+ * @self: a #GsWorkerPool
+ *
+ * Returns whether the calling thread is one of the pool’s worker threads.
+ *
+ * This is intended to be used as a precondition check to ensure that worker
+ * code is not accidentally run from the wrong thread.
+ *
+ * Returns: %TRUE if running in a worker thread, %FALSE otherwise
+ * Since: 43
+ */
+gboolean
+gs_worker_pool_is_in_worker_context (GsWorkerPool *self)
+{
+	return g_private_get (&current_pool) == self;
+}
+
+/**
+ * gs_worker_pool_shutdown_async:
+ * @self: a #GsWorkerPool
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback for once the asynchronous operation is complete
+ * @user_data: data to pass to @callback
+ *
+ * Shut down the worker threads.
+ *
+ * The threads will finish processing all the tasks which have already been
+ * queued, and will then join the main process.
+ *
+ * This is a no-op if called subsequently.
+ *
+ * Since: 43
+ */
+void
+gs_worker_pool_shutdown_async (GsWorkerPool        *self,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_WORKER_POOL (self));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_worker_pool_shutdown_async);
+
+	/* Already called? */
+	if (g_atomic_int_get (&self->state) != GS_WORKER_POOL_STATE_RUNNING) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* Signal the worker threads to stop once the queues are empty. The
+	 * last one to stop returns @task. */
+	locker = g_mutex_locker_new (&self->mutex);
+	g_atomic_int_set (&self->state, GS_WORKER_POOL_STATE_SHUTTING_DOWN);
+	self->shutdown_task = g_steal_pointer (&task);
+	wake_workers_locked (self);
+}
+
+/**
+ * gs_worker_pool_shutdown_finish:
+ * @self: a #GsWorkerPool
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous shutdown operation started with
+ * gs_worker_pool_shutdown_async();
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 43
+ */
+gboolean
+gs_worker_pool_shutdown_finish (GsWorkerPool  *self,
+                                GAsyncResult  *result,
+                                GError       **error)
+{
+	gboolean success;
+
+	g_return_val_if_fail (GS_IS_WORKER_POOL (self), FALSE);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_worker_pool_shutdown_async), FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	success = g_task_propagate_boolean (G_TASK (result), error);
+
+	if (success) {
+		for (guint i = 0; i < self->workers->len; i++) {
+			WorkerData *worker = g_ptr_array_index (self->workers, i);
+			if (worker->thread != NULL)
+				g_thread_join (g_steal_pointer (&worker->thread));
+		}
+	}
+
+	return success;
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2021 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GS_TYPE_WORKER_POOL (gs_worker_pool_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsWorkerPool, gs_worker_pool, GS, WORKER_POOL, GObject)
+
+GsWorkerPool	*gs_worker_pool_new			(const gchar *name,
+							 guint        n_threads);
+
+guint		 gs_worker_pool_get_n_threads		(GsWorkerPool *self);
+
+void		 gs_worker_pool_queue			(GsWorkerPool    *self,
+							 gint             priority,
+							 GTaskThreadFunc  work_func,
+							 GTask           *task);
+
+gboolean	 gs_worker_pool_is_in_worker_context	(GsWorkerPool *self);
+
+void		 gs_worker_pool_shutdown_async		(GsWorkerPool        *self,
+							 GCancellable        *cancellable,
+							 GAsyncReadyCallback  callback,
+							 gpointer             user_data);
+
+gboolean	 gs_worker_pool_shutdown_finish		(GsWorkerPool  *self,
+							 GAsyncResult  *result,
+							 GError       **error);
+
+G_END_DECLS
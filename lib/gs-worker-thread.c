@@ -42,6 +42,7 @@
 #include <glib-object.h>
 
 #include "gs-ioprio.h"
+#include "gs-profiler.h"
 #include "gs-worker-thread.h"
 
 typedef enum {
@@ -59,6 +60,9 @@ struct _GsWorkerThread
 	GsWorkerThreadState	 worker_state;  /* (atomic) */
 	GMainContext		*worker_context;  /* (owned); may be NULL before setup or after shutdown */
 	GThread			*worker_thread;  /* (atomic); may be NULL before setup or after shutdown */
+
+	guint			 n_queued;  /* (atomic) */
+	guint			 backlog_counter;  /* sysprof counter ID, or 0 */
 };
 
 typedef enum {
@@ -130,6 +134,10 @@ gs_worker_thread_constructed (GObject *object)
 
 	G_OBJECT_CLASS (gs_worker_thread_parent_class)->constructed (object);
 
+	self->backlog_counter = gs_profiler_define_counter ("gnome-software",
+							    self->name,
+							    "Tasks waiting for the worker thread");
+
 	/* Start up a worker thread and its #GMainContext. The worker will run
 	 * and process events on @worker_context until @worker_state changes
 	 * from %GS_WORKER_THREAD_STATE_RUNNING. */
@@ -206,6 +214,7 @@ gs_worker_thread_new (const gchar *name)
 /* Essentially a wrapper around these elements to avoid the caller having to
  * return `G_SOURCE_REMOVE` from their `work_func` every time. */
 typedef struct {
+	GsWorkerThread *worker;  /* (unowned) */
 	GTaskThreadFunc work_func;
 	GTask *task;  /* (owned) */
 	gint priority;
@@ -228,13 +237,24 @@ work_run_cb (gpointer _data)
 	gpointer source_object = g_task_get_source_object (task);
 	gpointer task_data = g_task_get_task_data (task);
 	GCancellable *cancellable = g_task_get_cancellable (task);
+	guint n_queued = g_atomic_int_add (&data->worker->n_queued, -1) - 1;
+	gint64 begin_time_nsec;
+
+	gs_profiler_set_counter (data->worker->backlog_counter, n_queued);
 
 	/* Set the I/O priority of the thread to match the priority of the
 	 * task. */
 	gs_ioprio_set (data->priority);
 
+	begin_time_nsec = gs_profiler_get_current_time ();
 	data->work_func (task, source_object, task_data, cancellable);
 
+	if (gs_profiler_is_enabled ()) {
+		const gchar *task_name = g_task_get_name (task);
+		g_autofree gchar *sysprof_name = g_strconcat ("worker:", data->worker->name, NULL);
+		gs_profiler_add_mark (begin_time_nsec, sysprof_name, task_name);
+	}
+
 	return G_SOURCE_REMOVE;
 }
 
@@ -278,6 +298,7 @@ gs_worker_thread_queue (GsWorkerThread  *self,
                         GTask           *task)
 {
 	g_autoptr(WorkData) data = NULL;
+	guint n_queued;
 
 	g_return_if_fail (GS_IS_WORKER_THREAD (self));
 	g_return_if_fail (work_func != NULL);
@@ -287,10 +308,14 @@ gs_worker_thread_queue (GsWorkerThread  *self,
 		  g_task_get_source_tag (task) == gs_worker_thread_shutdown_async);
 
 	data = g_new0 (WorkData, 1);
+	data->worker = self;
 	data->work_func = work_func;
 	data->task = g_steal_pointer (&task);
 	data->priority = priority;
 
+	n_queued = g_atomic_int_add (&self->n_queued, 1) + 1;
+	gs_profiler_set_counter (self->backlog_counter, n_queued);
+
 	g_main_context_invoke_full (self->worker_context, priority,
 				    work_run_cb, g_steal_pointer (&data), (GDestroyNotify) work_data_free);
 }
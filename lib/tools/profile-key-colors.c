@@ -16,12 +16,15 @@
 #include <math.h>
 
 #include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
 
 /* Test program which can be used to check the output and performance of the
  * gs_calculate_key_colors() function. It is linked against libgnomesoftware, so
  * will use the function implementation from there. It outputs a HTML page which
  * lists each icon from the flathub appstream data in your home directory, along
- * with its extracted key colors and how long extraction took. */
+ * with its extracted key colors and how long extraction took, followed by the
+ * total time taken by each k-means implementation supported by the CPU and by
+ * gs_calculate_key_colors_batch(). */
 
 static void
 print_colours (GString *html_output,
@@ -74,6 +77,58 @@ print_summary_statistics (GString *html_output,
 				min, max, mean, stddev, n_measurements);
 }
 
+static void
+print_implementation_timings (GString   *html_output,
+                              GPtrArray *pixbufs  /* (element-type GdkPixbuf) */)
+{
+	const struct {
+		GsKeyColorsImpl impl;
+		const gchar *name;
+	} impls[] = {
+		{ GS_KEY_COLORS_IMPL_SCALAR, "scalar" },
+		{ GS_KEY_COLORS_IMPL_SSE2, "SSE2" },
+		{ GS_KEY_COLORS_IMPL_AVX2, "AVX2" },
+	};
+	g_autoptr(GPtrArray) results = NULL;
+	gint64 start_time, duration;
+
+	g_string_append (html_output,
+			 "<table id='impl-table'>\n"
+			 "<thead><tr><td>Implementation</td><td>Total duration (μs)</td></tr></thead>\n");
+
+	for (gsize i = 0; i < G_N_ELEMENTS (impls); i++) {
+		if (!gs_key_colors_set_impl (impls[i].impl)) {
+			g_message ("Skipping %s implementation: not supported", impls[i].name);
+			continue;
+		}
+
+		g_message ("Timing %s implementation", impls[i].name);
+
+		start_time = g_get_real_time ();
+		for (guint j = 0; j < pixbufs->len; j++) {
+			g_autoptr(GArray) colours = gs_calculate_key_colors (pixbufs->pdata[j]);
+		}
+		duration = g_get_real_time () - start_time;
+
+		g_string_append_printf (html_output,
+					"<tr><th>%s</th><td class='number'>%" G_GINT64_FORMAT "</td></tr>\n",
+					impls[i].name, duration);
+	}
+
+	gs_key_colors_set_impl (GS_KEY_COLORS_IMPL_AUTO);
+
+	g_message ("Timing batch calculation");
+
+	start_time = g_get_real_time ();
+	results = gs_calculate_key_colors_batch (pixbufs);
+	duration = g_get_real_time () - start_time;
+
+	g_string_append_printf (html_output,
+				"<tr><th>batch (%u threads)</th><td class='number'>%" G_GINT64_FORMAT "</td></tr>\n"
+				"</table>\n",
+				g_get_num_processors (), duration);
+}
+
 int
 main (void)
 {
@@ -167,7 +222,12 @@ main (void)
 	print_summary_statistics (html_output, durations);
 	g_string_append (html_output, "</td><td></td></tr></tfoot>");
 
-	g_string_append (html_output, "</table></body></html>");
+	g_string_append (html_output, "</table>");
+
+	/* Compare the implementations over the whole set of icons. */
+	print_implementation_timings (html_output, pixbufs);
+
+	g_string_append (html_output, "</body></html>");
 
 	g_print ("%s\n", html_output->str);
 
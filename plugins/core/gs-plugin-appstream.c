@@ -34,26 +34,64 @@ struct _GsPluginAppstream
 {
 	GsPlugin		 parent;
 
-	GsWorkerThread		*worker;  /* (owned) */
+	GsWorkerPool		*worker;  /* (owned) */
 
-	XbSilo			*silo;
+	GPtrArray		*sources;  /* (element-type GsPluginAppstreamSource) (owned) (nullable) */
+	GPtrArray		*silos;  /* (element-type XbSilo) (owned) (nullable); the silos of @sources */
 	GRWLock			 silo_lock;
+	GMutex			 rebuild_mutex;  /* serialises rebuilding @sources */
 	GSettings		*settings;
 };
 
+typedef enum {
+	GS_PLUGIN_APPSTREAM_SOURCE_KIND_CATALOG,
+	GS_PLUGIN_APPSTREAM_SOURCE_KIND_METAINFO,
+	GS_PLUGIN_APPSTREAM_SOURCE_KIND_DESKTOP,
+	GS_PLUGIN_APPSTREAM_SOURCE_KIND_TEST,
+} GsPluginAppstreamSourceKind;
+
+/* Each source directory is compiled into its own silo, cached separately, so
+ * that a change in one directory only causes that directory to be rebuilt.
+ * All the silos are queried as a set. */
+typedef struct {
+	GsPluginAppstreamSourceKind	 kind;
+	gchar				*path;  /* (owned); the XML itself for KIND_TEST */
+	XbSilo				*silo;  /* (owned) (not nullable) once added to @sources */
+} GsPluginAppstreamSource;
+
+static GsPluginAppstreamSource *
+gs_plugin_appstream_source_new (GsPluginAppstreamSourceKind  kind,
+                                const gchar                 *path)
+{
+	GsPluginAppstreamSource *source = g_new0 (GsPluginAppstreamSource, 1);
+	source->kind = kind;
+	source->path = g_strdup (path);
+	return source;
+}
+
+static void
+gs_plugin_appstream_source_free (GsPluginAppstreamSource *source)
+{
+	g_free (source->path);
+	g_clear_object (&source->silo);
+	g_free (source);
+}
+
 G_DEFINE_TYPE (GsPluginAppstream, gs_plugin_appstream, GS_TYPE_PLUGIN)
 
 #define assert_in_worker(self) \
-	g_assert (gs_worker_thread_is_in_worker_context (self->worker))
+	g_assert (gs_worker_pool_is_in_worker_context (self->worker))
 
 static void
 gs_plugin_appstream_dispose (GObject *object)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (object);
 
-	g_clear_object (&self->silo);
+	g_clear_pointer (&self->sources, g_ptr_array_unref);
+	g_clear_pointer (&self->silos, g_ptr_array_unref);
 	g_clear_object (&self->settings);
 	g_rw_lock_clear (&self->silo_lock);
+	g_mutex_clear (&self->rebuild_mutex);
 	g_clear_object (&self->worker);
 
 	G_OBJECT_CLASS (gs_plugin_appstream_parent_class)->dispose (object);
@@ -64,9 +102,10 @@ gs_plugin_appstream_init (GsPluginAppstream *self)
 {
 	GApplication *application = g_application_get_default ();
 
-	/* XbSilo needs external locking as we destroy the silo and build a new
-	 * one when something changes */
+	/* XbSilo needs external locking as we destroy the silos and build new
+	 * ones when something changes */
 	g_rw_lock_init (&self->silo_lock);
+	g_mutex_init (&self->rebuild_mutex);
 
 	/* need package name */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "dpkg");
@@ -633,32 +672,204 @@ gs_add_appstream_metainfo_location (GPtrArray *locations, const gchar *root)
 }
 
 static gboolean
-gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
-                                GCancellable       *cancellable,
-                                GError            **error)
+gs_plugin_appstream_load_test_xml (GsPluginAppstream  *self,
+                                   XbBuilder          *builder,
+                                   const gchar        *test_xml,
+                                   GError            **error)
+{
+	g_autoptr(XbBuilderFixup) fixup1 = NULL;
+	g_autoptr(XbBuilderFixup) fixup2 = NULL;
+	g_autoptr(XbBuilderSource) source = xb_builder_source_new ();
+
+	if (!xb_builder_source_load_xml (source, test_xml,
+					 XB_BUILDER_SOURCE_FLAG_NONE,
+					 error))
+		return FALSE;
+	fixup1 = xb_builder_fixup_new ("AddOriginKeywords",
+				       gs_plugin_appstream_add_origin_keyword_cb,
+				       self, NULL);
+	xb_builder_fixup_set_max_depth (fixup1, 1);
+	xb_builder_source_add_fixup (source, fixup1);
+	fixup2 = xb_builder_fixup_new ("AddIcons",
+				       gs_plugin_appstream_add_icons_cb,
+				       self, NULL);
+	xb_builder_fixup_set_max_depth (fixup2, 2);
+	xb_builder_source_add_fixup (source, fixup2);
+	xb_builder_import_source (builder, source);
+
+	/* success */
+	return TRUE;
+}
+
+/* Returns the sources to load, in order of preference, with no silos yet */
+static GPtrArray *
+gs_plugin_appstream_get_sources (GsPluginAppstream *self)
 {
 	const gchar *test_xml;
+	g_autofree gchar *state_cache_dir = NULL;
+	g_autofree gchar *state_lib_dir = NULL;
+	g_autoptr(GPtrArray) parent_appdata = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GPtrArray) parent_appstream = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GPtrArray) sources = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_plugin_appstream_source_free);
+
+	/* only when in self test */
+	test_xml = g_getenv ("GS_SELF_TEST_APPSTREAM_XML");
+	if (test_xml != NULL) {
+		g_ptr_array_add (sources,
+				 gs_plugin_appstream_source_new (GS_PLUGIN_APPSTREAM_SOURCE_KIND_TEST,
+								 test_xml));
+		return g_steal_pointer (&sources);
+	}
+
+	/* add search paths */
+	gs_add_appstream_catalog_location (parent_appstream, DATADIR);
+	gs_add_appstream_metainfo_location (parent_appdata, DATADIR);
+
+	state_cache_dir = g_build_filename (LOCALSTATEDIR, "cache", NULL);
+	gs_add_appstream_catalog_location (parent_appstream, state_cache_dir);
+	state_lib_dir = g_build_filename (LOCALSTATEDIR, "lib", NULL);
+	gs_add_appstream_catalog_location (parent_appstream, state_lib_dir);
+
+#ifdef ENABLE_EXTERNAL_APPSTREAM
+	/* check for the corresponding setting */
+	if (!g_settings_get_boolean (self->settings, "external-appstream-system-wide")) {
+		g_autofree gchar *user_catalog_path = NULL;
+		g_autofree gchar *user_catalog_old_path = NULL;
+
+		/* migrate data paths */
+		user_catalog_path = g_build_filename (g_get_user_data_dir (), "swcatalog", NULL);
+		user_catalog_old_path = g_build_filename (g_get_user_data_dir (), "app-info", NULL);
+		if (g_file_test (user_catalog_old_path, G_FILE_TEST_IS_DIR) &&
+		    !g_file_test (user_catalog_path, G_FILE_TEST_IS_DIR)) {
+			g_debug ("Migrating external AppStream user location.");
+			if (g_rename (user_catalog_old_path, user_catalog_path) == 0) {
+				g_autofree gchar *user_catalog_xml_path = NULL;
+				g_autofree gchar *user_catalog_xml_old_path = NULL;
+
+				user_catalog_xml_path = g_build_filename (user_catalog_path, "xml", NULL);
+				user_catalog_xml_old_path = g_build_filename (user_catalog_path, "xmls", NULL);
+				if (g_file_test (user_catalog_xml_old_path, G_FILE_TEST_IS_DIR)) {
+					if (g_rename (user_catalog_xml_old_path, user_catalog_xml_path) != 0)
+						g_warning ("Unable to migrate external XML data location from '%s' to '%s': %s",
+							user_catalog_xml_old_path, user_catalog_xml_path, g_strerror (errno));
+				}
+			} else {
+				g_warning ("Unable to migrate external data location from '%s' to '%s': %s",
+					   user_catalog_old_path, user_catalog_path, g_strerror (errno));
+			}
+
+		}
+
+		/* add modern locations only */
+		g_ptr_array_add (parent_appstream,
+				g_build_filename (user_catalog_path, "xml", NULL));
+		g_ptr_array_add (parent_appstream,
+				g_build_filename (user_catalog_path, "yaml", NULL));
+	}
+#endif
+
+	/* Add the normal system directories if the installation prefix
+	 * is different from normal — typically this happens when doing
+	 * development builds. It’s useful to still list the system apps
+	 * during development. */
+	if (g_strcmp0 (DATADIR, "/usr/share") != 0) {
+		gs_add_appstream_catalog_location (parent_appstream, "/usr/share");
+		gs_add_appstream_metainfo_location (parent_appdata, "/usr/share");
+	}
+	if (g_strcmp0 (LOCALSTATEDIR, "/var") != 0) {
+		gs_add_appstream_catalog_location (parent_appstream, "/var/cache");
+		gs_add_appstream_catalog_location (parent_appstream, "/var/lib");
+	}
+
+	for (guint i = 0; i < parent_appstream->len; i++) {
+		const gchar *fn = g_ptr_array_index (parent_appstream, i);
+		g_ptr_array_add (sources,
+				 gs_plugin_appstream_source_new (GS_PLUGIN_APPSTREAM_SOURCE_KIND_CATALOG, fn));
+	}
+	for (guint i = 0; i < parent_appdata->len; i++) {
+		const gchar *fn = g_ptr_array_index (parent_appdata, i);
+		g_ptr_array_add (sources,
+				 gs_plugin_appstream_source_new (GS_PLUGIN_APPSTREAM_SOURCE_KIND_METAINFO, fn));
+	}
+	g_ptr_array_add (sources,
+			 gs_plugin_appstream_source_new (GS_PLUGIN_APPSTREAM_SOURCE_KIND_DESKTOP,
+							 DATADIR "/applications"));
+	if (g_strcmp0 (DATADIR, "/usr/share") != 0) {
+		g_ptr_array_add (sources,
+				 gs_plugin_appstream_source_new (GS_PLUGIN_APPSTREAM_SOURCE_KIND_DESKTOP,
+								 "/usr/share/applications"));
+	}
+
+	return g_steal_pointer (&sources);
+}
+
+static gchar *
+gs_plugin_appstream_source_get_blob_basename (GsPluginAppstreamSource *source)
+{
+	g_autofree gchar *source_key = NULL;
+	g_autofree gchar *source_hash = NULL;
+
+	source_key = g_strdup_printf ("%u:%s", (guint) source->kind, source->path);
+	source_hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, source_key, -1);
+	return g_strdup_printf ("components-%s.xmlb", source_hash);
+}
+
+/* Removes the cached silos which none of @sources uses any more, including
+ * the single blob all the components used to be compiled into */
+static void
+gs_plugin_appstream_prune_blobs (GPtrArray *sources)
+{
+	const gchar *name;
+	g_autofree gchar *blobfn = NULL;
+	g_autofree gchar *cachedir = NULL;
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GHashTable) basenames = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	blobfn = gs_utils_get_cache_filename ("appstream", "components.xmlb",
+					      GS_UTILS_CACHE_FLAG_WRITEABLE, NULL);
+	if (blobfn == NULL)
+		return;
+	cachedir = g_path_get_dirname (blobfn);
+	dir = g_dir_open (cachedir, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	for (guint i = 0; i < sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (sources, i);
+		g_hash_table_add (basenames, gs_plugin_appstream_source_get_blob_basename (source));
+	}
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *fn = NULL;
+
+		if (!g_str_has_prefix (name, "components") ||
+		    !g_str_has_suffix (name, ".xmlb") ||
+		    g_hash_table_contains (basenames, name))
+			continue;
+		fn = g_build_filename (cachedir, name, NULL);
+		g_debug ("removing unused %s", fn);
+		if (g_unlink (fn) != 0)
+			g_debug ("failed to remove %s: %s", fn, g_strerror (errno));
+	}
+}
+
+/* Compiles @source into its own cached silo; @self->rebuild_mutex must be
+ * held */
+static XbSilo *
+gs_plugin_appstream_build_silo (GsPluginAppstream        *self,
+                                GsPluginAppstreamSource  *source,
+                                GCancellable             *cancellable,
+                                GError                  **error)
+{
+	gboolean ret = FALSE;
 	g_autofree gchar *blobfn = NULL;
+	g_autofree gchar *basename = NULL;
 	g_autoptr(XbBuilder) builder = NULL;
-	g_autoptr(XbNode) n = NULL;
+	g_autoptr(XbSilo) silo = NULL;
 	g_autoptr(GFile) file = NULL;
-	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
-	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
-	g_autoptr(GPtrArray) parent_appdata = g_ptr_array_new_with_free_func (g_free);
-	g_autoptr(GPtrArray) parent_appstream = g_ptr_array_new_with_free_func (g_free);
 	const gchar *const *locales = g_get_language_names ();
 	g_autoptr(GMainContext) old_thread_default = NULL;
 
-	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	/* everything is okay */
-	if (self->silo != NULL && xb_silo_is_valid (self->silo))
-		return TRUE;
-	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
-
-	/* drat! silo needs regenerating */
-	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
-	g_clear_object (&self->silo);
-
 	/* FIXME: https://gitlab.gnome.org/GNOME/gnome-software/-/issues/1422 */
 	old_thread_default = g_main_context_ref_thread_default ();
 	if (old_thread_default == g_main_context_default ())
@@ -681,129 +892,43 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	for (guint i = 0; locales[i] != NULL; i++)
 		xb_builder_add_locale (builder, locales[i]);
 
-	/* only when in self test */
-	test_xml = g_getenv ("GS_SELF_TEST_APPSTREAM_XML");
-	if (test_xml != NULL) {
-		g_autoptr(XbBuilderFixup) fixup1 = NULL;
-		g_autoptr(XbBuilderFixup) fixup2 = NULL;
-		g_autoptr(XbBuilderSource) source = xb_builder_source_new ();
-		if (!xb_builder_source_load_xml (source, test_xml,
-						 XB_BUILDER_SOURCE_FLAG_NONE,
-						 error))
-			return FALSE;
-		fixup1 = xb_builder_fixup_new ("AddOriginKeywords",
-					       gs_plugin_appstream_add_origin_keyword_cb,
-					       self, NULL);
-		xb_builder_fixup_set_max_depth (fixup1, 1);
-		xb_builder_source_add_fixup (source, fixup1);
-		fixup2 = xb_builder_fixup_new ("AddIcons",
-					       gs_plugin_appstream_add_icons_cb,
-					       self, NULL);
-		xb_builder_fixup_set_max_depth (fixup2, 2);
-		xb_builder_source_add_fixup (source, fixup2);
-		xb_builder_import_source (builder, source);
-	} else {
-		g_autofree gchar *state_cache_dir = NULL;
-		g_autofree gchar *state_lib_dir = NULL;
-
-		/* add search paths */
-		gs_add_appstream_catalog_location (parent_appstream, DATADIR);
-		gs_add_appstream_metainfo_location (parent_appdata, DATADIR);
-
-		state_cache_dir = g_build_filename (LOCALSTATEDIR, "cache", NULL);
-		gs_add_appstream_catalog_location (parent_appstream, state_cache_dir);
-		state_lib_dir = g_build_filename (LOCALSTATEDIR, "lib", NULL);
-		gs_add_appstream_catalog_location (parent_appstream, state_lib_dir);
-
-#ifdef ENABLE_EXTERNAL_APPSTREAM
-		/* check for the corresponding setting */
-		if (!g_settings_get_boolean (self->settings, "external-appstream-system-wide")) {
-			g_autofree gchar *user_catalog_path = NULL;
-			g_autofree gchar *user_catalog_old_path = NULL;
-
-			/* migrate data paths */
-			user_catalog_path = g_build_filename (g_get_user_data_dir (), "swcatalog", NULL);
-			user_catalog_old_path = g_build_filename (g_get_user_data_dir (), "app-info", NULL);
-			if (g_file_test (user_catalog_old_path, G_FILE_TEST_IS_DIR) &&
-			    !g_file_test (user_catalog_path, G_FILE_TEST_IS_DIR)) {
-				g_debug ("Migrating external AppStream user location.");
-				if (g_rename (user_catalog_old_path, user_catalog_path) == 0) {
-					g_autofree gchar *user_catalog_xml_path = NULL;
-					g_autofree gchar *user_catalog_xml_old_path = NULL;
-
-					user_catalog_xml_path = g_build_filename (user_catalog_path, "xml", NULL);
-					user_catalog_xml_old_path = g_build_filename (user_catalog_path, "xmls", NULL);
-					if (g_file_test (user_catalog_xml_old_path, G_FILE_TEST_IS_DIR)) {
-						if (g_rename (user_catalog_xml_old_path, user_catalog_xml_path) != 0)
-							g_warning ("Unable to migrate external XML data location from '%s' to '%s': %s",
-								user_catalog_xml_old_path, user_catalog_xml_path, g_strerror (errno));
-					}
-				} else {
-					g_warning ("Unable to migrate external data location from '%s' to '%s': %s",
-						   user_catalog_old_path, user_catalog_path, g_strerror (errno));
-				}
-
-			}
-
-			/* add modern locations only */
-			g_ptr_array_add (parent_appstream,
-					g_build_filename (user_catalog_path, "xml", NULL));
-			g_ptr_array_add (parent_appstream,
-					g_build_filename (user_catalog_path, "yaml", NULL));
-		}
-#endif
-
-		/* Add the normal system directories if the installation prefix
-		 * is different from normal — typically this happens when doing
-		 * development builds. It’s useful to still list the system apps
-		 * during development. */
-		if (g_strcmp0 (DATADIR, "/usr/share") != 0) {
-			gs_add_appstream_catalog_location (parent_appstream, "/usr/share");
-			gs_add_appstream_metainfo_location (parent_appdata, "/usr/share");
-		}
-		if (g_strcmp0 (LOCALSTATEDIR, "/var") != 0) {
-			gs_add_appstream_catalog_location (parent_appstream, "/var/cache");
-			gs_add_appstream_catalog_location (parent_appstream, "/var/lib");
-		}
-
-		/* import all files */
-		for (guint i = 0; i < parent_appstream->len; i++) {
-			const gchar *fn = g_ptr_array_index (parent_appstream, i);
-			if (!gs_plugin_appstream_load_appstream (self, builder, fn,
-								 cancellable, error))
-				return FALSE;
-		}
-		for (guint i = 0; i < parent_appdata->len; i++) {
-			const gchar *fn = g_ptr_array_index (parent_appdata, i);
-			if (!gs_plugin_appstream_load_appdata (self, builder, fn,
-							       cancellable, error))
-				return FALSE;
-		}
-		if (!gs_plugin_appstream_load_desktop (self, builder,
-						       DATADIR "/applications",
-						       cancellable, error)) {
-			return FALSE;
-		}
-		if (g_strcmp0 (DATADIR, "/usr/share") != 0 &&
-		    !gs_plugin_appstream_load_desktop (self, builder,
-						       "/usr/share/applications",
-						       cancellable, error)) {
-			return FALSE;
-		}
+	/* import all files */
+	switch (source->kind) {
+	case GS_PLUGIN_APPSTREAM_SOURCE_KIND_CATALOG:
+		ret = gs_plugin_appstream_load_appstream (self, builder, source->path,
+							  cancellable, error);
+		break;
+	case GS_PLUGIN_APPSTREAM_SOURCE_KIND_METAINFO:
+		ret = gs_plugin_appstream_load_appdata (self, builder, source->path,
+							cancellable, error);
+		break;
+	case GS_PLUGIN_APPSTREAM_SOURCE_KIND_DESKTOP:
+		ret = gs_plugin_appstream_load_desktop (self, builder, source->path,
+							cancellable, error);
+		break;
+	case GS_PLUGIN_APPSTREAM_SOURCE_KIND_TEST:
+		ret = gs_plugin_appstream_load_test_xml (self, builder, source->path, error);
+		break;
+	default:
+		g_assert_not_reached ();
 	}
+	if (!ret)
+		return NULL;
 
 	/* regenerate with each minor release */
 	xb_builder_append_guid (builder, PACKAGE_VERSION);
 
-	/* create per-user cache */
-	blobfn = gs_utils_get_cache_filename ("appstream", "components.xmlb",
+	/* create per-user cache, one blob per source */
+	basename = gs_plugin_appstream_source_get_blob_basename (source);
+	blobfn = gs_utils_get_cache_filename ("appstream", basename,
 					      GS_UTILS_CACHE_FLAG_WRITEABLE |
 					      GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
 					      error);
 	if (blobfn == NULL)
-		return FALSE;
+		return NULL;
 	file = g_file_new_for_path (blobfn);
-	g_debug ("ensuring %s", blobfn);
+	g_debug ("ensuring %s for %s", blobfn,
+		 source->kind == GS_PLUGIN_APPSTREAM_SOURCE_KIND_TEST ? "self test" : source->path);
 
 	/* FIXME: https://gitlab.gnome.org/GNOME/gnome-software/-/issues/1422 */
 	old_thread_default = g_main_context_ref_thread_default ();
@@ -812,42 +937,124 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	if (old_thread_default != NULL)
 		g_main_context_pop_thread_default (old_thread_default);
 
-	self->silo = xb_builder_ensure (builder, file,
-					XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
-					XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
-					NULL, error);
-	if (self->silo == NULL) {
-		if (old_thread_default != NULL)
-			g_main_context_push_thread_default (old_thread_default);
-		return FALSE;
+	silo = xb_builder_ensure (builder, file,
+				  XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
+				  XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
+				  NULL, error);
+
+	/* watch the directory too, so that new files invalidate the silo */
+	if (silo != NULL && source->kind != GS_PLUGIN_APPSTREAM_SOURCE_KIND_TEST) {
+		g_autoptr(GFile) file_tmp = g_file_new_for_path (source->path);
+		if (!xb_silo_watch_file (silo, file_tmp, cancellable, error))
+			g_clear_object (&silo);
 	}
 
-	/* watch all directories too */
-	for (guint i = 0; i < parent_appstream->len; i++) {
-		const gchar *fn = g_ptr_array_index (parent_appstream, i);
-		g_autoptr(GFile) file_tmp = g_file_new_for_path (fn);
-		if (!xb_silo_watch_file (self->silo, file_tmp, cancellable, error)) {
-			if (old_thread_default != NULL)
-				g_main_context_push_thread_default (old_thread_default);
+	if (old_thread_default != NULL)
+		g_main_context_push_thread_default (old_thread_default);
+
+	return g_steal_pointer (&silo);
+}
+
+/* @self->silo_lock must be held */
+static gboolean
+gs_plugin_appstream_sources_valid (GsPluginAppstream *self)
+{
+	if (self->sources == NULL)
+		return FALSE;
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!xb_silo_is_valid (source->silo))
 			return FALSE;
-		}
 	}
-	for (guint i = 0; i < parent_appdata->len; i++) {
-		const gchar *fn = g_ptr_array_index (parent_appdata, i);
-		g_autoptr(GFile) file_tmp = g_file_new_for_path (fn);
-		if (!xb_silo_watch_file (self->silo, file_tmp, cancellable, error)) {
-			if (old_thread_default != NULL)
-				g_main_context_push_thread_default (old_thread_default);
-			return FALSE;
+	return TRUE;
+}
+
+/* @self->rebuild_mutex must be held */
+static gboolean
+gs_plugin_appstream_rebuild_silos (GsPluginAppstream  *self,
+                                   GCancellable       *cancellable,
+                                   GError            **error)
+{
+	gboolean found = FALSE;
+	guint n_rebuilt = 0;
+	g_autoptr(GPtrArray) sources = NULL;
+	g_autoptr(GPtrArray) sources_old = NULL;
+	g_autoptr(GPtrArray) silos = NULL;
+	g_autoptr(GString) stamp = NULL;
+	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
+	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
+
+	/* another worker thread may have done so while we were waiting; only
+	 * this function replaces @sources, so it can’t change after this */
+	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	if (gs_plugin_appstream_sources_valid (self))
+		return TRUE;
+	if (self->sources != NULL)
+		sources_old = g_ptr_array_ref (self->sources);
+	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
+
+	/* only rebuild the sources which changed, reusing the rest */
+	sources = gs_plugin_appstream_get_sources (self);
+	for (guint i = 0; i < sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (sources, i);
+
+		for (guint j = 0; sources_old != NULL && j < sources_old->len; j++) {
+			GsPluginAppstreamSource *source_old = g_ptr_array_index (sources_old, j);
+			if (source_old->kind == source->kind &&
+			    g_strcmp0 (source_old->path, source->path) == 0 &&
+			    xb_silo_is_valid (source_old->silo)) {
+				source->silo = g_object_ref (source_old->silo);
+				break;
+			}
+		}
+		if (source->silo == NULL) {
+			g_autoptr(GError) local_error = NULL;
+
+			source->silo = gs_plugin_appstream_build_silo (self, source, cancellable, &local_error);
+			if (source->silo == NULL) {
+				/* the previous silos are stale, but still usable */
+				if (sources_old != NULL &&
+				    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+					g_warning ("Failed to rebuild AppStream silo for %s, keeping the previous silos: %s",
+						   source->path, local_error->message);
+					return TRUE;
+				}
+				g_propagate_error (error, g_steal_pointer (&local_error));
+				return FALSE;
+			}
+			n_rebuilt++;
 		}
 	}
-
-	if (old_thread_default != NULL)
-		g_main_context_push_thread_default (old_thread_default);
+	g_debug ("rebuilt %u of %u AppStream silos", n_rebuilt, sources->len);
 
 	/* test we found something */
-	n = xb_silo_query_first (self->silo, "components/component", NULL);
-	if (n == NULL) {
+	for (guint i = 0; !found && i < sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (sources, i);
+		g_autoptr(XbNode) n = xb_silo_query_first (source->silo, "components/component", NULL);
+		found = (n != NULL);
+	}
+
+	/* the silo GUIDs change whenever their contents do */
+	stamp = g_string_new (NULL);
+	silos = g_ptr_array_new_full (sources->len, g_object_unref);
+	for (guint i = 0; i < sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (sources, i);
+		g_string_append_printf (stamp, "%s;", xb_silo_get_guid (source->silo));
+		g_ptr_array_add (silos, g_object_ref (source->silo));
+	}
+
+	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
+	g_clear_pointer (&self->sources, g_ptr_array_unref);
+	self->sources = g_steal_pointer (&sources);
+	g_clear_pointer (&self->silos, g_ptr_array_unref);
+	self->silos = g_steal_pointer (&silos);
+	gs_plugin_set_refine_cache_stamp (GS_PLUGIN (self), stamp->str);
+	g_clear_pointer (&writer_locker, g_rw_lock_writer_locker_free);
+
+	/* a source which went away, or changed path, leaves its blob behind */
+	gs_plugin_appstream_prune_blobs (self->sources);
+
+	if (!found) {
 		g_warning ("No AppStream data, try 'make install-sample-data' in data/");
 		g_set_error (error,
 			     GS_PLUGIN_ERROR,
@@ -860,6 +1067,41 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	return TRUE;
 }
 
+/* Only one worker rebuilds the silos at a time, and it does so without
+ * @silo_lock held; the writer lock is only taken to swap in the new set. Any
+ * other worker which finds a rebuild already running carries on querying the
+ * current set rather than waiting for it, and if a rebuild fails the previous
+ * set is kept too. Only the very first load blocks, as there is nothing to
+ * query before it. */
+static gboolean
+gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
+                                GCancellable       *cancellable,
+                                GError            **error)
+{
+	gboolean have_sources;
+	gboolean ret;
+	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
+
+	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	/* everything is okay */
+	if (gs_plugin_appstream_sources_valid (self))
+		return TRUE;
+	have_sources = (self->sources != NULL);
+	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
+
+	/* drat! some silos need regenerating; if another worker is already
+	 * doing so, keep using the current silos until it has finished */
+	if (!have_sources)
+		g_mutex_lock (&self->rebuild_mutex);
+	else if (!g_mutex_trylock (&self->rebuild_mutex))
+		return TRUE;
+
+	ret = gs_plugin_appstream_rebuild_silos (self, cancellable, error);
+	g_mutex_unlock (&self->rebuild_mutex);
+
+	return ret;
+}
+
 static gint
 get_priority_for_interactivity (gboolean interactive)
 {
@@ -883,12 +1125,14 @@ gs_plugin_appstream_setup_async (GsPlugin            *plugin,
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_appstream_setup_async);
 
-	/* Start up a worker thread to process all the plugin’s function calls. */
-	self->worker = gs_worker_thread_new ("gs-plugin-appstream");
+	/* Start up a pool of worker threads to process all the plugin’s
+	 * function calls. They only access the silo with @silo_lock held, so
+	 * can safely run in parallel. */
+	self->worker = gs_worker_pool_new ("gs-plugin-appstream", 0);
 
 	/* Queue a job to check the silo, which will cause it to be loaded. */
-	gs_worker_thread_queue (self->worker, G_PRIORITY_DEFAULT,
-				setup_thread_cb, g_steal_pointer (&task));
+	gs_worker_pool_queue (self->worker, G_PRIORITY_DEFAULT,
+			      setup_thread_cb, g_steal_pointer (&task));
 }
 
 /* Run in @worker. */
@@ -933,8 +1177,8 @@ gs_plugin_appstream_shutdown_async (GsPlugin            *plugin,
 	task = g_task_new (self, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_appstream_shutdown_async);
 
-	/* Stop the worker thread. */
-	gs_worker_thread_shutdown_async (self->worker, cancellable, shutdown_cb, g_steal_pointer (&task));
+	/* Stop the worker threads. */
+	gs_worker_pool_shutdown_async (self->worker, cancellable, shutdown_cb, g_steal_pointer (&task));
 }
 
 static void
@@ -944,12 +1188,12 @@ shutdown_cb (GObject      *source_object,
 {
 	g_autoptr(GTask) task = G_TASK (user_data);
 	GsPluginAppstream *self = g_task_get_source_object (task);
-	g_autoptr(GsWorkerThread) worker = NULL;
+	g_autoptr(GsWorkerPool) worker = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	worker = g_steal_pointer (&self->worker);
 
-	if (!gs_worker_thread_shutdown_finish (worker, result, &local_error)) {
+	if (!gs_worker_pool_shutdown_finish (worker, result, &local_error)) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
@@ -981,7 +1225,13 @@ gs_plugin_url_to_app (GsPlugin *plugin,
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
-	return gs_appstream_url_to_app (plugin, self->silo, list, url, cancellable, error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_url_to_app (plugin, source->silo, list, url, cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 static void
@@ -1035,23 +1285,28 @@ gs_plugin_appstream_refine_state (GsPluginAppstream  *self,
                                   GError            **error)
 {
 	g_autofree gchar *xpath = NULL;
-	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(XbNode) component = NULL;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
 	xpath = g_strdup_printf ("component/id[text()='%s']", gs_app_get_id (app));
-	component = xb_silo_query_first (self->silo, xpath, &error_local);
-	if (component == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		g_autoptr(GError) error_local = NULL;
+		g_autoptr(XbNode) component = NULL;
+
+		component = xb_silo_query_first (source->silo, xpath, &error_local);
+		if (component == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				continue;
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
+				continue;
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+		gs_app_set_state (app, GS_APP_STATE_INSTALLED);
+		break;
 	}
-	gs_app_set_state (app, GS_APP_STATE_INSTALLED);
 	return TRUE;
 }
 
@@ -1063,10 +1318,9 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
                           GError              **error)
 {
 	const gchar *id, *origin;
-	g_autoptr(GError) error_local = NULL;
+	gboolean found_any = FALSE;
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
 	g_autoptr(GString) xpath = g_string_new (NULL);
-	g_autoptr(GPtrArray) components = NULL;
 
 	/* not enough info to find */
 	id = gs_app_get_id (app);
@@ -1086,22 +1340,31 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
 		xb_string_append_union (xpath, "components/component[@type='web-application']/id[text()='%s']/..", id);
 	}
 	xb_string_append_union (xpath, "component/id[text()='%s']/..", id);
-	components = xb_silo_query (self->silo, xpath->str, 0, &error_local);
-	if (components == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
-	}
-	for (guint i = 0; i < components->len; i++) {
-		XbNode *component = g_ptr_array_index (components, i);
-		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, self->silo,
-					      component, flags, error))
+	for (guint j = 0; j < self->sources->len; j++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, j);
+		g_autoptr(GError) error_local = NULL;
+		g_autoptr(GPtrArray) components = NULL;
+
+		components = xb_silo_query (source->silo, xpath->str, 0, &error_local);
+		if (components == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				continue;
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
+				continue;
+			g_propagate_error (error, g_steal_pointer (&error_local));
 			return FALSE;
-		gs_plugin_appstream_set_compulsory_quirk (app, component);
+		}
+		for (guint i = 0; i < components->len; i++) {
+			XbNode *component = g_ptr_array_index (components, i);
+			if (!gs_appstream_refine_app_with_silos (GS_PLUGIN (self), app, self->silos,
+								 component, flags, error))
+				return FALSE;
+			gs_plugin_appstream_set_compulsory_quirk (app, component);
+		}
+		found_any = TRUE;
 	}
+	if (!found_any)
+		return TRUE;
 
 	/* if an installed desktop or appdata file exists set to installed */
 	if (gs_app_get_state (app) == GS_APP_STATE_UNKNOWN) {
@@ -1121,7 +1384,6 @@ gs_plugin_refine_from_pkgname (GsPluginAppstream    *self,
                                GError              **error)
 {
 	GPtrArray *sources = gs_app_get_sources (app);
-	g_autoptr(GError) error_local = NULL;
 
 	/* not enough info to find */
 	if (sources->len == 0)
@@ -1131,26 +1393,43 @@ gs_plugin_refine_from_pkgname (GsPluginAppstream    *self,
 	for (guint j = 0; j < sources->len; j++) {
 		const gchar *pkgname = g_ptr_array_index (sources, j);
 		g_autoptr(GRWLockReaderLocker) locker = NULL;
-		g_autoptr(GString) xpath = g_string_new (NULL);
+		const gchar *types[] = {
+			"desktop-application",
+			"console-application",
+			"web-application",
+			NULL,  /* any type */
+		};
 		g_autoptr(XbNode) component = NULL;
 
 		locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
-		/* prefer actual apps and then fallback to anything else */
-		xb_string_append_union (xpath, "components/component[@type='desktop-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component[@type='console-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component[@type='web-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component/pkgname[text()='%s']/..", pkgname);
-		component = xb_silo_query_first (self->silo, xpath->str, &error_local);
-		if (component == NULL) {
-			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-				continue;
-			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-				continue;
-			g_propagate_error (error, g_steal_pointer (&error_local));
-			return FALSE;
+		/* prefer actual apps and then fallback to anything else, from
+		 * any source, with the order of the sources breaking ties */
+		for (guint k = 0; component == NULL && k < G_N_ELEMENTS (types); k++) {
+			g_autoptr(GString) xpath = g_string_new (NULL);
+
+			if (types[k] != NULL)
+				xb_string_append_union (xpath, "components/component[@type='%s']/pkgname[text()='%s']/..", types[k], pkgname);
+			else
+				xb_string_append_union (xpath, "components/component/pkgname[text()='%s']/..", pkgname);
+			for (guint i = 0; component == NULL && i < self->sources->len; i++) {
+				GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+				g_autoptr(GError) error_local = NULL;
+
+				component = xb_silo_query_first (source->silo, xpath->str, &error_local);
+				if (component == NULL) {
+					if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+						continue;
+					if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
+						continue;
+					g_propagate_error (error, g_steal_pointer (&error_local));
+					return FALSE;
+				}
+			}
 		}
-		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, self->silo, component, flags, error))
+		if (component == NULL)
+			continue;
+		if (!gs_appstream_refine_app_with_silos (GS_PLUGIN (self), app, self->silos, component, flags, error))
 			return FALSE;
 		gs_plugin_appstream_set_compulsory_quirk (app, component);
 	}
@@ -1186,8 +1465,8 @@ gs_plugin_appstream_refine_async (GsPlugin            *plugin,
 	g_task_set_source_tag (task, gs_plugin_appstream_refine_async);
 
 	/* Queue a job for the refine. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				refine_thread_cb, g_steal_pointer (&task));
+	gs_worker_pool_queue (self->worker, get_priority_for_interactivity (interactive),
+			      refine_thread_cb, g_steal_pointer (&task));
 }
 
 static gboolean refine_wildcard (GsPluginAppstream    *self,
@@ -1282,9 +1561,7 @@ refine_wildcard (GsPluginAppstream    *self,
 {
 	const gchar *id;
 	g_autofree gchar *xpath = NULL;
-	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(GPtrArray) components = NULL;
 
 	/* not enough info to find */
 	id = gs_app_get_id (app);
@@ -1295,37 +1572,43 @@ refine_wildcard (GsPluginAppstream    *self,
 
 	/* find all app with package names when matching any prefixes */
 	xpath = g_strdup_printf ("components/component/id[text()='%s']/../pkgname/..", id);
-	components = xb_silo_query (self->silo, xpath, 0, &error_local);
-	if (components == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
-	}
-	for (guint i = 0; i < components->len; i++) {
-		XbNode *component = g_ptr_array_index (components, i);
-		g_autoptr(GsApp) new = NULL;
+	for (guint j = 0; j < self->sources->len; j++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, j);
+		g_autoptr(GError) error_local = NULL;
+		g_autoptr(GPtrArray) components = NULL;
 
-		/* new app */
-		new = gs_appstream_create_app (GS_PLUGIN (self), self->silo, component, error);
-		if (new == NULL)
-			return FALSE;
-		gs_app_set_scope (new, AS_COMPONENT_SCOPE_SYSTEM);
-		gs_app_subsume_metadata (new, app);
-		if (!gs_appstream_refine_app (GS_PLUGIN (self), new, self->silo, component,
-					      refine_flags, error))
+		components = xb_silo_query (source->silo, xpath, 0, &error_local);
+		if (components == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				continue;
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
+				continue;
+			g_propagate_error (error, g_steal_pointer (&error_local));
 			return FALSE;
-		gs_plugin_appstream_set_compulsory_quirk (new, component);
+		}
+		for (guint i = 0; i < components->len; i++) {
+			XbNode *component = g_ptr_array_index (components, i);
+			g_autoptr(GsApp) new = NULL;
 
-		/* if an installed desktop or appdata file exists set to installed */
-		if (gs_app_get_state (new) == GS_APP_STATE_UNKNOWN) {
-			if (!gs_plugin_appstream_refine_state (self, new, error))
+			/* new app */
+			new = gs_appstream_create_app (GS_PLUGIN (self), source->silo, component, error);
+			if (new == NULL)
 				return FALSE;
-		}
+			gs_app_set_scope (new, AS_COMPONENT_SCOPE_SYSTEM);
+			gs_app_subsume_metadata (new, app);
+			if (!gs_appstream_refine_app_with_silos (GS_PLUGIN (self), new, self->silos, component,
+								 refine_flags, error))
+				return FALSE;
+			gs_plugin_appstream_set_compulsory_quirk (new, component);
+
+			/* if an installed desktop or appdata file exists set to installed */
+			if (gs_app_get_state (new) == GS_APP_STATE_UNKNOWN) {
+				if (!gs_plugin_appstream_refine_state (self, new, error))
+					return FALSE;
+			}
 
-		gs_app_list_add (list, new);
+			gs_app_list_add (list, new);
+		}
 	}
 
 	/* success */
@@ -1346,12 +1629,17 @@ gs_plugin_add_category_apps (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_add_category_apps (plugin,
-					       self->silo,
-					       category,
-					       list,
-					       cancellable,
-					       error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_add_category_apps (plugin,
+						     source->silo,
+						     category,
+						     list,
+						     cancellable,
+						     error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 gboolean
@@ -1368,12 +1656,17 @@ gs_plugin_add_search (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_search (plugin,
-				    self->silo,
-				    (const gchar * const *) values,
-				    list,
-				    cancellable,
-				    error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_search (plugin,
+					  source->silo,
+					  (const gchar * const *) values,
+					  list,
+					  cancellable,
+					  error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 static void list_installed_apps_thread_cb (GTask        *task,
@@ -1396,8 +1689,8 @@ gs_plugin_appstream_list_installed_apps_async (GsPlugin                       *p
 	g_task_set_source_tag (task, gs_plugin_appstream_list_installed_apps_async);
 
 	/* Queue a job to check the silo, which will cause it to be loaded. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				list_installed_apps_thread_cb, g_steal_pointer (&task));
+	gs_worker_pool_queue (self->worker, get_priority_for_interactivity (interactive),
+			      list_installed_apps_thread_cb, g_steal_pointer (&task));
 }
 
 /* Run in @worker. */
@@ -1409,7 +1702,6 @@ list_installed_apps_thread_cb (GTask        *task,
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (source_object);
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(GPtrArray) components = NULL;
 	g_autoptr(GsAppList) list = gs_app_list_new ();
 	g_autoptr(GError) local_error = NULL;
 
@@ -1423,27 +1715,30 @@ list_installed_apps_thread_cb (GTask        *task,
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
-	/* get all installed appdata files (notice no 'components/' prefix...) */
-	components = xb_silo_query (self->silo, "component/description/..", 0, NULL);
-	if (components == NULL) {
-		g_task_return_pointer (task, g_steal_pointer (&list), g_object_unref);
-		return;
-	}
+	for (guint j = 0; j < self->sources->len; j++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, j);
+		g_autoptr(GPtrArray) components = NULL;
 
-	for (guint i = 0; i < components->len; i++) {
-		XbNode *component = g_ptr_array_index (components, i);
-		g_autoptr(GsApp) app = gs_appstream_create_app (GS_PLUGIN (self), self->silo, component, &local_error);
-		if (app == NULL) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
+		/* get all installed appdata files (notice no 'components/' prefix...) */
+		components = xb_silo_query (source->silo, "component/description/..", 0, NULL);
+		if (components == NULL)
+			continue;
 
-		/* Can get cached gsApp, which has the state already updated */
-		if (gs_app_get_state (app) != GS_APP_STATE_UPDATABLE &&
-		    gs_app_get_state (app) != GS_APP_STATE_UPDATABLE_LIVE)
-			gs_app_set_state (app, GS_APP_STATE_INSTALLED);
-		gs_app_set_scope (app, AS_COMPONENT_SCOPE_SYSTEM);
-		gs_app_list_add (list, app);
+		for (guint i = 0; i < components->len; i++) {
+			XbNode *component = g_ptr_array_index (components, i);
+			g_autoptr(GsApp) app = gs_appstream_create_app (GS_PLUGIN (self), source->silo, component, &local_error);
+			if (app == NULL) {
+				g_task_return_error (task, g_steal_pointer (&local_error));
+				return;
+			}
+
+			/* Can get cached gsApp, which has the state already updated */
+			if (gs_app_get_state (app) != GS_APP_STATE_UPDATABLE &&
+			    gs_app_get_state (app) != GS_APP_STATE_UPDATABLE_LIVE)
+				gs_app_set_state (app, GS_APP_STATE_INSTALLED);
+			gs_app_set_scope (app, AS_COMPONENT_SCOPE_SYSTEM);
+			gs_app_list_add (list, app);
+		}
 	}
 
 	g_task_return_pointer (task, g_steal_pointer (&list), g_object_unref);
@@ -1470,8 +1765,13 @@ gs_plugin_add_categories (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_add_categories (self->silo, list,
-					    cancellable, error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_add_categories (source->silo, list,
+						  cancellable, error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 gboolean
@@ -1487,7 +1787,12 @@ gs_plugin_add_popular (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_add_popular (self->silo, list, cancellable, error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_add_popular (source->silo, list, cancellable, error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 gboolean
@@ -1503,7 +1808,12 @@ gs_plugin_add_featured (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_add_featured (self->silo, list, cancellable, error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_add_featured (source->silo, list, cancellable, error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 gboolean
@@ -1520,8 +1830,13 @@ gs_plugin_add_recent (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_add_recent (GS_PLUGIN (self), self->silo, list, age,
-					cancellable, error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_add_recent (GS_PLUGIN (self), source->silo, list, age,
+					      cancellable, error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 gboolean
@@ -1538,8 +1853,13 @@ gs_plugin_add_alternates (GsPlugin *plugin,
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	return gs_appstream_add_alternates (self->silo, app, list,
-					    cancellable, error);
+	for (guint i = 0; i < self->sources->len; i++) {
+		GsPluginAppstreamSource *source = g_ptr_array_index (self->sources, i);
+		if (!gs_appstream_add_alternates (source->silo, app, list,
+						  cancellable, error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 static void refresh_metadata_thread_cb (GTask        *task,
@@ -1563,8 +1883,8 @@ gs_plugin_appstream_refresh_metadata_async (GsPlugin                     *plugin
 	g_task_set_source_tag (task, gs_plugin_appstream_refresh_metadata_async);
 
 	/* Queue a job to check the silo, which will cause it to be refreshed if needed. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				refresh_metadata_thread_cb, g_steal_pointer (&task));
+	gs_worker_pool_queue (self->worker, get_priority_for_interactivity (interactive),
+			      refresh_metadata_thread_cb, g_steal_pointer (&task));
 }
 
 /* Run in @worker. */
@@ -23,17 +23,42 @@
  * It is provided so that each plugin handling icons does not
  * have to handle the download and caching functionality.
  *
+ * All the missing icons for a refine are downloaded concurrently over one
+ * #SoupSession, so its connections are reused. At most
+ * %MAX_DOWNLOADS_IN_FLIGHT downloads run at once across all refines, and at
+ * most %MAX_DOWNLOADS_PER_HOST of those go to a single host, so one slow
+ * server can’t starve the others. Downloads which don’t fit are queued, and
+ * the refine completes once all its icons have landed or failed (including
+ * timing out, using the #SoupSession:timeout).
+ *
+ * Each icon is only downloaded once at a time: a request for an icon which is
+ * already queued or downloading, for another app or refine, waits for that
+ * download rather than starting its own.
+ *
  * FIXME: This plugin will eventually go away. Currently it only exists as the
  * plugin threading code is a convenient way of ensuring that loading the remote
  * icons happens in a worker thread.
  */
 
+#define MAX_DOWNLOADS_IN_FLIGHT 8
+#define MAX_DOWNLOADS_PER_HOST 4
+
 struct _GsPluginIcons
 {
 	GsPlugin	parent;
 
-	SoupSession	*soup_session;  /* (owned) */
+	SoupSession	*soup_session;  /* (owned); only used in @worker */
 	GsWorkerThread	*worker;  /* (owned) */
+
+	/* All only accessed from @worker: */
+	GQueue		 download_queue;  /* (element-type IconDownload) (unowned) */
+	guint		 n_downloads_in_flight;
+	GHashTable	*n_downloads_per_host;  /* (element-type utf8 guint) (owned) */
+
+	/* Every queued or in-flight download, by the cache filename of its
+	 * icon. The first of each is the one which is queued or downloading;
+	 * the rest wait for it. */
+	GHashTable	*downloads;  /* (element-type filename GPtrArray<IconDownload>) (owned) */
 };
 
 G_DEFINE_TYPE (GsPluginIcons, gs_plugin_icons, GS_TYPE_PLUGIN)
@@ -41,11 +66,45 @@ G_DEFINE_TYPE (GsPluginIcons, gs_plugin_icons, GS_TYPE_PLUGIN)
 #define assert_in_worker(self) \
 	g_assert (gs_worker_thread_is_in_worker_context (self->worker))
 
+/* A set of icon downloads for one refine, which is completed once they have
+ * all finished. */
+typedef struct {
+	GTask *task;  /* (owned) */
+	guint n_pending;
+} DownloadBatch;
+
+typedef struct {
+	DownloadBatch *batch;  /* (unowned) */
+	GsRemoteIcon *icon;  /* (owned) */
+	gchar *cache_filename;  /* (owned) */
+	gchar *app_id;  /* (owned) (nullable) */
+	gchar *host;  /* (owned) */
+	guint maximum_icon_size;
+	gint priority;
+} IconDownload;
+
+static void
+icon_download_free (IconDownload *download)
+{
+	g_clear_object (&download->icon);
+	g_free (download->cache_filename);
+	g_free (download->app_id);
+	g_free (download->host);
+	g_free (download);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IconDownload, icon_download_free)
+
 static void
 gs_plugin_icons_init (GsPluginIcons *self)
 {
 	/* needs remote icons downloaded */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "appstream");
+
+	g_queue_init (&self->download_queue);
+	self->n_downloads_per_host = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	self->downloads = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free, (GDestroyNotify) g_ptr_array_unref);
 }
 
 static void
@@ -59,6 +118,27 @@ gs_plugin_icons_dispose (GObject *object)
 	G_OBJECT_CLASS (gs_plugin_icons_parent_class)->dispose (object);
 }
 
+static void
+gs_plugin_icons_finalize (GObject *object)
+{
+	GsPluginIcons *self = GS_PLUGIN_ICONS (object);
+
+	/* all refines should have completed before the plugin is destroyed */
+	g_assert (g_queue_is_empty (&self->download_queue));
+	g_assert (self->n_downloads_in_flight == 0);
+	g_assert (g_hash_table_size (self->downloads) == 0);
+
+	g_hash_table_unref (self->n_downloads_per_host);
+	g_hash_table_unref (self->downloads);
+
+	G_OBJECT_CLASS (gs_plugin_icons_parent_class)->finalize (object);
+}
+
+static void setup_thread_cb (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable);
+
 static void
 gs_plugin_icons_setup_async (GsPlugin            *plugin,
                              GCancellable        *cancellable,
@@ -71,11 +151,33 @@ gs_plugin_icons_setup_async (GsPlugin            *plugin,
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_icons_setup_async);
 
-	self->soup_session = gs_build_soup_session ();
-
 	/* Start up a worker thread to process all the plugin’s function calls. */
 	self->worker = gs_worker_thread_new ("gs-plugin-icons");
 
+	/* The session is used asynchronously from the worker, so must be
+	 * created there. */
+	gs_worker_thread_queue (self->worker, G_PRIORITY_DEFAULT,
+				setup_thread_cb, g_steal_pointer (&task));
+}
+
+/* Run in @worker. */
+static void
+setup_thread_cb (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+	GsPluginIcons *self = GS_PLUGIN_ICONS (source_object);
+
+	assert_in_worker (self);
+
+	/* Like gs_build_soup_session(), but allowing enough connections per
+	 * host to make use of the per-host download limit. */
+	self->soup_session = soup_session_new_with_options ("user-agent", gs_user_agent (),
+							    "timeout", 10,
+							    "max-conns-per-host", MAX_DOWNLOADS_PER_HOST,
+							    NULL);
+
 	g_task_return_boolean (task, TRUE);
 }
 
@@ -136,27 +238,68 @@ gs_plugin_icons_shutdown_finish (GsPlugin      *plugin,
 	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
-static gboolean
-refine_app (GsPluginIcons        *self,
-            GsApp                *app,
-            GsPluginRefineFlags   flags,
-            GCancellable         *cancellable,
-            GError              **error)
+static void download_queue_dispatch (GsPluginIcons *self);
+
+static void
+refine_app (GsPluginIcons       *self,
+            GsApp               *app,
+            GsPluginRefineFlags  flags,
+            gint                 priority,
+            DownloadBatch       *batch)
 {
+	GPtrArray *icons;
 	guint maximum_icon_size;
 
 	assert_in_worker (self);
 
 	/* not required */
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON) == 0)
-		return TRUE;
+		return;
 
 	/* Currently a 160px icon is needed for #GsFeatureTile, at most. */
 	maximum_icon_size = 160 * gs_plugin_get_scale (GS_PLUGIN (self));
 
-	gs_app_ensure_icons_downloaded (app, self->soup_session, maximum_icon_size, cancellable);
+	/* Queue all the remote icons; whether they’re already cached is
+	 * checked when they’re dispatched. */
+	icons = gs_app_get_icons (app);
+
+	for (guint i = 0; icons != NULL && i < icons->len; i++) {
+		GIcon *icon = g_ptr_array_index (icons, i);
+		g_autoptr(IconDownload) download = NULL;
+		g_autofree gchar *host = NULL;
+		GPtrArray *downloads;
+
+		/* Only remote icons need to be cached. */
+		if (!GS_IS_REMOTE_ICON (icon))
+			continue;
+
+		if (!g_uri_split (gs_remote_icon_get_uri (GS_REMOTE_ICON (icon)), G_URI_FLAGS_NONE,
+				  NULL, NULL, &host, NULL, NULL, NULL, NULL, NULL))
+			host = NULL;
+
+		download = g_new0 (IconDownload, 1);
+		download->batch = batch;
+		download->icon = g_object_ref (GS_REMOTE_ICON (icon));
+		download->cache_filename = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (icon)));
+		download->app_id = g_strdup (gs_app_get_id (app));
+		download->host = (host != NULL) ? g_steal_pointer (&host) : g_strdup ("");
+		download->maximum_icon_size = maximum_icon_size;
+		download->priority = priority;
+
+		batch->n_pending++;
+
+		/* Wait for the same icon if it’s already on its way. */
+		downloads = g_hash_table_lookup (self->downloads, download->cache_filename);
+		if (downloads != NULL) {
+			g_ptr_array_add (downloads, g_steal_pointer (&download));
+			continue;
+		}
 
-	return TRUE;
+		downloads = g_ptr_array_new_with_free_func ((GDestroyNotify) icon_download_free);
+		g_hash_table_insert (self->downloads, g_strdup (download->cache_filename), downloads);
+		g_queue_push_tail (&self->download_queue, download);
+		g_ptr_array_add (downloads, g_steal_pointer (&download));
+	}
 }
 
 static void refine_thread_cb (GTask        *task,
@@ -178,6 +321,7 @@ gs_plugin_icons_refine_async (GsPlugin            *plugin,
 
 	task = gs_plugin_refine_data_new_task (plugin, list, flags, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_icons_refine_async);
+	g_task_set_priority (task, interactive ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW);
 
 	/* nothing to do here */
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON) == 0) {
@@ -186,7 +330,7 @@ gs_plugin_icons_refine_async (GsPlugin            *plugin,
 	}
 
 	/* Queue a job for the refine. */
-	gs_worker_thread_queue (self->worker, interactive ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW,
+	gs_worker_thread_queue (self->worker, g_task_get_priority (task),
 				refine_thread_cb, g_steal_pointer (&task));
 }
 
@@ -201,20 +345,171 @@ refine_thread_cb (GTask        *task,
 	GsPluginRefineData *data = task_data;
 	GsAppList *list = data->list;
 	GsPluginRefineFlags flags = data->flags;
-	g_autoptr(GError) local_error = NULL;
+	DownloadBatch *batch;
 
 	assert_in_worker (self);
 
+	batch = g_new0 (DownloadBatch, 1);
+	batch->task = g_object_ref (task);
+
 	for (guint i = 0; i < gs_app_list_length (list); i++) {
 		GsApp *app = gs_app_list_index (list, i);
 
-		if (!refine_app (self, app, flags, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
+		refine_app (self, app, flags, g_task_get_priority (task), batch);
+	}
+
+	/* no remote icons */
+	if (batch->n_pending == 0) {
+		g_clear_object (&batch->task);
+		g_free (batch);
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* The batch completes the task once all its downloads have finished. */
+	download_queue_dispatch (self);
+}
+
+static void download_cb (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data);
+
+/* Start as many of the queued downloads as the limits allow, in queue order
+ * but skipping over any for hosts which are already at their limit.
+ *
+ * Run in @worker. */
+static void
+download_queue_dispatch (GsPluginIcons *self)
+{
+	GList *l, *next;
+
+	assert_in_worker (self);
+
+	for (l = self->download_queue.head;
+	     l != NULL && self->n_downloads_in_flight < MAX_DOWNLOADS_IN_FLIGHT;
+	     l = next) {
+		IconDownload *download = l->data;
+		GCancellable *cancellable = g_task_get_cancellable (download->batch->task);
+		guint n_for_host;
+
+		next = l->next;
+
+		n_for_host = GPOINTER_TO_UINT (g_hash_table_lookup (self->n_downloads_per_host, download->host));
+		if (n_for_host >= MAX_DOWNLOADS_PER_HOST)
+			continue;
+
+		g_queue_delete_link (&self->download_queue, l);
+		g_hash_table_replace (self->n_downloads_per_host, g_strdup (download->host),
+				      GUINT_TO_POINTER (n_for_host + 1));
+		self->n_downloads_in_flight++;
+
+		gs_remote_icon_ensure_cached_async (download->icon,
+						    self->soup_session,
+						    download->maximum_icon_size,
+						    download->priority,
+						    cancellable,
+						    download_cb,
+						    download);
+	}
+}
+
+/* Counts @download as finished towards its batch, completing the batch’s
+ * refine if it was the last one.
+ *
+ * Run in @worker. */
+static void
+icon_download_finish (IconDownload *download)
+{
+	DownloadBatch *batch = download->batch;
+
+	g_assert (batch->n_pending > 0);
+	batch->n_pending--;
+
+	if (batch->n_pending == 0) {
+		g_autoptr(GTask) task = g_steal_pointer (&batch->task);
+
+		g_free (batch);
+
+		if (!g_task_return_error_if_cancelled (task))
+			g_task_return_boolean (task, TRUE);
+	}
+}
+
+/* Run in @worker. */
+static void
+download_cb (GObject      *source_object,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+	GsRemoteIcon *icon = GS_REMOTE_ICON (source_object);
+	IconDownload *download = user_data;
+	GsPluginIcons *self = g_task_get_source_object (download->batch->task);
+	guint n_for_host;
+	gboolean success;
+	g_autofree gchar *cache_filename = NULL;
+	g_autoptr(GPtrArray) downloads = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	assert_in_worker (self);
+
+	success = gs_remote_icon_ensure_cached_finish (icon, result, &local_error);
+	if (!success) {
+		/* we failed, but keep going */
+		g_debug ("failed to cache icon for %s: %s",
+			 download->app_id, local_error->message);
+	}
+
+	n_for_host = GPOINTER_TO_UINT (g_hash_table_lookup (self->n_downloads_per_host, download->host));
+	g_assert (n_for_host > 0);
+	if (n_for_host == 1)
+		g_hash_table_remove (self->n_downloads_per_host, download->host);
+	else
+		g_hash_table_replace (self->n_downloads_per_host, g_strdup (download->host),
+				      GUINT_TO_POINTER (n_for_host - 1));
+
+	g_assert (self->n_downloads_in_flight > 0);
+	self->n_downloads_in_flight--;
+
+	/* @download is owned by @downloads, and is the first of them */
+	if (!g_hash_table_steal_extended (self->downloads, download->cache_filename,
+					  (gpointer *) &cache_filename, (gpointer *) &downloads))
+		g_assert_not_reached ();
+	g_assert (g_ptr_array_index (downloads, 0) == download);
+
+	/* Only the refine which started the download was cancelled, so hand it
+	 * over to one of the others waiting for it, if there is one. */
+	if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		for (guint i = 1; i < downloads->len; i++) {
+			IconDownload *download_next = g_ptr_array_index (downloads, i);
+			GCancellable *cancellable = g_task_get_cancellable (download_next->batch->task);
+
+			if (g_cancellable_is_cancelled (cancellable))
+				continue;
+
+			g_ptr_array_index (downloads, i) = download;
+			g_ptr_array_index (downloads, 0) = download_next;
+			icon_download_finish (download);
+			g_ptr_array_remove_index (downloads, i);
+			g_queue_push_head (&self->download_queue, download_next);
+			g_hash_table_insert (self->downloads, g_steal_pointer (&cache_filename),
+					     g_steal_pointer (&downloads));
+			download_queue_dispatch (self);
 			return;
 		}
 	}
 
-	g_task_return_boolean (task, TRUE);
+	for (guint i = 0; i < downloads->len; i++) {
+		IconDownload *download_tmp = g_ptr_array_index (downloads, i);
+
+		/* the dimensions are stored on each icon */
+		if (success && download_tmp->icon != icon) {
+			gs_icon_set_width (G_ICON (download_tmp->icon), gs_icon_get_width (G_ICON (icon)));
+			gs_icon_set_height (G_ICON (download_tmp->icon), gs_icon_get_height (G_ICON (icon)));
+		}
+		icon_download_finish (download_tmp);
+	}
+
+	download_queue_dispatch (self);
 }
 
 static gboolean
@@ -232,6 +527,7 @@ gs_plugin_icons_class_init (GsPluginIconsClass *klass)
 	GsPluginClass *plugin_class = GS_PLUGIN_CLASS (klass);
 
 	object_class->dispose = gs_plugin_icons_dispose;
+	object_class->finalize = gs_plugin_icons_finalize;
 
 	plugin_class->setup_async = gs_plugin_icons_setup_async;
 	plugin_class->setup_finish = gs_plugin_icons_setup_finish;
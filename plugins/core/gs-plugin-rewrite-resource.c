@@ -42,8 +42,9 @@ G_DEFINE_TYPE (GsPluginRewriteResource, gs_plugin_rewrite_resource, GS_TYPE_PLUG
 static void
 gs_plugin_rewrite_resource_init (GsPluginRewriteResource *self)
 {
-	/* let appstream add metadata first */
+	/* let appstream and flatpak add metadata first */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "appstream");
+	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "flatpak");
 }
 
 static void
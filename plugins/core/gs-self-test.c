@@ -9,6 +9,7 @@
 #include "config.h"
 
 #include <glib/gstdio.h>
+#include <libsoup/soup.h>
 
 #include "gnome-software-private.h"
 
@@ -187,6 +188,229 @@ gs_plugins_core_generic_updates_func (GsPluginLoader *plugin_loader)
 	}
 }
 
+/* A minimal HTTP server, run in its own thread, which serves the same PNG
+ * icon at every path after a short delay, and counts how many requests it
+ * has in flight at once. */
+typedef struct {
+	GMainContext *context;  /* (owned) */
+	GMainLoop *loop;  /* (owned) */
+	GThread *thread;  /* (owned) */
+	SoupServer *soup_server;  /* (owned) */
+	guint port;
+	GBytes *icon_png;  /* (owned) */
+
+	/* only accessed from @thread while it’s running */
+	guint n_requests;
+	guint n_in_flight;
+	guint max_in_flight;
+} IconServer;
+
+typedef struct {
+	IconServer *server;  /* (unowned) */
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	SoupServerMessage *msg;  /* (owned) */
+#else
+	SoupMessage *msg;  /* (owned) */
+#endif
+} IconServerResponse;
+
+static void
+icon_server_response_free (IconServerResponse *response)
+{
+	g_object_unref (response->msg);
+	g_free (response);
+}
+
+static gboolean
+icon_server_respond_cb (gpointer user_data)
+{
+	IconServerResponse *response = user_data;
+	IconServer *server = response->server;
+	gsize icon_png_size;
+	const guint8 *icon_png_data = g_bytes_get_data (server->icon_png, &icon_png_size);
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	soup_server_message_set_status (response->msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (response->msg, "image/png", SOUP_MEMORY_COPY,
+					  (const gchar *) icon_png_data, icon_png_size);
+#if SOUP_CHECK_VERSION(3, 2, 0)
+	soup_server_message_unpause (response->msg);
+#else
+	soup_server_unpause_message (server->soup_server, response->msg);
+#endif
+#else
+	soup_message_set_status (response->msg, SOUP_STATUS_OK);
+	soup_message_set_response (response->msg, "image/png", SOUP_MEMORY_COPY,
+				   (const gchar *) icon_png_data, icon_png_size);
+	soup_server_unpause_message (server->soup_server, response->msg);
+#endif
+
+	server->n_in_flight--;
+
+	return G_SOURCE_REMOVE;
+}
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+icon_server_handler_cb (SoupServer        *soup_server,
+                        SoupServerMessage *msg,
+                        const char        *path,
+                        GHashTable        *query,
+                        gpointer           user_data)
+#else
+static void
+icon_server_handler_cb (SoupServer        *soup_server,
+                        SoupMessage       *msg,
+                        const char        *path,
+                        GHashTable        *query,
+                        SoupClientContext *client,
+                        gpointer           user_data)
+#endif
+{
+	IconServer *server = user_data;
+	IconServerResponse *response;
+	g_autoptr(GSource) source = NULL;
+
+	server->n_requests++;
+	server->n_in_flight++;
+	server->max_in_flight = MAX (server->max_in_flight, server->n_in_flight);
+
+	/* Delay the response so that concurrent requests overlap. */
+#if SOUP_CHECK_VERSION(3, 2, 0)
+	soup_server_message_pause (msg);
+#else
+	soup_server_pause_message (soup_server, msg);
+#endif
+
+	response = g_new0 (IconServerResponse, 1);
+	response->server = server;
+	response->msg = g_object_ref (msg);
+
+	source = g_timeout_source_new (50);
+	g_source_set_callback (source, icon_server_respond_cb, response, (GDestroyNotify) icon_server_response_free);
+	g_source_attach (source, server->context);
+}
+
+static gpointer
+icon_server_thread_cb (gpointer user_data)
+{
+	IconServer *server = user_data;
+	g_autoptr(GMainContextPusher) pusher = g_main_context_pusher_new (server->context);
+
+	g_main_loop_run (server->loop);
+
+	return NULL;
+}
+
+static void
+icon_server_start (IconServer *server)
+{
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	gchar *icon_png_data = NULL;
+	gsize icon_png_size = 0;
+	GSList *uris;
+	g_autoptr(GError) error = NULL;
+
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 64, 64);
+	gdk_pixbuf_fill (pixbuf, 0xff0000ff);
+	gdk_pixbuf_save_to_buffer (pixbuf, &icon_png_data, &icon_png_size, "png", &error, NULL);
+	g_assert_no_error (error);
+	server->icon_png = g_bytes_new_take (icon_png_data, icon_png_size);
+
+	/* The server attaches to the thread-default main context. */
+	server->context = g_main_context_new ();
+	server->loop = g_main_loop_new (server->context, FALSE);
+
+	g_main_context_push_thread_default (server->context);
+
+	server->soup_server = soup_server_new (NULL, NULL);
+	soup_server_add_handler (server->soup_server, NULL, icon_server_handler_cb, server, NULL);
+	soup_server_listen_local (server->soup_server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+	g_assert_no_error (error);
+
+	uris = soup_server_get_uris (server->soup_server);
+	g_assert_nonnull (uris);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	server->port = g_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+	server->port = soup_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+
+	g_main_context_pop_thread_default (server->context);
+
+	server->thread = g_thread_new ("icon-server", icon_server_thread_cb, server);
+}
+
+static void
+icon_server_stop (IconServer *server)
+{
+	g_main_loop_quit (server->loop);
+	g_thread_join (g_steal_pointer (&server->thread));
+
+	g_main_context_push_thread_default (server->context);
+	soup_server_disconnect (server->soup_server);
+	g_clear_object (&server->soup_server);
+	g_main_context_pop_thread_default (server->context);
+
+	g_clear_pointer (&server->loop, g_main_loop_unref);
+	g_clear_pointer (&server->context, g_main_context_unref);
+	g_clear_pointer (&server->icon_png, g_bytes_unref);
+}
+
+static void
+gs_plugins_core_icons_download_func (GsPluginLoader *plugin_loader)
+{
+	const guint n_apps = 20;
+	IconServer server = { NULL, };
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+
+	/* drop all caches */
+	gs_utils_rmtree (g_getenv ("GS_SELF_TEST_CACHEDIR"), NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	icon_server_start (&server);
+
+	/* create a list of apps, each with an uncached remote icon */
+	list = gs_app_list_new ();
+	for (guint i = 0; i < n_apps; i++) {
+		g_autofree gchar *id = g_strdup_printf ("icons-test-%u.desktop", i);
+		g_autofree gchar *uri = g_strdup_printf ("http://127.0.0.1:%u/icon-%u.png", server.port, i);
+		g_autoptr(GsApp) app = gs_app_new (id);
+		g_autoptr(GIcon) icon = gs_remote_icon_new (uri);
+
+		gs_app_add_icon (app, icon);
+		gs_app_list_add (list, app);
+	}
+
+	plugin_job = gs_plugin_job_refine_new (list, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+	ret = gs_plugin_loader_job_action (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	icon_server_stop (&server);
+
+	/* every icon was downloaded once, several at a time, but never more
+	 * than the per-host limit in the icons plugin */
+	g_assert_cmpuint (server.n_requests, ==, n_apps);
+	g_assert_cmpuint (server.max_in_flight, >, 1);
+	g_assert_cmpuint (server.max_in_flight, <=, 4);
+
+	/* and they’re all in the cache */
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		GIcon *icon = g_ptr_array_index (gs_app_get_icons (app), 0);
+
+		g_assert_true (g_file_query_exists (g_file_icon_get_file (G_FILE_ICON (icon)), NULL));
+		g_assert_cmpuint (GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (icon), "width")), ==, 64);
+	}
+}
+
 int
 main (int argc, char **argv)
 {
@@ -262,6 +486,9 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/core/generic-updates",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_core_generic_updates_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/icons-download",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_icons_download_func);
 	retval = g_test_run ();
 
 	/* Clean up. */
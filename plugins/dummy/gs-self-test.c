@@ -444,6 +444,50 @@ gs_plugins_dummy_search_func (GsPluginLoader *plugin_loader)
 	g_assert_cmpint (gs_app_get_kind (app), ==, AS_COMPONENT_KIND_DESKTOP_APP);
 }
 
+static void
+gs_plugins_dummy_search_partial_results_cb (GsPluginJob *plugin_job,
+					    GsAppList *list,
+					    gpointer user_data)
+{
+	guint *n_emitted = user_data;
+
+	/* partial results are refined and filtered like the final ones */
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		g_assert_cmpstr (gs_app_get_id (app), ==, "zeus.desktop");
+	}
+	(*n_emitted)++;
+}
+
+static void
+gs_plugins_dummy_search_partial_func (GsPluginLoader *plugin_loader)
+{
+	guint n_emitted = 0;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+
+	plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_SEARCH,
+					 "search", "zeus",
+					 "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+					 "partial-results", TRUE,
+					 NULL);
+	g_signal_connect (plugin_job, "partial-results",
+			  G_CALLBACK (gs_plugins_dummy_search_partial_results_cb),
+			  &n_emitted);
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+
+	/* the final results are unchanged */
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list, 0)), ==, "zeus.desktop");
+
+	/* dummy is not the last plugin to run, so its results were streamed */
+	g_assert_cmpuint (n_emitted, >, 0);
+}
+
 static void
 gs_plugins_dummy_search_alternate_func (GsPluginLoader *plugin_loader)
 {
@@ -852,6 +896,9 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/dummy/search",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_dummy_search_func);
+	g_test_add_data_func ("/gnome-software/plugins/dummy/search{partial}",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_dummy_search_partial_func);
 	g_test_add_data_func ("/gnome-software/plugins/dummy/search-alternate",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_dummy_search_alternate_func);
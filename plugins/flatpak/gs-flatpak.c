@@ -37,13 +37,23 @@
 #include "gs-flatpak.h"
 #include "gs-flatpak-utils.h"
 
+/* An immutable snapshot of the installed refs, indexed by their formatted
+ * ref (`kind/name/arch/branch`). Snapshots are never modified once published,
+ * so any number of threads can use one without locking. */
+typedef struct {
+	GPtrArray	*refs;  /* (element-type FlatpakInstalledRef) (owned) */
+	GHashTable	*by_ref;  /* (element-type utf8 FlatpakInstalledRef) (owned) */
+} GsFlatpakInstalledRefs;
+
 struct _GsFlatpak {
 	GObject			 parent_instance;
 	GsFlatpakFlags		 flags;
 	FlatpakInstallation	*installation_noninteractive;  /* (owned) */
 	FlatpakInstallation	*installation_interactive;  /* (owned) */
-	GPtrArray		*installed_refs;  /* must be entirely replaced rather than updated internally */
-	GMutex			 installed_refs_mutex;
+	GsFlatpakInstalledRefs	*installed_refs;  /* (atomic) (owned) (nullable); see gs_flatpak_get_installed_refs() */
+	gint			 installed_refs_readers;  /* (atomic) */
+	gint			 installed_refs_generation;  /* (atomic) */
+	GMutex			 installed_refs_mutex;  /* serialises rebuilding installed_refs */
 	GHashTable		*broken_remotes;
 	GMutex			 broken_remotes_mutex;
 	GFileMonitor		*monitor;
@@ -447,6 +457,176 @@ gs_flatpak_create_source (GsFlatpak *self, FlatpakRemote *xremote)
 	return g_steal_pointer (&app);
 }
 
+static void
+gs_flatpak_installed_refs_clear (GsFlatpakInstalledRefs *installed_refs)
+{
+	g_hash_table_unref (installed_refs->by_ref);
+	g_ptr_array_unref (installed_refs->refs);
+}
+
+static void
+gs_flatpak_installed_refs_unref (GsFlatpakInstalledRefs *installed_refs)
+{
+	g_atomic_rc_box_release_full (installed_refs, (GDestroyNotify) gs_flatpak_installed_refs_clear);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsFlatpakInstalledRefs, gs_flatpak_installed_refs_unref)
+
+static GsFlatpakInstalledRefs *
+gs_flatpak_installed_refs_new (FlatpakInstallation *installation,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	GsFlatpakInstalledRefs *installed_refs;
+	g_autoptr(GPtrArray) refs = NULL;
+
+	refs = flatpak_installation_list_installed_refs (installation, cancellable, error);
+	if (refs == NULL) {
+		gs_flatpak_error_convert (error);
+		return NULL;
+	}
+
+	installed_refs = g_atomic_rc_box_new0 (GsFlatpakInstalledRefs);
+	installed_refs->refs = g_steal_pointer (&refs);
+	installed_refs->by_ref = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (guint i = 0; i < installed_refs->refs->len; i++) {
+		FlatpakRef *xref = g_ptr_array_index (installed_refs->refs, i);
+		g_hash_table_insert (installed_refs->by_ref, flatpak_ref_format_ref (xref), xref);
+	}
+
+	return installed_refs;
+}
+
+/* returns (transfer none) (nullable) */
+static FlatpakInstalledRef *
+gs_flatpak_installed_refs_lookup (GsFlatpakInstalledRefs *installed_refs,
+				  const gchar *ref)
+{
+	return g_hash_table_lookup (installed_refs->by_ref, ref);
+}
+
+/* Returns a new reference to the published snapshot, or %NULL if there is
+ * none. This is the read side of an RCU scheme: it never blocks, it only
+ * advertises itself in installed_refs_readers for the few instructions
+ * between loading the pointer and taking a reference, so that
+ * gs_flatpak_installed_refs_retire() knows when nobody can still be about to
+ * take a reference to an unpublished snapshot. */
+static GsFlatpakInstalledRefs *
+gs_flatpak_installed_refs_acquire (GsFlatpak *self)
+{
+	GsFlatpakInstalledRefs *installed_refs;
+
+	g_atomic_int_inc (&self->installed_refs_readers);
+	installed_refs = g_atomic_pointer_get (&self->installed_refs);
+	if (installed_refs != NULL)
+		g_atomic_rc_box_acquire (installed_refs);
+	g_atomic_int_add (&self->installed_refs_readers, -1);
+
+	return installed_refs;
+}
+
+/* Drops the published reference to a snapshot which has just been
+ * unpublished, once no reader can still be holding the old pointer without
+ * having taken a reference. Readers which already have a reference keep the
+ * snapshot alive for as long as they need it. */
+static void
+gs_flatpak_installed_refs_retire (GsFlatpak *self,
+				  GsFlatpakInstalledRefs *installed_refs)
+{
+	if (installed_refs == NULL)
+		return;
+
+	while (g_atomic_int_get (&self->installed_refs_readers) > 0)
+		g_thread_yield ();
+
+	gs_flatpak_installed_refs_unref (installed_refs);
+}
+
+/* Unpublishes the current snapshot, so the next reader builds a new one.
+ * Safe to call from any thread. */
+static void
+gs_flatpak_invalidate_installed_refs (GsFlatpak *self)
+{
+	/* bump the generation first, so a rebuild which is in progress can
+	 * tell that what it listed may already be out of date */
+	GsFlatpakInstalledRefs *installed_refs;
+
+	g_atomic_int_inc (&self->installed_refs_generation);
+	do {
+		installed_refs = g_atomic_pointer_get (&self->installed_refs);
+	} while (!g_atomic_pointer_compare_and_exchange (&self->installed_refs, installed_refs, NULL));
+	gs_flatpak_installed_refs_retire (self, installed_refs);
+}
+
+/* Returns (transfer full) a snapshot of the installed refs, building and
+ * publishing a new one if there isn’t one already. Only rebuilding takes
+ * installed_refs_mutex; readers of an existing snapshot take no locks. */
+static GsFlatpakInstalledRefs *
+gs_flatpak_get_installed_refs (GsFlatpak *self,
+			       gboolean interactive,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	g_autoptr(GsFlatpakInstalledRefs) installed_refs = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	gint generation;
+
+	installed_refs = gs_flatpak_installed_refs_acquire (self);
+	if (installed_refs != NULL)
+		return g_steal_pointer (&installed_refs);
+
+	/* someone else may have rebuilt it while we waited */
+	locker = g_mutex_locker_new (&self->installed_refs_mutex);
+	installed_refs = gs_flatpak_installed_refs_acquire (self);
+	if (installed_refs != NULL)
+		return g_steal_pointer (&installed_refs);
+
+	generation = g_atomic_int_get (&self->installed_refs_generation);
+	installed_refs = gs_flatpak_installed_refs_new (gs_flatpak_get_installation (self, interactive),
+							cancellable, error);
+	if (installed_refs == NULL)
+		return NULL;
+
+	/* publish it, unless the installation changed while it was being
+	 * listed; the caller can still use it, as if it had raced with the
+	 * change. Only one thread can be here at once, and invalidating only
+	 * ever sets installed_refs to %NULL, so it is still %NULL. */
+	g_atomic_pointer_set (&self->installed_refs, g_atomic_rc_box_acquire (installed_refs));
+	if (g_atomic_int_get (&self->installed_refs_generation) != generation &&
+	    g_atomic_pointer_compare_and_exchange (&self->installed_refs, installed_refs, NULL))
+		gs_flatpak_installed_refs_retire (self, installed_refs);
+
+	return g_steal_pointer (&installed_refs);
+}
+
+static void
+gs_flatpak_rebuild_installed_refs_thread_cb (GTask *task,
+					     gpointer source_object,
+					     gpointer task_data,
+					     GCancellable *cancellable)
+{
+	GsFlatpak *self = GS_FLATPAK (source_object);
+	g_autoptr(GsFlatpakInstalledRefs) installed_refs = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	installed_refs = gs_flatpak_get_installed_refs (self, FALSE, cancellable, &error_local);
+	if (installed_refs == NULL)
+		g_debug ("failed to rebuild installed refs for %s: %s",
+			 gs_flatpak_get_id (self), error_local->message);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+/* Rebuilds the snapshot in a thread, so the refine which follows a change
+ * doesn’t have to wait for it. */
+static void
+gs_flatpak_rebuild_installed_refs_in_background (GsFlatpak *self)
+{
+	g_autoptr(GTask) task = g_task_new (self, NULL, NULL, NULL);
+	g_task_set_source_tag (task, gs_flatpak_rebuild_installed_refs_in_background);
+	g_task_run_in_thread (task, gs_flatpak_rebuild_installed_refs_thread_cb);
+}
+
 static gboolean
 gs_flatpak_claim_changed_idle_cb (gpointer user_data)
 {
@@ -471,10 +651,13 @@ gs_plugin_flatpak_changed_cb (GFileMonitor *monitor,
 	g_autoptr(GMutexLocker) locker = NULL;
 	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
 
-	/* drop the installed refs cache */
-	locker = g_mutex_locker_new (&self->installed_refs_mutex);
-	g_clear_pointer (&self->installed_refs, g_ptr_array_unref);
-	g_clear_pointer (&locker, g_mutex_locker_free);
+	/* stop refine results being cached until the next refine works out
+	 * the new stamp */
+	gs_plugin_set_refine_cache_stamp (self->plugin, NULL);
+
+	/* replace the installed refs snapshot */
+	gs_flatpak_invalidate_installed_refs (self);
+	gs_flatpak_rebuild_installed_refs_in_background (self);
 
 	/* drop the remote title cache */
 	locker = g_mutex_locker_new (&self->remote_title_mutex);
@@ -1534,33 +1717,19 @@ gs_flatpak_ref_to_app (GsFlatpak *self,
 		       GError **error)
 {
 	g_autoptr(GPtrArray) xremotes = NULL;
+	g_autoptr(GsFlatpakInstalledRefs) installed_refs = NULL;
+	FlatpakInstalledRef *xref;
 	FlatpakInstallation *installation = gs_flatpak_get_installation (self, interactive);
 
 	g_return_val_if_fail (ref != NULL, NULL);
 
-	g_mutex_lock (&self->installed_refs_mutex);
-
-	if (self->installed_refs == NULL) {
-		self->installed_refs = flatpak_installation_list_installed_refs (installation,
-								 cancellable, error);
-
-		if (self->installed_refs == NULL) {
-			g_mutex_unlock (&self->installed_refs_mutex);
-			gs_flatpak_error_convert (error);
-			return NULL;
-		}
-	}
-
-	for (guint i = 0; i < self->installed_refs->len; i++) {
-		g_autoptr(FlatpakInstalledRef) xref = g_object_ref (g_ptr_array_index (self->installed_refs, i));
-		g_autofree gchar *ref_tmp = flatpak_ref_format_ref (FLATPAK_REF (xref));
-		if (g_strcmp0 (ref, ref_tmp) == 0) {
-			g_mutex_unlock (&self->installed_refs_mutex);
-			return gs_flatpak_create_installed (self, xref, NULL, interactive, cancellable);
-		}
-	}
+	installed_refs = gs_flatpak_get_installed_refs (self, interactive, cancellable, error);
+	if (installed_refs == NULL)
+		return NULL;
 
-	g_mutex_unlock (&self->installed_refs_mutex);
+	xref = gs_flatpak_installed_refs_lookup (installed_refs, ref);
+	if (xref != NULL)
+		return gs_flatpak_create_installed (self, xref, NULL, interactive, cancellable);
 
 	/* look at each remote xref */
 	xremotes = flatpak_installation_list_remotes (installation,
@@ -1960,10 +2129,8 @@ gs_flatpak_refresh (GsFlatpak *self,
 		return FALSE;
 	}
 
-	/* drop the installed refs cache */
-	g_mutex_lock (&self->installed_refs_mutex);
-	g_clear_pointer (&self->installed_refs, g_ptr_array_unref);
-	g_mutex_unlock (&self->installed_refs_mutex);
+	/* drop the installed refs snapshot */
+	gs_flatpak_invalidate_installed_refs (self);
 
 	/* manually do this in case we created the first appstream file */
 	g_rw_lock_reader_lock (&self->silo_lock);
@@ -2173,7 +2340,7 @@ gs_flatpak_refine_app_state_unlocked (GsFlatpak *self,
                                       GError **error)
 {
 	g_autoptr(FlatpakInstalledRef) ref = NULL;
-	g_autoptr(GPtrArray) installed_refs = NULL;
+	g_autoptr(GsFlatpakInstalledRefs) installed_refs = NULL;
 	FlatpakInstallation *installation = gs_flatpak_get_installation (self, interactive);
 
 	/* already found */
@@ -2189,36 +2356,33 @@ gs_flatpak_refine_app_state_unlocked (GsFlatpak *self,
 		return FALSE;
 
 	/* find the app using the origin and the ID */
-	g_mutex_lock (&self->installed_refs_mutex);
+	installed_refs = gs_flatpak_get_installed_refs (self, interactive, cancellable, error);
+	if (installed_refs == NULL)
+		return FALSE;
 
-	if (self->installed_refs == NULL) {
-		self->installed_refs = flatpak_installation_list_installed_refs (installation,
-								 cancellable, error);
+	if (gs_flatpak_app_get_ref_name (app) != NULL &&
+	    gs_flatpak_app_get_ref_arch (app) != NULL &&
+	    gs_app_get_branch (app) != NULL) {
+		const gchar *kinds[] = { "app", "runtime", NULL };
 
-		if (self->installed_refs == NULL) {
-			g_mutex_unlock (&self->installed_refs_mutex);
-			gs_flatpak_error_convert (error);
-			return FALSE;
+		/* the kind isn’t always known yet, so try both */
+		if (gs_flatpak_app_get_ref_kind_as_str (app) != NULL) {
+			kinds[0] = gs_flatpak_app_get_ref_kind_as_str (app);
+			kinds[1] = NULL;
 		}
-	}
-
-	installed_refs = g_ptr_array_ref (self->installed_refs);
 
-	for (guint i = 0; i < installed_refs->len; i++) {
-		FlatpakInstalledRef *ref_tmp = g_ptr_array_index (installed_refs, i);
-		const gchar *origin = flatpak_installed_ref_get_origin (ref_tmp);
-		const gchar *name = flatpak_ref_get_name (FLATPAK_REF (ref_tmp));
-		const gchar *arch = flatpak_ref_get_arch (FLATPAK_REF (ref_tmp));
-		const gchar *branch = flatpak_ref_get_branch (FLATPAK_REF (ref_tmp));
-		if (g_strcmp0 (origin, gs_app_get_origin (app)) == 0 &&
-		    g_strcmp0 (name, gs_flatpak_app_get_ref_name (app)) == 0 &&
-		    g_strcmp0 (arch, gs_flatpak_app_get_ref_arch (app)) == 0 &&
-		    g_strcmp0 (branch, gs_app_get_branch (app)) == 0) {
-			ref = g_object_ref (ref_tmp);
-			break;
+		for (guint i = 0; ref == NULL && kinds[i] != NULL; i++) {
+			g_autofree gchar *ref_str = g_strdup_printf ("%s/%s/%s/%s",
+								     kinds[i],
+								     gs_flatpak_app_get_ref_name (app),
+								     gs_flatpak_app_get_ref_arch (app),
+								     gs_app_get_branch (app));
+			FlatpakInstalledRef *ref_tmp = gs_flatpak_installed_refs_lookup (installed_refs, ref_str);
+			if (ref_tmp != NULL &&
+			    g_strcmp0 (flatpak_installed_ref_get_origin (ref_tmp), gs_app_get_origin (app)) == 0)
+				ref = g_object_ref (ref_tmp);
 		}
 	}
-	g_mutex_unlock (&self->installed_refs_mutex);
 	if (ref != NULL) {
 		g_debug ("marking %s as installed with flatpak",
 			 gs_app_get_unique_id (app));
@@ -3909,6 +4073,7 @@ gs_flatpak_search (GsFlatpak *self,
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
 	g_autoptr(GMutexLocker) app_silo_locker = NULL;
 	g_autoptr(GPtrArray) silos_to_remove = g_ptr_array_new ();
+	g_autoptr(GsFlatpakInstalledRefs) installed_refs = NULL;
 	GHashTableIter iter;
 	gpointer key, value;
 
@@ -3926,31 +4091,19 @@ gs_flatpak_search (GsFlatpak *self,
 	gs_app_list_add_list (list, list_tmp);
 
 	/* Also search silos from installed apps which were missing from self->silo */
+	installed_refs = gs_flatpak_get_installed_refs (self, interactive, cancellable, error);
+	if (installed_refs == NULL)
+		return FALSE;
+
 	app_silo_locker = g_mutex_locker_new (&self->app_silos_mutex);
 	g_hash_table_iter_init (&iter, self->app_silos);
 	while (g_hash_table_iter_next (&iter, &key, &value)) {
 		g_autoptr(XbSilo) app_silo = g_object_ref (value);
 		g_autoptr(GsAppList) app_list_tmp = gs_app_list_new ();
 		const char *app_ref = (char *)key;
-		g_autoptr(FlatpakInstalledRef) installed_ref = NULL;
-		g_auto(GStrv) split = NULL;
-		FlatpakRefKind kind;
-
-		/* Ignore any silos of apps that have since been removed.
-		 * FIXME: can we use self->installed_refs here? */
-		split = g_strsplit (app_ref, "/", -1);
-		g_assert (g_strv_length (split) == 4);
-		if (g_strcmp0 (split[0], "app") == 0)
-			kind = FLATPAK_REF_KIND_APP;
-		else
-			kind = FLATPAK_REF_KIND_RUNTIME;
-		installed_ref = flatpak_installation_get_installed_ref (gs_flatpak_get_installation (self, interactive),
-									kind,
-									split[1],
-									split[2],
-									split[3],
-									NULL, NULL);
-		if (installed_ref == NULL) {
+
+		/* Ignore any silos of apps that have since been removed. */
+		if (gs_flatpak_installed_refs_lookup (installed_refs, app_ref) == NULL) {
 			g_ptr_array_add (silos_to_remove, (gpointer) app_ref);
 			continue;
 		}
@@ -4176,7 +4329,7 @@ gs_flatpak_finalize (GObject *object)
 	g_free (self->id);
 	g_object_unref (self->installation_noninteractive);
 	g_object_unref (self->installation_interactive);
-	g_clear_pointer (&self->installed_refs, g_ptr_array_unref);
+	g_clear_pointer (&self->installed_refs, gs_flatpak_installed_refs_unref);
 	g_mutex_clear (&self->installed_refs_mutex);
 	g_object_unref (self->plugin);
 	g_hash_table_unref (self->broken_remotes);
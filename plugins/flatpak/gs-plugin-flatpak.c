@@ -20,8 +20,11 @@
  * libflatpak API is entirely synchronous (and thread-safe). * Message passing
  * to the worker thread is by gs_worker_thread_queue().
  *
- * FIXME: It may speed things up in future to have one worker thread *per*
- * `FlatpakInstallation`, all operating in parallel.
+ * Operations which query every `FlatpakInstallation` (searching, refining
+ * wildcards, listing installed apps, updates and categories) are fanned out
+ * to run on all the installations in parallel by
+ * gs_plugin_flatpak_foreach_installation(), as each #GsFlatpak has its own
+ * silo and locks.
  */
 
 #include <config.h>
@@ -45,6 +48,7 @@ struct _GsPluginFlatpak
 	GsPlugin		 parent;
 
 	GsWorkerThread		*worker;  /* (owned) */
+	GThreadPool		*installation_pool;  /* (owned) */
 
 	GPtrArray		*installations;  /* (element-type GsFlatpak) (owned); may be NULL before setup or after shutdown */
 	gboolean		 has_system_helper;
@@ -70,6 +74,151 @@ G_DEFINE_TYPE (GsPluginFlatpak, gs_plugin_flatpak, GS_TYPE_PLUGIN)
 	} G_STMT_END
 #endif  /* flatpak < 1.13.0 */
 
+/* Called on one installation by gs_plugin_flatpak_foreach_installation(),
+ * possibly in parallel with the others. @list is specific to @flatpak. */
+typedef gboolean (*GsPluginFlatpakInstallationFunc) (GsFlatpak     *flatpak,
+						     GsAppList     *list,
+						     gpointer       user_data,
+						     gboolean       interactive,
+						     GCancellable  *cancellable,
+						     GError       **error);
+
+typedef struct {
+	GsPluginFlatpakInstallationFunc func;
+	gpointer user_data;
+	gboolean interactive;
+	GCancellable *cancellable;  /* (owned) */
+
+	GMutex mutex;
+	GCond cond;
+	guint n_pending;  /* (lock mutex) */
+	GError *error;  /* (lock mutex) (owned) (nullable) */
+} ForeachInstallationData;
+
+typedef struct {
+	ForeachInstallationData *data;  /* (unowned) */
+	GsFlatpak *flatpak;  /* (unowned) */
+	GsAppList *list;  /* (unowned) */
+} ForeachInstallationItem;
+
+static void
+foreach_installation_run (ForeachInstallationItem *item)
+{
+	ForeachInstallationData *data = item->data;
+	g_autoptr(GError) local_error = NULL;
+	gboolean failed;
+
+	failed = !data->func (item->flatpak, item->list, data->user_data,
+			      data->interactive, data->cancellable, &local_error);
+
+	/* keep the first error, rather than the cancellation errors it then
+	 * causes in the other installations */
+	g_mutex_lock (&data->mutex);
+	if (local_error != NULL && data->error == NULL)
+		data->error = g_steal_pointer (&local_error);
+	g_mutex_unlock (&data->mutex);
+
+	/* the overall result is going to be an error, so stop the others */
+	if (failed)
+		g_cancellable_cancel (data->cancellable);
+
+	g_mutex_lock (&data->mutex);
+	data->n_pending--;
+	g_cond_signal (&data->cond);
+	g_mutex_unlock (&data->mutex);
+}
+
+static void
+foreach_installation_thread_cb (gpointer data,
+                                gpointer user_data)
+{
+	foreach_installation_run (data);
+}
+
+static void
+foreach_installation_cancelled_cb (GCancellable *cancellable,
+                                   GCancellable *child_cancellable)
+{
+	g_cancellable_cancel (child_cancellable);
+}
+
+/* Calls @func on each installation in parallel and waits for them all to
+ * finish. The apps they add are merged into @list in installation order, so
+ * the results don’t depend on which finished first. If any of them fail, the
+ * others are cancelled and the first error is returned. */
+static gboolean
+gs_plugin_flatpak_foreach_installation (GsPluginFlatpak                 *self,
+                                        GsPluginFlatpakInstallationFunc  func,
+                                        gpointer                         user_data,
+                                        GsAppList                       *list,
+                                        gboolean                         interactive,
+                                        GCancellable                    *cancellable,
+                                        GError                         **error)
+{
+	ForeachInstallationData data = { 0, };
+	g_autofree ForeachInstallationItem *items = NULL;
+	g_autoptr(GPtrArray) lists = NULL;
+	guint n_installations = self->installations->len;
+	gulong cancelled_id = 0;
+
+	/* the common case needs no threads */
+	if (n_installations == 0)
+		return TRUE;
+	if (n_installations == 1) {
+		return func (g_ptr_array_index (self->installations, 0), list, user_data,
+			     interactive, cancellable, error);
+	}
+
+	data.func = func;
+	data.user_data = user_data;
+	data.interactive = interactive;
+	data.cancellable = g_cancellable_new ();
+	data.n_pending = n_installations;
+	g_mutex_init (&data.mutex);
+	g_cond_init (&data.cond);
+	if (cancellable != NULL) {
+		cancelled_id = g_cancellable_connect (cancellable,
+						      G_CALLBACK (foreach_installation_cancelled_cb),
+						      data.cancellable, NULL);
+	}
+
+	items = g_new0 (ForeachInstallationItem, n_installations);
+	lists = g_ptr_array_new_full (n_installations, g_object_unref);
+	for (guint i = 0; i < n_installations; i++) {
+		items[i].data = &data;
+		items[i].flatpak = g_ptr_array_index (self->installations, i);
+		items[i].list = gs_app_list_new ();
+		g_ptr_array_add (lists, items[i].list);
+	}
+
+	/* run the first installation in this thread while the pool runs the
+	 * others */
+	for (guint i = 1; i < n_installations; i++)
+		g_thread_pool_push (self->installation_pool, &items[i], NULL);
+	foreach_installation_run (&items[0]);
+
+	g_mutex_lock (&data.mutex);
+	while (data.n_pending > 0)
+		g_cond_wait (&data.cond, &data.mutex);
+	g_mutex_unlock (&data.mutex);
+
+	if (cancellable != NULL)
+		g_cancellable_disconnect (cancellable, cancelled_id);
+	g_clear_object (&data.cancellable);
+	g_cond_clear (&data.cond);
+	g_mutex_clear (&data.mutex);
+
+	if (data.error != NULL) {
+		g_propagate_error (error, data.error);
+		return FALSE;
+	}
+
+	for (guint i = 0; list != NULL && i < lists->len; i++)
+		gs_app_list_add_list (list, g_ptr_array_index (lists, i));
+
+	return TRUE;
+}
+
 static void
 gs_plugin_flatpak_dispose (GObject *object)
 {
@@ -77,6 +226,10 @@ gs_plugin_flatpak_dispose (GObject *object)
 
 	g_clear_pointer (&self->installations, g_ptr_array_unref);
 	g_clear_object (&self->worker);
+	if (self->installation_pool != NULL) {
+		g_thread_pool_free (self->installation_pool, FALSE, TRUE);
+		self->installation_pool = NULL;
+	}
 
 	G_OBJECT_CLASS (gs_plugin_flatpak_parent_class)->dispose (object);
 }
@@ -87,6 +240,8 @@ gs_plugin_flatpak_init (GsPluginFlatpak *self)
 	GsPlugin *plugin = GS_PLUGIN (self);
 
 	self->installations = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	self->installation_pool = g_thread_pool_new (foreach_installation_thread_cb, NULL,
+						     -1, FALSE, NULL);
 
 	/* getting app properties from appstream is quicker */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_RUN_AFTER, "appstream");
@@ -121,6 +276,40 @@ gs_plugin_adopt_app (GsPlugin *plugin, GsApp *app)
 		gs_app_set_management_plugin (app, plugin);
 }
 
+/* Flatpak touches the .changed file in an installation whenever it deploys,
+ * removes or updates anything in it (including appstream data), so its
+ * modification time is a good stamp for the refine cache. The stamp is
+ * cleared by gs_plugin_flatpak_changed_cb(), and set again on the next
+ * refine. */
+static void
+update_refine_cache_stamp (GsPluginFlatpak *self)
+{
+	g_autoptr(GString) stamp = g_string_new (NULL);
+
+	for (guint i = 0; i < self->installations->len; i++) {
+		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
+		FlatpakInstallation *installation = gs_flatpak_get_installation (flatpak, FALSE);
+		g_autoptr(GFile) path = flatpak_installation_get_path (installation);
+		g_autoptr(GFile) changed_file = g_file_get_child (path, ".changed");
+		g_autoptr(GFileInfo) info = NULL;
+		guint64 mtime = 0;
+		guint32 mtime_usec = 0;
+
+		info = g_file_query_info (changed_file,
+					  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+					  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+					  G_FILE_QUERY_INFO_NONE, NULL, NULL);
+		if (info != NULL) {
+			mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+			mtime_usec = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+		}
+		g_string_append_printf (stamp, "%s:%" G_GUINT64_FORMAT ".%06u;",
+					gs_flatpak_get_id (flatpak), mtime, mtime_usec);
+	}
+
+	gs_plugin_set_refine_cache_stamp (GS_PLUGIN (self), stamp->str);
+}
+
 static gboolean
 gs_plugin_flatpak_add_installation (GsPluginFlatpak      *self,
                                     FlatpakInstallation  *installation,
@@ -295,6 +484,8 @@ setup_thread_cb (GTask        *task,
 		return;
 	}
 
+	update_refine_cache_stamp (self);
+
 	g_task_return_boolean (task, TRUE);
 }
 
@@ -382,6 +573,17 @@ gs_plugin_flatpak_list_installed_apps_async (GsPlugin                       *plu
 				list_installed_apps_thread_cb, g_steal_pointer (&task));
 }
 
+static gboolean
+add_installed_cb (GsFlatpak     *flatpak,
+                  GsAppList     *list,
+                  gpointer       user_data,
+                  gboolean       interactive,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+	return gs_flatpak_add_installed (flatpak, list, interactive, cancellable, error);
+}
+
 /* Run in @worker. */
 static void
 list_installed_apps_thread_cb (GTask        *task,
@@ -397,13 +599,10 @@ list_installed_apps_thread_cb (GTask        *task,
 
 	assert_in_worker (self);
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-
-		if (!gs_flatpak_add_installed (flatpak, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
+	if (!gs_plugin_flatpak_foreach_installation (self, add_installed_cb, NULL, list,
+						     interactive, cancellable, &local_error)) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
 	}
 
 	g_task_return_pointer (task, g_steal_pointer (&list), g_object_unref);
@@ -434,6 +633,17 @@ gs_plugin_add_sources (GsPlugin *plugin,
 	return TRUE;
 }
 
+static gboolean
+add_updates_cb (GsFlatpak     *flatpak,
+                GsAppList     *list,
+                gpointer       user_data,
+                gboolean       interactive,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+	return gs_flatpak_add_updates (flatpak, list, interactive, cancellable, error);
+}
+
 gboolean
 gs_plugin_add_updates (GsPlugin *plugin,
 		       GsAppList *list,
@@ -443,11 +653,9 @@ gs_plugin_add_updates (GsPlugin *plugin,
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (plugin);
 	gboolean interactive = gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE);
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-		if (!gs_flatpak_add_updates (flatpak, list, interactive, cancellable, error))
-			return FALSE;
-	}
+	if (!gs_plugin_flatpak_foreach_installation (self, add_updates_cb, NULL, list,
+						     interactive, cancellable, error))
+		return FALSE;
 	gs_plugin_cache_lookup_by_state (plugin, list, GS_APP_STATE_INSTALLING);
 	return TRUE;
 }
@@ -637,6 +845,31 @@ gs_plugin_flatpak_refine_async (GsPlugin            *plugin,
 				refine_thread_cb, g_steal_pointer (&task));
 }
 
+typedef struct {
+	GsAppList *wildcards;  /* (unowned) */
+	GsPluginRefineFlags flags;
+} RefineWildcardsData;
+
+static gboolean
+refine_wildcards_cb (GsFlatpak     *flatpak,
+                     GsAppList     *list,
+                     gpointer       user_data,
+                     gboolean       interactive,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+	RefineWildcardsData *data = user_data;
+
+	for (guint i = 0; i < gs_app_list_length (data->wildcards); i++) {
+		GsApp *app = gs_app_list_index (data->wildcards, i);
+		if (!gs_flatpak_refine_wildcard (flatpak, app, list, data->flags, interactive,
+						 cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /* Run in @worker. */
 static void
 refine_thread_cb (GTask        *task,
@@ -654,6 +887,8 @@ refine_thread_cb (GTask        *task,
 
 	assert_in_worker (self);
 
+	update_refine_cache_stamp (self);
+
 	for (guint i = 0; i < gs_app_list_length (list); i++) {
 		GsApp *app = gs_app_list_index (list, i);
 		if (!refine_app (self, app, flags, interactive, cancellable, &local_error)) {
@@ -664,26 +899,25 @@ refine_thread_cb (GTask        *task,
 
 	/* Refine wildcards.
 	 *
-	 * Use a copy of the list for the loop because a function called
+	 * Use a copy of the wildcards for the loop because a function called
 	 * on the plugin may affect the list which can lead to problems
 	 * (e.g. inserting an app in the list on every call results in
-	 * an infinite loop) */
-	app_list = gs_app_list_copy (list);
-
-	for (guint j = 0; j < gs_app_list_length (app_list); j++) {
-		GsApp *app = gs_app_list_index (app_list, j);
+	 * an infinite loop). Each installation adds its results to its own
+	 * list, and they are merged into @list once all have finished. */
+	app_list = gs_app_list_new ();
+	for (guint j = 0; j < gs_app_list_length (list); j++) {
+		GsApp *app = gs_app_list_index (list, j);
+		if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+			gs_app_list_add (app_list, app);
+	}
 
-		if (!gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
-			continue;
+	if (gs_app_list_length (app_list) > 0) {
+		RefineWildcardsData wildcards_data = { app_list, flags };
 
-		for (guint i = 0; i < self->installations->len; i++) {
-			GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-
-			if (!gs_flatpak_refine_wildcard (flatpak, app, list, flags, interactive,
-							 cancellable, &local_error)) {
-				g_task_return_error (task, g_steal_pointer (&local_error));
-				return;
-			}
+		if (!gs_plugin_flatpak_foreach_installation (self, refine_wildcards_cb, &wildcards_data,
+							     list, interactive, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
 		}
 	}
 
@@ -1779,6 +2013,19 @@ gs_plugin_file_to_app (GsPlugin *plugin,
 	return TRUE;
 }
 
+static gboolean
+search_cb (GsFlatpak     *flatpak,
+           GsAppList     *list,
+           gpointer       user_data,
+           gboolean       interactive,
+           GCancellable  *cancellable,
+           GError       **error)
+{
+	const gchar * const *values = user_data;
+
+	return gs_flatpak_search (flatpak, values, list, interactive, cancellable, error);
+}
+
 static gboolean
 gs_plugin_flatpak_do_search (GsPlugin *plugin,
 			     gchar **values,
@@ -1789,15 +2036,8 @@ gs_plugin_flatpak_do_search (GsPlugin *plugin,
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (plugin);
 	gboolean interactive = gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE);
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-		if (!gs_flatpak_search (flatpak, (const gchar * const *) values, list,
-					interactive, cancellable, error)) {
-			return FALSE;
-		}
-	}
-
-	return TRUE;
+	return gs_plugin_flatpak_foreach_installation (self, search_cb, values, list,
+						       interactive, cancellable, error);
 }
 
 gboolean
@@ -1820,6 +2060,21 @@ gs_plugin_add_search_what_provides (GsPlugin *plugin,
 	return gs_plugin_flatpak_do_search (plugin, search, list, cancellable, error);
 }
 
+/* gs_category_increment_size() is atomic, so the installations can all
+ * count into the same categories */
+static gboolean
+add_categories_cb (GsFlatpak     *flatpak,
+                   GsAppList     *list,
+                   gpointer       user_data,
+                   gboolean       interactive,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+	GPtrArray *categories = user_data;
+
+	return gs_flatpak_add_categories (flatpak, categories, interactive, cancellable, error);
+}
+
 gboolean
 gs_plugin_add_categories (GsPlugin *plugin,
 			  GPtrArray *list,
@@ -1829,12 +2084,21 @@ gs_plugin_add_categories (GsPlugin *plugin,
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (plugin);
 	gboolean interactive = gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE);
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-		if (!gs_flatpak_add_categories (flatpak, list, interactive, cancellable, error))
-			return FALSE;
-	}
-	return TRUE;
+	return gs_plugin_flatpak_foreach_installation (self, add_categories_cb, list, NULL,
+						       interactive, cancellable, error);
+}
+
+static gboolean
+add_category_apps_cb (GsFlatpak     *flatpak,
+                      GsAppList     *list,
+                      gpointer       user_data,
+                      gboolean       interactive,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+	GsCategory *category = user_data;
+
+	return gs_flatpak_add_category_apps (flatpak, category, list, interactive, cancellable, error);
 }
 
 gboolean
@@ -1847,18 +2111,8 @@ gs_plugin_add_category_apps (GsPlugin *plugin,
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (plugin);
 	gboolean interactive = gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE);
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-		if (!gs_flatpak_add_category_apps (flatpak,
-						   category,
-						   list,
-						   interactive,
-						   cancellable,
-						   error)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+	return gs_plugin_flatpak_foreach_installation (self, add_category_apps_cb, category, list,
+						       interactive, cancellable, error);
 }
 
 gboolean
@@ -0,0 +1,415 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/*
+ * SECTION:gs-packagekit-file-index
+ * @short_description: A persistent index of which installed package owns a file
+ *
+ * #GsPackagekitFileIndex remembers the results of asking PackageKit which
+ * installed package owns a file (such as a desktop file, metainfo file or
+ * `.repo` file), so the same question doesn’t have to go through the
+ * PackageKit daemon again, including after gnome-software is restarted.
+ *
+ * Each entry records the inode, modification time and status change time of
+ * the file when it was stored. Package managers set the modification time
+ * from the package, and inodes are reused, but the status change time is
+ * always set when a file is written. Installing, updating or removing a package replaces or deletes its
+ * files, so an entry whose file no longer matches is stale and is ignored by
+ * gs_packagekit_file_index_lookup(). gs_packagekit_file_index_prune() drops
+ * stale entries, and is called when PackageKit says the installed packages
+ * have changed.
+ *
+ * The index is saved to disk a few seconds after it is last changed, and
+ * when it is disposed. It is safe to use from multiple threads.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "gs-packagekit-file-index.h"
+
+/* Bump GS_PACKAGEKIT_FILE_INDEX_FORMAT whenever the meaning of the stored
+ * fields changes. The magic number catches an index written with a different
+ * byte order. */
+#define GS_PACKAGEKIT_FILE_INDEX_MAGIC		0x4b504946  /* FIPK */
+#define GS_PACKAGEKIT_FILE_INDEX_FORMAT		2
+/* package ID, summary, inode, modification and status change times in
+ * microseconds */
+#define GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE	"(ssttt)"
+#define GS_PACKAGEKIT_FILE_INDEX_TYPE		"(uua{s" GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE "})"
+
+/* seconds to wait after the last change before saving */
+#define GS_PACKAGEKIT_FILE_INDEX_SAVE_DELAY	5
+
+struct _GsPackagekitFileIndex
+{
+	GObject		 parent_instance;
+
+	gchar		*filename;  /* (owned) (not nullable) */
+	GMainContext	*context;  /* (owned) (not nullable) */
+
+	GMutex		 mutex;
+	GHashTable	*entries;  /* (mutex mutex) (owned) (element-type filename GVariant) */
+	gboolean	 dirty;  /* (mutex mutex) */
+	GSource		*save_source;  /* (mutex mutex) (owned) (nullable) */
+};
+
+G_DEFINE_TYPE (GsPackagekitFileIndex, gs_packagekit_file_index, G_TYPE_OBJECT)
+
+/* Gets the inode, modification time and status change time of @path, or
+ * returns %FALSE if it doesn’t exist. */
+static gboolean
+get_file_stamp (const gchar *path,
+                guint64     *inode_out,
+                guint64     *mtime_usec_out,
+                guint64     *ctime_usec_out)
+{
+	g_autoptr(GFile) file = g_file_new_for_path (path);
+	g_autoptr(GFileInfo) info = NULL;
+
+	info = g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_UNIX_INODE ","
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+				  G_FILE_ATTRIBUTE_TIME_CHANGED ","
+				  G_FILE_ATTRIBUTE_TIME_CHANGED_USEC,
+				  G_FILE_QUERY_INFO_NONE,
+				  NULL, NULL);
+	if (info == NULL)
+		return FALSE;
+
+	*inode_out = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+	*mtime_usec_out = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+			  g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+	*ctime_usec_out = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED) * G_USEC_PER_SEC +
+			  g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_CHANGED_USEC);
+
+	return TRUE;
+}
+
+static gboolean
+entry_is_current (const gchar *path,
+                  GVariant    *entry)
+{
+	guint64 inode, mtime_usec, ctime_usec;
+	guint64 entry_inode, entry_mtime_usec, entry_ctime_usec;
+
+	if (!get_file_stamp (path, &inode, &mtime_usec, &ctime_usec))
+		return FALSE;
+
+	g_variant_get (entry, "(&s&sttt)", NULL, NULL, &entry_inode, &entry_mtime_usec, &entry_ctime_usec);
+
+	return (inode == entry_inode &&
+		mtime_usec == entry_mtime_usec &&
+		ctime_usec == entry_ctime_usec);
+}
+
+static void
+gs_packagekit_file_index_load (GsPackagekitFileIndex *self)
+{
+	guint32 magic = 0;
+	guint32 format = 0;
+	GVariantIter iter;
+	const gchar *path;
+	GVariant *entry;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) entries = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	mapped_file = g_mapped_file_new (self->filename, FALSE, &error_local);
+	if (mapped_file == NULL) {
+		if (!g_error_matches (error_local, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("failed to load file index: %s", error_local->message);
+		return;
+	}
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (GS_PACKAGEKIT_FILE_INDEX_TYPE),
+							     bytes, FALSE));
+	g_variant_get (data, "(uu@a{s" GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE "})", &magic, &format, &entries);
+	if (magic != GS_PACKAGEKIT_FILE_INDEX_MAGIC || format != GS_PACKAGEKIT_FILE_INDEX_FORMAT) {
+		g_debug ("ignoring file index %s with an unknown format", self->filename);
+		return;
+	}
+
+	g_variant_iter_init (&iter, entries);
+	while (g_variant_iter_next (&iter, "{&s@" GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE "}", &path, &entry))
+		g_hash_table_insert (self->entries, g_strdup (path), entry);
+
+	g_debug ("loaded %u entries from file index", g_hash_table_size (self->entries));
+}
+
+/*
+ * gs_packagekit_file_index_save:
+ * @self: a #GsPackagekitFileIndex
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the index to disk now, if it has changed.
+ *
+ * This is done automatically shortly after the index changes.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+gs_packagekit_file_index_save (GsPackagekitFileIndex  *self,
+                               GError                **error)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{s" GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE "}"));
+	g_autoptr(GVariant) data = NULL;
+
+	g_return_val_if_fail (GS_IS_PACKAGEKIT_FILE_INDEX (self), FALSE);
+
+	{
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+		if (!self->dirty)
+			return TRUE;
+		self->dirty = FALSE;
+
+		g_hash_table_iter_init (&iter, self->entries);
+		while (g_hash_table_iter_next (&iter, &key, &value))
+			g_variant_builder_add (&builder, "{s@" GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE "}",
+					       (const gchar *) key, (GVariant *) value);
+	}
+
+	data = g_variant_ref_sink (g_variant_new ("(uu@a{s" GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE "})",
+						  GS_PACKAGEKIT_FILE_INDEX_MAGIC,
+						  GS_PACKAGEKIT_FILE_INDEX_FORMAT,
+						  g_variant_builder_end (&builder)));
+	return g_file_set_contents (self->filename,
+				    g_variant_get_data (data),
+				    g_variant_get_size (data),
+				    error);
+}
+
+static gboolean
+save_timeout_cb (gpointer user_data)
+{
+	GsPackagekitFileIndex *self = GS_PACKAGEKIT_FILE_INDEX (user_data);
+	g_autoptr(GError) error_local = NULL;
+
+	g_mutex_lock (&self->mutex);
+	g_clear_pointer (&self->save_source, g_source_unref);
+	g_mutex_unlock (&self->mutex);
+
+	if (!gs_packagekit_file_index_save (self, &error_local))
+		g_warning ("failed to save file index: %s", error_local->message);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* must be called with the mutex held */
+static void
+schedule_save_locked (GsPackagekitFileIndex *self)
+{
+	self->dirty = TRUE;
+	if (self->save_source != NULL)
+		return;
+
+	self->save_source = g_timeout_source_new_seconds (GS_PACKAGEKIT_FILE_INDEX_SAVE_DELAY);
+	g_source_set_name (self->save_source, "[gnome-software] packagekit file index save");
+	g_source_set_callback (self->save_source, save_timeout_cb, self, NULL);
+	g_source_attach (self->save_source, self->context);
+}
+
+/*
+ * gs_packagekit_file_index_lookup:
+ * @self: a #GsPackagekitFileIndex
+ * @path: (type filename): absolute path of an installed file
+ *
+ * Look up which installed package owns @path. Entries for files which have
+ * changed since they were stored are ignored.
+ *
+ * Returns: (transfer full) (nullable): the installed package which owns
+ *   @path, or %NULL if it’s not known
+ */
+PkPackage *
+gs_packagekit_file_index_lookup (GsPackagekitFileIndex *self,
+                                 const gchar           *path)
+{
+	const gchar *package_id;
+	const gchar *summary;
+	g_autoptr(GVariant) entry = NULL;
+	g_autoptr(PkPackage) package = NULL;
+
+	g_return_val_if_fail (GS_IS_PACKAGEKIT_FILE_INDEX (self), NULL);
+	g_return_val_if_fail (path != NULL, NULL);
+
+	{
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+		entry = g_hash_table_lookup (self->entries, path);
+		if (entry == NULL)
+			return NULL;
+		g_variant_ref (entry);
+	}
+
+	if (!entry_is_current (path, entry))
+		return NULL;
+
+	g_variant_get (entry, "(&s&sttt)", &package_id, &summary, NULL, NULL, NULL);
+
+	package = pk_package_new ();
+	if (!pk_package_set_id (package, package_id, NULL))
+		return NULL;
+	pk_package_set_info (package, PK_INFO_ENUM_INSTALLED);
+	g_object_set (package, "summary", summary, NULL);
+
+	return g_steal_pointer (&package);
+}
+
+/*
+ * gs_packagekit_file_index_store:
+ * @self: a #GsPackagekitFileIndex
+ * @path: (type filename): absolute path of an installed file
+ * @package: the installed package which owns @path
+ *
+ * Record that @package owns @path, as it is now. Nothing is stored if @path
+ * doesn’t exist.
+ */
+void
+gs_packagekit_file_index_store (GsPackagekitFileIndex *self,
+                                const gchar           *path,
+                                PkPackage             *package)
+{
+	guint64 inode, mtime_usec, ctime_usec;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_PACKAGEKIT_FILE_INDEX (self));
+	g_return_if_fail (path != NULL);
+	g_return_if_fail (PK_IS_PACKAGE (package));
+
+	if (!get_file_stamp (path, &inode, &mtime_usec, &ctime_usec))
+		return;
+
+	locker = g_mutex_locker_new (&self->mutex);
+	g_hash_table_insert (self->entries, g_strdup (path),
+			     g_variant_ref_sink (g_variant_new (GS_PACKAGEKIT_FILE_INDEX_ENTRY_TYPE,
+								pk_package_get_id (package),
+								(pk_package_get_summary (package) != NULL) ? pk_package_get_summary (package) : "",
+								inode,
+								mtime_usec,
+								ctime_usec)));
+	schedule_save_locked (self);
+}
+
+/*
+ * gs_packagekit_file_index_prune:
+ * @self: a #GsPackagekitFileIndex
+ *
+ * Drop the entries for files which have been changed or removed since they
+ * were stored, such as after packages have been updated or removed.
+ *
+ * Returns: the number of entries dropped
+ */
+guint
+gs_packagekit_file_index_prune (GsPackagekitFileIndex *self)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	guint n_pruned = 0;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (GS_IS_PACKAGEKIT_FILE_INDEX (self), 0);
+
+	locker = g_mutex_locker_new (&self->mutex);
+	g_hash_table_iter_init (&iter, self->entries);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		if (!entry_is_current (key, value)) {
+			g_hash_table_iter_remove (&iter);
+			n_pruned++;
+		}
+	}
+
+	if (n_pruned > 0) {
+		g_debug ("pruned %u stale entries from file index", n_pruned);
+		schedule_save_locked (self);
+	}
+
+	return n_pruned;
+}
+
+static void
+gs_packagekit_file_index_dispose (GObject *object)
+{
+	GsPackagekitFileIndex *self = GS_PACKAGEKIT_FILE_INDEX (object);
+	g_autoptr(GError) error_local = NULL;
+
+	if (self->save_source != NULL) {
+		g_source_destroy (self->save_source);
+		g_clear_pointer (&self->save_source, g_source_unref);
+	}
+
+	if (!gs_packagekit_file_index_save (self, &error_local))
+		g_warning ("failed to save file index: %s", error_local->message);
+
+	G_OBJECT_CLASS (gs_packagekit_file_index_parent_class)->dispose (object);
+}
+
+static void
+gs_packagekit_file_index_finalize (GObject *object)
+{
+	GsPackagekitFileIndex *self = GS_PACKAGEKIT_FILE_INDEX (object);
+
+	g_hash_table_unref (self->entries);
+	g_free (self->filename);
+	g_main_context_unref (self->context);
+	g_mutex_clear (&self->mutex);
+
+	G_OBJECT_CLASS (gs_packagekit_file_index_parent_class)->finalize (object);
+}
+
+static void
+gs_packagekit_file_index_class_init (GsPackagekitFileIndexClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->dispose = gs_packagekit_file_index_dispose;
+	object_class->finalize = gs_packagekit_file_index_finalize;
+}
+
+static void
+gs_packagekit_file_index_init (GsPackagekitFileIndex *self)
+{
+	g_mutex_init (&self->mutex);
+	self->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) g_variant_unref);
+	self->context = g_main_context_ref_thread_default ();
+}
+
+/*
+ * gs_packagekit_file_index_new:
+ * @filename: (type filename): path to the index file
+ *
+ * Create a new #GsPackagekitFileIndex, loading any entries previously saved
+ * to @filename. A missing or invalid file is treated as an empty index.
+ *
+ * The index is saved from the thread-default #GMainContext at the time of
+ * construction.
+ *
+ * Returns: (transfer full): a new #GsPackagekitFileIndex
+ */
+GsPackagekitFileIndex *
+gs_packagekit_file_index_new (const gchar *filename)
+{
+	GsPackagekitFileIndex *self;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	self = g_object_new (GS_TYPE_PACKAGEKIT_FILE_INDEX, NULL);
+	self->filename = g_strdup (filename);
+	gs_packagekit_file_index_load (self);
+
+	return self;
+}
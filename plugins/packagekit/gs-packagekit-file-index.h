@@ -0,0 +1,32 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include <packagekit-glib2/packagekit.h>
+
+G_BEGIN_DECLS
+
+#define GS_TYPE_PACKAGEKIT_FILE_INDEX (gs_packagekit_file_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsPackagekitFileIndex, gs_packagekit_file_index, GS, PACKAGEKIT_FILE_INDEX, GObject)
+
+GsPackagekitFileIndex	*gs_packagekit_file_index_new	(const gchar		*filename);
+
+PkPackage	*gs_packagekit_file_index_lookup	(GsPackagekitFileIndex	*self,
+							 const gchar		*path);
+void		 gs_packagekit_file_index_store		(GsPackagekitFileIndex	*self,
+							 const gchar		*path,
+							 PkPackage		*package);
+guint		 gs_packagekit_file_index_prune		(GsPackagekitFileIndex	*self);
+
+gboolean	 gs_packagekit_file_index_save		(GsPackagekitFileIndex	*self,
+							 GError			**error);
+
+G_END_DECLS
@@ -12,13 +12,16 @@
 #include <config.h>
 
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <gnome-software.h>
 #include <gsettings-desktop-schemas/gdesktop-enums.h>
 #include <packagekit-glib2/packagekit.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "packagekit-common.h"
 #include "gs-markdown.h"
+#include "gs-packagekit-file-index.h"
 #include "gs-packagekit-helper.h"
 #include "gs-packagekit-task.h"
 
@@ -35,7 +38,9 @@
  * Also supports doing a PackageKit UpdatePackages(ONLY_DOWNLOAD) method on
  * refresh and also converts any package files to applications the best we can.
  *
- * Also supports converting repo filenames to package-ids.
+ * Also supports converting repo filenames to package-ids. Which installed
+ * package owns a file is remembered in a #GsPackagekitFileIndex, so each
+ * file normally only has to be looked up in PackageKit once.
  *
  * Also supports marking previously downloaded packages as zero size, and allows
  * scheduling the offline update.
@@ -80,8 +85,7 @@ struct _GsPluginPackagekit {
 	PkTask			*task_refresh;
 	GMutex			 task_mutex_refresh;
 
-	PkClient		*client_refine_repos;
-	GMutex			 client_mutex_refine_repos;
+	GsPackagekitFileIndex	*file_index;  /* (owned) (nullable) */
 
 	GFileMonitor		*monitor;
 	GFileMonitor		*monitor_trigger;
@@ -189,13 +193,6 @@ gs_plugin_packagekit_init (GsPluginPackagekit *self)
 	pk_client_set_background (PK_CLIENT (self->task_refresh), TRUE);
 	pk_client_set_interactive (PK_CLIENT (self->task_refresh), gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE));
 
-	/* repos refine */
-	g_mutex_init (&self->client_mutex_refine_repos);
-	self->client_refine_repos = pk_client_new ();
-	pk_client_set_background (self->client_refine_repos, FALSE);
-	pk_client_set_cache_age (self->client_refine_repos, G_MAXUINT);
-	pk_client_set_interactive (self->client_refine_repos, gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE));
-
 	/* offline updates */
 	g_mutex_init (&self->prepared_updates_mutex);
 	self->prepared_updates = g_hash_table_new_full (g_str_hash, g_str_equal,
@@ -257,8 +254,8 @@ gs_plugin_packagekit_dispose (GObject *object)
 	/* refresh */
 	g_clear_object (&self->task_refresh);
 
-	/* refine repos */
-	g_clear_object (&self->client_refine_repos);
+	/* refine */
+	g_clear_object (&self->file_index);
 
 	/* offline updates */
 	g_clear_pointer (&self->prepared_updates, g_hash_table_unref);
@@ -279,7 +276,6 @@ gs_plugin_packagekit_finalize (GObject *object)
 	g_mutex_clear (&self->client_mutex_url_to_app);
 	g_mutex_clear (&self->task_mutex_upgrade);
 	g_mutex_clear (&self->task_mutex_refresh);
-	g_mutex_clear (&self->client_mutex_refine_repos);
 	g_mutex_clear (&self->prepared_updates_mutex);
 
 	G_OBJECT_CLASS (gs_plugin_packagekit_parent_class)->finalize (object);
@@ -956,9 +952,60 @@ gs_plugin_launch (GsPlugin *plugin,
 	return gs_plugin_app_launch (plugin, app, error);
 }
 
+/* PackageKit records every transaction which changes anything, including
+ * refreshing the metadata, in its transaction database, so its modification
+ * time stands in for the ID of the last transaction. The package databases
+ * are included too, to catch changes made without PackageKit. These are the
+ * database files themselves, as rewriting a file in place doesn’t touch its
+ * directory; pacman has no single database file, but adds and renames an
+ * entry in its local directory for each package installed or updated. */
+static const gchar *refine_cache_stamp_paths[] = {
+	"/var/lib/PackageKit/transactions.db",
+	"/var/lib/rpm/rpmdb.sqlite",
+	"/var/lib/rpm/Packages",
+	"/var/lib/rpm/Packages.db",
+	"/usr/lib/sysimage/rpm/rpmdb.sqlite",
+	"/usr/lib/sysimage/rpm/Packages",
+	"/usr/lib/sysimage/rpm/Packages.db",
+	"/var/lib/dpkg/status",
+	"/var/lib/pacman/local",
+};
+
+static void
+gs_plugin_packagekit_update_refine_cache_stamp (GsPluginPackagekit *self)
+{
+	g_autoptr(GString) stamp = g_string_new (NULL);
+
+	/* whole seconds are too coarse to tell apart two transactions in
+	 * quick succession, and a database which is replaced rather than
+	 * rewritten gets a new inode */
+	for (gsize i = 0; i < G_N_ELEMENTS (refine_cache_stamp_paths); i++) {
+		GStatBuf buf;
+
+		if (g_stat (refine_cache_stamp_paths[i], &buf) != 0)
+			continue;
+		g_string_append_printf (stamp, "%s:%" G_GUINT64_FORMAT ":%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT ".%09ld;",
+					refine_cache_stamp_paths[i],
+					(guint64) buf.st_ino,
+					(gint64) buf.st_size,
+					(gint64) buf.st_mtim.tv_sec,
+					(glong) buf.st_mtim.tv_nsec);
+	}
+
+	gs_plugin_set_refine_cache_stamp (GS_PLUGIN (self), stamp->str);
+}
+
 static void
 gs_plugin_packagekit_updates_changed_cb (PkControl *control, GsPlugin *plugin)
 {
+	GsPluginPackagekit *self = GS_PLUGIN_PACKAGEKIT (plugin);
+
+	gs_plugin_packagekit_update_refine_cache_stamp (self);
+
+	/* packages have been installed, updated or removed */
+	if (self->file_index != NULL)
+		gs_packagekit_file_index_prune (self->file_index);
+
 	gs_plugin_updates_changed (plugin);
 }
 
@@ -1367,17 +1414,23 @@ refine_task_complete_operation_with_error (GTask  *refine_task,
 	refine_task_complete_operation (refine_task);
 }
 
+/* All the file to package lookups for one refine, done as a single
+ * SearchFiles transaction. SearchFiles doesn’t say which file each package
+ * matched, so if there’s more than one file, the matching packages are then
+ * mapped back to the files with a single GetFiles transaction. */
 typedef struct {
 	GTask *refine_task;  /* (owned) (not nullable) */
-	GsApp *app;  /* (owned) (not nullable) */
-	gchar *filename;  /* (owned) (not nullable) */
+	GPtrArray *apps;  /* (element-type GsApp) (owned) (not nullable) */
+	GPtrArray *filenames;  /* (element-type utf8) (owned) (not nullable); same order as @apps */
+	GHashTable *packages;  /* (element-type utf8 PkPackage) (owned) (nullable); package ID ~> package */
 } SearchFilesData;
 
 static void
 search_files_data_free (SearchFilesData *data)
 {
-	g_free (data->filename);
-	g_clear_object (&data->app);
+	g_clear_pointer (&data->packages, g_hash_table_unref);
+	g_clear_pointer (&data->filenames, g_ptr_array_unref);
+	g_clear_pointer (&data->apps, g_ptr_array_unref);
 	g_clear_object (&data->refine_task);
 	g_free (data);
 }
@@ -1385,18 +1438,88 @@ search_files_data_free (SearchFilesData *data)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (SearchFilesData, search_files_data_free)
 
 static SearchFilesData *
-search_files_data_new_operation (GTask       *refine_task,
-                                 GsApp       *app,
-                                 const gchar *filename)
+search_files_data_new (void)
 {
 	g_autoptr(SearchFilesData) data = g_new0 (SearchFilesData, 1);
-	data->refine_task = refine_task_add_operation (refine_task);
-	data->app = g_object_ref (app);
-	data->filename = g_strdup (filename);
+	data->apps = g_ptr_array_new_with_free_func (g_object_unref);
+	data->filenames = g_ptr_array_new_with_free_func (g_free);
 
 	return g_steal_pointer (&data);
 }
 
+/* Sets the package for @app straight away if the file index knows which
+ * package owns @filename, otherwise queues it to be looked up. */
+static void
+search_files_data_add (SearchFilesData    *data,
+                       GsPluginPackagekit *self,
+                       GsApp              *app,
+                       const gchar        *filename)
+{
+	if (self->file_index != NULL) {
+		g_autoptr(PkPackage) package = gs_packagekit_file_index_lookup (self->file_index, filename);
+		if (package != NULL) {
+			gs_plugin_packagekit_set_metadata_from_package (GS_PLUGIN (self), app, package);
+			return;
+		}
+	}
+
+	g_ptr_array_add (data->apps, g_object_ref (app));
+	g_ptr_array_add (data->filenames, g_strdup (filename));
+}
+
+static void
+search_files_found_package (GsPluginPackagekit *self,
+                            GsApp              *app,
+                            const gchar        *filename,
+                            PkPackage          *package)
+{
+	gs_plugin_packagekit_set_metadata_from_package (GS_PLUGIN (self), app, package);
+	if (self->file_index != NULL)
+		gs_packagekit_file_index_store (self->file_index, filename, package);
+}
+
+/* Canonicalises @filename, so that two paths to the same file compare equal
+ * whichever symlinks they go through, including the /bin → /usr/bin ones of
+ * a merged /usr. */
+static gchar *
+search_files_canonicalize_filename (const gchar *filename)
+{
+	const gchar *merged_dirs[] = { "/bin/", "/sbin/", "/lib/", "/lib64/", NULL };
+	g_autofree gchar *canonical = g_canonicalize_filename (filename, "/");
+	char *resolved = realpath (canonical, NULL);
+
+	if (resolved != NULL) {
+		gchar *ret = g_strdup (resolved);
+		free (resolved);
+		return ret;
+	}
+
+	/* not on disk, so at least treat a merged /usr the same either way */
+	for (guint i = 0; merged_dirs[i] != NULL; i++) {
+		if (g_str_has_prefix (canonical, merged_dirs[i]))
+			return g_strconcat ("/usr", canonical, NULL);
+	}
+	return g_steal_pointer (&canonical);
+}
+
+/* Returns the unique filenames to search for, as a %NULL-terminated array
+ * of strings owned by @data. */
+static const gchar **
+search_files_data_get_values (SearchFilesData *data)
+{
+	g_autoptr(GHashTable) seen = g_hash_table_new (g_str_hash, g_str_equal);
+	g_autoptr(GPtrArray) values = g_ptr_array_new ();
+
+	for (guint i = 0; i < data->filenames->len; i++) {
+		const gchar *filename = g_ptr_array_index (data->filenames, i);
+		if (g_hash_table_add (seen, (gpointer) filename))
+			g_ptr_array_add (values, (gpointer) filename);
+	}
+	g_ptr_array_add (values, NULL);
+
+	return (const gchar **) g_ptr_array_free (g_steal_pointer (&values), FALSE);
+}
+
 static void upgrade_system_cb (GObject      *source_object,
                                GAsyncResult *result,
                                gpointer      user_data);
@@ -1406,6 +1529,9 @@ static void resolve_all_packages_with_filter_cb (GObject      *source_object,
 static void search_files_cb (GObject      *source_object,
                              GAsyncResult *result,
                              gpointer      user_data);
+static void search_files_get_files_cb (GObject      *source_object,
+                                       GAsyncResult *result,
+                                       gpointer      user_data);
 static void get_update_detail_cb (GObject      *source_object,
                                   GAsyncResult *result,
                                   gpointer      user_data);
@@ -1436,8 +1562,12 @@ gs_plugin_packagekit_refine_async (GsPlugin            *plugin,
 	g_autoptr(GTask) task = NULL;
 	g_autoptr(RefineData) data = NULL;
 	RefineData *data_unowned = NULL;
+	g_autoptr(SearchFilesData) search_files_data = search_files_data_new ();
 	g_autoptr(GError) local_error = NULL;
 
+	/* catch any changes made without PackageKit */
+	gs_plugin_packagekit_update_refine_cache_stamp (self);
+
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_packagekit_refine_async);
 	data_unowned = data = g_new0 (RefineData, 1);
@@ -1576,8 +1706,6 @@ gs_plugin_packagekit_refine_async (GsPlugin            *plugin,
 			g_autofree gchar *fn = NULL;
 			GsApp *app = gs_app_list_index (list, i);
 			const gchar *tmp;
-			const gchar *to_array[] = { NULL, NULL };
-			g_autoptr(GsPackagekitHelper) helper = NULL;
 
 			if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
 				continue;
@@ -1610,45 +1738,37 @@ gs_plugin_packagekit_refine_async (GsPlugin            *plugin,
 				continue;
 			}
 
-			helper = gs_packagekit_helper_new (plugin);
-			to_array[0] = fn;
-			gs_packagekit_helper_add_app (helper, app);
-			g_mutex_lock (&self->client_mutex_refine);
-			pk_client_set_interactive (self->client_refine, gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE));
-			pk_client_search_files_async (self->client_refine,
-						      pk_bitfield_from_enums (PK_FILTER_ENUM_INSTALLED, -1),
-						      (gchar **) to_array,
-						      cancellable,
-						      gs_packagekit_helper_cb, refine_task_add_progress_data (task, helper),
-						      search_files_cb,
-						      search_files_data_new_operation (task, app, fn));
-			g_mutex_unlock (&self->client_mutex_refine);
+			search_files_data_add (search_files_data, self, app, fn);
 		}
 	}
 
-	/* Refine repo package names */
+	/* set the source package name for an installed .repo file */
 	for (guint i = 0; i < gs_app_list_length (repos_list); i++) {
 		GsApp *app = gs_app_list_index (repos_list, i);
-		const gchar *filename;
-		const gchar *to_array[] = { NULL, NULL };
-		g_autoptr(GsPackagekitHelper) helper = NULL;
+		search_files_data_add (search_files_data, self, app,
+				       gs_app_get_metadata_item (app, "repos::repo-filename"));
+	}
 
-		filename = gs_app_get_metadata_item (app, "repos::repo-filename");
+	/* look up all the files in one go */
+	if (search_files_data->filenames->len > 0) {
+		g_autoptr(GsPackagekitHelper) helper = gs_packagekit_helper_new (plugin);
+		g_autofree const gchar **values = search_files_data_get_values (search_files_data);
 
-		/* set the source package name for an installed .repo file */
-		helper = gs_packagekit_helper_new (plugin);
-		to_array[0] = filename;
-		gs_packagekit_helper_add_app (helper, app);
-		g_mutex_lock (&self->client_mutex_refine_repos);
-		pk_client_set_interactive (self->client_refine_repos, gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE));
-		pk_client_search_files_async (self->client_refine_repos,
+		for (guint i = 0; i < search_files_data->apps->len; i++)
+			gs_packagekit_helper_add_app (helper, g_ptr_array_index (search_files_data->apps, i));
+
+		search_files_data->refine_task = refine_task_add_operation (task);
+
+		g_mutex_lock (&self->client_mutex_refine);
+		pk_client_set_interactive (self->client_refine, gs_plugin_has_flags (plugin, GS_PLUGIN_FLAGS_INTERACTIVE));
+		pk_client_search_files_async (self->client_refine,
 					      pk_bitfield_from_enums (PK_FILTER_ENUM_INSTALLED, -1),
-					      (gchar **) to_array,
+					      (gchar **) values,
 					      cancellable,
 					      gs_packagekit_helper_cb, refine_task_add_progress_data (task, helper),
 					      search_files_cb,
-					      search_files_data_new_operation (task, app, filename));
-		g_mutex_unlock (&self->client_mutex_refine_repos);
+					      g_steal_pointer (&search_files_data));
+		g_mutex_unlock (&self->client_mutex_refine);
 	}
 
 	/* any update details missing? */
@@ -1874,29 +1994,154 @@ search_files_cb (GObject      *source_object,
 {
 	PkClient *client = PK_CLIENT (source_object);
 	g_autoptr(SearchFilesData) search_files_data = g_steal_pointer (&user_data);
-	GTask *refine_task = search_files_data->refine_task;
+	g_autoptr(GTask) refine_task = g_steal_pointer (&search_files_data->refine_task);
 	GsPluginPackagekit *self = GS_PLUGIN_PACKAGEKIT (g_task_get_source_object (refine_task));
 	g_autoptr(PkResults) results = NULL;
 	g_autoptr(GPtrArray) packages = NULL;
 	g_autoptr(GError) local_error = NULL;
+	g_autofree const gchar **package_ids = NULL;
 
 	results = pk_client_generic_finish (client, result, &local_error);
 
 	if (!gs_plugin_packagekit_results_valid (results, &local_error)) {
-		g_prefix_error (&local_error, "failed to search file %s: ", search_files_data->filename);
+		if (search_files_data->filenames->len == 1)
+			g_prefix_error (&local_error, "failed to search file %s: ",
+					(const gchar *) g_ptr_array_index (search_files_data->filenames, 0));
+		else
+			g_prefix_error (&local_error, "failed to search %u files: ",
+					search_files_data->filenames->len);
 		refine_task_complete_operation_with_error (refine_task, g_steal_pointer (&local_error));
 		return;
 	}
 
 	/* get results */
 	packages = pk_results_get_package_array (results);
-	if (packages->len == 1) {
-		PkPackage *package;
-		package = g_ptr_array_index (packages, 0);
-		gs_plugin_packagekit_set_metadata_from_package (GS_PLUGIN (self), search_files_data->app, package);
-	} else {
-		g_debug ("Failed to find one package for %s, %s, [%u]",
-			 gs_app_get_id (search_files_data->app), search_files_data->filename, packages->len);
+
+	/* with only one file, all the packages must have matched it */
+	if (search_files_data->filenames->len == 1 || packages->len == 0) {
+		for (guint i = 0; i < search_files_data->apps->len; i++) {
+			GsApp *app = g_ptr_array_index (search_files_data->apps, i);
+			const gchar *filename = g_ptr_array_index (search_files_data->filenames, i);
+
+			if (packages->len == 1) {
+				PkPackage *package = g_ptr_array_index (packages, 0);
+				search_files_found_package (self, app, filename, package);
+			} else {
+				g_debug ("Failed to find one package for %s, %s, [%u]",
+					 gs_app_get_id (app), filename, packages->len);
+			}
+		}
+
+		refine_task_complete_operation (refine_task);
+		return;
+	}
+
+	/* otherwise work out which file each package matched */
+	search_files_data->packages = g_hash_table_new_full (g_str_hash, g_str_equal,
+							     NULL, g_object_unref);
+	package_ids = g_new0 (const gchar *, packages->len + 1);
+	for (guint i = 0; i < packages->len; i++) {
+		PkPackage *package = g_ptr_array_index (packages, i);
+		package_ids[i] = pk_package_get_id (package);
+		g_hash_table_insert (search_files_data->packages,
+				     (gpointer) pk_package_get_id (package),
+				     g_object_ref (package));
+	}
+
+	search_files_data->refine_task = g_steal_pointer (&refine_task);
+
+	g_mutex_lock (&self->client_mutex_refine);
+	pk_client_get_files_async (client,
+				   (gchar **) package_ids,
+				   g_task_get_cancellable (search_files_data->refine_task),
+				   NULL, NULL,
+				   search_files_get_files_cb,
+				   g_steal_pointer (&search_files_data));
+	g_mutex_unlock (&self->client_mutex_refine);
+}
+
+static void
+search_files_get_files_cb (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+	PkClient *client = PK_CLIENT (source_object);
+	g_autoptr(SearchFilesData) search_files_data = g_steal_pointer (&user_data);
+	g_autoptr(GTask) refine_task = g_steal_pointer (&search_files_data->refine_task);
+	GsPluginPackagekit *self = GS_PLUGIN_PACKAGEKIT (g_task_get_source_object (refine_task));
+	g_autoptr(PkResults) results = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+	g_autoptr(GHashTable) filename_to_package_ids = NULL;
+	g_autoptr(GHashTable) basenames = NULL;
+	g_autoptr(GPtrArray) canonical_filenames = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	results = pk_client_generic_finish (client, result, &local_error);
+
+	if (!gs_plugin_packagekit_results_valid (results, &local_error)) {
+		g_prefix_error (&local_error, "failed to get files for %u packages: ",
+				g_hash_table_size (search_files_data->packages));
+		refine_task_complete_operation_with_error (refine_task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	/* only the files which were searched for are interesting; the package
+	 * file lists may use different paths to the same files, so compare the
+	 * canonical paths, but only resolve the ones which might match */
+	filename_to_package_ids = g_hash_table_new_full (g_str_hash, g_str_equal,
+							 g_free, (GDestroyNotify) g_ptr_array_unref);
+	basenames = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	canonical_filenames = g_ptr_array_new_with_free_func (g_free);
+	for (guint i = 0; i < search_files_data->filenames->len; i++) {
+		const gchar *filename = g_ptr_array_index (search_files_data->filenames, i);
+		g_autofree gchar *canonical = search_files_canonicalize_filename (filename);
+
+		g_hash_table_add (basenames, g_path_get_basename (filename));
+		g_hash_table_add (basenames, g_path_get_basename (canonical));
+		if (!g_hash_table_contains (filename_to_package_ids, canonical))
+			g_hash_table_insert (filename_to_package_ids, g_strdup (canonical),
+					     g_ptr_array_new_with_free_func (g_free));
+		g_ptr_array_add (canonical_filenames, g_steal_pointer (&canonical));
+	}
+
+	array = pk_results_get_files_array (results);
+	for (guint i = 0; i < array->len; i++) {
+		PkFiles *item = g_ptr_array_index (array, i);
+		gchar **fns = pk_files_get_files (item);
+
+		for (guint j = 0; fns != NULL && fns[j] != NULL; j++) {
+			g_autofree gchar *basename = g_path_get_basename (fns[j]);
+			g_autofree gchar *canonical = NULL;
+			GPtrArray *package_ids;
+
+			if (!g_hash_table_contains (basenames, basename))
+				continue;
+			canonical = search_files_canonicalize_filename (fns[j]);
+			package_ids = g_hash_table_lookup (filename_to_package_ids, canonical);
+			if (package_ids != NULL &&
+			    !g_ptr_array_find_with_equal_func (package_ids, pk_files_get_package_id (item), g_str_equal, NULL))
+				g_ptr_array_add (package_ids, g_strdup (pk_files_get_package_id (item)));
+		}
+	}
+
+	/* an app whose file can’t be mapped to exactly one package keeps
+	 * whatever package details it already had */
+	for (guint i = 0; i < search_files_data->apps->len; i++) {
+		GsApp *app = g_ptr_array_index (search_files_data->apps, i);
+		const gchar *filename = g_ptr_array_index (search_files_data->filenames, i);
+		GPtrArray *package_ids = g_hash_table_lookup (filename_to_package_ids,
+							      g_ptr_array_index (canonical_filenames, i));
+		PkPackage *package = NULL;
+
+		if (package_ids->len == 1)
+			package = g_hash_table_lookup (search_files_data->packages,
+						       g_ptr_array_index (package_ids, 0));
+		if (package != NULL) {
+			search_files_found_package (self, app, filename, package);
+		} else {
+			g_debug ("Failed to find one package for %s, %s, [%u]",
+				 gs_app_get_id (app), filename, package_ids->len);
+		}
 	}
 
 	refine_task_complete_operation (refine_task);
@@ -2351,12 +2596,29 @@ setup_proxy_settings_cb (GObject      *source_object,
 	GsPluginPackagekit *self = g_task_get_source_object (task);
 	GCancellable *cancellable = g_task_get_cancellable (task);
 	g_autoptr(GFile) file_trigger = NULL;
+	g_autofree gchar *file_index_filename = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	if (!reload_proxy_settings_finish (self, result, &local_error))
 		g_warning ("Failed to load proxy settings: %s", local_error->message);
 	g_clear_error (&local_error);
 
+	gs_plugin_packagekit_update_refine_cache_stamp (self);
+
+	/* load the file to package index */
+	file_index_filename = gs_utils_get_cache_filename ("packagekit",
+							   "file-index.gvariant",
+							   GS_UTILS_CACHE_FLAG_WRITEABLE |
+							   GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+							   &local_error);
+	if (file_index_filename == NULL) {
+		g_warning ("Failed to get file index filename: %s", local_error->message);
+		g_clear_error (&local_error);
+	} else {
+		self->file_index = gs_packagekit_file_index_new (file_index_filename);
+		gs_packagekit_file_index_prune (self->file_index);
+	}
+
 	/* watch the prepared file */
 	self->monitor = pk_offline_get_prepared_monitor (cancellable, &local_error);
 	if (self->monitor == NULL) {
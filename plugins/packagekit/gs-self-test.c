@@ -8,9 +8,12 @@
 
 #include "config.h"
 
+#include <glib/gstdio.h>
+
 #include "gnome-software-private.h"
 
 #include "gs-markdown.h"
+#include "gs-packagekit-file-index.h"
 #include "gs-test.h"
 
 static void
@@ -193,6 +196,72 @@ gs_markdown_func (void)
 	g_free (text);
 }
 
+static void
+gs_packagekit_file_index_func (void)
+{
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *index_fn = NULL;
+	g_autofree gchar *desktop_fn = NULL;
+	g_autofree gchar *new_desktop_fn = NULL;
+	g_autoptr(GsPackagekitFileIndex) file_index = NULL;
+	g_autoptr(PkPackage) package = NULL;
+	g_autoptr(PkPackage) found = NULL;
+	g_autoptr(GError) error = NULL;
+
+	tmp_dir = g_dir_make_tmp ("gs-packagekit-file-index-XXXXXX", &error);
+	g_assert_no_error (error);
+	index_fn = g_build_filename (tmp_dir, "file-index.gvariant", NULL);
+	desktop_fn = g_build_filename (tmp_dir, "chiron.desktop", NULL);
+	g_file_set_contents (desktop_fn, "[Desktop Entry]\n", -1, &error);
+	g_assert_no_error (error);
+
+	package = pk_package_new ();
+	g_assert_true (pk_package_set_id (package, "chiron;1.1-1.fc24;x86_64;installed:fedora", &error));
+	g_assert_no_error (error);
+	g_object_set (package, "summary", "Single line synopsis", NULL);
+
+	/* unknown files, and files which don’t exist, aren’t found */
+	file_index = gs_packagekit_file_index_new (index_fn);
+	g_assert_null (gs_packagekit_file_index_lookup (file_index, desktop_fn));
+	gs_packagekit_file_index_store (file_index, "/nonexistent/chiron.desktop", package);
+	g_assert_null (gs_packagekit_file_index_lookup (file_index, "/nonexistent/chiron.desktop"));
+
+	/* a stored file is found, including after reloading the index */
+	gs_packagekit_file_index_store (file_index, desktop_fn, package);
+	found = gs_packagekit_file_index_lookup (file_index, desktop_fn);
+	g_assert_nonnull (found);
+	g_assert_cmpstr (pk_package_get_id (found), ==, "chiron;1.1-1.fc24;x86_64;installed:fedora");
+	g_assert_cmpstr (pk_package_get_name (found), ==, "chiron");
+	g_assert_cmpstr (pk_package_get_summary (found), ==, "Single line synopsis");
+	g_assert_cmpint (pk_package_get_info (found), ==, PK_INFO_ENUM_INSTALLED);
+	g_clear_object (&found);
+
+	g_assert_true (gs_packagekit_file_index_save (file_index, &error));
+	g_assert_no_error (error);
+	g_clear_object (&file_index);
+
+	file_index = gs_packagekit_file_index_new (index_fn);
+	found = gs_packagekit_file_index_lookup (file_index, desktop_fn);
+	g_assert_nonnull (found);
+	g_assert_cmpstr (pk_package_get_id (found), ==, "chiron;1.1-1.fc24;x86_64;installed:fedora");
+	g_clear_object (&found);
+
+	/* replacing the file, as a package update would, makes it stale */
+	g_assert_cmpint (gs_packagekit_file_index_prune (file_index), ==, 0);
+	new_desktop_fn = g_build_filename (tmp_dir, "chiron.desktop.new", NULL);
+	g_file_set_contents (new_desktop_fn, "[Desktop Entry]\nName=Chiron\n", -1, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (g_rename (new_desktop_fn, desktop_fn), ==, 0);
+	g_assert_null (gs_packagekit_file_index_lookup (file_index, desktop_fn));
+	g_assert_cmpint (gs_packagekit_file_index_prune (file_index), ==, 1);
+	g_assert_cmpint (gs_packagekit_file_index_prune (file_index), ==, 0);
+
+	g_clear_object (&file_index);
+	g_unlink (desktop_fn);
+	g_unlink (index_fn);
+	g_rmdir (tmp_dir);
+}
+
 static void
 gs_plugins_packagekit_local_func (GsPluginLoader *plugin_loader)
 {
@@ -252,6 +321,7 @@ main (int argc, char **argv)
 
 	/* generic tests go here */
 	g_test_add_func ("/gnome-software/markdown", gs_markdown_func);
+	g_test_add_func ("/gnome-software/packagekit/file-index", gs_packagekit_file_index_func);
 
 	/* we can only load this once per process */
 	plugin_loader = gs_plugin_loader_new ();
@@ -24,6 +24,7 @@
 
 #include "gs-plugin-rpm-ostree.h"
 #include "gs-rpmostree-generated.h"
+#include "gs-rpmostree-package-index.h"
 
 /*
  * SECTION:
@@ -33,6 +34,12 @@
  * while the rpm-ostreed API is asynchronous over D-Bus, the plugin also needs
  * to use lower level libostree and libdnf APIs which are entirely synchronous.
  * Message passing to the worker thread is by gs_worker_thread_queue().
+ *
+ * Available packages are looked up in a #GsRpmostreePackageIndex rather than
+ * a #DnfSack. The index is saved in the user’s cache directory and mapped
+ * again on setup. It is only rebuilt, from a temporary sack, when the
+ * repository metadata changes, which is checked on first use after setup,
+ * after the plugin has been idle, and after refreshing the metadata.
  */
 
 /* This shows up in the `rpm-ostree status` as the software that
@@ -59,7 +66,9 @@ struct _GsPluginRpmOstree {
 	GsRPMOSTreeSysroot	*sysroot_proxy;
 	OstreeRepo		*ot_repo;
 	OstreeSysroot		*ot_sysroot;
-	DnfContext		*dnf_context;
+	GsRpmostreePackageIndex	*package_index;  /* (owned) (nullable) */
+	gboolean		 package_index_checked;
+	gchar			*package_index_filename;  /* (owned) (nullable) */
 	gboolean		 update_triggered;
 	guint			 inactive_timeout_id;
 };
@@ -79,7 +88,8 @@ gs_plugin_rpm_ostree_dispose (GObject *object)
 	g_clear_object (&self->sysroot_proxy);
 	g_clear_object (&self->ot_sysroot);
 	g_clear_object (&self->ot_repo);
-	g_clear_object (&self->dnf_context);
+	g_clear_object (&self->package_index);
+	g_clear_pointer (&self->package_index_filename, g_free);
 	g_clear_object (&self->worker);
 
 	G_OBJECT_CLASS (gs_plugin_rpm_ostree_parent_class)->dispose (object);
@@ -190,7 +200,7 @@ gs_rpmostree_inactive_timeout_cb (gpointer user_data)
 		g_clear_object (&self->sysroot_proxy);
 		g_clear_object (&self->ot_sysroot);
 		g_clear_object (&self->ot_repo);
-		g_clear_object (&self->dnf_context);
+		self->package_index_checked = FALSE;
 		self->inactive_timeout_id = 0;
 
 		g_clear_pointer (&locker, g_mutex_locker_free);
@@ -346,6 +356,7 @@ static void setup_thread_cb (GTask        *task,
                              gpointer      source_object,
                              gpointer      task_data,
                              GCancellable *cancellable);
+static void gs_rpmostree_load_package_index (GsPluginRpmOstree *self);
 
 static void
 gs_plugin_rpm_ostree_setup_async (GsPlugin            *plugin,
@@ -382,6 +393,8 @@ setup_thread_cb (GTask        *task,
 
 	assert_in_worker (self);
 
+	gs_rpmostree_load_package_index (self);
+
 	if (!gs_rpmostree_ref_proxies (self, NULL, NULL, cancellable, &local_error))
 		g_task_return_error (task, g_steal_pointer (&local_error));
 	else
@@ -960,53 +973,131 @@ gs_rpmostree_create_bare_dnf_context (GCancellable *cancellable,
 	return g_steal_pointer (&context);
 }
 
-static gboolean
-gs_rpmostree_ref_dnf_context_locked (GsPluginRpmOstree *self,
-				     GsRPMOSTreeOS **out_os_proxy,
-				     GsRPMOSTreeSysroot **out_sysroot_proxy,
-				     DnfContext **out_dnf_context,
-				     GCancellable *cancellable,
-				     GError **error)
+static gint
+compare_repos_by_id (gconstpointer a,
+                     gconstpointer b)
 {
-	g_autoptr(DnfContext) context = NULL;
-	g_autoptr(DnfState) state = NULL;
-	g_autoptr(GsRPMOSTreeOS) os_proxy = NULL;
-	g_autoptr(GsRPMOSTreeSysroot) sysroot_proxy = NULL;
+	DnfRepo *repo_a = *((DnfRepo **) a);
+	DnfRepo *repo_b = *((DnfRepo **) b);
 
-	if (!gs_rpmostree_ref_proxies_locked (self, &os_proxy, &sysroot_proxy, cancellable, error))
-		return FALSE;
+	return g_strcmp0 (dnf_repo_get_id (repo_a), dnf_repo_get_id (repo_b));
+}
 
-	if (self->dnf_context != NULL) {
-		if (out_os_proxy)
-			*out_os_proxy = g_steal_pointer (&os_proxy);
-		if (out_sysroot_proxy)
-			*out_sysroot_proxy = g_steal_pointer (&sysroot_proxy);
-		if (out_dnf_context)
-			*out_dnf_context = g_object_ref (self->dnf_context);
-		return TRUE;
+/* Identifies the metadata of the enabled repos, which is what the package
+ * index is built from. */
+static gchar *
+gs_rpmostree_compute_repos_stamp (DnfContext *context)
+{
+	GPtrArray *repos = dnf_context_get_repos (context);
+	g_autoptr(GPtrArray) enabled_repos = g_ptr_array_new ();
+	g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+	for (guint i = 0; i < repos->len; i++) {
+		DnfRepo *repo = g_ptr_array_index (repos, i);
+
+		if ((dnf_repo_get_enabled (repo) & DNF_REPO_ENABLED_PACKAGES) != 0)
+			g_ptr_array_add (enabled_repos, repo);
+	}
+
+	/* the repos are listed in whatever order their files were read */
+	g_ptr_array_sort (enabled_repos, compare_repos_by_id);
+
+	for (guint i = 0; i < enabled_repos->len; i++) {
+		DnfRepo *repo = g_ptr_array_index (enabled_repos, i);
+		const gchar *repo_id = dnf_repo_get_id (repo);
+		g_autofree gchar *repomd_filename = NULL;
+		g_autofree gchar *repomd = NULL;
+		gsize repomd_len = 0;
+
+		/* include the terminating nul, to separate the fields */
+		g_checksum_update (checksum, (const guchar *) repo_id, strlen (repo_id) + 1);
+
+		repomd_filename = g_build_filename (dnf_repo_get_location (repo), "repodata", "repomd.xml", NULL);
+		if (g_file_get_contents (repomd_filename, &repomd, &repomd_len, NULL))
+			g_checksum_update (checksum, (const guchar *) repomd, repomd_len);
 	}
 
+	return g_strdup (g_checksum_get_string (checksum));
+}
+
+/* Run in @worker. */
+static void
+gs_rpmostree_load_package_index (GsPluginRpmOstree *self)
+{
+	g_autoptr(GsRpmostreePackageIndex) package_index = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	assert_in_worker (self);
+
+	locker = g_mutex_locker_new (&self->mutex);
+
+	self->package_index_filename = gs_utils_get_cache_filename ("rpm-ostree",
+								    "package-index.gvariant",
+								    GS_UTILS_CACHE_FLAG_WRITEABLE |
+								    GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+								    &local_error);
+	if (self->package_index_filename == NULL) {
+		g_warning ("Failed to get package index filename: %s", local_error->message);
+		return;
+	}
+
+	package_index = gs_rpmostree_package_index_new_from_file (self->package_index_filename, &local_error);
+	if (package_index == NULL) {
+		if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("Failed to load package index: %s", local_error->message);
+		return;
+	}
+
+	g_set_object (&self->package_index, package_index);
+}
+
+/* Hold the plugin mutex when called. This loads a sack to rebuild the index if
+ * the repo metadata has changed since it was built, which takes a while. */
+static GsRpmostreePackageIndex *
+gs_rpmostree_ref_package_index_locked (GsPluginRpmOstree  *self,
+                                       GCancellable       *cancellable,
+                                       GError            **error)
+{
+	g_autoptr(DnfContext) context = NULL;
+	g_autoptr(DnfState) state = NULL;
+	g_autoptr(GsRpmostreePackageIndex) package_index = NULL;
+	g_autofree gchar *stamp = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	if (self->package_index != NULL && self->package_index_checked)
+		return g_object_ref (self->package_index);
+
 	context = gs_rpmostree_create_bare_dnf_context (cancellable, error);
 	if (!context)
-		return FALSE;
+		return NULL;
+
+	stamp = gs_rpmostree_compute_repos_stamp (context);
+	if (self->package_index != NULL &&
+	    g_strcmp0 (gs_rpmostree_package_index_get_stamp (self->package_index), stamp) == 0) {
+		self->package_index_checked = TRUE;
+		return g_object_ref (self->package_index);
+	}
+
+	g_debug ("Repo metadata changed; rebuilding package index");
 
 	state = dnf_state_new ();
 
 	if (!dnf_context_setup_sack_with_flags (context, state, DNF_CONTEXT_SETUP_SACK_FLAG_SKIP_RPMDB, error)) {
 		gs_rpmostree_error_convert (error);
-		return FALSE;
+		return NULL;
 	}
 
-	g_set_object (&self->dnf_context, context);
+	package_index = gs_rpmostree_package_index_new_from_sack (dnf_context_get_sack (context), stamp);
 
-	if (out_os_proxy)
-		*out_os_proxy = g_steal_pointer (&os_proxy);
-	if (out_sysroot_proxy)
-		*out_sysroot_proxy = g_steal_pointer (&sysroot_proxy);
-	if (out_dnf_context)
-		*out_dnf_context = g_object_ref (self->dnf_context);
+	if (self->package_index_filename != NULL &&
+	    !gs_rpmostree_package_index_save (package_index, self->package_index_filename, &local_error))
+		g_warning ("Failed to save package index: %s", local_error->message);
 
-	return TRUE;
+	g_set_object (&self->package_index, package_index);
+	self->package_index_checked = TRUE;
+
+	return g_steal_pointer (&package_index);
 }
 
 static void refresh_metadata_thread_cb (GTask        *task,
@@ -1092,6 +1183,11 @@ refresh_metadata_thread_cb (GTask        *task,
 		}
 	}
 
+	/* the repo metadata may have changed */
+	g_mutex_lock (&self->mutex);
+	self->package_index_checked = FALSE;
+	g_mutex_unlock (&self->mutex);
+
 	if (data->cache_age_secs == G_MAXUINT64) {
 		g_task_return_boolean (task, TRUE);
 		return;
@@ -1722,38 +1818,6 @@ gs_plugin_app_remove (GsPlugin *plugin,
 	return TRUE;
 }
 
-static DnfPackage *
-find_package_by_name (DnfSack     *sack,
-                      const char  *pkgname)
-{
-	g_autoptr(GPtrArray) pkgs = NULL;
-	hy_autoquery HyQuery query = hy_query_create (sack);
-
-	hy_query_filter (query, HY_PKG_NAME, HY_EQ, pkgname);
-	hy_query_filter_latest_per_arch (query, TRUE);
-
-	pkgs = hy_query_run (query);
-	if (pkgs->len == 0)
-		return NULL;
-
-	return g_object_ref (pkgs->pdata[pkgs->len-1]);
-}
-
-static GPtrArray *
-find_packages_by_provides (DnfSack *sack,
-                           gchar **search)
-{
-	g_autoptr(GPtrArray) pkgs = NULL;
-	hy_autoquery HyQuery query = hy_query_create (sack);
-
-	hy_query_filter_provides_in (query, search);
-	hy_query_filter_latest_per_arch (query, TRUE);
-
-	pkgs = hy_query_run (query);
-
-	return g_steal_pointer (&pkgs);
-}
-
 static gboolean
 gs_rpm_ostree_has_launchable (GsApp *app)
 {
@@ -1822,14 +1886,13 @@ resolve_installed_packages_app (GsPlugin *plugin,
 
 static gboolean
 resolve_available_packages_app (GsPlugin *plugin,
-                                DnfSack *sack,
+                                GsRpmostreePackageIndex *package_index,
                                 GsApp *app)
 {
-	g_autoptr(DnfPackage) pkg = NULL;
+	GsRpmostreeIndexedPackage pkg;
 
-	pkg = find_package_by_name (sack, gs_app_get_source_default (app));
-	if (pkg != NULL) {
-		gs_app_set_version (app, dnf_package_get_evr (pkg));
+	if (gs_rpmostree_package_index_lookup_name (package_index, gs_app_get_source_default (app), &pkg)) {
+		gs_app_set_version (app, pkg.evr);
 		if (gs_app_get_state (app) == GS_APP_STATE_UNKNOWN)
 			gs_app_set_state (app, GS_APP_STATE_AVAILABLE);
 
@@ -1837,14 +1900,12 @@ resolve_available_packages_app (GsPlugin *plugin,
 		gs_app_remove_quirk (app, GS_APP_QUIRK_COMPULSORY);
 
 		/* set origin */
-		if (gs_app_get_origin (app) == NULL) {
-			const gchar *reponame = dnf_package_get_reponame (pkg);
-			gs_app_set_origin (app, reponame);
-		}
+		if (gs_app_get_origin (app) == NULL)
+			gs_app_set_origin (app, pkg.reponame);
 
 		/* set more metadata for packages that don't have appstream data */
-		gs_app_set_name (app, GS_APP_QUALITY_LOWEST, dnf_package_get_name (pkg));
-		gs_app_set_summary (app, GS_APP_QUALITY_LOWEST, dnf_package_get_summary (pkg));
+		gs_app_set_name (app, GS_APP_QUALITY_LOWEST, pkg.name);
+		gs_app_set_summary (app, GS_APP_QUALITY_LOWEST, pkg.summary);
 
 		/* set hide-from-search quirk for available apps we don't want to show; results for non-installed desktop apps
 		 * are intentionally hidden (as recommended by Matthias Clasen) by a special quirk because app layering
@@ -1939,7 +2000,7 @@ gs_rpm_ostree_refine_apps (GsPlugin *plugin,
 	g_autoptr(GVariant) default_deployment = NULL;
 	g_autoptr(GsRPMOSTreeOS) os_proxy = NULL;
 	g_autoptr(GsRPMOSTreeSysroot) sysroot_proxy = NULL;
-	g_autoptr(DnfContext) dnf_context = NULL;
+	g_autoptr(GsRpmostreePackageIndex) package_index = NULL;
 	g_autoptr(OstreeRepo) ot_repo = NULL;
 	g_auto(GStrv) layered_packages_strv = NULL;
 	g_auto(GStrv) layered_local_packages_strv = NULL;
@@ -1947,12 +2008,13 @@ gs_rpm_ostree_refine_apps (GsPlugin *plugin,
 
 	locker = g_mutex_locker_new (&self->mutex);
 
-	if (!gs_rpmostree_ref_dnf_context_locked (self, &os_proxy, &sysroot_proxy, &dnf_context, cancellable, error))
+	if (!gs_rpmostree_ref_proxies_locked (self, &os_proxy, &sysroot_proxy, cancellable, error))
 		return FALSE;
 
 	ot_repo = g_object_ref (self->ot_repo);
 
-	if (!dnf_context)
+	package_index = gs_rpmostree_ref_package_index_locked (self, cancellable, error);
+	if (package_index == NULL)
 		return FALSE;
 
 	g_clear_pointer (&locker, g_mutex_locker_free);
@@ -2030,8 +2092,8 @@ gs_rpm_ostree_refine_apps (GsPlugin *plugin,
 		found = resolve_installed_packages_app (plugin, packages, layered_packages, layered_local_packages, app);
 
 		/* if we didn't find anything, try resolving from available packages */
-		if (!found && dnf_context != NULL)
-			found = resolve_available_packages_app (plugin, dnf_context_get_sack (dnf_context), app);
+		if (!found)
+			found = resolve_available_packages_app (plugin, package_index, app);
 
 		/* if we still didn't find anything then it's likely a package
 		 * that is still in appstream data, but removed from the repos */
@@ -2365,24 +2427,28 @@ gs_plugin_add_search_what_provides (GsPlugin *plugin,
 {
 	GsPluginRpmOstree *self = GS_PLUGIN_RPM_OSTREE (plugin);
 	g_autoptr(GMutexLocker) locker = NULL;
-	g_autoptr(GPtrArray) pkglist = NULL;
-	g_autoptr(DnfContext) dnf_context = NULL;
+	g_autoptr(GArray) pkglist = NULL;
+	g_autoptr(GsRpmostreePackageIndex) package_index = NULL;
 	g_auto(GStrv) provides = NULL;
 
 	locker = g_mutex_locker_new (&self->mutex);
 
-	if (!gs_rpmostree_ref_dnf_context_locked (self, NULL, NULL, &dnf_context, cancellable, error))
+	if (!gs_rpmostree_ref_proxies_locked (self, NULL, NULL, cancellable, error))
+		return FALSE;
+
+	package_index = gs_rpmostree_ref_package_index_locked (self, cancellable, error);
+	if (package_index == NULL)
 		return FALSE;
 
 	g_clear_pointer (&locker, g_mutex_locker_free);
 
 	provides = what_provides_decompose (search);
-	pkglist = find_packages_by_provides (dnf_context_get_sack (dnf_context), provides);
+	pkglist = gs_rpmostree_package_index_lookup_provides (package_index, (const gchar * const *) provides);
 	for (guint i = 0; i < pkglist->len; i++) {
-		DnfPackage *pkg = g_ptr_array_index (pkglist, i);
+		const GsRpmostreeIndexedPackage *pkg = &g_array_index (pkglist, GsRpmostreeIndexedPackage, i);
 		g_autoptr(GsApp) app = NULL;
 
-		app = gs_plugin_cache_lookup (plugin, dnf_package_get_nevra (pkg));
+		app = gs_plugin_cache_lookup (plugin, pkg->nevra);
 		if (app != NULL) {
 			gs_app_list_add (list, app);
 			continue;
@@ -2397,9 +2463,9 @@ gs_plugin_add_search_what_provides (GsPlugin *plugin,
 		gs_app_set_kind (app, AS_COMPONENT_KIND_GENERIC);
 		gs_app_set_bundle_kind (app, AS_BUNDLE_KIND_PACKAGE);
 		gs_app_set_scope (app, AS_COMPONENT_SCOPE_SYSTEM);
-		gs_app_add_source (app, dnf_package_get_name (pkg));
+		gs_app_add_source (app, pkg->name);
 
-		gs_plugin_cache_add (plugin, dnf_package_get_nevra (pkg), app);
+		gs_plugin_cache_add (plugin, pkg->nevra, app);
 		gs_app_list_add (list, app);
 	}
 
@@ -0,0 +1,429 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/*
+ * SECTION:gs-rpmostree-package-index
+ * @short_description: A persistent index of the packages available to layer
+ *
+ * #GsRpmostreePackageIndex holds the few details of each available package
+ * which the rpm-ostree plugin needs to refine and search for layerable
+ * packages, so that it doesn’t have to load the repository metadata into a
+ * #DnfSack for every refine. Loading a sack takes several seconds and a lot of
+ * memory, and the plugin would otherwise have to do it again after each time
+ * it goes idle.
+ *
+ * The index maps package names to their NEVRA, EVR, repository and summary,
+ * and namespaced provides (such as `gstreamer1(decoder-video/x-h264)`, which
+ * are what gs_plugin_add_search_what_provides() searches for) to package
+ * names. Plain provides aren’t indexed, to keep the index small. Both tables
+ * are sorted arrays in a #GVariant, so an index loaded from disk is used
+ * directly from the mapped file and lookups are binary searches.
+ *
+ * An index is immutable once built. Its stamp identifies the repository
+ * metadata it was built from, so the caller can tell when it needs
+ * rebuilding.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "gs-rpmostree-package-index.h"
+
+/* Bump GS_RPMOSTREE_PACKAGE_INDEX_FORMAT whenever the meaning of the stored
+ * fields changes. The magic number catches an index written with a different
+ * byte order. */
+#define GS_RPMOSTREE_PACKAGE_INDEX_MAGIC	0x584f5052  /* RPOX */
+#define GS_RPMOSTREE_PACKAGE_INDEX_FORMAT	1
+/* name, NEVRA, EVR, repository, summary; sorted by name */
+#define GS_RPMOSTREE_PACKAGE_INDEX_PACKAGE_TYPE	"(sssss)"
+/* provide, package names; sorted by provide */
+#define GS_RPMOSTREE_PACKAGE_INDEX_PROVIDE_TYPE	"(sas)"
+/* magic, format, stamp, packages, provides */
+#define GS_RPMOSTREE_PACKAGE_INDEX_TYPE		"(uusa" GS_RPMOSTREE_PACKAGE_INDEX_PACKAGE_TYPE \
+						 "a" GS_RPMOSTREE_PACKAGE_INDEX_PROVIDE_TYPE ")"
+
+struct _GsRpmostreePackageIndex
+{
+	GObject		 parent_instance;
+
+	GVariant	*data;  /* (owned) (not nullable) */
+	const gchar	*stamp;  /* (not nullable); owned by @data */
+	GVariant	*packages;  /* (owned) (not nullable) */
+	GVariant	*provides;  /* (owned) (not nullable) */
+};
+
+G_DEFINE_TYPE (GsRpmostreePackageIndex, gs_rpmostree_package_index, G_TYPE_OBJECT)
+
+static GsRpmostreePackageIndex *
+gs_rpmostree_package_index_new_from_bytes (GBytes  *bytes,
+                                           GError **error)
+{
+	g_autoptr(GsRpmostreePackageIndex) self = NULL;
+	g_autoptr(GVariant) data = NULL;
+	guint32 magic = 0;
+	guint32 format = 0;
+
+	data = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (GS_RPMOSTREE_PACKAGE_INDEX_TYPE),
+							     bytes, FALSE));
+	g_variant_get_child (data, 0, "u", &magic);
+	g_variant_get_child (data, 1, "u", &format);
+	if (magic != GS_RPMOSTREE_PACKAGE_INDEX_MAGIC || format != GS_RPMOSTREE_PACKAGE_INDEX_FORMAT) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "Unknown package index format");
+		return NULL;
+	}
+
+	self = g_object_new (GS_TYPE_RPMOSTREE_PACKAGE_INDEX, NULL);
+	self->data = g_steal_pointer (&data);
+	g_variant_get_child (self->data, 2, "&s", &self->stamp);
+	self->packages = g_variant_get_child_value (self->data, 3);
+	self->provides = g_variant_get_child_value (self->data, 4);
+
+	return g_steal_pointer (&self);
+}
+
+/*
+ * gs_rpmostree_package_index_new_from_file:
+ * @filename: (type filename): file to load the index from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load an index saved by gs_rpmostree_package_index_save(). The file is
+ * mapped rather than read.
+ *
+ * Returns: (transfer full): a new #GsRpmostreePackageIndex, or %NULL on error
+ */
+GsRpmostreePackageIndex *
+gs_rpmostree_package_index_new_from_file (const gchar  *filename,
+                                          GError      **error)
+{
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	mapped_file = g_mapped_file_new (filename, FALSE, error);
+	if (mapped_file == NULL)
+		return NULL;
+	bytes = g_mapped_file_get_bytes (mapped_file);
+
+	return gs_rpmostree_package_index_new_from_bytes (bytes, error);
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+	return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static GPtrArray *
+get_sorted_keys (GHashTable *hash_table)
+{
+	GHashTableIter iter;
+	gpointer key;
+	GPtrArray *keys = g_ptr_array_sized_new (g_hash_table_size (hash_table));
+
+	g_hash_table_iter_init (&iter, hash_table);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (keys, key);
+	g_ptr_array_sort (keys, compare_strings);
+
+	return keys;
+}
+
+/*
+ * gs_rpmostree_package_index_new_from_sack:
+ * @sack: a #DnfSack with the available packages loaded
+ * @stamp: identifies the repository metadata @sack was loaded from
+ *
+ * Build an index of the latest packages in @sack.
+ *
+ * Returns: (transfer full): a new #GsRpmostreePackageIndex
+ */
+GsRpmostreePackageIndex *
+gs_rpmostree_package_index_new_from_sack (DnfSack     *sack,
+                                          const gchar *stamp)
+{
+	g_autoptr(GPtrArray) pkgs = NULL;
+	g_autoptr(GHashTable) packages = NULL;
+	g_autoptr(GHashTable) provides = NULL;
+	g_autoptr(GPtrArray) names = NULL;
+	g_autoptr(GPtrArray) provide_keys = NULL;
+	g_auto(GVariantBuilder) packages_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a" GS_RPMOSTREE_PACKAGE_INDEX_PACKAGE_TYPE));
+	g_auto(GVariantBuilder) provides_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a" GS_RPMOSTREE_PACKAGE_INDEX_PROVIDE_TYPE));
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) local_error = NULL;
+	GsRpmostreePackageIndex *self;
+	hy_autoquery HyQuery query = hy_query_create (sack);
+
+	g_return_val_if_fail (DNF_IS_SACK (sack), NULL);
+	g_return_val_if_fail (stamp != NULL, NULL);
+
+	hy_query_filter_latest_per_arch (query, TRUE);
+	pkgs = hy_query_run (query);
+
+	/* name → DnfPackage, and provide → names; the strings are owned by
+	 * the packages in @pkgs */
+	packages = g_hash_table_new (g_str_hash, g_str_equal);
+	provides = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+
+	for (guint i = 0; i < pkgs->len; i++) {
+		DnfPackage *pkg = g_ptr_array_index (pkgs, i);
+		const gchar *name = dnf_package_get_name (pkg);
+		DnfReldepList *reldeps;
+
+		if (name == NULL)
+			continue;
+
+		/* as with a query by name, the last arch wins */
+		g_hash_table_insert (packages, (gpointer) name, pkg);
+
+		reldeps = dnf_package_get_provides (pkg);
+		for (gint j = 0; j < dnf_reldep_list_count (reldeps); j++) {
+			DnfReldep *reldep = dnf_reldep_list_index (reldeps, j);
+			const gchar *str = dnf_reldep_to_string (reldep);
+			const gchar *space = strchr (str, ' ');
+			g_autofree gchar *provide = NULL;
+			GPtrArray *provide_names;
+
+			/* drop any version from the provide; the string is
+			 * only valid until the next call, so copy it now */
+			provide = (space != NULL) ? g_strndup (str, space - str) : g_strdup (str);
+			dnf_reldep_free (reldep);
+
+			if (strchr (provide, '(') == NULL)
+				continue;
+
+			provide_names = g_hash_table_lookup (provides, provide);
+			if (provide_names == NULL) {
+				provide_names = g_ptr_array_new ();
+				g_hash_table_insert (provides, g_steal_pointer (&provide), provide_names);
+			}
+			if (!g_ptr_array_find_with_equal_func (provide_names, name, g_str_equal, NULL))
+				g_ptr_array_add (provide_names, (gpointer) name);
+		}
+		dnf_reldep_list_free (reldeps);
+	}
+
+	names = get_sorted_keys (packages);
+	for (guint i = 0; i < names->len; i++) {
+		const gchar *name = g_ptr_array_index (names, i);
+		DnfPackage *pkg = g_hash_table_lookup (packages, name);
+
+		g_variant_builder_add (&packages_builder, GS_RPMOSTREE_PACKAGE_INDEX_PACKAGE_TYPE,
+				       name,
+				       (dnf_package_get_nevra (pkg) != NULL) ? dnf_package_get_nevra (pkg) : "",
+				       (dnf_package_get_evr (pkg) != NULL) ? dnf_package_get_evr (pkg) : "",
+				       (dnf_package_get_reponame (pkg) != NULL) ? dnf_package_get_reponame (pkg) : "",
+				       (dnf_package_get_summary (pkg) != NULL) ? dnf_package_get_summary (pkg) : "");
+	}
+
+	provide_keys = get_sorted_keys (provides);
+	for (guint i = 0; i < provide_keys->len; i++) {
+		const gchar *provide = g_ptr_array_index (provide_keys, i);
+		GPtrArray *provide_names = g_hash_table_lookup (provides, provide);
+		g_auto(GVariantBuilder) names_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE_STRING_ARRAY);
+
+		for (guint j = 0; j < provide_names->len; j++)
+			g_variant_builder_add (&names_builder, "s", (const gchar *) g_ptr_array_index (provide_names, j));
+		g_variant_builder_add (&provides_builder, "(s@as)", provide,
+				       g_variant_builder_end (&names_builder));
+	}
+
+	data = g_variant_ref_sink (g_variant_new ("(uus@a" GS_RPMOSTREE_PACKAGE_INDEX_PACKAGE_TYPE
+						  "@a" GS_RPMOSTREE_PACKAGE_INDEX_PROVIDE_TYPE ")",
+						  GS_RPMOSTREE_PACKAGE_INDEX_MAGIC,
+						  GS_RPMOSTREE_PACKAGE_INDEX_FORMAT,
+						  stamp,
+						  g_variant_builder_end (&packages_builder),
+						  g_variant_builder_end (&provides_builder)));
+
+	/* use the serialised form, so the index works the same whether it
+	 * was built or loaded */
+	bytes = g_variant_get_data_as_bytes (data);
+	self = gs_rpmostree_package_index_new_from_bytes (bytes, &local_error);
+	g_assert_no_error (local_error);
+
+	g_debug ("built package index with %u packages and %u provides",
+		 names->len, provide_keys->len);
+
+	return self;
+}
+
+const gchar *
+gs_rpmostree_package_index_get_stamp (GsRpmostreePackageIndex *self)
+{
+	g_return_val_if_fail (GS_IS_RPMOSTREE_PACKAGE_INDEX (self), NULL);
+
+	return self->stamp;
+}
+
+/* @array is sorted by the string in the first field of each child. */
+static gboolean
+find_sorted (GVariant    *array,
+             const gchar *key,
+             gsize       *index_out)
+{
+	gsize lower = 0;
+	gsize upper = g_variant_n_children (array);
+
+	while (lower < upper) {
+		gsize mid = lower + (upper - lower) / 2;
+		g_autoptr(GVariant) child = g_variant_get_child_value (array, mid);
+		const gchar *child_key;
+		gint cmp;
+
+		g_variant_get_child (child, 0, "&s", &child_key);
+		cmp = strcmp (key, child_key);
+		if (cmp == 0) {
+			*index_out = mid;
+			return TRUE;
+		} else if (cmp < 0) {
+			upper = mid;
+		} else {
+			lower = mid + 1;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * gs_rpmostree_package_index_lookup_name:
+ * @self: a #GsRpmostreePackageIndex
+ * @name: a package name
+ * @package_out: (out caller-allocates): return location for the package
+ *
+ * Look up the latest available package called @name.
+ *
+ * Returns: %TRUE if it was found
+ */
+gboolean
+gs_rpmostree_package_index_lookup_name (GsRpmostreePackageIndex   *self,
+                                        const gchar               *name,
+                                        GsRpmostreeIndexedPackage *package_out)
+{
+	gsize idx;
+
+	g_return_val_if_fail (GS_IS_RPMOSTREE_PACKAGE_INDEX (self), FALSE);
+	g_return_val_if_fail (name != NULL, FALSE);
+	g_return_val_if_fail (package_out != NULL, FALSE);
+
+	if (!find_sorted (self->packages, name, &idx))
+		return FALSE;
+
+	g_variant_get_child (self->packages, idx, "(&s&s&s&s&s)",
+			     &package_out->name,
+			     &package_out->nevra,
+			     &package_out->evr,
+			     &package_out->reponame,
+			     &package_out->summary);
+
+	return TRUE;
+}
+
+/*
+ * gs_rpmostree_package_index_lookup_provides:
+ * @self: a #GsRpmostreePackageIndex
+ * @provides: (array zero-terminated=1): namespaced provides, without versions
+ *
+ * Look up the latest available packages which provide any of @provides.
+ *
+ * Returns: (transfer full) (element-type GsRpmostreeIndexedPackage): the
+ *   packages, each listed once
+ */
+GArray *
+gs_rpmostree_package_index_lookup_provides (GsRpmostreePackageIndex *self,
+                                            const gchar * const     *provides)
+{
+	GArray *packages = g_array_new (FALSE, FALSE, sizeof (GsRpmostreeIndexedPackage));
+	g_autoptr(GHashTable) seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+	g_return_val_if_fail (GS_IS_RPMOSTREE_PACKAGE_INDEX (self), packages);
+
+	for (guint i = 0; provides != NULL && provides[i] != NULL; i++) {
+		g_autoptr(GVariant) names = NULL;
+		GVariantIter iter;
+		const gchar *name;
+		gsize idx;
+
+		if (!find_sorted (self->provides, provides[i], &idx))
+			continue;
+
+		g_variant_get_child (self->provides, idx, "(&s@as)", NULL, &names);
+		g_variant_iter_init (&iter, names);
+		while (g_variant_iter_next (&iter, "&s", &name)) {
+			GsRpmostreeIndexedPackage package;
+
+			if (g_hash_table_contains (seen, name) ||
+			    !gs_rpmostree_package_index_lookup_name (self, name, &package))
+				continue;
+
+			g_hash_table_add (seen, (gpointer) package.name);
+			g_array_append_val (packages, package);
+		}
+	}
+
+	return packages;
+}
+
+/*
+ * gs_rpmostree_package_index_save:
+ * @self: a #GsRpmostreePackageIndex
+ * @filename: (type filename): file to save the index to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the index so it can be loaded with
+ * gs_rpmostree_package_index_new_from_file(). The file is replaced
+ * atomically, so any index currently mapped from it stays valid.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+gs_rpmostree_package_index_save (GsRpmostreePackageIndex  *self,
+                                 const gchar              *filename,
+                                 GError                  **error)
+{
+	g_return_val_if_fail (GS_IS_RPMOSTREE_PACKAGE_INDEX (self), FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	return g_file_set_contents (filename,
+				    g_variant_get_data (self->data),
+				    g_variant_get_size (self->data),
+				    error);
+}
+
+static void
+gs_rpmostree_package_index_finalize (GObject *object)
+{
+	GsRpmostreePackageIndex *self = GS_RPMOSTREE_PACKAGE_INDEX (object);
+
+	g_clear_pointer (&self->packages, g_variant_unref);
+	g_clear_pointer (&self->provides, g_variant_unref);
+	g_clear_pointer (&self->data, g_variant_unref);
+
+	G_OBJECT_CLASS (gs_rpmostree_package_index_parent_class)->finalize (object);
+}
+
+static void
+gs_rpmostree_package_index_class_init (GsRpmostreePackageIndexClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = gs_rpmostree_package_index_finalize;
+}
+
+static void
+gs_rpmostree_package_index_init (GsRpmostreePackageIndex *self)
+{
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2022 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include <libdnf/libdnf.h>
+
+G_BEGIN_DECLS
+
+#define GS_TYPE_RPMOSTREE_PACKAGE_INDEX (gs_rpmostree_package_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsRpmostreePackageIndex, gs_rpmostree_package_index, GS, RPMOSTREE_PACKAGE_INDEX, GObject)
+
+/* The strings are owned by the index, and are valid for as long as it is. */
+typedef struct {
+	const gchar	*name;
+	const gchar	*nevra;
+	const gchar	*evr;
+	const gchar	*reponame;
+	const gchar	*summary;
+} GsRpmostreeIndexedPackage;
+
+GsRpmostreePackageIndex	*gs_rpmostree_package_index_new_from_file	(const gchar		 *filename,
+									 GError			**error);
+GsRpmostreePackageIndex	*gs_rpmostree_package_index_new_from_sack	(DnfSack		 *sack,
+									 const gchar		 *stamp);
+
+const gchar	*gs_rpmostree_package_index_get_stamp		(GsRpmostreePackageIndex	 *self);
+gboolean	 gs_rpmostree_package_index_lookup_name		(GsRpmostreePackageIndex	 *self,
+								 const gchar			 *name,
+								 GsRpmostreeIndexedPackage	 *package_out);
+GArray		*gs_rpmostree_package_index_lookup_provides	(GsRpmostreePackageIndex	 *self,
+								 const gchar * const		 *provides);
+
+gboolean	 gs_rpmostree_package_index_save		(GsRpmostreePackageIndex	 *self,
+								 const gchar			 *filename,
+								 GError				**error);
+
+G_END_DECLS
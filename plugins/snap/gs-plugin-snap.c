@@ -25,8 +25,16 @@
  * the real work is done in the snapd daemon. FIXME: This means the plugin can
  * therefore execute entirely in the main thread, making asynchronous calls,
  * once all the vfuncs have been ported.
+ *
+ * The results of find queries to the store are cached for
+ * %QUERY_CACHE_TTL_SECONDS, as the same queries are repeated a lot (for
+ * example, by the shell search provider as the user types), and identical
+ * queries which are made at the same time share one request to snapd.
  */
 
+#define QUERY_CACHE_TTL_SECONDS		300
+#define QUERY_CACHE_MAX_ENTRIES		100
+
 struct _GsPluginSnap {
 	GsPlugin		 parent;
 
@@ -36,6 +44,16 @@ struct _GsPluginSnap {
 
 	GMutex			 store_snaps_lock;
 	GHashTable		*store_snaps;
+
+	GMutex			 queries_lock;
+	GHashTable		*query_cache;  /* (lock queries_lock) (owned) (element-type utf8 QueryCacheEntry) */
+	GHashTable		*pending_queries;  /* (lock queries_lock) (owned) (element-type utf8 PendingQuery) */
+
+	/* requests to snapd are made from their own thread, as they are
+	 * shared between callers which may stop iterating their own contexts
+	 * at any time */
+	GThread			*query_thread;  /* (lock queries_lock) (owned) (nullable) */
+	GMainLoop		*query_loop;  /* (lock queries_lock) (owned) (nullable) */
 };
 
 G_DEFINE_TYPE (GsPluginSnap, gs_plugin_snap, GS_TYPE_PLUGIN)
@@ -61,6 +79,45 @@ cache_entry_free (CacheEntry *entry)
 	g_slice_free (CacheEntry, entry);
 }
 
+typedef struct {
+	GPtrArray *snaps;  /* (owned) (element-type SnapdSnap) */
+	gint64 expiry_time;  /* monotonic, in µs */
+	gint64 last_used_time;  /* monotonic, in µs */
+} QueryCacheEntry;
+
+static void
+query_cache_entry_free (QueryCacheEntry *entry)
+{
+	g_ptr_array_unref (entry->snaps);
+	g_slice_free (QueryCacheEntry, entry);
+}
+
+/* An identical query which is in flight, shared by all the callers waiting for
+ * its results. */
+typedef struct {
+	GPtrArray *waiters;  /* (lock queries_lock) (owned) (nullable) (element-type GTask<FindSnapsWaiter>); %NULL once completed */
+	GCancellable *cancellable;  /* (owned); cancels the snapd request */
+} PendingQuery;
+
+static void
+pending_query_clear (PendingQuery *pending)
+{
+	g_clear_pointer (&pending->waiters, g_ptr_array_unref);
+	g_object_unref (pending->cancellable);
+}
+
+static PendingQuery *
+pending_query_ref (PendingQuery *pending)
+{
+	return g_atomic_rc_box_acquire (pending);
+}
+
+static void
+pending_query_unref (PendingQuery *pending)
+{
+	g_atomic_rc_box_release_full (pending, (GDestroyNotify) pending_query_clear);
+}
+
 static SnapdAuthData *
 get_auth_data (GsPluginSnap *self)
 {
@@ -136,6 +193,7 @@ gs_plugin_snap_init (GsPluginSnap *self)
 	g_autoptr (GError) error = NULL;
 
 	g_mutex_init (&self->store_snaps_lock);
+	g_mutex_init (&self->queries_lock);
 
 	client = get_client (self, FALSE, &error);
 	if (client == NULL) {
@@ -145,6 +203,10 @@ gs_plugin_snap_init (GsPluginSnap *self)
 
 	self->store_snaps = g_hash_table_new_full (g_str_hash, g_str_equal,
 						   g_free, (GDestroyNotify) cache_entry_free);
+	self->query_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+						   g_free, (GDestroyNotify) query_cache_entry_free);
+	self->pending_queries = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, (GDestroyNotify) pending_query_unref);
 
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_BETTER_THAN, "packagekit");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_BEFORE, "icons");
@@ -332,6 +394,379 @@ store_snap_cache_update (GsPluginSnap *self,
 	}
 }
 
+static gchar *
+query_cache_key (SnapdFindFlags  flags,
+                 const gchar    *section,
+                 const gchar    *query)
+{
+	return g_strdup_printf ("%u\x1f%s\x1f%s", (guint) flags,
+				(section != NULL) ? section : "",
+				(query != NULL) ? query : "");
+}
+
+/* Must be called with the queries lock held. */
+static GPtrArray *
+query_cache_lookup_locked (GsPluginSnap *self,
+                           const gchar  *key)
+{
+	QueryCacheEntry *entry;
+	gint64 now = g_get_monotonic_time ();
+
+	entry = g_hash_table_lookup (self->query_cache, key);
+	if (entry == NULL)
+		return NULL;
+
+	if (now >= entry->expiry_time) {
+		g_hash_table_remove (self->query_cache, key);
+		return NULL;
+	}
+
+	entry->last_used_time = now;
+
+	return g_ptr_array_ref (entry->snaps);
+}
+
+/* Must be called with the queries lock held. */
+static void
+query_cache_insert_locked (GsPluginSnap *self,
+                           const gchar  *key,
+                           GPtrArray    *snaps)
+{
+	QueryCacheEntry *entry;
+	gint64 now = g_get_monotonic_time ();
+
+	/* make room by dropping the expired entries, or else the least
+	 * recently used one */
+	if (g_hash_table_size (self->query_cache) >= QUERY_CACHE_MAX_ENTRIES &&
+	    !g_hash_table_contains (self->query_cache, key)) {
+		GHashTableIter iter;
+		gpointer iter_key, iter_value;
+		const gchar *lru_key = NULL;
+		gint64 lru_time = G_MAXINT64;
+
+		g_hash_table_iter_init (&iter, self->query_cache);
+		while (g_hash_table_iter_next (&iter, &iter_key, &iter_value)) {
+			QueryCacheEntry *e = iter_value;
+
+			if (now >= e->expiry_time) {
+				g_hash_table_iter_remove (&iter);
+			} else if (e->last_used_time < lru_time) {
+				lru_key = iter_key;
+				lru_time = e->last_used_time;
+			}
+		}
+
+		if (g_hash_table_size (self->query_cache) >= QUERY_CACHE_MAX_ENTRIES && lru_key != NULL)
+			g_hash_table_remove (self->query_cache, lru_key);
+	}
+
+	entry = g_slice_new (QueryCacheEntry);
+	entry->snaps = g_ptr_array_ref (snaps);
+	entry->expiry_time = now + QUERY_CACHE_TTL_SECONDS * G_USEC_PER_SEC;
+	entry->last_used_time = now;
+	g_hash_table_insert (self->query_cache, g_strdup (key), entry);
+}
+
+typedef struct {
+	gchar *key;  /* (owned) */
+	PendingQuery *pending;  /* (owned) (nullable) */
+	gulong cancelled_id;
+} FindSnapsWaiter;
+
+static void
+find_snaps_waiter_free (FindSnapsWaiter *waiter)
+{
+	g_free (waiter->key);
+	g_clear_pointer (&waiter->pending, pending_query_unref);
+	g_free (waiter);
+}
+
+typedef struct {
+	GsPluginSnap *self;  /* (owned) */
+	SnapdClient *client;  /* (owned) */
+	gchar *key;  /* (owned) */
+	SnapdFindFlags flags;
+	gchar *section;  /* (owned) (nullable) */
+	gchar *query;  /* (owned) (nullable) */
+	PendingQuery *pending;  /* (owned) */
+} FindSectionData;
+
+static void
+find_section_data_free (FindSectionData *data)
+{
+	g_object_unref (data->self);
+	g_object_unref (data->client);
+	g_free (data->key);
+	g_free (data->section);
+	g_free (data->query);
+	pending_query_unref (data->pending);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FindSectionData, find_section_data_free)
+
+static gpointer
+query_thread_cb (gpointer user_data)
+{
+	g_autoptr(GMainLoop) loop = user_data;
+	GMainContext *context = g_main_loop_get_context (loop);
+
+	g_main_context_push_thread_default (context);
+	g_main_loop_run (loop);
+	g_main_context_pop_thread_default (context);
+
+	return NULL;
+}
+
+static gboolean
+query_loop_quit_cb (gpointer user_data)
+{
+	g_main_loop_quit (user_data);
+	return G_SOURCE_REMOVE;
+}
+
+/* Must be called with the queries lock held. */
+static GMainContext *
+get_query_context_locked (GsPluginSnap *self)
+{
+	if (self->query_loop == NULL) {
+		g_autoptr(GMainContext) context = g_main_context_new ();
+
+		self->query_loop = g_main_loop_new (context, FALSE);
+		self->query_thread = g_thread_new ("gs-plugin-snap-queries", query_thread_cb,
+						   g_main_loop_ref (self->query_loop));
+	}
+
+	return g_main_loop_get_context (self->query_loop);
+}
+
+static void find_section_cb (GObject      *source_object,
+                             GAsyncResult *result,
+                             gpointer      user_data);
+
+/* Runs in the query thread. */
+static gboolean
+find_section_start_cb (gpointer user_data)
+{
+	FindSectionData *data = user_data;
+
+	snapd_client_find_section_async (data->client, data->flags, data->section, data->query,
+					 data->pending->cancellable, find_section_cb, data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void find_snaps_cancelled_cb (GCancellable *cancellable,
+                                     gpointer      user_data);
+
+/* The results are returned from the query cache if possible. Otherwise, if an
+ * identical query is already in flight, this waits for its results rather than
+ * making another request. Cancelling @cancellable returns straight away; the
+ * shared snapd request is only cancelled once all of its callers have been.
+ *
+ * The request is made from the query thread rather than the caller’s thread,
+ * so that it completes for the other callers even if the first one is
+ * cancelled and stops iterating its main context. */
+static void
+find_snaps_async (GsPluginSnap        *self,
+                  SnapdClient         *client,
+                  SnapdFindFlags       flags,
+                  const gchar         *section,
+                  const gchar         *query,
+                  GCancellable        *cancellable,
+                  GAsyncReadyCallback  callback,
+                  gpointer             user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	g_autofree gchar *key = NULL;
+	g_autoptr(GPtrArray) snaps = NULL;
+	g_autoptr(FindSectionData) data = NULL;
+	g_autoptr(GMainContext) query_context = NULL;
+	PendingQuery *pending;
+	FindSnapsWaiter *waiter;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, find_snaps_async);
+
+	key = query_cache_key (flags, section, query);
+	waiter = g_new0 (FindSnapsWaiter, 1);
+	waiter->key = g_strdup (key);
+	g_task_set_task_data (task, waiter, (GDestroyNotify) find_snaps_waiter_free);
+
+	/* connect before @task can be returned by find_section_cb(), which
+	 * disconnects it */
+	if (cancellable != NULL)
+		waiter->cancelled_id = g_cancellable_connect (cancellable,
+							      G_CALLBACK (find_snaps_cancelled_cb),
+							      task, NULL);
+
+	g_mutex_lock (&self->queries_lock);
+
+	snaps = query_cache_lookup_locked (self, key);
+	if (snaps != NULL) {
+		g_mutex_unlock (&self->queries_lock);
+		if (cancellable != NULL)
+			g_cancellable_disconnect (cancellable, waiter->cancelled_id);
+		g_task_return_pointer (task, g_steal_pointer (&snaps), (GDestroyNotify) g_ptr_array_unref);
+		return;
+	}
+
+	/* join an identical query which is already in flight */
+	pending = g_hash_table_lookup (self->pending_queries, key);
+	if (pending != NULL) {
+		waiter->pending = pending_query_ref (pending);
+		g_ptr_array_add (pending->waiters, g_steal_pointer (&task));
+		g_mutex_unlock (&self->queries_lock);
+		return;
+	}
+
+	pending = g_atomic_rc_box_new0 (PendingQuery);
+	pending->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+	pending->cancellable = g_cancellable_new ();
+	waiter->pending = pending_query_ref (pending);
+	g_ptr_array_add (pending->waiters, g_steal_pointer (&task));
+	g_hash_table_insert (self->pending_queries, g_strdup (key), pending);
+
+	data = g_new0 (FindSectionData, 1);
+	data->self = g_object_ref (self);
+	data->client = g_object_ref (client);
+	data->key = g_steal_pointer (&key);
+	data->flags = flags;
+	data->section = g_strdup (section);
+	data->query = g_strdup (query);
+	data->pending = pending_query_ref (pending);
+	query_context = g_main_context_ref (get_query_context_locked (self));
+
+	g_mutex_unlock (&self->queries_lock);
+
+	g_main_context_invoke (query_context, find_section_start_cb, g_steal_pointer (&data));
+}
+
+/* Runs in the caller’s main context, outside the ::cancelled emission, so the
+ * handler can be disconnected. */
+static gboolean
+find_snaps_cancelled_idle_cb (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GsPluginSnap *self = g_task_get_source_object (task);
+	FindSnapsWaiter *waiter = g_task_get_task_data (task);
+	PendingQuery *pending = waiter->pending;
+	g_autoptr(GTask) stolen_task = NULL;
+	gboolean cancel_request = FALSE;
+	guint idx;
+
+	/* the results came from the query cache */
+	if (pending == NULL)
+		return G_SOURCE_REMOVE;
+
+	g_mutex_lock (&self->queries_lock);
+	if (pending->waiters != NULL &&
+	    g_ptr_array_find (pending->waiters, task, &idx)) {
+		stolen_task = g_ptr_array_steal_index_fast (pending->waiters, idx);
+
+		/* nobody wants the results any more, so stop new callers
+		 * joining the request before cancelling it */
+		if (pending->waiters->len == 0) {
+			if (g_hash_table_lookup (self->pending_queries, waiter->key) == pending)
+				g_hash_table_remove (self->pending_queries, waiter->key);
+			cancel_request = TRUE;
+		}
+	}
+	g_mutex_unlock (&self->queries_lock);
+
+	/* find_section_cb() has already returned it */
+	if (stolen_task == NULL)
+		return G_SOURCE_REMOVE;
+
+	if (cancel_request)
+		g_cancellable_cancel (pending->cancellable);
+
+	g_cancellable_disconnect (g_task_get_cancellable (task), waiter->cancelled_id);
+	g_task_return_error_if_cancelled (stolen_task);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+find_snaps_cancelled_cb (GCancellable *cancellable,
+                         gpointer      user_data)
+{
+	GTask *task = G_TASK (user_data);
+	g_autoptr(GSource) source = g_idle_source_new ();
+
+	g_source_set_callback (source, find_snaps_cancelled_idle_cb, g_object_ref (task), g_object_unref);
+	g_source_attach (source, g_task_get_context (task));
+}
+
+static void
+find_section_cb (GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	SnapdClient *client = SNAPD_CLIENT (source_object);
+	g_autoptr(FindSectionData) data = user_data;
+	GsPluginSnap *self = data->self;
+	g_autoptr(GPtrArray) snaps = NULL;
+	g_autoptr(GPtrArray) waiters = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	snaps = snapd_client_find_section_finish (client, result, NULL, &local_error);
+	if (snaps == NULL)
+		snapd_error_convert (&local_error);
+	else
+		store_snap_cache_update (self, snaps, data->flags & SNAPD_FIND_FLAGS_MATCH_NAME);
+
+	/* a newer request for the same query may have replaced this one if
+	 * all its callers were cancelled */
+	g_mutex_lock (&self->queries_lock);
+	if (snaps != NULL)
+		query_cache_insert_locked (self, data->key, snaps);
+	if (g_hash_table_lookup (self->pending_queries, data->key) == data->pending)
+		g_hash_table_remove (self->pending_queries, data->key);
+	waiters = g_steal_pointer (&data->pending->waiters);
+	g_mutex_unlock (&self->queries_lock);
+
+	for (guint i = 0; i < waiters->len; i++) {
+		GTask *task = g_ptr_array_index (waiters, i);
+		GCancellable *cancellable = g_task_get_cancellable (task);
+		FindSnapsWaiter *waiter = g_task_get_task_data (task);
+
+		if (cancellable != NULL)
+			g_cancellable_disconnect (cancellable, waiter->cancelled_id);
+
+		if (snaps != NULL)
+			g_task_return_pointer (task, g_ptr_array_ref (snaps), (GDestroyNotify) g_ptr_array_unref);
+		else
+			g_task_return_error (task, g_error_copy (local_error));
+	}
+}
+
+static GPtrArray *
+find_snaps_finish (GsPluginSnap  *self,
+                   GAsyncResult  *result,
+                   GError       **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+	g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == find_snaps_async, NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+async_result_cb (GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	GAsyncResult **result_out = user_data;
+
+	g_assert (*result_out == NULL);
+	*result_out = g_object_ref (result);
+	g_main_context_wakeup (g_main_context_get_thread_default ());
+}
+
+/* Synchronous version of find_snaps_async() for the vfuncs which are still
+ * run in a worker thread. The returned array must not be modified, as it may
+ * be shared with the query cache. */
 static GPtrArray *
 find_snaps (GsPluginSnap    *self,
             SnapdClient     *client,
@@ -341,17 +776,17 @@ find_snaps (GsPluginSnap    *self,
             GCancellable    *cancellable,
             GError         **error)
 {
-	g_autoptr(GPtrArray) snaps = NULL;
+	g_autoptr(GMainContext) context = g_main_context_new ();
+	g_autoptr(GMainContextPusher) pusher = g_main_context_pusher_new (context);
+	g_autoptr(GAsyncResult) result = NULL;
 
-	snaps = snapd_client_find_section_sync (client, flags, section, query, NULL, cancellable, error);
-	if (snaps == NULL) {
-		snapd_error_convert (error);
-		return NULL;
-	}
+	find_snaps_async (self, client, flags, section, query, cancellable,
+			  async_result_cb, &result);
 
-	store_snap_cache_update (self, snaps, flags & SNAPD_FIND_FLAGS_MATCH_NAME);
+	while (result == NULL)
+		g_main_context_iteration (context, TRUE);
 
-	return g_steal_pointer (&snaps);
+	return find_snaps_finish (self, result, error);
 }
 
 static gchar *
@@ -469,6 +904,21 @@ gs_plugin_snap_dispose (GObject *object)
 	g_clear_pointer (&self->store_name, g_free);
 	g_clear_pointer (&self->store_hostname, g_free);
 	g_clear_pointer (&self->store_snaps, g_hash_table_unref);
+	g_clear_pointer (&self->query_cache, g_hash_table_unref);
+	g_clear_pointer (&self->pending_queries, g_hash_table_unref);
+
+	/* this may be the last reference, dropped by find_section_cb() in the
+	 * query thread itself, which then exits once the callback returns */
+	if (self->query_loop != NULL) {
+		g_main_context_invoke (g_main_loop_get_context (self->query_loop),
+				       query_loop_quit_cb, self->query_loop);
+		if (self->query_thread == g_thread_self ())
+			g_thread_unref (self->query_thread);
+		else
+			g_thread_join (self->query_thread);
+		self->query_thread = NULL;
+		g_clear_pointer (&self->query_loop, g_main_loop_unref);
+	}
 
 	G_OBJECT_CLASS (gs_plugin_snap_parent_class)->dispose (object);
 }
@@ -479,6 +929,7 @@ gs_plugin_snap_finalize (GObject *object)
 	GsPluginSnap *self = GS_PLUGIN_SNAP (object);
 
 	g_mutex_clear (&self->store_snaps_lock);
+	g_mutex_clear (&self->queries_lock);
 
 	G_OBJECT_CLASS (gs_plugin_snap_parent_class)->finalize (object);
 }
@@ -851,6 +1302,8 @@ gs_plugin_add_alternates (GsPlugin *plugin,
 
 		snap = get_store_snap (self, client, snap_name, TRUE, cancellable, NULL);
 		if (snap == NULL) {
+			if (g_cancellable_set_error_if_cancelled (cancellable, error))
+				return FALSE;
 			g_warning ("Failed to get store snap %s", snap_name);
 			return TRUE;
 		}
@@ -1169,6 +1622,56 @@ gs_plugin_snap_refine_async (GsPlugin            *plugin,
 static void get_icon_cb (GObject      *object,
                          GAsyncResult *result,
                          gpointer      user_data);
+static void find_store_snap_cb (GObject      *source_object,
+                                GAsyncResult *result,
+                                gpointer      user_data);
+
+/* Whether refining @app needs the full details of its snap from the store,
+ * rather than what’s already in the store snap cache. */
+static gboolean
+app_needs_store_details (GsPluginSnap        *self,
+                         GsApp               *app,
+                         GsPluginRefineFlags  flags)
+{
+	const gchar *channel = gs_app_get_branch (app);
+	g_autoptr(SnapdSnap) store_snap = NULL;
+	g_autofree gchar *store_channel = NULL;
+
+	if (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS)
+		return TRUE;
+	if (channel == NULL)
+		return FALSE;
+
+	store_snap = store_snap_cache_lookup (self, gs_app_get_metadata_item (app, "snap::name"), FALSE);
+	if (store_snap != NULL)
+		store_channel = expand_channel_name (snapd_snap_get_channel (store_snap));
+
+	return (g_strcmp0 (store_channel, channel) != 0);
+}
+
+typedef struct {
+	GTask *task;  /* (owned) (nullable) */
+	SnapdClient *client;  /* (owned) */
+	GPtrArray *local_snaps;  /* (owned) (element-type SnapdSnap) */
+	GHashTable *need_details;  /* (owned) (element-type utf8) */
+	GHashTable *store_snaps;  /* (owned) (element-type utf8 SnapdSnap) */
+	guint n_pending_ops;
+} GetStoreSnapsData;
+
+static void
+get_store_snaps_data_free (GetStoreSnapsData *data)
+{
+	g_assert (data->n_pending_ops == 0);
+
+	g_clear_object (&data->task);
+	g_object_unref (data->client);
+	g_ptr_array_unref (data->local_snaps);
+	g_hash_table_unref (data->need_details);
+	g_hash_table_unref (data->store_snaps);
+	g_free (data);
+}
+
+static void refine_snaps (GetStoreSnapsData *store_data);
 
 static void
 get_snaps_cb (GObject      *object,
@@ -1181,8 +1684,8 @@ get_snaps_cb (GObject      *object,
 	GCancellable *cancellable = g_task_get_cancellable (task);
 	GsPluginRefineData *data = g_task_get_task_data (task);
 	GsAppList *list = data->list;
-	GsPluginRefineFlags flags = data->flags;
 	g_autoptr(GPtrArray) local_snaps = NULL;
+	GetStoreSnapsData *store_data;
 	g_autoptr(GError) local_error = NULL;
 
 	local_snaps = snapd_client_get_snaps_finish (client, result, &local_error);
@@ -1191,13 +1694,90 @@ get_snaps_cb (GObject      *object,
 		return;
 	}
 
+	/* Get the full store details for the snaps which need them, in
+	 * parallel, before refining the apps. */
+	store_data = g_new0 (GetStoreSnapsData, 1);
+	store_data->task = g_steal_pointer (&task);
+	store_data->client = g_object_ref (client);
+	store_data->local_snaps = g_steal_pointer (&local_snaps);
+	store_data->need_details = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	store_data->store_snaps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	store_data->n_pending_ops = 1;
+
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		const gchar *snap_name = gs_app_get_metadata_item (app, "snap::name");
+		g_autoptr(SnapdSnap) store_snap = NULL;
+
+		if (snap_name == NULL ||
+		    g_hash_table_contains (store_data->need_details, snap_name) ||
+		    !app_needs_store_details (self, app, data->flags))
+			continue;
+
+		g_hash_table_add (store_data->need_details, g_strdup (snap_name));
+
+		store_snap = store_snap_cache_lookup (self, snap_name, TRUE);
+		if (store_snap != NULL) {
+			g_hash_table_replace (store_data->store_snaps, g_strdup (snap_name), g_steal_pointer (&store_snap));
+			continue;
+		}
+
+		store_data->n_pending_ops++;
+		find_snaps_async (self, client,
+				  SNAPD_FIND_FLAGS_SCOPE_WIDE | SNAPD_FIND_FLAGS_MATCH_NAME,
+				  NULL, snap_name, cancellable,
+				  find_store_snap_cb, store_data);
+	}
+
+	find_store_snap_cb (G_OBJECT (self), NULL, store_data);
+}
+
+/* @result is %NULL for the initial call from get_snaps_cb() */
+static void
+find_store_snap_cb (GObject      *source_object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+	GsPluginSnap *self = GS_PLUGIN_SNAP (source_object);
+	GetStoreSnapsData *store_data = user_data;
+	g_autoptr(GPtrArray) snaps = NULL;
+
+	/* errors are ignored, as the app may not be in the store */
+	if (result != NULL)
+		snaps = find_snaps_finish (self, result, NULL);
+	if (snaps != NULL && snaps->len > 0) {
+		SnapdSnap *snap = g_ptr_array_index (snaps, 0);
+		g_hash_table_replace (store_data->store_snaps,
+				      g_strdup (snapd_snap_get_name (snap)),
+				      g_object_ref (snap));
+	}
+
+	g_assert (store_data->n_pending_ops > 0);
+	store_data->n_pending_ops--;
+
+	if (store_data->n_pending_ops > 0)
+		return;
+
+	refine_snaps (store_data);
+	get_store_snaps_data_free (store_data);
+}
+
+static void
+refine_snaps (GetStoreSnapsData *store_data)
+{
+	g_autoptr(GTask) task = g_steal_pointer (&store_data->task);
+	SnapdClient *client = store_data->client;
+	GsPluginSnap *self = g_task_get_source_object (task);
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	GsPluginRefineData *data = g_task_get_task_data (task);
+	GsAppList *list = data->list;
+	GsPluginRefineFlags flags = data->flags;
+
 	for (guint i = 0; i < gs_app_list_length (list); i++) {
 		GsApp *app = gs_app_list_index (list, i);
 		const gchar *snap_name, *name, *website, *contact, *version;
 		g_autofree gchar *channel = NULL;
-		g_autofree gchar *store_channel = NULL;
 		g_autofree gchar *tracking_channel = NULL;
-		gboolean need_details = FALSE;
 		SnapdConfinement confinement = SNAPD_CONFINEMENT_UNKNOWN;
 		SnapdSnap *local_snap, *snap;
 		g_autoptr(SnapdSnap) store_snap = NULL;
@@ -1209,20 +1789,13 @@ get_snaps_cb (GObject      *object,
 		channel = g_strdup (gs_app_get_branch (app));
 
 		/* get information from locally installed snaps and information we already have */
-		local_snap = find_snap_in_array (local_snaps, snap_name);
-		store_snap = store_snap_cache_lookup (self, snap_name, FALSE);
-		if (store_snap != NULL)
-			store_channel = expand_channel_name (snapd_snap_get_channel (store_snap));
-
-		/* check if requested information requires us to go to the Snap Store */
-		if (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS)
-			need_details = TRUE;
-		if (channel != NULL && g_strcmp0 (store_channel, channel) != 0)
-			need_details = TRUE;
-		if (need_details) {
-			g_clear_object (&store_snap);
-			store_snap = get_store_snap (self, client, snap_name, need_details,
-						     cancellable, NULL);
+		local_snap = find_snap_in_array (store_data->local_snaps, snap_name);
+		if (snap_name != NULL && g_hash_table_contains (store_data->need_details, snap_name)) {
+			store_snap = g_hash_table_lookup (store_data->store_snaps, snap_name);
+			if (store_snap != NULL)
+				g_object_ref (store_snap);
+		} else {
+			store_snap = store_snap_cache_lookup (self, snap_name, FALSE);
 		}
 
 		/* we don't know anything about this snap */
@@ -16,6 +16,14 @@
 
 static gboolean snap_installed = FALSE;
 
+/* the plugin calls these from worker threads */
+static gint n_find_section_calls = 0;  /* (atomic) */
+static gint n_get_snaps_finish_calls = 0;  /* (atomic) */
+static GMutex find_section_lock;
+static GCond find_section_cond;
+static gboolean hold_find_section = FALSE;  /* (lock find_section_lock) */
+static GTask *held_find_section_task = NULL;  /* (lock find_section_lock) (owned) (nullable) */
+
 SnapdAuthData *
 snapd_login_sync (const gchar *username, const gchar *password, const gchar *otp,
 		  GCancellable *cancellable, GError **error)
@@ -76,11 +84,13 @@ make_snap (const gchar *name, SnapdSnapStatus status)
 	g_autoptr(GDateTime) install_date = NULL;
 	g_autoptr(GPtrArray) apps = NULL;
 	g_autoptr(GPtrArray) media = NULL;
+	g_autoptr(GPtrArray) channels = NULL;
 	SnapdMedia *m;
 
 	install_date = g_date_time_new_utc (2017, 1, 2, 11, 23, 58);
 
 	apps = g_ptr_array_new_with_free_func (g_object_unref);
+	channels = g_ptr_array_new_with_free_func (g_object_unref);
 
 	media = g_ptr_array_new_with_free_func (g_object_unref);
 	m = g_object_new (SNAPD_TYPE_MEDIA,
@@ -100,6 +110,7 @@ make_snap (const gchar *name, SnapdSnapStatus status)
 
 	return g_object_new (SNAPD_TYPE_SNAP,
 			     "apps", status == SNAPD_SNAP_STATUS_INSTALLED ? apps : NULL,
+			     "channels", channels,
 			     "common-ids", common_ids,
 			     "description", "DESCRIPTION",
 			     "download-size", status == SNAPD_SNAP_STATUS_AVAILABLE ? 500 : 0,
@@ -130,6 +141,27 @@ snapd_client_get_snaps_sync (SnapdClient *client,
 	return snaps;
 }
 
+void
+snapd_client_get_snaps_async (SnapdClient *client,
+			      SnapdGetSnapsFlags flags, gchar **names,
+			      GCancellable *cancellable,
+			      GAsyncReadyCallback callback, gpointer user_data)
+{
+	g_autoptr(GTask) task = g_task_new (client, cancellable, callback, user_data);
+	g_task_return_pointer (task,
+			       snapd_client_get_snaps_sync (client, flags, names, cancellable, NULL),
+			       (GDestroyNotify) g_ptr_array_unref);
+}
+
+GPtrArray *
+snapd_client_get_snaps_finish (SnapdClient *client,
+			       GAsyncResult *result,
+			       GError **error)
+{
+	g_atomic_int_inc (&n_get_snaps_finish_calls);
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 SnapdSnap *
 snapd_client_get_snap_sync (SnapdClient *client,
 			    const gchar *name,
@@ -180,19 +212,49 @@ snapd_client_get_connections_sync (SnapdClient *client,
 	return TRUE;
 }
 
-GPtrArray *
-snapd_client_find_section_sync (SnapdClient *client,
-				SnapdFindFlags flags,
-				const gchar *section, const gchar *query,
-				gchar **suggested_currency,
-				GCancellable *cancellable, GError **error)
+static void
+find_section_return (GTask *task)
 {
 	GPtrArray *snaps;
 
 	snaps = g_ptr_array_new_with_free_func (g_object_unref);
-	g_ptr_array_add (snaps, make_snap ("snap", SNAPD_SNAP_STATUS_AVAILABLE));
+	g_ptr_array_add (snaps, make_snap (g_task_get_task_data (task), SNAPD_SNAP_STATUS_AVAILABLE));
+	g_task_return_pointer (task, snaps, (GDestroyNotify) g_ptr_array_unref);
+}
 
-	return snaps;
+void
+snapd_client_find_section_async (SnapdClient *client,
+				 SnapdFindFlags flags,
+				 const gchar *section, const gchar *query,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback, gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&find_section_lock);
+
+	g_atomic_int_inc (&n_find_section_calls);
+
+	task = g_task_new (client, cancellable, callback, user_data);
+	g_task_set_task_data (task,
+			      g_strdup ((flags & SNAPD_FIND_FLAGS_MATCH_NAME) ? query : "snap"),
+			      g_free);
+	if (hold_find_section) {
+		g_assert_null (held_find_section_task);
+		held_find_section_task = g_steal_pointer (&task);
+		g_cond_broadcast (&find_section_cond);
+		return;
+	}
+
+	find_section_return (task);
+}
+
+GPtrArray *
+snapd_client_find_section_finish (SnapdClient *client,
+				  GAsyncResult *result,
+				  gchar **suggested_currency,
+				  GError **error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 gboolean
@@ -258,6 +320,7 @@ gs_plugins_snap_test_func (GsPluginLoader *plugin_loader)
 	g_autoptr(GsAppList) apps = NULL;
 	gboolean ret;
 	GsApp *app;
+	gint n_find_calls;
 	GPtrArray *screenshots, *images;
 	AsScreenshot *screenshot;
 	AsImage *image;
@@ -308,6 +371,20 @@ gs_plugins_snap_test_func (GsPluginLoader *plugin_loader)
 	g_assert_cmpint (gs_app_get_size_download (app), ==, 500);
 	g_assert_cmpint (gs_app_get_install_date (app), ==, 0);
 
+	/* the same search again is answered from the query cache */
+	n_find_calls = g_atomic_int_get (&n_find_section_calls);
+	g_object_unref (plugin_job);
+	g_object_unref (apps);
+	plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_SEARCH,
+					 "search", "snap",
+					 "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON | GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS,
+					 NULL);
+	apps = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (gs_app_list_length (apps), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&n_find_section_calls), ==, n_find_calls);
+	app = gs_app_list_index (apps, 0);
+
 	g_object_unref (plugin_job);
 	plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_INSTALL,
 					 "app", app,
@@ -343,6 +420,158 @@ gs_plugins_snap_test_func (GsPluginLoader *plugin_loader)
 	g_assert (ret);
 }
 
+static void
+async_result_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	GAsyncResult **result_out = user_data;
+	*result_out = g_object_ref (result);
+}
+
+/* Make two identical store queries for @snap_name: one from the synchronous
+ * alternates vfunc in a worker thread, which starts the snapd request, and
+ * one from the asynchronous refine in this thread, which joins it. The snapd
+ * request is held until find_section_release() is called. */
+static GsApp *
+start_joined_queries (GsPluginLoader  *plugin_loader,
+                      const gchar     *snap_name,
+                      GCancellable    *alternates_cancellable,
+                      GAsyncResult   **alternates_result,
+                      GAsyncResult   **refine_result)
+{
+	GsPlugin *plugin = gs_plugin_loader_find_plugin (plugin_loader, "snap");
+	g_autoptr(GsApp) alternates_app = gs_app_new (NULL);
+	g_autoptr(GsApp) refine_app = gs_app_new (NULL);
+	g_autoptr(GsAppList) refine_list = gs_app_list_new ();
+	g_autoptr(GsPluginJob) alternates_job = NULL;
+	g_autoptr(GsPluginJob) refine_job = NULL;
+	gint n_get_snaps_finish_calls_before = g_atomic_int_get (&n_get_snaps_finish_calls);
+
+	g_mutex_lock (&find_section_lock);
+	hold_find_section = TRUE;
+	g_mutex_unlock (&find_section_lock);
+
+	gs_app_set_management_plugin (alternates_app, plugin);
+	gs_app_set_metadata (alternates_app, "snap::name", snap_name);
+	alternates_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_GET_ALTERNATES,
+					     "app", alternates_app,
+					     NULL);
+	gs_plugin_loader_job_process_async (plugin_loader, alternates_job, alternates_cancellable,
+					    async_result_cb, alternates_result);
+
+	/* wait for it to make the snapd request */
+	g_mutex_lock (&find_section_lock);
+	while (held_find_section_task == NULL)
+		g_cond_wait (&find_section_cond, &find_section_lock);
+	g_mutex_unlock (&find_section_lock);
+
+	/* the refine joins the request as soon as it has the local snaps */
+	gs_app_set_management_plugin (refine_app, plugin);
+	gs_app_set_metadata (refine_app, "snap::name", snap_name);
+	gs_app_list_add (refine_list, refine_app);
+	refine_job = gs_plugin_job_refine_new (refine_list, GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS);
+	gs_plugin_loader_job_process_async (plugin_loader, refine_job, NULL,
+					    async_result_cb, refine_result);
+
+	while (g_atomic_int_get (&n_get_snaps_finish_calls) == n_get_snaps_finish_calls_before)
+		g_main_context_iteration (NULL, TRUE);
+
+	return g_steal_pointer (&refine_app);
+}
+
+static void
+find_section_release (void)
+{
+	g_autoptr(GTask) task = NULL;
+
+	g_mutex_lock (&find_section_lock);
+	hold_find_section = FALSE;
+	task = g_steal_pointer (&held_find_section_task);
+	g_mutex_unlock (&find_section_lock);
+
+	g_assert_nonnull (task);
+	find_section_return (task);
+}
+
+static void
+gs_plugins_snap_query_coalesced_func (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GAsyncResult) alternates_result = NULL;
+	g_autoptr(GAsyncResult) refine_result = NULL;
+	g_autoptr(GsAppList) alternates = NULL;
+	g_autoptr(GsAppList) refined = NULL;
+	g_autoptr(GsApp) app = NULL;
+	g_autoptr(GError) error = NULL;
+	gint n_find_calls = g_atomic_int_get (&n_find_section_calls);
+
+	/* no snap, abort */
+	if (!gs_plugin_loader_get_enabled (plugin_loader, "snap")) {
+		g_test_skip ("not enabled");
+		return;
+	}
+
+	app = start_joined_queries (plugin_loader, "coalesced", NULL,
+				    &alternates_result, &refine_result);
+	find_section_release ();
+
+	while (alternates_result == NULL || refine_result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+
+	alternates = gs_plugin_loader_job_process_finish (plugin_loader, alternates_result, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (alternates);
+	refined = gs_plugin_loader_job_process_finish (plugin_loader, refine_result, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (refined);
+	g_assert_cmpint (gs_app_get_screenshots (app)->len, ==, 2);
+
+	/* only one request was made to snapd */
+	g_assert_cmpint (g_atomic_int_get (&n_find_section_calls), ==, n_find_calls + 1);
+}
+
+static void
+gs_plugins_snap_query_cancel_first_func (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+	g_autoptr(GAsyncResult) alternates_result = NULL;
+	g_autoptr(GAsyncResult) refine_result = NULL;
+	g_autoptr(GsAppList) alternates = NULL;
+	g_autoptr(GsAppList) refined = NULL;
+	g_autoptr(GsApp) app = NULL;
+	g_autoptr(GError) error = NULL;
+	gint n_find_calls = g_atomic_int_get (&n_find_section_calls);
+
+	/* no snap, abort */
+	if (!gs_plugin_loader_get_enabled (plugin_loader, "snap")) {
+		g_test_skip ("not enabled");
+		return;
+	}
+
+	app = start_joined_queries (plugin_loader, "cancel-first", cancellable,
+				    &alternates_result, &refine_result);
+
+	/* cancelling the caller which started the request returns it
+	 * straight away, without cancelling the request for the other */
+	g_cancellable_cancel (cancellable);
+	while (alternates_result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	alternates = gs_plugin_loader_job_process_finish (plugin_loader, alternates_result, NULL);
+
+	g_mutex_lock (&find_section_lock);
+	g_assert_false (g_cancellable_is_cancelled (g_task_get_cancellable (held_find_section_task)));
+	g_mutex_unlock (&find_section_lock);
+
+	/* the other caller still gets the results */
+	find_section_release ();
+	while (refine_result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	refined = gs_plugin_loader_job_process_finish (plugin_loader, refine_result, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (refined);
+	g_assert_cmpint (gs_app_get_screenshots (app)->len, ==, 2);
+
+	g_assert_cmpint (g_atomic_int_get (&n_find_section_calls), ==, n_find_calls + 1);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -372,5 +601,11 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/snap/test",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_snap_test_func);
+	g_test_add_data_func ("/gnome-software/plugins/snap/query-coalesced",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_snap_query_coalesced_func);
+	g_test_add_data_func ("/gnome-software/plugins/snap/query-cancel-first",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_snap_query_cancel_first_func);
 	return g_test_run ();
 }
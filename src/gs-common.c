@@ -998,3 +998,125 @@ gs_utils_invoke_reboot_async (GCancellable *cancellable,
 				ready_callback,
 				user_data);
 }
+
+/* whether every token of @old_tokens is a prefix of a token of @new_tokens,
+ * which means anything matching @new_tokens also matched @old_tokens */
+static gboolean
+gs_utils_search_tokens_refine (gchar **old_tokens, gchar **new_tokens)
+{
+	for (guint i = 0; old_tokens[i] != NULL; i++) {
+		gboolean found = FALSE;
+		for (guint j = 0; new_tokens[j] != NULL && !found; j++)
+			found = g_str_has_prefix (new_tokens[j], old_tokens[i]);
+		if (!found)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+gs_utils_add_search_text (GPtrArray		*haystack,
+			  GArray		*haystack_match_values,
+			  const gchar		*text,
+			  AsSearchTokenMatch	 match_value)
+{
+	g_auto(GStrv) tokens = NULL;
+	g_auto(GStrv) ascii_tokens = NULL;
+
+	if (text == NULL || text[0] == '\0')
+		return;
+	tokens = g_str_tokenize_and_fold (text, NULL, &ascii_tokens);
+	for (guint i = 0; tokens[i] != NULL; i++) {
+		g_ptr_array_add (haystack, g_steal_pointer (&tokens[i]));
+		g_array_append_val (haystack_match_values, match_value);
+	}
+	for (guint i = 0; ascii_tokens[i] != NULL; i++) {
+		g_ptr_array_add (haystack, g_steal_pointer (&ascii_tokens[i]));
+		g_array_append_val (haystack_match_values, match_value);
+	}
+}
+
+/* Scores @app against @tokens on the same fields, with the same weights, as
+ * the AppStream search index, as far as they are available on a #GsApp.
+ * Returns 0 if any token doesn’t match. */
+static guint
+gs_utils_app_get_search_match_value (GsApp *app, gchar **tokens)
+{
+	GPtrArray *sources = gs_app_get_sources (app);
+	guint match_value = 0;
+	g_autoptr(GPtrArray) haystack = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GArray) haystack_match_values = g_array_new (FALSE, FALSE, sizeof (AsSearchTokenMatch));
+
+	gs_utils_add_search_text (haystack, haystack_match_values,
+				  gs_app_get_id (app), AS_SEARCH_TOKEN_MATCH_ID);
+	gs_utils_add_search_text (haystack, haystack_match_values,
+				  gs_app_get_launchable (app, AS_LAUNCHABLE_KIND_DESKTOP_ID),
+				  AS_SEARCH_TOKEN_MATCH_ID);
+	gs_utils_add_search_text (haystack, haystack_match_values,
+				  gs_app_get_name (app), AS_SEARCH_TOKEN_MATCH_NAME);
+	gs_utils_add_search_text (haystack, haystack_match_values,
+				  gs_app_get_summary (app), AS_SEARCH_TOKEN_MATCH_SUMMARY);
+	gs_utils_add_search_text (haystack, haystack_match_values,
+				  gs_app_get_origin (app), AS_SEARCH_TOKEN_MATCH_ORIGIN);
+	for (guint i = 0; i < sources->len; i++) {
+		gs_utils_add_search_text (haystack, haystack_match_values,
+					  g_ptr_array_index (sources, i),
+					  AS_SEARCH_TOKEN_MATCH_PKGNAME);
+	}
+
+	for (guint i = 0; tokens[i] != NULL; i++) {
+		g_autofree gchar *folded = g_utf8_casefold (tokens[i], -1);
+		guint token_match_value = 0;
+		for (guint j = 0; j < haystack->len; j++) {
+			if (g_str_has_prefix (g_ptr_array_index (haystack, j), folded))
+				token_match_value |= g_array_index (haystack_match_values, AsSearchTokenMatch, j);
+		}
+		if (token_match_value == 0)
+			return 0;
+		match_value |= token_match_value;
+	}
+	return match_value;
+}
+
+/**
+ * gs_utils_search_narrow_results:
+ * @list: A #GsAppList of every result of a search for @old_tokens
+ * @old_tokens: the search tokens @list was found for
+ * @new_tokens: the search tokens to narrow @list down to
+ *
+ * Answers a search for @new_tokens from the results of an earlier search,
+ * where @new_tokens refines @old_tokens. The apps in @list which still
+ * match are returned, with their match value recalculated for @new_tokens.
+ *
+ * Keywords and mimetypes aren’t available on a #GsApp, so an app which only
+ * matches on those is dropped. If none of @list matches, a full search may
+ * still find something, so %NULL is returned rather than an empty list.
+ *
+ * Returns: (transfer full) (nullable): the narrowed results, or %NULL if
+ *   a full search is needed
+ */
+GsAppList *
+gs_utils_search_narrow_results (GsAppList *list, gchar **old_tokens, gchar **new_tokens)
+{
+	g_autoptr(GsAppList) narrowed = NULL;
+
+	if (!gs_utils_search_tokens_refine (old_tokens, new_tokens))
+		return NULL;
+
+	narrowed = gs_app_list_new ();
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		guint match_value = gs_utils_app_get_search_match_value (app, new_tokens);
+		if (match_value == 0)
+			continue;
+
+		/* like the AppStream search, the ID isn’t visible in the UI so
+		 * shouldn’t affect the ordering */
+		gs_app_set_match_value (app, match_value & (~AS_SEARCH_TOKEN_MATCH_ID));
+		gs_app_list_add (narrowed, app);
+	}
+	if (gs_app_list_length (narrowed) == 0)
+		return NULL;
+
+	return g_steal_pointer (&narrowed);
+}
@@ -51,6 +51,9 @@ gchar		*gs_utils_build_unique_id_kind	(AsComponentKind kind,
 						 const gchar	*id);
 gboolean	 gs_utils_list_has_component_fuzzy	(GsAppList	*list,
 						 GsApp		*app);
+GsAppList	*gs_utils_search_narrow_results	(GsAppList	*list,
+						 gchar		**old_tokens,
+						 gchar		**new_tokens);
 void		 gs_utils_reboot_notify		(GsAppList	*list,
 						 gboolean	 is_install);
 gchar		*gs_utils_time_to_string	(gint64		 unix_time_seconds);
@@ -96,16 +96,50 @@ gs_search_page_app_to_show_created_cb (GObject *source_object,
 	}
 }
 
+static void
+gs_search_page_show_results (GsSearchPage *self, GsAppList *list)
+{
+	/* remove old entries */
+	gs_widget_remove_all (self->list_box_search, (GsRemoveFunc) gtk_list_box_remove);
+
+	gs_stop_spinner (GTK_SPINNER (self->spinner_search));
+	gtk_stack_set_visible_child_name (GTK_STACK (self->stack_search), "results");
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		GtkWidget *app_row = gs_app_row_new (app);
+		gs_app_row_set_show_rating (GS_APP_ROW (app_row), TRUE);
+		g_signal_connect (app_row, "button-clicked",
+				  G_CALLBACK (gs_search_page_app_row_clicked_cb),
+				  self);
+		gtk_list_box_append (GTK_LIST_BOX (self->list_box_search), app_row);
+		gs_app_row_set_size_groups (GS_APP_ROW (app_row),
+					    self->sizegroup_name,
+					    self->sizegroup_button_label,
+					    self->sizegroup_button_image);
+		gtk_widget_show (app_row);
+	}
+}
+
+static void
+gs_search_page_partial_results_cb (GsPluginJob *plugin_job,
+				   GsAppList *list,
+				   gpointer user_data)
+{
+	GsSearchPage *self = GS_SEARCH_PAGE (user_data);
+
+	/* show what the fastest plugins found while the others finish */
+	g_debug ("showing %u partial search results", gs_app_list_length (list));
+	gs_search_page_waiting_cancel (self);
+	gs_search_page_show_results (self, list);
+}
+
 static void
 gs_search_page_get_search_cb (GObject *source_object,
                               GAsyncResult *res,
                               gpointer user_data)
 {
-	guint i;
-	GsApp *app;
 	GsSearchPage *self = GS_SEARCH_PAGE (user_data);
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (source_object);
-	GtkWidget *app_row;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GsAppList) list = NULL;
 
@@ -138,25 +172,7 @@ gs_search_page_get_search_cb (GObject *source_object,
 		return;
 	}
 
-	/* remove old entries */
-	gs_widget_remove_all (self->list_box_search, (GsRemoveFunc) gtk_list_box_remove);
-
-	gs_stop_spinner (GTK_SPINNER (self->spinner_search));
-	gtk_stack_set_visible_child_name (GTK_STACK (self->stack_search), "results");
-	for (i = 0; i < gs_app_list_length (list); i++) {
-		app = gs_app_list_index (list, i);
-		app_row = gs_app_row_new (app);
-		gs_app_row_set_show_rating (GS_APP_ROW (app_row), TRUE);
-		g_signal_connect (app_row, "button-clicked",
-				  G_CALLBACK (gs_search_page_app_row_clicked_cb),
-				  self);
-		gtk_list_box_append (GTK_LIST_BOX (self->list_box_search), app_row);
-		gs_app_row_set_size_groups (GS_APP_ROW (app_row),
-					    self->sizegroup_name,
-					    self->sizegroup_button_label,
-					    self->sizegroup_button_image);
-		gtk_widget_show (app_row);
-	}
+	gs_search_page_show_results (self, list);
 
 	/* too many results */
 	if (gs_app_list_has_flag (list, GS_APP_LIST_FLAG_IS_TRUNCATED)) {
@@ -291,6 +307,10 @@ gs_search_page_load (GsSearchPage *self)
 							 GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES,
 					 NULL);
 	gs_plugin_job_set_sort_func (plugin_job, gs_search_page_sort_cb, self);
+	gs_plugin_job_set_partial_results (plugin_job, TRUE);
+	g_signal_connect_object (plugin_job, "partial-results",
+				 G_CALLBACK (gs_search_page_partial_results_cb),
+				 self, 0);
 	gs_plugin_loader_job_process_async (self->plugin_loader, plugin_job,
 					    self->search_cancellable,
 					    gs_search_page_get_search_cb,
@@ -10,6 +10,7 @@
 
 #include "gnome-software-private.h"
 
+#include "gs-common.h"
 #include "gs-css.h"
 #include "gs-test.h"
 
@@ -40,6 +41,46 @@ gs_css_func (void)
 	g_assert_cmpstr (tmp, ==, "color: white;");
 }
 
+static void
+gs_search_narrow_results_func (void)
+{
+	GsApp *app;
+	const gchar *old_tokens[] = { "gno", NULL };
+	const gchar *new_tokens[] = { "gnome", "text", NULL };
+	const gchar *unrelated_tokens[] = { "firefox", NULL };
+	const gchar *unmatched_tokens[] = { "gnomish", NULL };
+	g_autoptr(GsApp) app1 = gs_app_new ("org.gnome.TextEditor");
+	g_autoptr(GsApp) app2 = gs_app_new ("org.gnome.Calculator");
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsAppList) narrowed = NULL;
+
+	gs_app_set_name (app1, GS_APP_QUALITY_NORMAL, "Text Editor");
+	gs_app_set_summary (app1, GS_APP_QUALITY_NORMAL, "Edit text files");
+	gs_app_set_match_value (app1, AS_SEARCH_TOKEN_MATCH_NAME);
+	gs_app_list_add (list, app1);
+	gs_app_set_name (app2, GS_APP_QUALITY_NORMAL, "Calculator");
+	gs_app_set_summary (app2, GS_APP_QUALITY_NORMAL, "Perform arithmetic");
+	gs_app_list_add (list, app2);
+
+	/* narrowed down to the apps which still match, and rescored */
+	narrowed = gs_utils_search_narrow_results (list, (gchar **) old_tokens, (gchar **) new_tokens);
+	g_assert_nonnull (narrowed);
+	g_assert_cmpint (gs_app_list_length (narrowed), ==, 1);
+	app = gs_app_list_index (narrowed, 0);
+	g_assert_true (app == app1);
+	g_assert_cmpint (gs_app_get_match_value (app), ==,
+			 AS_SEARCH_TOKEN_MATCH_NAME | AS_SEARCH_TOKEN_MATCH_SUMMARY);
+	g_clear_object (&narrowed);
+
+	/* tokens which don’t refine the old ones need a full search */
+	narrowed = gs_utils_search_narrow_results (list, (gchar **) old_tokens, (gchar **) unrelated_tokens);
+	g_assert_null (narrowed);
+
+	/* as does nothing matching, as a keyword could still match */
+	narrowed = gs_utils_search_narrow_results (list, (gchar **) old_tokens, (gchar **) unmatched_tokens);
+	g_assert_null (narrowed);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -47,6 +88,7 @@ main (int argc, char **argv)
 
 	/* tests go here */
 	g_test_add_func ("/gnome-software/src/css", gs_css_func);
+	g_test_add_func ("/gnome-software/src/search-narrow-results", gs_search_narrow_results_func);
 
 	return g_test_run ();
 }
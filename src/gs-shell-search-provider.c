@@ -21,9 +21,17 @@
 
 #define GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS	20
 
+/* how long to wait for slow plugins before answering with partial results */
+#define GS_SHELL_SEARCH_PROVIDER_PARTIAL_TIMEOUT	500 /* ms */
+
 typedef struct {
 	GsShellSearchProvider *provider;
-	GDBusMethodInvocation *invocation;
+	GDBusMethodInvocation *invocation;	/* (nullable) once answered */
+	GsPluginJob *plugin_job;
+	gulong partial_results_id;
+	GsAppList *partial_results;		/* (nullable) */
+	guint timeout_id;
+	gchar **tokens;
 } PendingSearch;
 
 struct _GsShellSearchProvider {
@@ -35,6 +43,12 @@ struct _GsShellSearchProvider {
 
 	GHashTable *metas_cache;
 	GsAppList *search_results;
+
+	/* set when search_results holds every match for these tokens, so a
+	 * subsearch can filter them rather than search again */
+	AsPool *as_pool;
+	gchar **search_tokens;
+	gboolean search_complete;
 };
 
 G_DEFINE_TYPE (GsShellSearchProvider, gs_shell_search_provider, G_TYPE_OBJECT)
@@ -42,7 +56,14 @@ G_DEFINE_TYPE (GsShellSearchProvider, gs_shell_search_provider, G_TYPE_OBJECT)
 static void
 pending_search_free (PendingSearch *search)
 {
-	g_object_unref (search->invocation);
+	if (search->partial_results_id != 0)
+		g_signal_handler_disconnect (search->plugin_job, search->partial_results_id);
+	if (search->timeout_id != 0)
+		g_source_remove (search->timeout_id);
+	g_clear_object (&search->invocation);
+	g_clear_object (&search->plugin_job);
+	g_clear_object (&search->partial_results);
+	g_strfreev (search->tokens);
 	g_slice_free (PendingSearch, search);
 }
 
@@ -59,6 +80,82 @@ search_sort_by_kudo_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return 0;
 }
 
+static void
+return_results (GsShellSearchProvider *self,
+		GDBusMethodInvocation *invocation,
+		GsAppList *list)
+{
+	GVariantBuilder builder;
+	g_autoptr(GsAppList) sorted = gs_app_list_copy (list);
+
+	/* cache no longer valid */
+	gs_app_list_remove_all (self->search_results);
+
+	/* sort by kudos, as there is no ratings data by default */
+	gs_app_list_sort (sorted, search_sort_by_kudo_cb, NULL);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+	for (guint i = 0; i < gs_app_list_length (sorted); i++) {
+		GsApp *app = gs_app_list_index (sorted, i);
+		g_variant_builder_add (&builder, "s", gs_app_get_unique_id (app));
+
+		/* cache this in case we need the app in GetResultMetas */
+		gs_app_list_add (self->search_results, app);
+	}
+	g_dbus_method_invocation_return_value (invocation, g_variant_new ("(as)", &builder));
+}
+
+static void
+pending_search_return (PendingSearch *search, GsAppList *list, gboolean complete)
+{
+	GsShellSearchProvider *self = search->provider;
+
+	return_results (self, search->invocation, list);
+	g_clear_object (&search->invocation);
+
+	/* partial or truncated results can't be narrowed by a subsearch */
+	g_strfreev (self->search_tokens);
+	self->search_tokens = g_steal_pointer (&search->tokens);
+	self->search_complete = complete &&
+		!gs_app_list_has_flag (list, GS_APP_LIST_FLAG_IS_TRUNCATED);
+}
+
+static gboolean
+search_partial_timeout_cb (gpointer user_data)
+{
+	PendingSearch *search = user_data;
+
+	search->timeout_id = 0;
+
+	/* answer with what we have, or with the next partial results */
+	if (search->partial_results != NULL) {
+		g_debug ("answering with %u partial results",
+			 gs_app_list_length (search->partial_results));
+		pending_search_return (search, search->partial_results, FALSE);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void
+search_partial_results_cb (GsPluginJob *plugin_job,
+			   GsAppList *list,
+			   gpointer user_data)
+{
+	PendingSearch *search = user_data;
+
+	if (search->invocation == NULL)
+		return;
+	g_set_object (&search->partial_results, list);
+
+	/* the remaining plugins can only reorder a full set of results, and
+	 * there is no point waiting any longer once the timeout expired */
+	if (gs_app_list_length (list) >= GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS ||
+	    search->timeout_id == 0) {
+		g_debug ("answering with %u partial results", gs_app_list_length (list));
+		pending_search_return (search, list, FALSE);
+	}
+}
+
 static void
 search_done_cb (GObject *source,
 		GAsyncResult *res,
@@ -66,34 +163,28 @@ search_done_cb (GObject *source,
 {
 	PendingSearch *search = user_data;
 	GsShellSearchProvider *self = search->provider;
-	guint i;
-	GVariantBuilder builder;
 	g_autoptr(GsAppList) list = NULL;
 
-	/* cache no longer valid */
-	gs_app_list_remove_all (self->search_results);
-
 	list = gs_plugin_loader_job_process_finish (self->plugin_loader, res, NULL);
+
+	/* already answered with partial results */
+	if (search->invocation == NULL) {
+		pending_search_free (search);
+		g_application_release (g_application_get_default ());
+		return;
+	}
+
 	if (list == NULL) {
+		/* cache no longer valid */
+		gs_app_list_remove_all (self->search_results);
+		self->search_complete = FALSE;
 		g_dbus_method_invocation_return_value (search->invocation, g_variant_new ("(as)", NULL));
 		pending_search_free (search);
 		g_application_release (g_application_get_default ());
 		return;	
 	}
 
-	/* sort by kudos, as there is no ratings data by default */
-	gs_app_list_sort (list, search_sort_by_kudo_cb, NULL);
-
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
-	for (i = 0; i < gs_app_list_length (list); i++) {
-		GsApp *app = gs_app_list_index (list, i);
-		g_variant_builder_add (&builder, "s", gs_app_get_unique_id (app));
-
-		/* cache this in case we need the app in GetResultMetas */
-		gs_app_list_add (self->search_results, app);
-	}
-	g_dbus_method_invocation_return_value (search->invocation, g_variant_new ("(as)", &builder));
-
+	pending_search_return (search, list, TRUE);
 	pending_search_free (search);
 	g_application_release (g_application_get_default ());
 }
@@ -142,6 +233,51 @@ gs_shell_search_provider_sort_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return g_strcmp0 (key2, key1);
 }
 
+static gchar **
+build_search_tokens (GsShellSearchProvider *self, gchar **terms)
+{
+	g_autofree gchar *value = g_strjoinv (" ", terms);
+
+	/* use the same tokens as the plugin loader, so that stemming and
+	 * stop words are handled identically */
+	if (self->as_pool == NULL)
+		self->as_pool = as_pool_new ();
+	return as_pool_build_search_tokens (self->as_pool, value);
+}
+
+/* Answers a subsearch by narrowing down the previous results, when they
+ * were complete; see gs_utils_search_narrow_results(). */
+static gboolean
+execute_subsearch (GsShellSearchProvider  *self,
+		   GDBusMethodInvocation  *invocation,
+		   gchar		 **terms)
+{
+	g_auto(GStrv) tokens = NULL;
+	g_autoptr(GsAppList) list = NULL;
+
+	if (!self->search_complete || self->search_tokens == NULL)
+		return FALSE;
+	tokens = build_search_tokens (self, terms);
+	if (tokens == NULL)
+		return FALSE;
+	list = gs_utils_search_narrow_results (self->search_results, self->search_tokens, tokens);
+	if (list == NULL)
+		return FALSE;
+	gs_app_list_sort (list, gs_shell_search_provider_sort_cb, self);
+	g_debug ("narrowed %u previous results to %u",
+		 gs_app_list_length (self->search_results),
+		 gs_app_list_length (list));
+
+	/* an earlier search must not overwrite these results */
+	g_cancellable_cancel (self->cancellable);
+	g_clear_object (&self->cancellable);
+
+	return_results (self, invocation, list);
+	g_strfreev (self->search_tokens);
+	self->search_tokens = g_steal_pointer (&tokens);
+	return TRUE;
+}
+
 static void
 execute_search (GsShellSearchProvider  *self,
 		GDBusMethodInvocation  *invocation,
@@ -155,6 +291,7 @@ execute_search (GsShellSearchProvider  *self,
 
 	g_cancellable_cancel (self->cancellable);
 	g_clear_object (&self->cancellable);
+	self->search_complete = FALSE;
 
 	/* don't attempt searches for a single character */
 	if (g_strv_length (terms) == 1 &&
@@ -163,9 +300,10 @@ execute_search (GsShellSearchProvider  *self,
 		return;
 	}
 
-	pending_search = g_slice_new (PendingSearch);
+	pending_search = g_slice_new0 (PendingSearch);
 	pending_search->provider = self;
 	pending_search->invocation = g_object_ref (invocation);
+	pending_search->tokens = build_search_tokens (self, terms);
 
 	g_application_hold (g_application_get_default ());
 	self->cancellable = g_cancellable_new ();
@@ -179,6 +317,19 @@ execute_search (GsShellSearchProvider  *self,
 							 GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES,
 					 NULL);
 	gs_plugin_job_set_sort_func (plugin_job, gs_shell_search_provider_sort_cb, self);
+
+	/* don't let one slow plugin hold back the results of the others */
+	gs_plugin_job_set_partial_results (plugin_job, TRUE);
+	pending_search->plugin_job = g_object_ref (plugin_job);
+	pending_search->partial_results_id =
+		g_signal_connect (plugin_job, "partial-results",
+				  G_CALLBACK (search_partial_results_cb),
+				  pending_search);
+	pending_search->timeout_id =
+		g_timeout_add (GS_SHELL_SEARCH_PROVIDER_PARTIAL_TIMEOUT,
+			       search_partial_timeout_cb,
+			       pending_search);
+
 	gs_plugin_loader_job_process_async (self->plugin_loader, plugin_job,
 					    self->cancellable,
 					    search_done_cb,
@@ -208,7 +359,8 @@ handle_get_subsearch_result_set (GsShellSearchProvider2	*skeleton,
 	GsShellSearchProvider *self = user_data;
 
 	g_debug ("****** GetSubSearchResultSet");
-	execute_search (self, invocation, terms);
+	if (!execute_subsearch (self, invocation, terms))
+		execute_search (self, invocation, terms);
 	return TRUE;
 }
 
@@ -358,6 +510,8 @@ search_provider_dispose (GObject *obj)
 	}
 
 	g_clear_object (&self->search_results);
+	g_clear_pointer (&self->search_tokens, g_strfreev);
+	g_clear_object (&self->as_pool);
 	g_clear_object (&self->plugin_loader);
 	g_clear_object (&self->skeleton);
 